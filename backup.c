@@ -9,13 +9,23 @@
 #include "backup.h"
 #include "filehelper.h"
 #include "crypt/crypt_easy.h"
+#include "crypt/crypt_manifest.h"
+#include "crypt/crypt_master.h"
+#include "crypt/base16.h"
 #include "crypt/crypt_getpassword.h"
 #include "fileiterator.h"
 #include "log.h"
 #include "checksum.h"
+#include "checksumsort.h"
+#include "treehash.h"
+#include "blockcrc.h"
+#include "scrub.h"
+#include "watch.h"
 #include "options/options.h"
 #include "strings/stringhelper.h"
 #include "strings/stringarray.h"
+#include "strings/arena.h"
+#include "strings/stringset.h"
 #include "compression/zip.h"
 #include "cloud/base.h"
 #include "readline_include.h"
@@ -23,6 +33,8 @@
 #include <string.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
 
 #define UNUSED(x) ((void)x)
 
@@ -52,228 +64,1029 @@ cleanup:
 	return 0;
 }
 
-static int make_file_paths(const char* file, const char* base_directory, const char* delta_extension, char** out_file_path, char** out_delta_path){
-	char* output_files = NULL;
-	char* output_deltas = NULL;
-	int ret = 0;
+/* destination prefixes that stay the same for an entire run */
+struct path_prefixes{
+	char* files;
+	char* deltas;
+	/* data appended to a file since its copy in files was made */
+	char* appends;
+	/* compression dictionaries, named after their dictionary id */
+	char* dicts;
+	/* the salt and parameters the master key is derived from the password with */
+	char* key;
+	/* convergently encrypted files, named after their content id */
+	char* objects;
+	/* the leaf hashes of tree hashed files */
+	char* trees;
+	/* the block checksums of each object, at the same path the object has within the base directory */
+	char* crcs;
+};
+
+static void free_path_prefixes(struct path_prefixes* pp){
+	free(pp->files);
+	free(pp->deltas);
+	free(pp->appends);
+	free(pp->dicts);
+	free(pp->key);
+	free(pp->objects);
+	free(pp->trees);
+	free(pp->crcs);
+	pp->files = NULL;
+	pp->deltas = NULL;
+	pp->appends = NULL;
+	pp->dicts = NULL;
+	pp->key = NULL;
+	pp->objects = NULL;
+	pp->trees = NULL;
+	pp->crcs = NULL;
+}
 
-	if (out_file_path || out_delta_path){
-		if (!base_directory){
-			log_warning("output_directory is NULL when it is needed to determine out_file_path or out_delta_path.");
-			ret = -1;
-			goto cleanup;
-		}
-		if (make_internal_directory_paths(base_directory, &output_files, &output_deltas) != 0){
-			log_error("Failed to determine internal directory paths.");
-			ret = -1;
-			goto cleanup;
-		}
+static int make_path_prefixes(const char* base_directory, struct path_prefixes* out){
+	out->files = NULL;
+	out->deltas = NULL;
+	out->appends = NULL;
+	out->dicts = NULL;
+	out->key = NULL;
+	out->objects = NULL;
+	out->trees = NULL;
+	out->crcs = NULL;
+
+	if (!base_directory){
+		log_warning("base_directory is NULL when it is needed to determine the file and delta prefixes.");
+		return -1;
+	}
+	if (make_internal_directory_paths(base_directory, &out->files, &out->deltas) != 0 || !out->files || !out->deltas ||
+			(out->appends = sh_concat_path(sh_dup(base_directory), "/appends")) == NULL ||
+			(out->dicts = sh_concat_path(sh_dup(base_directory), "/dicts")) == NULL ||
+			(out->key = sh_concat_path(sh_dup(base_directory), "/key")) == NULL ||
+			(out->objects = sh_concat_path(sh_dup(base_directory), "/objects")) == NULL ||
+			(out->trees = sh_concat_path(sh_dup(base_directory), "/trees")) == NULL ||
+			(out->crcs = sh_concat_path(sh_dup(base_directory), "/" SCRUB_CRC_DIR)) == NULL){
+		log_error("Failed to determine internal directory paths.");
+		free_path_prefixes(out);
+		return -1;
 	}
+	return 0;
+}
 
-	if (out_file_path){
-		*out_file_path = sh_concat_path(sh_dup(output_files), file);
-		if (!(*out_file_path)){
-			log_error("Failed to create out_file_path.");
-			ret = -1;
-			goto cleanup;
-		}
+static int make_file_paths(const char* file, const struct path_prefixes* pp, const char* delta_extension, struct arena* a, char** out_file_path, char** out_delta_path){
+	if (out_file_path && (*out_file_path = arena_concat_path(a, pp->files, file, NULL)) == NULL){
+		log_error("Failed to create out_file_path.");
+		return -1;
 	}
-	if (out_delta_path){
-		*out_delta_path = sh_concat_path(sh_dup(output_deltas), file);
-		*out_delta_path = sh_concat(*out_delta_path, ".");
-		*out_delta_path = sh_concat(*out_delta_path, delta_extension);
-		if (!(*out_delta_path)){
-			log_error("Failed to create out_delta_path.");
-			ret = -1;
-			goto cleanup;
-		}
+	if (out_delta_path && ((*out_delta_path = arena_concat_path(a, pp->deltas, file, NULL)) == NULL || (*out_delta_path = arena_join(a, *out_delta_path, ".", delta_extension, NULL)) == NULL)){
+		log_error("Failed to create out_delta_path.");
+		return -1;
 	}
+	return 0;
+}
 
-cleanup:
-	if (ret != 0){
-		out_file_path ? free(*out_file_path) : (void)0;
-		out_delta_path ? free(*out_delta_path) : (void)0;
+/* files in the same directory share one copy of their parent's name */
+static const char* intern_parent_dir(struct string_set* dirs, const char* path){
+	const char* filename = sh_filename(path);
+
+	if (filename == path){
+		return NULL;
 	}
-	free(output_files);
-	free(output_deltas);
-	return ret;
+	return ss_intern_n(dirs, path, filename - path - 1);
+}
+
+struct backup_run{
+	const struct options* opt;
+	struct cloud_data* cd;
+	const char* delta_extension;
+	/* every file's key is derived from this, so the password only goes through the slow kdf once per run */
+	const struct crypt_master* master;
+	FILE* fp_checksum;
+	/* the previous checksum list, or NULL if there is none */
+	const struct checksum_source* prev;
+	struct path_prefixes local;
+	struct path_prefixes cloud;
+	/* per-file strings, reset after every file */
+	struct arena* arena;
+	struct string_set* dirs;
+	/* opt->directories and opt->exclude, normalized so each file is walked once */
+	struct string_array* roots;
+	struct string_array* exclude;
+	/* output directories already created or found during this run */
+	struct string_set* local_dirs;
+	struct string_set* cloud_dirs;
+	/* content ids of objects known to be in the cloud */
+	struct string_set* cloud_objects;
+	/* small files are compressed with this if it is not NULL */
+	struct zip_dict* dict;
+	/* picks the compression level if it is not NULL */
+	struct zip_adapt* adapt;
+	/* hashes small files several at a time if it is not NULL */
+	struct checksum_batch* batch;
+};
+
+/* passed to backup_file() for a file that was not part of a batch */
+#define NO_BATCH ((size_t)-1)
+
+static int cloud_mkdir_cached(const char* dir, struct backup_run* br){
+	int res;
+
+	if (ss_find(br->cloud_dirs, dir)){
+		return 1;
+	}
+	if ((res = cloud_mkdir(dir, br->cd)) < 0){
+		return -1;
+	}
+	if (!ss_intern(br->cloud_dirs, dir)){
+		log_warning_ex("Failed to cache directory %s", dir);
+	}
+	return res;
 }
 
-static int cloud_copy_single_file(const char* file_orig_path, const char* file_final, const char* cloud_directory, struct cloud_data* cd, const char* delta_extension){
+static int cloud_copy_single_file(const char* file_orig_path, const char* file_final, int had_appends, struct backup_run* br){
 	char* cloud_path_files = NULL;
 	char* cloud_path_delta = NULL;
-	char* cloud_parent_files = NULL;
-	char* cloud_parent_delta = NULL;
-	int ret = 0;
+	const char* cloud_parent_files;
+	const char* cloud_parent_delta;
 
-	if (make_file_paths(file_orig_path, cloud_directory, delta_extension, &cloud_path_files, &cloud_path_delta) != 0){
+	if (make_file_paths(file_orig_path, &br->cloud, br->delta_extension, br->arena, &cloud_path_files, &cloud_path_delta) != 0){
 		log_error("Failed to create cloud paths.");
-		ret = -1;
-		goto cleanup;
+		return -1;
 	}
 
-	cloud_parent_files = sh_parent_dir(cloud_path_files);
-	cloud_parent_delta = sh_parent_dir(cloud_path_delta);
+	if (had_appends){
+		char* cloud_appends = arena_concat_path(br->arena, br->cloud.appends, file_orig_path, NULL);
+		char* cloud_appends_delta = arena_join(br->arena, cloud_path_delta, ".appends", NULL);
+		if (!cloud_appends || !cloud_appends_delta || cloud_rename(cloud_appends, cloud_appends_delta, br->cd) != 0){
+			log_warning_ex("Failed to move appended data for %s.", file_orig_path);
+		}
+	}
+
+	cloud_parent_files = intern_parent_dir(br->dirs, cloud_path_files);
+	cloud_parent_delta = intern_parent_dir(br->dirs, cloud_path_delta);
 	if (!cloud_parent_files || !cloud_parent_delta){
 		log_warning("Failed to create parent directories.");
-		ret = -1;
-		goto cleanup;
+		return -1;
 	}
 
-	if (cloud_mkdir(cloud_parent_files, cd) < 0){
+	if (cloud_mkdir_cached(cloud_parent_files, br) < 0){
 		log_warning_ex("Failed to create file parent directory %s.", cloud_parent_files);
-		ret = -1;
-		goto cleanup;
+		return -1;
 	}
 
-	if (cloud_stat(cloud_path_files, NULL, cd) == 0){
-		if (cloud_mkdir(cloud_parent_delta, cd) < 0){
+	if (cloud_stat(cloud_path_files, NULL, br->cd) == 0){
+		if (cloud_mkdir_cached(cloud_parent_delta, br) < 0){
 			log_warning_ex("Failed to create delta parent directory %s.", cloud_parent_delta);
 		}
-		else if (cloud_rename(cloud_path_files, cloud_path_delta, cd) != 0){
+		else if (cloud_rename(cloud_path_files, cloud_path_delta, br->cd) != 0){
 			log_warning_ex("Failed to create delta for %s.", cloud_path_files);
 		}
 	}
 
-	if (cloud_upload(file_final, cloud_path_files, cd) != 0){
+	if (cloud_upload(file_final, cloud_path_files, br->cd) != 0){
 		log_error_ex("Failed to upload %s to the cloud.", file_final);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* where the block checksums of a path within the output directory go */
+static char* crc_path(const char* path, struct backup_run* br){
+	return arena_concat_path(br->arena, br->local.crcs, path + strlen(br->opt->output_directory), NULL);
+}
+
+/* checksums the stored bytes of an object, so it can be scrubbed without decrypting or decompressing it */
+static int write_block_crc(const char* path, struct backup_run* br){
+	char* path_crc = crc_path(path, br);
+	const char* crc_parent = path_crc ? intern_parent_dir(br->dirs, path_crc) : NULL;
+
+	if (!crc_parent || mkdir_recursive_cached(crc_parent, br->local_dirs) < 0){
+		log_error("Failed to determine block checksum path");
+		return -1;
+	}
+	return block_crc_create(path, path_crc);
+}
+
+/* the block checksums of an object follow it when it becomes a delta */
+static void move_block_crc(const char* from, const char* to, struct backup_run* br){
+	char* crc_from = crc_path(from, br);
+	char* crc_to = crc_path(to, br);
+	const char* crc_parent = crc_to ? intern_parent_dir(br->dirs, crc_to) : NULL;
+
+	if (!crc_from || !crc_parent){
+		log_warning_ex("Failed to determine block checksum path of %s", from);
+		return;
+	}
+	if (!file_exists(crc_from) && !directory_exists(crc_from)){
+		return;
+	}
+	if (mkdir_recursive_cached(crc_parent, br->local_dirs) < 0 || rename(crc_from, crc_to) != 0){
+		log_warning_ex2("Failed to move block checksums of %s (%s)", from, strerror(errno));
+	}
+}
+
+/* wall clock time in seconds, for measuring the throughput of each stage */
+static double now_secs(void){
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int compression_level(const struct backup_run* br){
+	return br->adapt ? zip_adapt_level(br->adapt) : br->opt->c_level;
+}
+
+static int compress_file(const char* file, const char* out, struct backup_run* br){
+	const struct options* opt = br->opt;
+
+#ifndef NO_ZSTD_SUPPORT
+	if (br->dict && get_file_size(file) <= ZIP_DICT_MAX_FILE_SIZE){
+		return zip_compress_dict(file, out, compression_level(br), opt->c_flags, br->dict);
+	}
+#endif
+	return zip_compress(file, out, opt->c_type, compression_level(br), opt->c_flags);
+}
+
+/* compresses a file (or everything past offset) straight into an encrypting stream, so the output is only written once, already encrypted */
+static int compress_encrypt_file(const char* file, unsigned long offset, const char* out, struct backup_run* br){
+	const struct options* opt = br->opt;
+	struct easy_writer* ew;
+	int res;
+
+	ew = easy_encrypt_master_fopen(out, EVP_CIPHER_name(opt->enc_algorithm), br->master, ZIP_GET_THREADS(opt->c_flags));
+	if (!ew){
+		return -1;
+	}
+
+#ifndef NO_ZSTD_SUPPORT
+	if (br->dict && offset == 0 && get_file_size(file) <= ZIP_DICT_MAX_FILE_SIZE){
+		res = zip_compress_dict_fp(file, easy_writer_fp(ew), compression_level(br), opt->c_flags, br->dict);
+		return easy_writer_close(ew, res != 0);
+	}
+#endif
+	res = zip_compress_fp(file, easy_writer_fp(ew), offset, opt->c_type, compression_level(br), opt->c_flags);
+	return easy_writer_close(ew, res != 0);
+}
+
+/* links dst to src if possible, since both are under the output directory and usually on the same filesystem */
+static int link_or_copy(const char* src, const char* dst){
+	if (link(src, dst) == 0){
+		return 0;
+	}
+	return copy_file(src, dst);
+}
+
+/* finds where the one stored copy of a file's contents goes, objects/<xx>/<content id>.
+ * the id is taken over the file itself rather than its compressed form, so identical files match even if the compression level, dictionary, or compressor version differs */
+static int find_object(const char* file, struct backup_run* br, unsigned char id[CRYPT_CONTENT_ID_LEN], const char** out_id, const char** out_path){
+	char* id_hex = NULL;
+	char* dir_object;
+	int ret = 0;
+
+	if (crypt_master_content_id(br->master, file, id) != 0 || to_base16(id, CRYPT_CONTENT_ID_LEN, &id_hex) != 0){
+		log_error_ex("Failed to compute the content id of %s", file);
+		ret = -1;
+		goto cleanup;
+	}
+
+	*out_id = arena_dup(br->arena, id_hex);
+	dir_object = arena_dup_n(br->arena, id_hex, 2);
+	dir_object = dir_object ? arena_concat_path(br->arena, br->local.objects, dir_object, NULL) : NULL;
+	*out_path = dir_object ? arena_concat_path(br->arena, dir_object, id_hex, NULL) : NULL;
+	if (!*out_id || !*out_path){
+		log_error("Failed to determine object path");
 		ret = -1;
 		goto cleanup;
 	}
 
 cleanup:
-	free(cloud_path_files);
-	free(cloud_path_delta);
-	free(cloud_parent_files);
-	free(cloud_parent_delta);
+	free(id_hex);
 	return ret;
 }
 
-static int copy_single_file(const char* file, const struct options* opt, const char* delta_extension, struct cloud_data* cd, const char* cloud_directory, const char* password){
-	char* path_files = NULL;
-	char* path_delta = NULL;
-	char* file_parent = NULL;
-	char* delta_parent = NULL;
+/* encrypts a compressed file convergently and keeps a link to it as its object, so later copies of the same contents are not compressed or encrypted again.
+ * the salt is taken over the compressed data rather than the source file, since that is what gets encrypted, and the same source can compress differently.
+ * two different plaintexts must never share a key, as the aead nonces only depend on the chunk index.
+ * path_object is NULL if the file should not be linked as an object */
+static int store_object(const char* path_files, const char* path_object, struct backup_run* br){
+	const struct options* opt = br->opt;
+	unsigned char salt[CRYPT_CONTENT_ID_LEN];
+	const char* dir_object;
+
+	if (crypt_master_content_id(br->master, path_files, salt) != 0 ||
+			easy_encrypt_convergent_inplace(path_files, EVP_CIPHER_name(opt->enc_algorithm), opt->flags.bits.flag_verbose, br->master, salt, ZIP_GET_THREADS(opt->c_flags)) != 0){
+		return -1;
+	}
+	if (!path_object){
+		return 0;
+	}
+	/* the file is still backed up if this fails, it just cannot be deduplicated against */
+	dir_object = intern_parent_dir(br->dirs, path_object);
+	if (!dir_object || mkdir_recursive_cached(dir_object, br->local_dirs) < 0 || link_or_copy(path_files, path_object) != 0){
+		log_warning_ex("Failed to store %s as an object", path_files);
+	}
+	return 0;
+}
+
+/* uploads an object the cloud does not have yet, and a small file in its place that names the object */
+static int cloud_copy_object(const char* file_orig_path, const char* file_final, const char* object_id, int had_appends, struct backup_run* br){
+	struct TMPFILE* tfp_ref = NULL;
+	char* cloud_dir_object;
+	char* cloud_path_object;
 	int ret = 0;
 
-	if (make_file_paths(file, opt->output_directory, delta_extension, &path_files, &path_delta) != 0){
-		log_error("Failed determining file path or delta path");
+	cloud_dir_object = arena_dup_n(br->arena, object_id, 2);
+	cloud_dir_object = cloud_dir_object ? arena_concat_path(br->arena, br->cloud.objects, cloud_dir_object, NULL) : NULL;
+	cloud_path_object = cloud_dir_object ? arena_concat_path(br->arena, cloud_dir_object, object_id, NULL) : NULL;
+	if (!cloud_path_object){
+		log_error("Failed to determine cloud object path");
+		return -1;
+	}
+
+	if (!ss_find(br->cloud_objects, object_id)){
+		if (cloud_stat(cloud_path_object, NULL, br->cd) != 0 &&
+				(cloud_mkdir_cached(br->cloud.objects, br) < 0 || cloud_mkdir_cached(cloud_dir_object, br) < 0 || cloud_upload(file_final, cloud_path_object, br->cd) != 0)){
+			log_error_ex("Failed to upload object %s", object_id);
+			ret = -1;
+			goto cleanup;
+		}
+		ss_intern(br->cloud_objects, object_id);
+	}
+	else{
+		log_debug_ex("Object %s is already in the cloud. Skipping upload", object_id);
+	}
+
+	tfp_ref = temp_fopen();
+	if (!tfp_ref || fprintf(tfp_ref->fp, "%s\n", object_id) < 0 || temp_fflush(tfp_ref) != 0){
+		log_error("Failed to write object reference");
 		ret = -1;
 		goto cleanup;
 	}
+	ret = cloud_copy_single_file(file_orig_path, tfp_ref->name, had_appends, br);
 
-	file_parent = sh_parent_dir(path_files);
-	delta_parent = sh_parent_dir(path_delta);
-	if (mkdir_recursive(file_parent) < 0 || mkdir_recursive(delta_parent) < 0){
+cleanup:
+	if (tfp_ref){
+		remove(tfp_ref->name);
+		temp_fclose(tfp_ref);
+	}
+	return ret;
+}
+
+static int copy_single_file(const char* file, struct backup_run* br){
+	const struct options* opt = br->opt;
+	char* path_files = NULL;
+	char* path_delta = NULL;
+	const char* file_parent;
+	const char* delta_parent;
+	int res_parent;
+	int had_appends = 0;
+	uint64_t size = get_file_size(file);
+	unsigned char id[CRYPT_CONTENT_ID_LEN];
+	const char* object_id = NULL;
+	const char* path_object = NULL;
+	int duplicate = 0;
+	double t_start;
+	double t_compressed;
+
+	if (make_file_paths(file, &br->local, br->delta_extension, br->arena, &path_files, &path_delta) != 0){
+		log_error("Failed determining file path or delta path");
+		return -1;
+	}
+
+	file_parent = intern_parent_dir(br->dirs, path_files);
+	delta_parent = intern_parent_dir(br->dirs, path_delta);
+	res_parent = mkdir_recursive_cached(file_parent, br->local_dirs);
+	if (res_parent < 0 || mkdir_recursive_cached(delta_parent, br->local_dirs) < 0){
 		log_warning("Failed to make one or more parent directories.");
 	}
 
-	if (file_exists(path_files) && rename_file(path_files, path_delta) != 0){
-		log_warning_ex("Failed to create delta for %s", path_files);
+	/* a directory that was just created cannot contain a previous version */
+	if (res_parent != 0 && file_exists(path_files)){
+		char* path_appends;
+
+		if (rename_file(path_files, path_delta) != 0){
+			log_warning_ex("Failed to create delta for %s", path_files);
+		}
+		else{
+			move_block_crc(path_files, path_delta, br);
+		}
+
+		/* the previous version also includes anything appended to it */
+		path_appends = arena_concat_path(br->arena, br->local.appends, file, NULL);
+		if (path_appends && directory_exists(path_appends)){
+			had_appends = 1;
+			if (rename(path_appends, arena_join(br->arena, path_delta, ".appends", NULL)) != 0){
+				log_warning_ex2("Failed to move appended data for %s (%s)", path_files, strerror(errno));
+			}
+			else{
+				move_block_crc(path_appends, arena_join(br->arena, path_delta, ".appends", NULL), br);
+			}
+		}
+	}
+
+	/* the previous version can be a link to an object that other files share, so it is never written through */
+	if (remove(path_files) != 0 && errno != ENOENT){
+		log_error_ex2("Failed to remove the previous version of %s (%s)", path_files, strerror(errno));
+		return -1;
+	}
+
+	if (opt->enc_algorithm && opt->flags.bits.flag_convergent){
+		if (find_object(file, br, id, &object_id, &path_object) != 0){
+			return -1;
+		}
+		if (file_exists(path_object)){
+			if (link_or_copy(path_object, path_files) != 0){
+				log_error_ex2("Failed to link %s to %s", path_files, path_object);
+				return -1;
+			}
+			log_debug_ex("%s is a duplicate. Skipping compression and encryption", path_files);
+			duplicate = 1;
+		}
 	}
 
-	if (zip_compress(file, path_files, opt->c_type, opt->c_level, opt->c_flags) != 0){
+	t_start = now_secs();
+	if (duplicate){
+		/* already in place */
+	}
+	else if (opt->enc_algorithm && !opt->flags.bits.flag_convergent){
+		if (compress_encrypt_file(file, 0, path_files, br) != 0){
+			log_error("Failed to compress and encrypt output file");
+			return -1;
+		}
+	}
+	/* convergent encryption goes through a plaintext file, and is encrypted in place by store_object() */
+	else if (compress_file(file, path_files, br) != 0){
 		log_error("Failed to compress output file");
-		ret = -1;
-		goto cleanup;
+		return -1;
 	}
+	t_compressed = now_secs();
+
+	/* the file was read once to find its object and again to compress it.
+	 * if it changed in between, the object would not hold what its id says, and every later copy of the old contents would be linked to the new ones */
+	if (object_id && !duplicate){
+		unsigned char id_after[CRYPT_CONTENT_ID_LEN];
 
-	if (opt->enc_algorithm && easy_encrypt_inplace(path_files, EVP_CIPHER_name(opt->enc_algorithm), opt->flags.bits.flag_verbose, password) != 0){
+		if (crypt_master_content_id(br->master, file, id_after) != 0 || memcmp(id, id_after, sizeof(id)) != 0){
+			log_warning_ex("%s changed while it was being backed up. It will not be deduplicated", file);
+			object_id = NULL;
+			path_object = NULL;
+		}
+	}
+
+	if (opt->enc_algorithm && opt->flags.bits.flag_convergent && !duplicate && store_object(path_files, path_object, br) != 0){
 		log_error("Failed to encrypt file");
-		ret = -1;
-		goto cleanup;
+		return -1;
+	}
+
+	if (write_block_crc(path_files, br) != 0){
+		log_warning_ex("Failed to checksum the blocks of %s", path_files);
 	}
 
-	if (cd && cloud_copy_single_file(file, path_files, cloud_directory, cd, delta_extension) != 0){
+	if (br->cd && (object_id ? cloud_copy_object(file, path_files, object_id, had_appends, br) : cloud_copy_single_file(file, path_files, had_appends, br)) != 0){
 		log_warning_ex("Failed to upload %s to the cloud", path_files);
-		ret = -1;
+		return -1;
 	}
 
-cleanup:
-	free(path_files);
-	free(path_delta);
-	free(file_parent);
-	free(delta_parent);
-	return ret;
+	/* uploading (and encryption, when it is not streamed behind compression) is what compression has to keep up with */
+	if (!duplicate){
+		zip_adapt_update(br->adapt, size, t_compressed - t_start, now_secs() - t_compressed);
+	}
+	return 0;
 }
 
-static int copy_files(const struct options* opt, const struct cloud_options* co, const char* delta_extension, FILE* fp_checksum, FILE* fp_checksum_prev){
-	char* password = NULL;
-	struct cloud_data* cd = NULL;
-	int ret = 0;
+/* stores only the data appended to a file since the last backup as appends/<file>/<offset> */
+static int copy_append_segment(const char* file, unsigned long offset, struct backup_run* br){
+	const struct options* opt = br->opt;
+	char offset_str[32];
+	char* dir_appends;
+	char* path_segment;
+
+	sprintf(offset_str, "%lu", offset);
+
+	dir_appends = arena_concat_path(br->arena, br->local.appends, file, NULL);
+	path_segment = dir_appends ? arena_concat_path(br->arena, dir_appends, offset_str, NULL) : NULL;
+	if (!path_segment){
+		log_error("Failed to determine append segment path");
+		return -1;
+	}
+
+	if (mkdir_recursive_cached(dir_appends, br->local_dirs) < 0){
+		log_error_ex("Failed to create %s", dir_appends);
+		return -1;
+	}
+
+	if (opt->enc_algorithm){
+		if (compress_encrypt_file(file, offset, path_segment, br) != 0){
+			log_error("Failed to compress and encrypt appended data");
+			return -1;
+		}
+	}
+	else if (zip_compress_tail(file, path_segment, offset, opt->c_type, compression_level(br), opt->c_flags) != 0){
+		log_error("Failed to compress appended data");
+		return -1;
+	}
+
+	if (write_block_crc(path_segment, br) != 0){
+		log_warning_ex("Failed to checksum the blocks of %s", path_segment);
+	}
+
+	if (br->cd){
+		char* cloud_dir_appends = arena_concat_path(br->arena, br->cloud.appends, file, NULL);
+		char* cloud_path_segment = cloud_dir_appends ? arena_concat_path(br->arena, cloud_dir_appends, offset_str, NULL) : NULL;
+
+		if (!cloud_path_segment || cloud_mkdir_cached(cloud_dir_appends, br) < 0 || cloud_upload(path_segment, cloud_path_segment, br->cd) != 0){
+			log_warning_ex("Failed to upload %s to the cloud", path_segment);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* normalized directories end with a '/', but the path can be the directory itself */
+static int is_within(const char* path, const char* dir){
+	size_t len = strlen(path);
+	return sh_starts_with(path, dir) || (strncmp(path, dir, len) == 0 && dir[len] == '/' && dir[len + 1] == '\0');
+}
+
+static int is_excluded(const char* file, const struct string_array* exclude){
 	size_t i;
+	for (i = 0; i < exclude->len; ++i){
+		if (is_within(file, exclude->strings[i])){
+			return 1;
+		}
+	}
+	return 0;
+}
 
-	if (co->cp != CLOUD_NONE && cloud_login(co, &cd) != 0){
-		log_error("Could not connect to the cloud.");
-		ret = -1;
-		goto cleanup;
+/* keeps the leaf hashes of a tree hashed file as trees/<file>, so its regions can be checked later */
+static int store_tree(const char* file, const struct tree_hash* th, struct backup_run* br){
+	const struct options* opt = br->opt;
+	char* path_tree;
+	const char* tree_parent;
+
+	path_tree = arena_concat_path(br->arena, br->local.trees, file, NULL);
+	tree_parent = path_tree ? intern_parent_dir(br->dirs, path_tree) : NULL;
+	if (!tree_parent || mkdir_recursive_cached(tree_parent, br->local_dirs) < 0){
+		log_error("Failed to determine tree hash path");
+		return -1;
 	}
 
-	if (opt->enc_algorithm && !opt->enc_password){
-		int res;
+	if (tree_hash_save(th, path_tree) != 0){
+		return -1;
+	}
 
-		while ((res = crypt_getpassword("Enter  encryption password:", "Verify encryption password:", &password)) > 0);
+	/* the leaf hashes say as much about a file as its checksum does, so they are kept as secret */
+	if (opt->enc_algorithm && easy_encrypt_master_inplace(path_tree, EVP_CIPHER_name(opt->enc_algorithm), 0, br->master, ZIP_GET_THREADS(opt->c_flags)) != 0){
+		log_error("Failed to encrypt tree hash");
+		remove(path_tree);
+		return -1;
+	}
 
-		if (res < 0){
-			log_error("Failed to read encryption password from terminal");
-			ret = -1;
-			goto cleanup;
+	if (br->cd){
+		char* cloud_path_tree = arena_concat_path(br->arena, br->cloud.trees, file, NULL);
+		const char* cloud_tree_parent = cloud_path_tree ? intern_parent_dir(br->dirs, cloud_path_tree) : NULL;
+
+		if (!cloud_tree_parent || cloud_mkdir_cached(cloud_tree_parent, br) < 0 || cloud_upload(path_tree, cloud_path_tree, br->cd) != 0){
+			log_warning_ex("Failed to upload %s to the cloud", path_tree);
+			return -1;
 		}
 	}
+	return 0;
+}
 
-	for (i = 0; i < opt->directories->len; ++i){
-		struct fi_stack* fis = NULL;
-		char* tmp;
-		int res;
+static void backup_file(const char* file, size_t batch_index, struct backup_run* br){
+	struct tree_hash* th = NULL;
+	unsigned long append_offset = 0;
+	int res;
+
+	if (checksum_batch_hashed(br->batch, batch_index)){
+		res = add_checksum_from_batch(br->batch, batch_index, br->fp_checksum, br->prev, NULL);
+	}
+	/* tree hashes are not checked for appended data, so it is backed up like any other change */
+	else if (br->opt->flags.bits.flag_tree_hash){
+		res = add_checksum_to_file_tree(file, br->opt->hash_algorithm, ZIP_GET_THREADS(br->opt->c_flags), br->fp_checksum, br->prev, NULL, &th);
+	}
+	else{
+		res = add_checksum_to_file_src(file, br->opt->hash_algorithm, br->fp_checksum, br->prev, NULL, &append_offset);
+	}
+	if (res == CHECKSUM_APPENDED){
+		printf("%s (appended)\n", file);
+		if (copy_append_segment(file, append_offset, br) != 0){
+			log_warning_ex("Failed to copy appended data for %s", file);
+		}
+	}
+	else if (res > 0){
+		log_info_ex("File %s was unchanged", file);
+	}
+	else if (res == 0){
+		printf("%s\n", file);
+		if (copy_single_file(file, br) != 0){
+			log_warning_ex("Failed to copy %s", file);
+		}
+		else if (th && store_tree(file, th, br) != 0){
+			log_warning_ex("Failed to store the tree hash of %s", file);
+		}
+	}
+	else{
+		log_error_ex("Failed to calculate checksum for %s", file);
+	}
+	tree_hash_free(th);
+	arena_reset(br->arena);
+}
+
+/* the paths waiting to be hashed together.
+ * they are copied into an arena that is reset after every batch, so its chunks are reused instead of allocating for every file */
+struct file_batch{
+	struct arena* arena;
+	const char* files[CHECKSUM_BATCH_LEN];
+	size_t len;
+};
+
+/* hashes the small files in a batch together, then backs up every file in the batch in order */
+static void backup_batch(struct file_batch* fb, struct backup_run* br){
+	size_t i;
+
+	if (br->batch && checksum_batch_run(br->batch, fb->files, fb->len) != 0){
+		log_warning("Failed to hash a batch of files. Hashing them one at a time.");
+	}
+	for (i = 0; i < fb->len; ++i){
+		backup_file(fb->files[i], br->batch ? i : NO_BATCH, br);
+	}
+	fb->len = 0;
+	arena_reset(fb->arena);
+}
+
+static void backup_directory(const char* dir, struct backup_run* br){
+	struct fi_stack* fis = NULL;
+	struct file_batch fb;
+	const char* tmp;
+
+	fis = fi_start(dir);
+	if (!fis){
+		log_warning_ex("Failed to fi_start in directory %s", dir);
+	}
+	fb.arena = arena_new(0);
+	fb.len = 0;
+	if (!fb.arena){
+		log_enomem();
+		fi_end(fis);
+		return;
+	}
+	while ((tmp = fi_next_path(fis)) != NULL){
+		const char* file;
+
+		if (is_excluded(tmp, br->exclude)){
+			/* an excluded file should not take its siblings with it */
+			if (is_excluded(fi_directory_name(fis), br->exclude)){
+				fi_skip_current_dir(fis);
+			}
+			continue;
+		}
+
+		/* tmp stays valid until the next fi_next_path(), so it can still be backed up on its own */
+		if ((file = arena_dup(fb.arena, tmp)) == NULL){
+			backup_batch(&fb, br);
+			backup_file(tmp, NO_BATCH, br);
+			continue;
+		}
+		fb.files[fb.len++] = file;
+		if (fb.len == CHECKSUM_BATCH_LEN){
+			backup_batch(&fb, br);
+		}
+	}
+	backup_batch(&fb, br);
+	arena_free(fb.arena);
+	fi_end(fis);
+}
+
+#ifndef NO_ZSTD_SUPPORT
+/* more samples than this take longer to train on without making the dictionary noticeably better */
+#define DICT_MAX_SAMPLES (2000)
+
+static int collect_dict_samples(const struct backup_run* br, struct string_array* samples){
+	size_t i;
+
+	for (i = 0; i < br->roots->len && samples->len < DICT_MAX_SAMPLES; ++i){
+		struct fi_stack* fis;
+		const char* tmp;
 
-		fis = fi_start(opt->directories->strings[i]);
+		fis = fi_start(br->roots->strings[i]);
 		if (!fis){
-			log_warning_ex("Failed to fi_start in directory %s", opt->directories->strings[i]);
+			log_warning_ex("Failed to fi_start in directory %s", br->roots->strings[i]);
+			continue;
 		}
-		while ((tmp = fi_next(fis)) != NULL){
-			size_t j;
-			for (j = 0; j < opt->exclude->len; ++j){
-				if (sh_starts_with(tmp, opt->exclude->strings[j])){
+		while (samples->len < DICT_MAX_SAMPLES && (tmp = fi_next_path(fis)) != NULL){
+			uint64_t size;
+
+			if (is_excluded(tmp, br->exclude)){
+				if (is_excluded(fi_directory_name(fis), br->exclude)){
 					fi_skip_current_dir(fis);
-					break;
 				}
-			}
-			if (j != opt->exclude->len){
-				free(tmp);
 				continue;
 			}
 
-			res = add_checksum_to_file(tmp, opt->hash_algorithm, fp_checksum, fp_checksum_prev, NULL);
-			if (res > 0){
-				log_info_ex("File %s was unchanged", tmp);
+			size = get_file_size(tmp);
+			if (size > 0 && size <= ZIP_DICT_MAX_FILE_SIZE && sa_add(samples, tmp) != 0){
+				fi_end(fis);
+				return -1;
 			}
-			else if (res == 0){
-				printf("%s\n", tmp);
-				if (copy_single_file(tmp, opt, delta_extension, cd, co->upload_directory, password ? password : opt->enc_password) != 0){
-					log_warning_ex("Failed to copy %s", tmp);
-				}
-			}
-			else{
-				log_error_ex("Failed to calculate checksum for %s", tmp);
-			}
-
-			free(tmp);
 		}
 		fi_end(fis);
 	}
+	return 0;
+}
+
+/* trains a dictionary on the small files being backed up and stores it as dicts/<id>, which is needed to decompress them */
+static struct zip_dict* make_backup_dict(struct backup_run* br){
+	const struct options* opt = br->opt;
+	struct string_array* samples = NULL;
+	struct zip_dict* dict = NULL;
+	char id_str[32];
+	char* path_dict = NULL;
+
+	samples = sa_new();
+	if (!samples || collect_dict_samples(br, samples) != 0){
+		log_error("Failed to collect dictionary samples");
+		goto cleanup_fail;
+	}
+
+	dict = zip_dict_train((const char* const*)samples->strings, samples->len, ZIP_DICT_SIZE);
+	if (!dict){
+		log_error_ex("Failed to train a dictionary on %lu files", (unsigned long)samples->len);
+		goto cleanup_fail;
+	}
+	sprintf(id_str, "%u", zip_dict_id(dict));
+
+	path_dict = arena_concat_path(br->arena, br->local.dicts, id_str, NULL);
+	if (!path_dict || mkdir_recursive_cached(br->local.dicts, br->local_dirs) < 0 || zip_dict_save(dict, path_dict) != 0){
+		log_error("Failed to save dictionary");
+		goto cleanup_fail;
+	}
+
+	if (opt->enc_algorithm && easy_encrypt_master_inplace(path_dict, EVP_CIPHER_name(opt->enc_algorithm), opt->flags.bits.flag_verbose, br->master, ZIP_GET_THREADS(opt->c_flags)) != 0){
+		log_error("Failed to encrypt dictionary");
+		goto cleanup_fail;
+	}
+
+	if (br->cd){
+		char* cloud_path_dict = arena_concat_path(br->arena, br->cloud.dicts, id_str, NULL);
+
+		if (!cloud_path_dict || cloud_mkdir_cached(br->cloud.dicts, br) < 0 || cloud_upload(path_dict, cloud_path_dict, br->cd) != 0){
+			log_error("Failed to upload dictionary to the cloud");
+			goto cleanup_fail;
+		}
+	}
+
+	log_info_ex2("Trained dictionary %s on %lu files", id_str, (unsigned long)samples->len);
+	sa_free(samples);
+	arena_reset(br->arena);
+	return dict;
+
+cleanup_fail:
+	path_dict ? remove(path_dict) : 0;
+	zip_dict_free(dict);
+	sa_free(samples);
+	arena_reset(br->arena);
+	return NULL;
+}
+#endif
+
+static void backup_dirty_path(const char* path, struct backup_run* br){
+	struct stat st;
+	size_t i;
+
+	for (i = 0; i < br->roots->len; ++i){
+		if (is_within(path, br->roots->strings[i])){
+			break;
+		}
+	}
+	if (i == br->roots->len || is_excluded(path, br->exclude)){
+		return;
+	}
+
+	if (lstat(path, &st) != 0){
+		/* removed since it was marked dirty */
+		return;
+	}
+	if (S_ISDIR(st.st_mode)){
+		backup_directory(path, br);
+	}
+	else{
+		backup_file(path, NO_BATCH, br);
+	}
+}
+
+/* carries over every previous checksum that the dirty paths could not have changed */
+static int copy_clean_checksums(const struct string_array* dirty, FILE* fp_checksum, const struct checksum_source* prev){
+	struct element* e;
+
+	if (prev->rewind(prev->data) != 0){
+		log_error("Failed to rewind previous checksum file");
+		return -1;
+	}
+
+	while ((e = prev->next(prev->data)) != NULL){
+		if (!watch_is_dirty(dirty, e->file) && write_element_to_file(fp_checksum, e) != 0){
+			log_error_ex("Failed to carry over checksum for %s", e->file);
+			free_element(e);
+			return -1;
+		}
+		free_element(e);
+	}
+	return 0;
+}
+
+static void print_adapt_levels(const struct zip_adapt* za){
+	int level;
+
+	for (level = 0; level <= ZIP_ADAPT_MAX_LEVEL; ++level){
+		uint64_t bytes = zip_adapt_level_bytes(za, level);
+		if (bytes > 0){
+			printf("Compressed %lu KB at level %d\n", (unsigned long)(bytes / 1024), level);
+		}
+	}
+}
+
+static int copy_files(const struct options* opt, const struct cloud_options* co, const char* delta_extension, const struct crypt_master* master, FILE* fp_checksum, const struct checksum_source* prev, const struct string_array* dirty){
+	struct backup_run br;
+	struct cloud_data* cd = NULL;
+	int ret = 0;
+	int res;
+	size_t i;
+
+	memset(&br, 0, sizeof(br));
+
+	if (co->cp != CLOUD_NONE && cloud_login(co, &cd) != 0){
+		log_error("Could not connect to the cloud.");
+		ret = -1;
+		goto cleanup;
+	}
+
+	br.opt = opt;
+	br.cd = cd;
+	br.delta_extension = delta_extension;
+	br.master = master;
+	br.fp_checksum = fp_checksum;
+	br.prev = prev;
+
+	if (make_path_prefixes(opt->output_directory, &br.local) != 0 || (cd && make_path_prefixes(co->upload_directory, &br.cloud) != 0)){
+		log_error("Failed to determine output prefixes");
+		ret = -1;
+		goto cleanup;
+	}
+
+	br.arena = arena_new(0);
+	br.dirs = ss_new();
+	br.local_dirs = ss_new();
+	br.cloud_dirs = ss_new();
+	br.cloud_objects = ss_new();
+	if (!br.arena || !br.dirs || !br.local_dirs || !br.cloud_dirs || !br.cloud_objects){
+		log_error("Failed to allocate path storage");
+		ret = -1;
+		goto cleanup;
+	}
+
+	/* the key file is needed to restore the backup from the cloud alone */
+	if (master && cd && (cloud_mkdir_cached(co->upload_directory, &br) < 0 || cloud_upload(br.local.key, br.cloud.key, cd) != 0)){
+		log_error("Failed to upload the key file to the cloud");
+		ret = -1;
+		goto cleanup;
+	}
+
+	br.roots = sa_dup(opt->directories);
+	br.exclude = sa_dup(opt->exclude);
+	if (!br.roots || !br.exclude){
+		log_error("Failed to copy directories");
+		ret = -1;
+		goto cleanup;
+	}
+	if ((res = sa_normalize_roots(br.roots, br.exclude)) < 0){
+		log_error("Failed to normalize directories");
+		ret = -1;
+		goto cleanup;
+	}
+	if (res > 0){
+		log_info_ex("Skipping %d redundant or missing directories", res);
+	}
+
+	if (opt->c_adapt_rate > 0){
+		br.adapt = zip_adapt_new(opt->c_type, opt->c_level, opt->c_adapt_rate * 1048576.0);
+		if (!br.adapt){
+			log_warning("Compressing at a fixed level");
+		}
+	}
+
+	br.batch = checksum_batch_new(opt->hash_algorithm, ZIP_GET_THREADS(opt->c_flags));
+	if (!br.batch){
+		log_warning("Hashing files one at a time");
+	}
+
+	if (dirty){
+		for (i = 0; i < dirty->len; ++i){
+			backup_dirty_path(dirty->strings[i], &br);
+		}
+		if (copy_clean_checksums(dirty, fp_checksum, prev) != 0){
+			log_error("Failed to carry over unchanged checksums");
+			ret = -1;
+			goto cleanup;
+		}
+	}
+	else{
+#ifndef NO_ZSTD_SUPPORT
+		/* watch-triggered runs only see a handful of files, which is not enough to train on.
+		 * seekable containers have no room for a dictionary, so an options file that asks for both gets none */
+		if (opt->c_type == COMPRESSOR_ZSTD && (opt->c_flags & ZSTD_DICT) && !(opt->c_flags & ZIP_SEEKABLE) && (br.dict = make_backup_dict(&br)) == NULL){
+			log_warning("Compressing without a dictionary");
+		}
+#endif
+		for (i = 0; i < br.roots->len; ++i){
+			backup_directory(br.roots->strings[i], &br);
+		}
+	}
+
+	if (br.adapt && opt->flags.bits.flag_verbose){
+		print_adapt_levels(br.adapt);
+	}
 
 cleanup:
+	free_path_prefixes(&br.local);
+	free_path_prefixes(&br.cloud);
+	arena_free(br.arena);
+	ss_free(br.dirs);
+	ss_free(br.local_dirs);
+	ss_free(br.cloud_dirs);
+	ss_free(br.cloud_objects);
+	sa_free(br.roots);
+	sa_free(br.exclude);
+#ifndef NO_ZSTD_SUPPORT
+	zip_dict_free(br.dict);
+#endif
+	zip_adapt_free(br.adapt);
+	checksum_batch_free(br.batch);
 	cloud_logout(cd);
-	free(password);
 	return ret;
 }
 
-static int cloud_remove_deleted_files(const char* checksum_file, const char* delta_extension, const struct cloud_options* co){
+/* reads a previous checksum list, which is an encrypted manifest if that backup was encrypted */
+static int open_checksum_source(FILE* fp, const struct crypt_master* master, struct crypt_manifest** out_manifest, struct checksum_source* out){
+	int res;
+
+	*out_manifest = NULL;
+
+	if ((res = crypt_manifest_detect(fp)) < 0){
+		return -1;
+	}
+	if (res == 0){
+		checksum_source_file(fp, out);
+		return 0;
+	}
+
+	if (!master){
+		log_warning("The previous checksum file is encrypted, but this backup is not");
+		return -1;
+	}
+	*out_manifest = crypt_manifest_open(fp, crypt_master_key(master), CRYPT_MASTER_KEY_LEN);
+	if (!*out_manifest){
+		return -1;
+	}
+	crypt_manifest_source(*out_manifest, out);
+	return 0;
+}
+
+/* encrypts a sorted checksum list into the manifest that replaces it */
+static int seal_checksum_file(const char* work_file, const char* checksum_file, const struct options* opt, const struct crypt_master* master){
+	enum crypt_aead_cipher cipher = crypt_aead_from_evp(opt->enc_algorithm);
+	FILE* fp;
+	int ret;
+
+	fp = fopen(work_file, "rb");
+	if (!fp){
+		log_efopen(work_file);
+		return -1;
+	}
+	ret = crypt_manifest_seal(fp, checksum_file, cipher != CRYPT_AEAD_NONE ? cipher : CRYPT_AEAD_AES_256_GCM, crypt_master_key(master), CRYPT_MASTER_KEY_LEN);
+	if (fclose(fp) != 0){
+		log_efclose(work_file);
+	}
+	/* the plaintext list does not stay around either way */
+	remove(work_file);
+	return ret;
+}
+
+static int cloud_remove_deleted_files(const char* checksum_file, const char* delta_extension, const struct cloud_options* co, const struct crypt_master* master){
 	struct TMPFILE* tfp_removed = NULL;
+	struct checksum_source src;
+	struct crypt_manifest* manifest = NULL;
+	FILE* fp_checksum = NULL;
 	struct cloud_data* cd = NULL;
+	struct path_prefixes pp = { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+	struct arena* a = NULL;
 	char* tmp;
 	int ret = 0;
 
+	/* only the cloud copy is touched here, and logging into no cloud prompts for a username */
+	if (co->cp == CLOUD_NONE){
+		return 0;
+	}
 	if (!file_exists(checksum_file)){
 		log_info("Previous checksum file does not exist.");
 		return 0;
@@ -286,7 +1099,14 @@ static int cloud_remove_deleted_files(const char* checksum_file, const char* del
 		goto cleanup;
 	}
 
-	if (create_removed_list(checksum_file, tfp_removed->name)){
+	fp_checksum = fopen(checksum_file, "rb");
+	if (!fp_checksum){
+		log_efopen(checksum_file);
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (open_checksum_source(fp_checksum, master, &manifest, &src) != 0 || create_removed_list_src(&src, tfp_removed->name) != 0){
 		log_warning("Failed to create removed list.");
 		ret = -1;
 		goto cleanup;
@@ -304,17 +1124,30 @@ static int cloud_remove_deleted_files(const char* checksum_file, const char* del
 		goto cleanup;
 	}
 
+	if (make_path_prefixes(co->upload_directory, &pp) != 0){
+		log_warning("Failed to determine cloud prefixes.");
+		ret = -1;
+		goto cleanup;
+	}
+
+	a = arena_new(0);
+	if (!a){
+		log_warning("Failed to allocate path storage.");
+		ret = -1;
+		goto cleanup;
+	}
+
 	while ((tmp = get_next_removed(tfp_removed->fp)) != NULL){
 		char* file_path = NULL;
 		char* delta_path = NULL;
 		char* delta_path_parent = NULL;
 
-		if (make_file_paths(tmp, co->upload_directory, delta_extension, &file_path, &delta_path) != 0){
+		if (make_file_paths(tmp, &pp, delta_extension, a, &file_path, &delta_path) != 0){
 			log_warning_ex("Failed to create file paths for %s", tmp);
 			goto cleanup_inner_loop;
 		}
 
-		if ((delta_path_parent = sh_parent_dir(delta_path)) == NULL){
+		if ((delta_path_parent = arena_dup_n(a, delta_path, sh_filename(delta_path) - delta_path - 1)) == NULL){
 			log_warning_ex("Failed to determine parent dir for %s", delta_path);
 			goto cleanup_inner_loop;
 		}
@@ -335,32 +1168,35 @@ static int cloud_remove_deleted_files(const char* checksum_file, const char* del
 		}
 
 cleanup_inner_loop:
-		free(file_path);
-		free(delta_path);
-		free(delta_path_parent);
+		arena_reset(a);
 		free(tmp);
 	}
 
 cleanup:
+	free_path_prefixes(&pp);
+	arena_free(a);
 	temp_fclose(tfp_removed);
+	crypt_manifest_close(manifest);
+	fp_checksum ? fclose(fp_checksum) : 0;
 	cloud_logout(cd);
 	return ret;
 }
 
-static int create_checksum_files(const char* checksum_file, const char* delta_extension, FILE** out_checksum, FILE** out_checksum_prev){
+static int create_checksum_files(const char* checksum_file, const char* work_file, const char* delta_extension, FILE** out_checksum, FILE** out_checksum_prev){
 	FILE* fp_checksum = NULL;
 	FILE* fp_checksum_prev = NULL;
 	char* checksum_file_prev = NULL;
 	int ret = 0;
 
 	return_ifnull(checksum_file, -1);
+	return_ifnull(work_file, -1);
 	return_ifnull(out_checksum, -1);
 	return_ifnull(out_checksum_prev, -1);
 
 	if (!file_exists(checksum_file)){
-		fp_checksum = fopen(checksum_file, "wb");
+		fp_checksum = fopen(work_file, "wb");
 		if (!fp_checksum){
-			log_efopen(checksum_file);
+			log_efopen(work_file);
 			ret = -1;
 			goto cleanup;
 		}
@@ -382,9 +1218,9 @@ static int create_checksum_files(const char* checksum_file, const char* delta_ex
 		goto cleanup;
 	}
 
-	fp_checksum = fopen(checksum_file, "wb");
+	fp_checksum = fopen(work_file, "wb");
 	if (!fp_checksum){
-		log_efopen(checksum_file);
+		log_efopen(work_file);
 		ret = -1;
 		goto cleanup;
 	}
@@ -484,11 +1320,52 @@ struct cloud_options* generate_filled_co(const struct cloud_options* co){
 	return ret;
 }
 
+/* prompts for the password if needed and derives the master key from it and the backup's key file */
+static struct crypt_master* get_master_key(const struct options* opt){
+	struct crypt_master* ret;
+	char* password = NULL;
+	char* key_file;
+	int res;
+
+	key_file = sh_concat_path(sh_dup(opt->output_directory), "/key");
+	if (!key_file){
+		log_error("Failed to determine location of key file.");
+		return NULL;
+	}
+
+	if (!opt->enc_password){
+		while ((res = crypt_getpassword("Enter  encryption password:", "Verify encryption password:", &password)) > 0);
+
+		if (res < 0){
+			log_error("Failed to read encryption password from terminal");
+			free(key_file);
+			return NULL;
+		}
+	}
+
+	ret = crypt_master_new(password ? password : opt->enc_password, key_file);
+	if (!ret){
+		log_error("Failed to derive the encryption key");
+	}
+
+	if (password){
+		crypt_freepassword(password);
+	}
+	free(key_file);
+	return ret;
+}
+
 int backup(const struct options* opt){
 	char* checksum_path = NULL;
+	char* checksum_work = NULL;
 	FILE* fp_checksum = NULL;
 	FILE* fp_checksum_prev = NULL;
+	struct checksum_source prev;
+	struct crypt_manifest* manifest_prev = NULL;
+	int have_prev = 0;
+	struct crypt_master* master = NULL;
 	struct cloud_options* co_true = NULL;
+	struct string_array* dirty = NULL;
 	unsigned long backup_time = time(NULL);
 	char delta_extension[16];
 	int ret = 0;
@@ -506,18 +1383,33 @@ int backup(const struct options* opt){
 		ret = -1;
 		goto cleanup;
 	}
+	/* so "-e auto" and "-C auto" keep using these for this backup */
+	if (options_record_algorithms(opt) != 0){
+		log_warning("Failed to record the backup's algorithms");
+	}
+	/* every file's key is derived from this, so the password only goes through the slow kdf once per run */
+	if (opt->enc_algorithm && (master = get_master_key(opt)) == NULL){
+		ret = -1;
+		goto cleanup;
+	}
+	if (watch_take_journal(opt->output_directory, &dirty) < 0){
+		log_warning("Failed to read dirty-path journal. Performing a full scan.");
+	}
+
 	checksum_path = sh_concat_path(sh_dup(opt->output_directory), "checksums.txt");
-	if (!checksum_path){
+	/* an encrypted backup's list is built in plaintext next to it, then sealed into checksums.txt once it is sorted */
+	checksum_work = checksum_path ? (master ? sh_sprintf("%s.part", checksum_path) : sh_dup(checksum_path)) : NULL;
+	if (!checksum_work){
 		log_error("Failed to determine location of checksum file.");
 		ret = -1;
 		goto cleanup;
 	}
 
-	if (cloud_remove_deleted_files(checksum_path, delta_extension, co_true) != 0){
+	if (cloud_remove_deleted_files(checksum_path, delta_extension, co_true, master) != 0){
 		log_warning("Failed to remove deleted files since last backup.");
 	}
 
-	if (create_checksum_files(checksum_path, delta_extension, &fp_checksum, &fp_checksum_prev) != 0){
+	if (create_checksum_files(checksum_path, checksum_work, delta_extension, &fp_checksum, &fp_checksum_prev) != 0){
 		log_warning("Failed to create checksum delta.");
 	}
 	if (!fp_checksum){
@@ -525,26 +1417,59 @@ int backup(const struct options* opt){
 		ret = -1;
 		goto cleanup;
 	}
+	if (fp_checksum_prev){
+		if (open_checksum_source(fp_checksum_prev, master, &manifest_prev, &prev) == 0){
+			have_prev = 1;
+		}
+		else{
+			log_warning("Failed to read previous checksum file. Every file will be backed up.");
+		}
+	}
 
-	if (copy_files(opt, co_true, delta_extension, fp_checksum, fp_checksum_prev) != 0){
+	/* the dirty paths alone cannot produce a complete checksum file */
+	if (dirty && !have_prev){
+		sa_free(dirty);
+		dirty = NULL;
+	}
+
+	if (copy_files(opt, co_true, delta_extension, master, fp_checksum, have_prev ? &prev : NULL, dirty) != 0){
 		log_error("Error copying files to their destinations");
 		ret = -1;
 		goto cleanup;
 	}
 
 	if (fclose(fp_checksum) != 0){
-		log_efclose(checksum_path);
+		log_efclose(checksum_work);
 	}
 	fp_checksum = NULL;
 
-	if (sort_checksum_file(checksum_path) != 0){
+	if (sort_checksum_file(checksum_work) != 0){
 		log_warning("Failed to sort checksum file");
 	}
+	if (master && seal_checksum_file(checksum_work, checksum_path, opt, master) != 0){
+		log_error("Failed to encrypt checksum file");
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (!dirty && watch_mark_full_scan(opt->output_directory) != 0){
+		log_warning("Failed to record full scan");
+	}
 
 cleanup:
+	if (ret != 0 && dirty){
+		watch_invalidate_full_scan(opt->output_directory);
+	}
+	sa_free(dirty);
+	crypt_manifest_close(manifest_prev);
 	fp_checksum ? fclose(fp_checksum) : 0;
 	fp_checksum_prev ? fclose(fp_checksum_prev) : 0;
+	if (master && checksum_work){
+		remove(checksum_work);
+	}
+	crypt_master_free(master);
 	free(checksum_path);
+	free(checksum_work);
 	co_free(co_true);
 	return ret;
 }
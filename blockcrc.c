@@ -0,0 +1,304 @@
+/** @file blockcrc.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "blockcrc.h"
+#include "crc32c.h"
+#include "log.h"
+#include "filehelper.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* a sidecar is laid out as follows
+ *
+ * 8 byte magic
+ * u8  version
+ * u8  log2 of the block size
+ * 6 bytes reserved
+ * u64 size of the file (little endian)
+ * u32 crc32c of each block (little endian)
+ * u32 crc32c of everything before it, so a damaged sidecar is not mistaken for a damaged file */
+#define BLOCK_CRC_MAGIC "EZBCRC01"
+#define BLOCK_CRC_VERSION (1)
+#define BLOCK_CRC_HEADER_LEN (24)
+#define BLOCK_CRC_MIN_SHIFT (10)
+#define BLOCK_CRC_MAX_SHIFT (30)
+
+static void put_u32(unsigned char* out, uint32_t val){
+	out[0] = val & 0xFF;
+	out[1] = (val >> 8) & 0xFF;
+	out[2] = (val >> 16) & 0xFF;
+	out[3] = (val >> 24) & 0xFF;
+}
+
+static uint32_t get_u32(const unsigned char* in){
+	return (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static void put_u64(unsigned char* out, uint64_t val){
+	put_u32(out, (uint32_t)(val & 0xFFFFFFFFUL));
+	put_u32(out + 4, (uint32_t)(val >> 32));
+}
+
+static uint64_t get_u64(const unsigned char* in){
+	return (uint64_t)get_u32(in) | (uint64_t)get_u32(in + 4) << 32;
+}
+
+static uint64_t block_count(uint64_t size, unsigned shift){
+	return (size + ((uint64_t)1 << shift) - 1) >> shift;
+}
+
+/* writes to the sidecar while keeping the crc of everything written so far */
+static int write_crc(FILE* fp, const unsigned char* data, size_t len, uint32_t* self){
+	*self = crc32c(*self, data, len);
+	return fwrite(data, 1, len, fp) == len ? 0 : -1;
+}
+
+int block_crc_create(const char* file, const char* out_file){
+	unsigned char header[BLOCK_CRC_HEADER_LEN];
+	unsigned char tmp[4];
+	unsigned char* buf = NULL;
+	FILE* fp_in = NULL;
+	FILE* fp_out = NULL;
+	uint32_t self = 0;
+	uint64_t size;
+	uint64_t total = 0;
+	int len;
+	int ret = 0;
+
+	return_ifnull(file, -1);
+	return_ifnull(out_file, -1);
+
+	fp_in = fopen(file, "rb");
+	if (!fp_in){
+		log_efopen(file);
+		ret = -1;
+		goto cleanup;
+	}
+	size = get_file_size_fp(fp_in);
+
+	fp_out = fopen(out_file, "wb");
+	if (!fp_out){
+		log_efopen(out_file);
+		ret = -1;
+		goto cleanup;
+	}
+
+	buf = malloc((size_t)1 << BLOCK_CRC_SHIFT);
+	if (!buf){
+		log_enomem();
+		ret = -1;
+		goto cleanup;
+	}
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, BLOCK_CRC_MAGIC, 8);
+	header[8] = BLOCK_CRC_VERSION;
+	header[9] = BLOCK_CRC_SHIFT;
+	put_u64(header + 16, size);
+	if (write_crc(fp_out, header, sizeof(header), &self) != 0){
+		log_efwrite(out_file);
+		ret = -1;
+		goto cleanup;
+	}
+
+	while ((len = read_file(fp_in, buf, (size_t)1 << BLOCK_CRC_SHIFT)) > 0){
+		put_u32(tmp, crc32c(0, buf, len));
+		if (write_crc(fp_out, tmp, sizeof(tmp), &self) != 0){
+			log_efwrite(out_file);
+			ret = -1;
+			goto cleanup;
+		}
+		total += len;
+	}
+	if (len < 0){
+		log_efread(file);
+		ret = -1;
+		goto cleanup;
+	}
+	if (total != size){
+		log_error_ex("%s changed size while it was being checksummed", file);
+		ret = -1;
+		goto cleanup;
+	}
+
+	put_u32(tmp, self);
+	if (fwrite(tmp, 1, sizeof(tmp), fp_out) != sizeof(tmp)){
+		log_efwrite(out_file);
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	free(buf);
+	fp_in ? fclose(fp_in) : 0;
+	if (fp_out && fclose(fp_out) != 0){
+		log_efclose(out_file);
+		ret = -1;
+	}
+	if (ret != 0 && fp_out){
+		remove(out_file);
+	}
+	return ret;
+}
+
+/* reads and checks a whole sidecar. returns the block crcs, which start at the beginning of the returned buffer */
+static unsigned char* read_sidecar(const char* crc_file, unsigned* out_shift, uint64_t* out_size, uint64_t* out_n_blocks){
+	unsigned char* data = NULL;
+	uint64_t len;
+	uint64_t n_blocks;
+	FILE* fp = NULL;
+
+	len = get_file_size(crc_file);
+	if (len < BLOCK_CRC_HEADER_LEN + 4 || (len - BLOCK_CRC_HEADER_LEN - 4) % 4 != 0 || len > (uint64_t)1 << 30){
+		log_error_ex("%s is not a block checksum file", crc_file);
+		return NULL;
+	}
+
+	fp = fopen(crc_file, "rb");
+	if (!fp){
+		log_efopen(crc_file);
+		return NULL;
+	}
+	data = malloc(len);
+	if (!data){
+		log_enomem();
+		goto cleanup_fail;
+	}
+	if (fread(data, 1, len, fp) != len){
+		log_efread(crc_file);
+		goto cleanup_fail;
+	}
+
+	if (memcmp(data, BLOCK_CRC_MAGIC, 8) != 0 || data[8] != BLOCK_CRC_VERSION ||
+			crc32c(0, data, len - 4) != get_u32(data + len - 4)){
+		log_error_ex("%s is damaged", crc_file);
+		goto cleanup_fail;
+	}
+
+	*out_shift = data[9];
+	*out_size = get_u64(data + 16);
+	n_blocks = (len - BLOCK_CRC_HEADER_LEN - 4) / 4;
+	if (*out_shift < BLOCK_CRC_MIN_SHIFT || *out_shift > BLOCK_CRC_MAX_SHIFT || block_count(*out_size, *out_shift) != n_blocks){
+		log_error_ex("%s is damaged", crc_file);
+		goto cleanup_fail;
+	}
+	*out_n_blocks = n_blocks;
+
+	fclose(fp);
+	memmove(data, data + BLOCK_CRC_HEADER_LEN, n_blocks * 4);
+	return data;
+
+cleanup_fail:
+	free(data);
+	fclose(fp);
+	return NULL;
+}
+
+static int add_bad(uint64_t index, uint64_t** bad, size_t* n_bad){
+	uint64_t* tmp;
+
+	if (!bad){
+		(*n_bad)++;
+		return 0;
+	}
+
+	tmp = realloc(*bad, (*n_bad + 1) * sizeof(**bad));
+	if (!tmp){
+		log_enomem();
+		return -1;
+	}
+	*bad = tmp;
+	(*bad)[(*n_bad)++] = index;
+	return 0;
+}
+
+int block_crc_check(const char* file, const char* crc_file, uint64_t** out_bad, size_t* out_n_bad){
+	unsigned char* crcs = NULL;
+	unsigned char* buf = NULL;
+	uint64_t* bad = NULL;
+	size_t n_bad = 0;
+	unsigned shift;
+	uint64_t size;
+	uint64_t n_blocks;
+	uint64_t i;
+	FILE* fp = NULL;
+	int ret = 0;
+
+	return_ifnull(file, -1);
+	return_ifnull(crc_file, -1);
+
+	if (out_bad){
+		*out_bad = NULL;
+	}
+	if (out_n_bad){
+		*out_n_bad = 0;
+	}
+
+	crcs = read_sidecar(crc_file, &shift, &size, &n_blocks);
+	if (!crcs){
+		ret = -1;
+		goto cleanup;
+	}
+
+	fp = fopen(file, "rb");
+	if (!fp){
+		log_efopen(file);
+		ret = -1;
+		goto cleanup;
+	}
+	buf = malloc((size_t)1 << shift);
+	if (!buf){
+		log_enomem();
+		ret = -1;
+		goto cleanup;
+	}
+
+	for (i = 0; i < n_blocks; ++i){
+		uint64_t offset = i << shift;
+		size_t expected = size - offset < ((uint64_t)1 << shift) ? (size_t)(size - offset) : (size_t)1 << shift;
+		int len = read_file(fp, buf, expected);
+
+		if (len < 0){
+			log_efread(file);
+			ret = -1;
+			goto cleanup;
+		}
+		if ((size_t)len != expected || crc32c(0, buf, len) != get_u32(crcs + i * 4)){
+			if (add_bad(i, out_bad ? &bad : NULL, &n_bad) != 0){
+				ret = -1;
+				goto cleanup;
+			}
+		}
+	}
+
+	/* anything after the last block was not there when the sidecar was made */
+	if (read_file(fp, buf, 1) > 0 && add_bad(n_blocks, out_bad ? &bad : NULL, &n_bad) != 0){
+		ret = -1;
+		goto cleanup;
+	}
+
+	ret = n_bad > 0;
+
+cleanup:
+	if (ret >= 0){
+		if (out_bad){
+			*out_bad = bad;
+			bad = NULL;
+		}
+		if (out_n_bad){
+			*out_n_bad = n_bad;
+		}
+	}
+	free(bad);
+	free(buf);
+	free(crcs);
+	fp ? fclose(fp) : 0;
+	return ret;
+}
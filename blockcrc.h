@@ -0,0 +1,53 @@
+/** @file blockcrc.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __BLOCKCRC_H
+#define __BLOCKCRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef BLOCK_CRC_SHIFT
+#define BLOCK_CRC_SHIFT (20) /**< @brief log2 of the block size (1MB) that block_crc_create() checksums. */
+#endif
+
+/**
+ * @brief Writes a CRC-32C of every block of a file to a sidecar file.<br>
+ * This checks the stored bytes, not what they decrypt or decompress to, so an object can be checked with block_crc_check() without keys and at disk speed.
+ * @see crc32c()
+ *
+ * @param file The file to checksum.
+ *
+ * @param out_file Path to write the sidecar to.<br>
+ * This file is overwritten if it exists, and removed on failure.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int block_crc_create(const char* file, const char* out_file);
+
+/**
+ * @brief Checks a file against a sidecar made by block_crc_create().
+ *
+ * @param file The file to check.
+ *
+ * @param crc_file The sidecar.
+ *
+ * @param out_bad A pointer to an array that will contain the indices of the blocks that do not match, in ascending order.<br>
+ * Block i covers bytes [i << BLOCK_CRC_SHIFT, (i + 1) << BLOCK_CRC_SHIFT) of the file.<br>
+ * A block that is missing because the file is too short does not match. If the file is too long, the block just past the last one is listed.<br>
+ * This will be set to NULL if every block matches or on failure. Otherwise it must be free()'d when no longer in use.<br>
+ * This can be NULL if it is not used.
+ *
+ * @param out_n_bad A pointer to the amount of blocks that do not match.<br>
+ * This can be NULL if it is not used.
+ *
+ * @return 0 if the file matches, positive if it does not, or negative on failure (including if the file or sidecar cannot be read, or the sidecar is damaged).
+ */
+int block_crc_check(const char* file, const char* crc_file, uint64_t** out_bad, size_t* out_n_bad);
+
+#endif
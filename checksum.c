@@ -9,16 +9,40 @@
 #include "checksum.h"
 #include "crypt/base16.h"
 #include "log.h"
+#include "ctxpool.h"
 #include <errno.h>
 #include <openssl/err.h>
 #include "filehelper.h"
 #include "checksumsort.h"
 #include "strings/stringhelper.h"
+#include "threadpool.h"
+#include "treehash.h"
+#include <fcntl.h>
 #include <stdio.h>
 #include <openssl/evp.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <errno.h>
+#include <unistd.h>
+
+static void md_ctx_free(void* ctx){
+	EVP_MD_CTX_destroy(ctx);
+}
+
+/* gets a digest context for the calling thread.
+ * EVP_DigestInit_ex() fully reinitializes a context, so one left over from a previous file can be reused for any algorithm */
+static EVP_MD_CTX* md_ctx_get(void){
+	EVP_MD_CTX* ctx = ctxpool_take(CTXPOOL_DIGEST, 0, 0, 0);
+
+	if (!ctx && !(ctx = EVP_MD_CTX_create())){
+		log_error("Failed to initialize EVP_MD_CTX");
+		ERR_print_errors_fp(stderr);
+	}
+	return ctx;
+}
+
+static void md_ctx_put(EVP_MD_CTX* ctx){
+	ctxpool_give(CTXPOOL_DIGEST, 0, 0, 0, ctx, md_ctx_free);
+}
 
 const EVP_MD* get_evp_md(const char* hash_name){
 	return hash_name ? EVP_get_digestbyname(hash_name) : EVP_md_null();
@@ -103,9 +127,7 @@ int checksum(const char* file, const EVP_MD* algorithm, unsigned char** out, uns
 		return -1;
 	}
 
-	if (!(ctx = EVP_MD_CTX_create())){
-		log_error("Failed to initialize EVP_MD_CTX");
-		ERR_print_errors_fp(stderr);
+	if (!(ctx = md_ctx_get())){
 		ret = -1;
 		goto cleanup;
 	}
@@ -147,7 +169,7 @@ int checksum(const char* file, const EVP_MD* algorithm, unsigned char** out, uns
 
 cleanup:
 	if (ctx){
-		EVP_MD_CTX_destroy(ctx);
+		md_ctx_put(ctx);
 	}
 	if (fp){
 		fclose(fp);
@@ -239,11 +261,38 @@ cleanup:
  * way to seperate the hash from its filename is to use a '\0'
  *
  * returns 0 on success or err on error */
-int add_checksum_to_file(const char* file, const EVP_MD* algorithm, FILE* out, FILE* prev_checksums, char** out_hash){
-	struct element* e;
+static int add_element(struct element* e, FILE* out, const struct checksum_source* prev, char** out_hash){
 	char* checksum = NULL;
 	int ret;
 
+	if (prev &&
+			prev->search(prev->data, e->file, &checksum) == 0 &&
+			strcmp(checksum, e->checksum) == 0){
+		ret = 1;
+	}
+	else{
+		ret = 0;
+	}
+	free(checksum);
+
+	if (write_element_to_file(out, e) != 0){
+		log_debug("Could not write element to file");
+		return -1;
+	}
+
+	if (out_hash){
+		*out_hash = sh_dup(e->checksum);
+		if (!(*out_hash)){
+			log_warning("Failed to output hash.");
+		}
+	}
+	return ret;
+}
+
+static int add_checksum(const char* file, const EVP_MD* algorithm, FILE* out, const struct checksum_source* prev, char** out_hash){
+	struct element* e;
+	int ret;
+
 	return_ifnull(file, -1);
 	return_ifnull(out, -1);
 
@@ -256,43 +305,631 @@ int add_checksum_to_file(const char* file, const EVP_MD* algorithm, FILE* out, F
 		return -1;
 	}
 
+	if (file_to_element(file, algorithm, &e) != 0){
+		log_debug("Could not create element from file");
+		return -1;
+	}
+
+	ret = add_element(e, out, prev, out_hash);
+	free_element(e);
+	return ret;
+}
+
+int add_checksum_to_file(const char* file, const EVP_MD* algorithm, FILE* out, FILE* prev_checksums, char** out_hash){
+	struct checksum_source src;
+
 	if (prev_checksums && !file_opened_for_reading(prev_checksums)){
 		log_emode();
 		return -1;
 	}
 
-	if (file_to_element(file, algorithm, &e) != 0){
-		log_debug("Could not create element from file");
+	checksum_source_file(prev_checksums, &src);
+	return add_checksum(file, algorithm, out, prev_checksums ? &src : NULL, out_hash);
+}
+
+/* a standard digest of a file that is checked for appended data, and the size it covers */
+struct sized_digest{
+	unsigned long size;
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned md_len;
+};
+
+static int parse_digest(const char* hex, size_t hex_len, unsigned md_len, unsigned char* out){
+	char buf[EVP_MAX_MD_SIZE * 2 + 1];
+	void* bytes;
+	unsigned len;
+
+	if (hex_len != md_len * 2){
 		return -1;
 	}
+	memcpy(buf, hex, hex_len);
+	buf[hex_len] = '\0';
+
+	if (from_base16(buf, &bytes, &len) != 0){
+		return -1;
+	}
+	if (len != md_len){
+		free(bytes);
+		return -1;
+	}
+	memcpy(out, bytes, len);
+	free(bytes);
+	return 0;
+}
+
+/* parses "DIGEST:SIZE". returns negative if the checksum is anything else */
+static int parse_sized_digest(const char* str, unsigned md_len, struct sized_digest* out){
+	const char* colon = strchr(str, ':');
+	char* endptr;
+
+	if (!colon){
+		return -1;
+	}
+
+	out->md_len = md_len;
+	out->size = strtoul(colon + 1, &endptr, 10);
+	if (endptr == colon + 1 || *endptr != '\0' ||
+			parse_digest(str, (size_t)(colon - str), md_len, out->digest) != 0){
+		return -1;
+	}
+	return 0;
+}
+
+static char* format_sized_digest(const struct sized_digest* sd){
+	char* digest;
+	char* ret;
+
+	if (to_base16(sd->digest, sd->md_len, &digest) != 0){
+		log_error("Failed to convert digest to hexadecimal");
+		return NULL;
+	}
+	ret = sh_sprintf("%s:%lu", digest, sd->size);
+	free(digest);
+	return ret;
+}
+
+int add_checksum_to_file_ex(const char* file, const EVP_MD* algorithm, FILE* out, FILE* prev_checksums, char** out_hash, unsigned long* out_append_offset){
+	struct checksum_source src;
+
+	if (prev_checksums && !file_opened_for_reading(prev_checksums)){
+		log_emode();
+		return -1;
+	}
+
+	checksum_source_file(prev_checksums, &src);
+	return add_checksum_to_file_src(file, algorithm, out, prev_checksums ? &src : NULL, out_hash, out_append_offset);
+}
+
+int add_checksum_to_file_src(const char* file, const EVP_MD* algorithm, FILE* out, const struct checksum_source* prev_checksums, char** out_hash, unsigned long* out_append_offset){
+	struct sized_digest prev;
+	struct sized_digest cur;
+	unsigned char prefix[EVP_MAX_MD_SIZE];
+	unsigned char buffer[BUFFER_LEN];
+	struct element e;
+	struct stat st;
+	EVP_MD_CTX* ctx = NULL;
+	EVP_MD_CTX* snapshot = NULL;
+	FILE* fp = NULL;
+	char* prev_checksum = NULL;
+	int have_prev = 0;
+	int prefix_matches = 0;
+	size_t len;
+	int ret = 0;
+
+	return_ifnull(file, -1);
+	return_ifnull(out, -1);
+	return_ifnull(out_append_offset, -1);
+
+	*out_append_offset = 0;
+	e.checksum = NULL;
+
+	if (stat(file, &st) != 0 || !S_ISREG(st.st_mode) || (unsigned long)st.st_size < CHECKSUM_APPEND_MIN_SIZE){
+		return add_checksum(file, algorithm, out, prev_checksums, out_hash);
+	}
+
+	if (out_hash){
+		*out_hash = NULL;
+	}
+
+	if (!file_opened_for_writing(out)){
+		log_emode();
+		return -1;
+	}
+
+	if (!algorithm){
+		algorithm = EVP_sha1();
+	}
 
 	if (prev_checksums &&
-			search_for_checksum(prev_checksums, e->file, &checksum) == 0 &&
-			strcmp(checksum, e->checksum) == 0){
-		ret = 1;
+			prev_checksums->search(prev_checksums->data, file, &prev_checksum) == 0 &&
+			parse_sized_digest(prev_checksum, EVP_MD_size(algorithm), &prev) == 0){
+		have_prev = 1;
 	}
-	else{
-		ret = 0;
+
+	fp = fopen(file, "rb");
+	if (!fp){
+		log_efopen(file);
+		ret = -1;
+		goto cleanup;
 	}
 
-	if (write_element_to_file(out, e) != 0){
-		free_element(e);
-		free(checksum);
+	if (!(ctx = md_ctx_get()) || !(snapshot = md_ctx_get())){
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (EVP_DigestInit_ex(ctx, algorithm, NULL) != 1){
+		log_error("Failed to initialize digest");
+		ERR_print_errors_fp(stderr);
+		ret = -1;
+		goto cleanup;
+	}
+
+	cur.md_len = EVP_MD_size(algorithm);
+	cur.size = 0;
+	while ((len = fread(buffer, 1, sizeof(buffer), fp)) > 0){
+		size_t head = 0;
+
+		/* this read goes past the previous end of the file, so a copy of the digest up to there is finished.
+		 * if it matches the previous digest, the file only grew */
+		if (have_prev && cur.size <= prev.size && len > prev.size - cur.size){
+			head = prev.size - cur.size;
+			if (EVP_DigestUpdate(ctx, buffer, head) != 1 ||
+					EVP_MD_CTX_copy_ex(snapshot, ctx) != 1 ||
+					EVP_DigestFinal_ex(snapshot, prefix, NULL) != 1){
+				log_error_ex("Failed to calculate checksum for %s", file);
+				ERR_print_errors_fp(stderr);
+				ret = -1;
+				goto cleanup;
+			}
+			prefix_matches = memcmp(prefix, prev.digest, prev.md_len) == 0;
+		}
+
+		if (EVP_DigestUpdate(ctx, buffer + head, len - head) != 1){
+			log_error_ex("Failed to calculate checksum for %s", file);
+			ERR_print_errors_fp(stderr);
+			ret = -1;
+			goto cleanup;
+		}
+		cur.size += len;
+	}
+	if (ferror(fp)){
+		log_efread(file);
+		ret = -1;
+		goto cleanup;
+	}
+	if (EVP_DigestFinal_ex(ctx, cur.digest, NULL) != 1){
+		log_error_ex("Failed to calculate checksum for %s", file);
+		ERR_print_errors_fp(stderr);
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (prefix_matches){
+		*out_append_offset = prev.size;
+		ret = CHECKSUM_APPENDED;
+	}
+	else if (have_prev){
+		ret = prev.size == cur.size && memcmp(prev.digest, cur.digest, cur.md_len) == 0;
+	}
+	/* lists from before append detection have plain digests, which are the same digest without the size */
+	else if (prev_checksum && parse_digest(prev_checksum, strlen(prev_checksum), cur.md_len, prev.digest) == 0){
+		ret = memcmp(prev.digest, cur.digest, cur.md_len) == 0;
+	}
+
+	e.file = (char*)file;
+	e.checksum = format_sized_digest(&cur);
+	if (!e.checksum){
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (write_element_to_file(out, &e) != 0){
 		log_debug("Could not write element to file");
-		return -1;
+		ret = -1;
+		goto cleanup;
 	}
 
 	if (out_hash){
-		*out_hash = sh_dup(e->checksum);
+		*out_hash = sh_dup(e.checksum);
 		if (!(*out_hash)){
 			log_warning("Failed to output hash.");
 		}
 	}
-	free_element(e);
-	free(checksum);
+
+cleanup:
+	if (ret < 0){
+		*out_append_offset = 0;
+	}
+	ctx ? md_ctx_put(ctx) : (void)0;
+	snapshot ? md_ctx_put(snapshot) : (void)0;
+	fp ? fclose(fp) : 0;
+	free(prev_checksum);
+	free(e.checksum);
+	return ret;
+}
+
+int add_checksum_to_file_tree(const char* file, const EVP_MD* algorithm, unsigned threads, FILE* out, const struct checksum_source* prev_checksums, char** out_hash, struct tree_hash** out_tree){
+	struct tree_hash* th = NULL;
+	const unsigned char* root;
+	unsigned root_len;
+	char* root_hex = NULL;
+	struct element e;
+	struct stat st;
+	int ret;
+
+	return_ifnull(file, -1);
+	return_ifnull(out, -1);
+
+	if (out_tree){
+		*out_tree = NULL;
+	}
+
+	if (stat(file, &st) != 0 || !S_ISREG(st.st_mode) || (unsigned long)st.st_size < CHECKSUM_TREE_MIN_SIZE){
+		return add_checksum(file, algorithm, out, prev_checksums, out_hash);
+	}
+
+	if (out_hash){
+		*out_hash = NULL;
+	}
+
+	if (!file_opened_for_writing(out)){
+		log_emode();
+		return -1;
+	}
+
+	th = tree_hash_file(file, algorithm, TREE_HASH_LEAF_SHIFT, threads);
+	if (!th){
+		log_error_ex("Failed to calculate checksum for %s", file);
+		return -1;
+	}
+
+	root = tree_hash_root(th, &root_len);
+	e.file = (char*)file;
+	e.checksum = NULL;
+	if (to_base16(root, root_len, &root_hex) != 0 ||
+			(e.checksum = sh_sprintf("tree:%lu:%s", (unsigned long)tree_hash_size(th), root_hex)) == NULL){
+		log_error("Failed to convert digest to hexadecimal");
+		ret = -1;
+		goto cleanup;
+	}
+
+	ret = add_element(&e, out, prev_checksums, out_hash);
+
+cleanup:
+	if (ret >= 0 && out_tree){
+		*out_tree = th;
+		th = NULL;
+	}
+	tree_hash_free(th);
+	free(root_hex);
+	free(e.checksum);
 	return ret;
 }
 
+/* a plain checksum is a digest of the whole file, an appendable one is the same digest followed by the file's size, and a tree one is the root of a tree hash.
+ * the last two record the file's size, so data past it can be caught without hashing it */
+struct checksum_stream{
+	EVP_MD_CTX* ctx;
+	struct tree_hash* th;
+	int sized;
+	unsigned long size;
+	unsigned long total;
+	unsigned char expected[EVP_MAX_MD_SIZE];
+	unsigned md_len;
+};
+
+/* parses "tree:SIZE:ROOT" */
+static int parse_tree_checksum(const char* str, unsigned md_len, unsigned long* out_size, unsigned char* out_root){
+	const char* size_str = str + strlen("tree:");
+	char* endptr;
+
+	*out_size = strtoul(size_str, &endptr, 10);
+	if (endptr == size_str || *endptr != ':'){
+		return -1;
+	}
+	return parse_digest(endptr + 1, strlen(endptr + 1), md_len, out_root);
+}
+
+struct checksum_stream* checksum_stream_new(const char* checksum, const EVP_MD* algorithm){
+	struct checksum_stream* cs;
+	struct sized_digest sd;
+
+	return_ifnull(checksum, NULL);
+
+	if (!algorithm){
+		algorithm = EVP_sha1();
+	}
+
+	cs = calloc(1, sizeof(*cs));
+	if (!cs){
+		log_enomem();
+		return NULL;
+	}
+	cs->md_len = EVP_MD_size(algorithm);
+
+	if (sh_starts_with(checksum, "tree:")){
+		if (parse_tree_checksum(checksum, cs->md_len, &cs->size, cs->expected) != 0){
+			goto cleanup_parse;
+		}
+		cs->sized = 1;
+		cs->th = tree_hash_begin(cs->size, algorithm, TREE_HASH_LEAF_SHIFT);
+		if (!cs->th){
+			goto cleanup_fail;
+		}
+		return cs;
+	}
+
+	if (strchr(checksum, ':')){
+		if (parse_sized_digest(checksum, cs->md_len, &sd) != 0){
+			goto cleanup_parse;
+		}
+		memcpy(cs->expected, sd.digest, cs->md_len);
+		cs->size = sd.size;
+		cs->sized = 1;
+	}
+	else if (parse_digest(checksum, strlen(checksum), cs->md_len, cs->expected) != 0){
+		goto cleanup_parse;
+	}
+
+	if (!(cs->ctx = md_ctx_get())){
+		goto cleanup_fail;
+	}
+	if (EVP_DigestInit_ex(cs->ctx, algorithm, NULL) != 1){
+		log_error("Failed to initialize digest");
+		ERR_print_errors_fp(stderr);
+		goto cleanup_fail;
+	}
+	return cs;
+
+cleanup_parse:
+	log_error_ex("Could not parse checksum %s", checksum);
+cleanup_fail:
+	checksum_stream_free(cs);
+	return NULL;
+}
+
+int checksum_stream_update(struct checksum_stream* cs, const void* data, size_t len){
+	return_ifnull(cs, -1);
+
+	/* there is no point in hashing data that already makes the size wrong */
+	if (cs->sized && (cs->total > cs->size || len > cs->size - cs->total)){
+		cs->total = cs->size + 1;
+		return 0;
+	}
+	cs->total += len;
+
+	if (cs->th){
+		return tree_hash_update(cs->th, data, len);
+	}
+	return EVP_DigestUpdate(cs->ctx, data, len) == 1 ? 0 : -1;
+}
+
+int checksum_stream_check(struct checksum_stream* cs){
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	const unsigned char* result = digest;
+
+	return_ifnull(cs, -1);
+
+	if (cs->sized && cs->total != cs->size){
+		return 1;
+	}
+
+	if (cs->th){
+		if (tree_hash_end(cs->th) != 0){
+			return -1;
+		}
+		result = tree_hash_root(cs->th, NULL);
+	}
+	else if (!cs->ctx || EVP_DigestFinal_ex(cs->ctx, digest, NULL) != 1){
+		log_error("Failed to calculate checksum");
+		return -1;
+	}
+	else{
+		/* the context is spent either way */
+		md_ctx_put(cs->ctx);
+		cs->ctx = NULL;
+	}
+
+	return memcmp(result, cs->expected, cs->md_len) != 0;
+}
+
+void checksum_stream_free(struct checksum_stream* cs){
+	if (!cs){
+		return;
+	}
+	cs->ctx ? md_ctx_put(cs->ctx) : (void)0;
+	tree_hash_free(cs->th);
+	free(cs);
+}
+
+/* the small-file hashing engine.
+ * per-file cost on tiny files is mostly opening the file and setting up the digest, not hashing, so files are hashed CHECKSUM_BATCH_LEN at a time:
+ * each one is read with a single read() into its own buffer and digested on a worker thread, each with its own context.
+ * the result is the same digest checksum() would give, so the two can be mixed freely */
+struct batch_job{
+	const struct checksum_batch* cb;
+	const char* file;
+	unsigned char* buf;
+	char* hex;
+};
+
+struct checksum_batch{
+	const EVP_MD* algorithm;
+	/* the copy of algorithm fetched from the default provider, if there is one */
+	EVP_MD* fetched;
+	struct threadpool* tp;
+	struct batch_job jobs[CHECKSUM_BATCH_LEN];
+	size_t n_jobs;
+};
+
+/* reads a whole file if it is a regular file that fits in the buffer.
+ * returns its length, or negative if it should be hashed the normal way instead */
+static long read_small_file(const char* file, unsigned char* buf){
+	struct stat st;
+	long len = 0;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0){
+		return -1;
+	}
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size >= CHECKSUM_BATCH_FILE_SIZE){
+		close(fd);
+		return -1;
+	}
+
+	/* read one byte more than could fit, so a file that grew since fstat() is noticed */
+	while (len < CHECKSUM_BATCH_FILE_SIZE){
+		ssize_t res = read(fd, buf + len, CHECKSUM_BATCH_FILE_SIZE - len);
+		if (res < 0 && errno == EINTR){
+			continue;
+		}
+		if (res <= 0){
+			break;
+		}
+		len += res;
+	}
+	close(fd);
+	return len < CHECKSUM_BATCH_FILE_SIZE ? len : -1;
+}
+
+static void batch_job_run(void* arg, unsigned thread_index){
+	struct batch_job* job = arg;
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned md_len;
+	EVP_MD_CTX* ctx;
+	long len;
+
+	(void)thread_index;
+
+	len = read_small_file(job->file, job->buf);
+	if (len < 0 || !(ctx = md_ctx_get())){
+		return;
+	}
+	if (EVP_DigestInit_ex(ctx, job->cb->algorithm, NULL) == 1 &&
+			EVP_DigestUpdate(ctx, job->buf, len) == 1 &&
+			EVP_DigestFinal_ex(ctx, md, &md_len) == 1 &&
+			to_base16(md, md_len, &job->hex) != 0){
+		job->hex = NULL;
+	}
+	md_ctx_put(ctx);
+}
+
+struct checksum_batch* checksum_batch_new(const EVP_MD* algorithm, unsigned threads){
+	struct checksum_batch* cb;
+	size_t i;
+
+	cb = calloc(1, sizeof(*cb));
+	if (!cb){
+		log_enomem();
+		return NULL;
+	}
+	cb->algorithm = algorithm ? algorithm : EVP_sha1();
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	/* a built-in digest is looked up again on every EVP_DigestInit_ex(), which costs as much as hashing a tiny file.
+	 * fetching it once skips that */
+	cb->fetched = EVP_MD_fetch(NULL, EVP_MD_get0_name(cb->algorithm), NULL);
+	if (cb->fetched){
+		cb->algorithm = cb->fetched;
+	}
+#endif
+
+	for (i = 0; i < CHECKSUM_BATCH_LEN; ++i){
+		cb->jobs[i].cb = cb;
+		cb->jobs[i].buf = malloc(CHECKSUM_BATCH_FILE_SIZE);
+		if (!cb->jobs[i].buf){
+			log_enomem();
+			checksum_batch_free(cb);
+			return NULL;
+		}
+	}
+
+	cb->tp = tp_new(threads);
+	if (!cb->tp){
+		log_error("Failed to create threadpool");
+		checksum_batch_free(cb);
+		return NULL;
+	}
+	return cb;
+}
+
+int checksum_batch_run(struct checksum_batch* cb, const char* const* files, size_t n_files){
+	size_t i;
+	int ret = 0;
+
+	return_ifnull(cb, -1);
+	return_ifnull(files, -1);
+
+	if (n_files > CHECKSUM_BATCH_LEN){
+		log_error_ex("Too many files for one batch (%lu)", (unsigned long)n_files);
+		return -1;
+	}
+
+	for (i = 0; i < cb->n_jobs; ++i){
+		free(cb->jobs[i].hex);
+		cb->jobs[i].hex = NULL;
+	}
+	cb->n_jobs = 0;
+
+	for (i = 0; i < n_files; ++i){
+		cb->jobs[i].file = files[i];
+		cb->n_jobs++;
+		/* a job that is not run is not an error. its file is just hashed the normal way */
+		if (tp_submit(cb->tp, batch_job_run, &cb->jobs[i]) != 0){
+			ret = -1;
+			break;
+		}
+	}
+	tp_wait(cb->tp);
+	return ret;
+}
+
+int checksum_batch_hashed(const struct checksum_batch* cb, size_t index){
+	return cb && index < cb->n_jobs && cb->jobs[index].hex != NULL;
+}
+
+int add_checksum_from_batch(const struct checksum_batch* cb, size_t index, FILE* out, const struct checksum_source* prev_checksums, char** out_hash){
+	struct element e;
+
+	return_ifnull(out, -1);
+
+	if (out_hash){
+		*out_hash = NULL;
+	}
+
+	if (!checksum_batch_hashed(cb, index)){
+		log_error("This file was not hashed by the batch");
+		return -1;
+	}
+
+	if (!file_opened_for_writing(out)){
+		log_emode();
+		return -1;
+	}
+
+	e.file = (char*)cb->jobs[index].file;
+	e.checksum = cb->jobs[index].hex;
+	return add_element(&e, out, prev_checksums, out_hash);
+}
+
+void checksum_batch_free(struct checksum_batch* cb){
+	size_t i;
+
+	if (!cb){
+		return;
+	}
+	tp_free(cb->tp);
+	for (i = 0; i < CHECKSUM_BATCH_LEN; ++i){
+		free(cb->jobs[i].buf);
+		free(cb->jobs[i].hex);
+	}
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	EVP_MD_free(cb->fetched);
+#endif
+	free(cb);
+}
+
 int sort_checksum_file(const char* in_out){
 	struct TMPFILE** tmp_files = NULL;
 	struct TMPFILE* tmp_in = NULL;
@@ -355,6 +992,25 @@ int search_for_checksum(FILE* fp_checksums, const char* key, char** checksum){
 	return search_file(fp_checksums, key, checksum);
 }
 
+static int file_search(void* data, const char* key, char** checksum){
+	return search_for_checksum(data, key, checksum);
+}
+
+static struct element* file_next(void* data){
+	return get_next_checksum_element(data);
+}
+
+static int file_rewind(void* data){
+	return fseek(data, 0, SEEK_SET);
+}
+
+void checksum_source_file(FILE* fp, struct checksum_source* out){
+	out->search = file_search;
+	out->next = file_next;
+	out->rewind = file_rewind;
+	out->data = fp;
+}
+
 int check_file_exists(const char* file){
 	struct stat st;
 
@@ -374,11 +1030,9 @@ int check_file_exists(const char* file){
 }
 
 int create_removed_list(const char* checksum_file, const char* out_file){
+	struct checksum_source src;
 	FILE* fp_checksum = NULL;
-	FILE* fp_out = NULL;
-	struct element* tmp;
-	int err;
-	int ret = 0;
+	int ret;
 
 	return_ifnull(checksum_file, -1);
 	return_ifnull(out_file, -1);
@@ -386,9 +1040,27 @@ int create_removed_list(const char* checksum_file, const char* out_file){
 	fp_checksum = fopen(checksum_file, "rb");
 	if (!fp_checksum){
 		log_efopen(checksum_file);
-		ret = -1;
-		goto cleanup;
+		return -1;
+	}
+
+	checksum_source_file(fp_checksum, &src);
+	ret = create_removed_list_src(&src, out_file);
+
+	if (fclose(fp_checksum) != 0){
+		log_efclose(checksum_file);
 	}
+	return ret;
+}
+
+int create_removed_list_src(const struct checksum_source* src, const char* out_file){
+	FILE* fp_out = NULL;
+	struct element* tmp;
+	int err;
+	int ret = 0;
+
+	return_ifnull(src, -1);
+	return_ifnull(out_file, -1);
+
 	fp_out = fopen(out_file, "wb");
 	if (!fp_out){
 		log_efopen(out_file);
@@ -396,7 +1068,13 @@ int create_removed_list(const char* checksum_file, const char* out_file){
 		goto cleanup;
 	}
 
-	while ((tmp = get_next_checksum_element(fp_checksum)) != NULL){
+	if (src->rewind(src->data) != 0){
+		log_error("Failed to rewind checksum list");
+		ret = -1;
+		goto cleanup;
+	}
+
+	while ((tmp = src->next(src->data)) != NULL){
 		err = check_file_exists(tmp->file);
 		switch (err){
 		case 1:
@@ -406,17 +1084,15 @@ int create_removed_list(const char* checksum_file, const char* out_file){
 			break;
 		default:
 			free_element(tmp);
-			return err;
+			ret = err;
+			goto cleanup;
 		}
 		free_element(tmp);
 	}
 
 cleanup:
-	if (fp_checksum && fclose(fp_checksum) != 0){
-		log_efclose(checksum_file);
-	}
 	if (fp_out && fclose(fp_out) != 0){
-		log_efclose(fp_out);
+		log_efclose(out_file);
 	}
 	return ret;
 }
@@ -16,6 +16,39 @@
 #define __attribute__(x)
 #endif
 
+#ifndef CHECKSUM_APPEND_MIN_SIZE
+#define CHECKSUM_APPEND_MIN_SIZE (1 << 22) /**< @brief Files at least this large (4MB) are checked for appended data by add_checksum_to_file_ex(). */
+#endif
+
+#ifndef CHECKSUM_BATCH_LEN
+#define CHECKSUM_BATCH_LEN (16) /**< @brief The most files a checksum_batch hashes at once. */
+#endif
+
+#ifndef CHECKSUM_BATCH_FILE_SIZE
+#define CHECKSUM_BATCH_FILE_SIZE (1 << 16) /**< @brief Files smaller than this (64KB) are hashed by a checksum_batch. Larger ones are hashed the normal way. */
+#endif
+
+#ifndef CHECKSUM_TREE_MIN_SIZE
+#define CHECKSUM_TREE_MIN_SIZE (1 << 24) /**< @brief Files at least this large (16MB) are tree hashed by add_checksum_to_file_tree(). */
+#endif
+
+#define CHECKSUM_APPENDED (2) /**< @brief Returned by add_checksum_to_file_ex() if data was only appended to a file. */
+
+struct element;
+struct tree_hash;
+
+/**
+ * @brief A sorted checksum list that can be searched and read in order.<br>
+ * This lets previous checksums come from something other than a plain checksum file, such as an encrypted manifest.
+ * @see checksum_source_file()
+ */
+struct checksum_source{
+	int (*search)(void* data, const char* key, char** checksum); /**< @brief Searches the list. This must behave like search_for_checksum(). */
+	struct element* (*next)(void* data);                         /**< @brief Returns the next element in order. This must behave like get_next_checksum_element(). */
+	int (*rewind)(void* data);                                   /**< @brief Goes back to the first element. This must return 0 on success. */
+	void* data;                                                  /**< @brief Passed to each of the above. */
+};
+
 /**
  * @brief Returns an EVP_MD* object for a given string.
  * @see checksum()
@@ -111,6 +144,222 @@ int bytes_to_hex(const unsigned char* bytes, unsigned len, char** out) __attribu
  */
 int add_checksum_to_file(const char* file, const EVP_MD* algorithm, FILE* out, FILE* prev_checksums, char** out_hash);
 
+/**
+ * @brief Adds a file's checksum to a checksum list, detecting files that only had data appended to them.<br>
+ * Files smaller than CHECKSUM_APPEND_MIN_SIZE are handled exactly like add_checksum_to_file().<br>
+ * <br>
+ * Their checksum has the following format:<br>
+ * `DIGEST:SIZE`<br>
+ * where DIGEST is the same digest add_checksum_to_file() writes, so it can be compared with other tools that hash the whole file.<br>
+ * The file is read once from the start. If it grew and its first SIZE bytes still hash to the previous DIGEST, CHECKSUM_APPENDED is returned, so only the data after the previous end of the file needs to be compressed and stored.<br>
+ * The whole file is still hashed every time; only the work done after hashing scales with how much the file grew.<br>
+ * A file that was also changed before its previous end counts as changed.<br>
+ * A previous entry that is a plain digest (from a list made before this format) is compared like add_checksum_to_file() does.
+ * @see add_checksum_to_file()
+ *
+ * @param file The file to calculate a checksum for.
+ *
+ * @param algorithm The digest algorithm to use.
+ * @see get_evp_md()
+ *
+ * @param out The checksum list to add the file's checksum to.<br>
+ * This FILE* must be opened in writing binary ("wb") mode.<br>
+ *
+ * @param prev_checksums An optional previous sorted checksum list to check if the file's contents were changed or not.<br>
+ * Set this parameter to NULL if there is no previous checksum list.<br>
+ * Otherwise, this FILE* must be opened in reading binary ("rb") mode.
+ *
+ * @param out_hash A pointer to a string that will contain the generated hash.
+ * This can be NULL if it is not used.
+ *
+ * @param out_append_offset A pointer to an offset that will contain the previous size of the file if CHECKSUM_APPENDED is returned.
+ *
+ * @return 0 if the file changed, positive if the file was unchanged from prev_checksums, CHECKSUM_APPENDED if data was only appended to the file, or negative on failure.
+ */
+int add_checksum_to_file_ex(const char* file, const EVP_MD* algorithm, FILE* out, FILE* prev_checksums, char** out_hash, unsigned long* out_append_offset);
+
+/**
+ * @brief Same as add_checksum_to_file_ex(), but the previous checksums come from a checksum_source.
+ * @see add_checksum_to_file_ex()
+ * @param file The file to calculate a checksum for.
+ * @param algorithm The digest algorithm to use.
+ * @param out The checksum list to add the file's checksum to.<br>
+ * This FILE* must be opened in writing binary ("wb") mode.<br>
+ * @param prev_checksums The previous checksums, or NULL if there are none.
+ * @param out_hash A pointer to a string that will contain the generated hash.
+ * This can be NULL if it is not used.
+ * @param out_append_offset A pointer to an offset that will contain the previous size of the file if CHECKSUM_APPENDED is returned.
+ * @return 0 if the file changed, positive if the file was unchanged from prev_checksums, CHECKSUM_APPENDED if data was only appended to the file, or negative on failure.
+ */
+int add_checksum_to_file_src(const char* file, const EVP_MD* algorithm, FILE* out, const struct checksum_source* prev_checksums, char** out_hash, unsigned long* out_append_offset);
+
+/**
+ * @brief Adds a file's checksum to a checksum list, hashing large files as a Merkle tree on several threads.<br>
+ * Files smaller than CHECKSUM_TREE_MIN_SIZE are handled exactly like add_checksum_to_file().<br>
+ * <br>
+ * Larger files are hashed with tree_hash_file() using TREE_HASH_LEAF_SHIFT sized leaves.<br>
+ * Their checksum has the following format:<br>
+ * `tree:SIZE:ROOT`<br>
+ * This is not the same as the file's plain checksum, so switching a file to or from tree hashing counts as a change.
+ * @see tree_hash_file()
+ *
+ * @param file The file to calculate a checksum for.
+ *
+ * @param algorithm The digest algorithm to use.
+ * @see get_evp_md()
+ *
+ * @param threads The amount of worker threads to hash leaves on.<br>
+ * 0 hashes on the calling thread.
+ *
+ * @param out The checksum list to add the file's checksum to.<br>
+ * This FILE* must be opened in writing binary ("wb") mode.<br>
+ *
+ * @param prev_checksums The previous checksums, or NULL if there are none.
+ *
+ * @param out_hash A pointer to a string that will contain the generated hash.
+ * This can be NULL if it is not used.
+ *
+ * @param out_tree A pointer to the tree hash of the file, so its leaf hashes can be saved with tree_hash_save().<br>
+ * This is set to NULL if the file was too small to be tree hashed or on failure. Otherwise it must be freed with tree_hash_free() when no longer in use.<br>
+ * This can be NULL if it is not used.
+ *
+ * @return 0 if the file changed, positive if the file was unchanged from prev_checksums, or negative on failure.
+ */
+int add_checksum_to_file_tree(const char* file, const EVP_MD* algorithm, unsigned threads, FILE* out, const struct checksum_source* prev_checksums, char** out_hash, struct tree_hash** out_tree);
+
+/**
+ * @brief Checks data that arrives a piece at a time against a checksum from a checksum file.<br>
+ * Every kind of checksum add_checksum_to_file(), add_checksum_to_file_src(), and add_checksum_to_file_tree() write is understood, so a file's contents can be checked as they are decrypted and decompressed, without writing them to disk.
+ */
+struct checksum_stream;
+
+/**
+ * @brief Starts checking data against a checksum.
+ *
+ * @param checksum The checksum, as it appears in the checksum file.<br>
+ * Tree hashes are assumed to have TREE_HASH_LEAF_SHIFT sized leaves.
+ *
+ * @param algorithm The digest algorithm the checksum was made with.<br>
+ * If this is NULL, sha1 is used.
+ *
+ * @return A new checksum stream, or NULL on failure (including if the checksum cannot be parsed).<br>
+ * This must be freed with checksum_stream_free() when no longer in use.
+ */
+struct checksum_stream* checksum_stream_new(const char* checksum, const EVP_MD* algorithm) __attribute__((malloc));
+
+/**
+ * @brief Hashes the next piece of data.
+ *
+ * @param cs The checksum stream.
+ *
+ * @param data The data.
+ *
+ * @param len The length of the data.
+ *
+ * @return 0 on success, or negative on failure.<br>
+ * More data than the checksum covers is not a failure, but makes checksum_stream_check() report a mismatch.
+ */
+int checksum_stream_update(struct checksum_stream* cs, const void* data, size_t len);
+
+/**
+ * @brief Checks everything given to checksum_stream_update() against the checksum.<br>
+ * This can only be called once per stream.
+ *
+ * @param cs The checksum stream.
+ *
+ * @return 0 if the data matches the checksum, positive if it does not, or negative on failure.
+ */
+int checksum_stream_check(struct checksum_stream* cs);
+
+/**
+ * @brief Frees a checksum stream.
+ *
+ * @param cs The checksum stream to free.<br>
+ * If this is NULL, this function does nothing.
+ *
+ * @return void
+ */
+void checksum_stream_free(struct checksum_stream* cs);
+
+/**
+ * @brief Hashes many small files at once.<br>
+ * Tiny files spend more time being opened and set up than being hashed, so a batch reads each one with a single read() and hashes them side by side on worker threads.<br>
+ * The digests are identical to the ones checksum() computes.
+ */
+struct checksum_batch;
+
+/**
+ * @brief Creates a checksum_batch.
+ *
+ * @param algorithm The digest algorithm to use.<br>
+ * If this is NULL, sha1 is used.
+ *
+ * @param threads The amount of worker threads to hash on.<br>
+ * 0 hashes on the calling thread.
+ *
+ * @return A new checksum_batch, or NULL on failure.<br>
+ * This must be freed with checksum_batch_free() when no longer in use.
+ */
+struct checksum_batch* checksum_batch_new(const EVP_MD* algorithm, unsigned threads) __attribute__((malloc));
+
+/**
+ * @brief Hashes the files among a list that are smaller than CHECKSUM_BATCH_FILE_SIZE.<br>
+ * This replaces the results of the previous run.
+ *
+ * @param cb The checksum_batch.
+ *
+ * @param files Paths to the files.<br>
+ * These must stay valid until the next run.
+ *
+ * @param n_files The amount of files. This can be at most CHECKSUM_BATCH_LEN.
+ *
+ * @return 0 on success, or negative on failure.<br>
+ * A file that could not be hashed (e.g. because it is too large or unreadable) is not a failure. Check checksum_batch_hashed() for each file.
+ */
+int checksum_batch_run(struct checksum_batch* cb, const char* const* files, size_t n_files);
+
+/**
+ * @brief Checks if a file in the last run was hashed.
+ *
+ * @param cb The checksum_batch.
+ *
+ * @param index The index of the file in the list given to checksum_batch_run().
+ *
+ * @return 1 if it was hashed, 0 if it must be hashed the normal way (e.g. with add_checksum_to_file_src()).
+ */
+int checksum_batch_hashed(const struct checksum_batch* cb, size_t index);
+
+/**
+ * @brief Adds a file hashed by a checksum_batch to a checksum list.<br>
+ * This behaves exactly like add_checksum_to_file(), except the file is not read again.
+ * @see add_checksum_to_file()
+ *
+ * @param cb The checksum_batch.
+ *
+ * @param index The index of the file in the list given to checksum_batch_run().<br>
+ * checksum_batch_hashed() must be true for it.
+ *
+ * @param out The output checksum list.<br>
+ * This FILE* must be opened in writing binary ("wb") mode.
+ *
+ * @param prev_checksums The previous checksum list, or NULL if there is none.
+ *
+ * @param out_hash A pointer to the output hash location, or NULL if not needed.
+ *
+ * @return 0 if the file changed, positive if the file was unchanged from prev_checksums, or negative on failure.
+ */
+int add_checksum_from_batch(const struct checksum_batch* cb, size_t index, FILE* out, const struct checksum_source* prev_checksums, char** out_hash);
+
+/**
+ * @brief Frees a checksum_batch.
+ *
+ * @param cb The checksum_batch to free.<br>
+ * If this is NULL, this function does nothing.
+ *
+ * @return void
+ */
+void checksum_batch_free(struct checksum_batch* cb);
+
 /**
  * @brief Sorts a checksum list in strcmp() order by filename.
  *
@@ -159,6 +408,24 @@ int search_for_checksum(FILE* fp, const char* key, char** checksum);
  */
 int create_removed_list(const char* checksum_file, const char* out_file);
 
+/**
+ * @brief Same as create_removed_list(), but the previous checksums come from a checksum_source.
+ * @see create_removed_list()
+ * @param src The previous checksums.
+ * @param out_file The filename of the resulting output file.
+ * @return 0 on success, negative on failure
+ */
+int create_removed_list_src(const struct checksum_source* src, const char* out_file);
+
+/**
+ * @brief Makes a checksum_source that reads a plain sorted checksum file.
+ * @param fp A sorted checksum list.<br>
+ * This FILE* must be opened in reading binary ("rb") mode, and must stay open while the source is in use.
+ * @param out The checksum_source to fill in.
+ * @return void
+ */
+void checksum_source_file(FILE* fp, struct checksum_source* out);
+
 /* TODO: return an integer since there's multiple reasons for NULL */
 
 /**
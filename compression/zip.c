@@ -10,12 +10,15 @@
 #include "zip.h"
 #include "zip_file.h"
 #include "../log.h"
+#include "../ctxpool.h"
 #include "../filehelper.h"
 #include "../strings/stringhelper.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <limits.h>
 
 #ifndef NO_GZIP_SUPPORT
 #include <zlib.h>
@@ -26,9 +29,14 @@
 #ifndef NO_XZ_SUPPORT
 #include <lzma.h>
 #endif
+#include "zip_parallel.h"
+#include "zip_seekable.h"
 #ifndef NO_LZ4_SUPPORT
 #include "zip_lz4.h"
 #endif
+#ifndef NO_ZSTD_SUPPORT
+#include <zstd.h>
+#endif
 
 #ifndef __GNUC__
 #define __attribute__(x)
@@ -45,7 +53,7 @@ static void zfree(void* q, void* p){
 }
 
 #ifndef NO_GZIP_SUPPORT
-__attribute__((malloc)) static struct ZIP_FILE* gzip_open(const char* file, const char* mode){
+__attribute__((malloc)) static struct ZIP_FILE* gzip_open(FILE* fp, const char* mode){
 	struct ZIP_FILE* ret = NULL;
 	const int gz_windowbits = 15 + 16;
 
@@ -82,12 +90,7 @@ __attribute__((malloc)) static struct ZIP_FILE* gzip_open(const char* file, cons
 			}
 		}
 
-		ret->fp = fopen(file, "wb");
-		if (!ret->fp){
-			log_efopen(file);
-			free(ret);
-			return NULL;
-		}
+		ret->fp = fp;
 
 		if (deflateInit2(&(ret->strm.zstrm), compression_level, Z_DEFLATED, gz_windowbits, strchr(mode, 'l') == NULL ? 9 : 3, strategy) != 0){
 			log_error("Failed to initialize compression operation");
@@ -99,12 +102,7 @@ __attribute__((malloc)) static struct ZIP_FILE* gzip_open(const char* file, cons
 		ret->strm.zstrm.next_in = Z_NULL;
 		ret->strm.zstrm.avail_in = 0;
 
-		ret->fp = fopen(file, "rb");
-		if (!ret->fp){
-			log_efopen(file);
-			free(ret);
-			return NULL;
-		}
+		ret->fp = fp;
 
 		if (inflateInit2(&(ret->strm.zstrm), gz_windowbits) != Z_OK){
 			log_error("Failed to initialize decompression operation");
@@ -116,8 +114,172 @@ __attribute__((malloc)) static struct ZIP_FILE* gzip_open(const char* file, cons
 }
 #endif
 
+#ifndef NO_GZIP_SUPPORT
+/* pigz-style parallel gzip.
+ * each block is deflated on its own with the previous 32KB of input as a preset dictionary, so the compression ratio barely suffers.
+ * the raw deflate streams are byte-aligned with Z_SYNC_FLUSH and joined under a single gzip header, and the per-block crc32's are combined for the trailer */
+#define GZIP_PARALLEL_BLOCK_SIZE (128 * 1024)
+#define GZIP_DICT_SIZE           (32 * 1024)
+
+struct gzip_parallel{
+	int level;
+	int mem_level;
+	int strategy;
+	unsigned long crc;
+	unsigned long len;
+};
+
+static void deflate_raw_free(void* arg){
+	z_stream* strm = arg;
+	deflateEnd(strm);
+	free(strm);
+}
+
+/* gets a raw deflate stream for the calling worker, reusing the one from its previous block if possible */
+static z_stream* deflate_raw_get(const struct gzip_parallel* gp){
+	z_stream* strm;
+
+	strm = ctxpool_take(CTXPOOL_DEFLATE_RAW, gp->strategy, gp->level, gp->mem_level);
+	if (strm){
+		if (deflateReset(strm) == Z_OK){
+			return strm;
+		}
+		deflate_raw_free(strm);
+	}
+
+	strm = calloc(1, sizeof(*strm));
+	if (!strm){
+		log_enomem();
+		return NULL;
+	}
+	strm->zalloc = zalloc;
+	strm->zfree = zfree;
+	strm->opaque = Z_NULL;
+
+	/* negative window bits produce a raw deflate stream with no header or trailer */
+	if (deflateInit2(strm, gp->level, Z_DEFLATED, -15, gp->mem_level, gp->strategy) != Z_OK){
+		log_error("Failed to initialize compression operation");
+		free(strm);
+		return NULL;
+	}
+	return strm;
+}
+
+static int gzip_compress_block(struct zip_block* block, unsigned thread_index, void* ctx){
+	struct gzip_parallel* gp = ctx;
+	z_stream* strm;
+	size_t bound;
+	int res;
+	int ret = 0;
+
+	(void)thread_index;
+
+	strm = deflate_raw_get(gp);
+	if (!strm){
+		return -1;
+	}
+
+	if (block->dict_len > 0 && deflateSetDictionary(strm, block->dict, block->dict_len) != Z_OK){
+		log_error("Failed to set gzip dictionary");
+		ret = -1;
+		goto cleanup;
+	}
+
+	/* room for the sync flush marker as well */
+	bound = deflateBound(strm, block->in_len) + 16;
+	if (block->out_size < bound){
+		unsigned char* tmp = realloc(block->out, bound);
+		if (!tmp){
+			log_enomem();
+			ret = -1;
+			goto cleanup;
+		}
+		block->out = tmp;
+		block->out_size = bound;
+	}
+
+	strm->next_in = (unsigned char*)block->in;
+	strm->avail_in = block->in_len;
+	strm->next_out = block->out;
+	strm->avail_out = block->out_size;
+
+	res = deflate(strm, block->last ? Z_FINISH : Z_SYNC_FLUSH);
+	if (res != (block->last ? Z_STREAM_END : Z_OK) || strm->avail_in != 0){
+		log_error_ex("gzip write error (%d)", res);
+		ret = -1;
+		goto cleanup;
+	}
+
+	block->out_len = block->out_size - strm->avail_out;
+	block->check = crc32(crc32(0, Z_NULL, 0), block->in, block->in_len);
+
+cleanup:
+	ctxpool_give(CTXPOOL_DEFLATE_RAW, gp->strategy, gp->level, gp->mem_level, strm, deflate_raw_free);
+	return ret;
+}
+
+static int gzip_write_block(struct zip_block* block, FILE* fp_out, void* ctx){
+	struct gzip_parallel* gp = ctx;
+
+	gp->crc = crc32_combine(gp->crc, block->check, (z_off_t)block->in_len);
+	gp->len += block->in_len;
+
+	if (fwrite(block->out, 1, block->out_len, fp_out) != block->out_len){
+		log_efwrite("file");
+		return -1;
+	}
+	return 0;
+}
+
+static int gzip_parallel_write(FILE* fp_in, struct ZIP_FILE* zfp){
+	struct gzip_parallel gp;
+	unsigned block_shift = ZIP_GET_BLOCK_SHIFT(zfp->flags);
+	size_t block_size = block_shift > 0 && block_shift < 31 ? (size_t)1 << block_shift : GZIP_PARALLEL_BLOCK_SIZE;
+	/* magic, deflate, no flags, no mtime, extra flags, unix */
+	unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+	unsigned char trailer[8];
+	int i;
+
+	gp.level = zfp->level >= 0 && zfp->level <= 9 ? zfp->level : Z_DEFAULT_COMPRESSION;
+	gp.mem_level = zfp->flags & GZIP_LOWMEM ? 3 : 9;
+	gp.strategy = Z_DEFAULT_STRATEGY;
+	if (zfp->flags & GZIP_HUFFMAN_ONLY){
+		gp.strategy = Z_HUFFMAN_ONLY;
+	}
+	else if (zfp->flags & GZIP_FILTERED){
+		gp.strategy = Z_FILTERED;
+	}
+	else if (zfp->flags & GZIP_RLE){
+		gp.strategy = Z_RLE;
+	}
+	gp.crc = crc32(0, Z_NULL, 0);
+	gp.len = 0;
+
+	header[8] = gp.level == 9 ? 2 : (gp.level == 1 ? 4 : 0);
+	if (fwrite(header, 1, sizeof(header), zfp->fp) != sizeof(header)){
+		log_efwrite("file");
+		return -1;
+	}
+
+	if (zip_parallel_compress(fp_in, zfp->fp, ZIP_GET_THREADS(zfp->flags), block_size, GZIP_DICT_SIZE, gzip_compress_block, gzip_write_block, &gp) != 0){
+		return -1;
+	}
+
+	/* crc32 and length mod 2^32, both little-endian */
+	for (i = 0; i < 4; ++i){
+		trailer[i] = (gp.crc >> (8 * i)) & 0xFF;
+		trailer[i + 4] = (gp.len >> (8 * i)) & 0xFF;
+	}
+	if (fwrite(trailer, 1, sizeof(trailer), zfp->fp) != sizeof(trailer)){
+		log_efwrite("file");
+		return -1;
+	}
+	return 0;
+}
+#endif
+
 #ifndef NO_BZIP2_SUPPORT
-__attribute__((malloc)) static struct ZIP_FILE* bzip2_open(const char* file, const char* mode){
+__attribute__((malloc)) static struct ZIP_FILE* bzip2_open(FILE* fp, const char* mode){
 	struct ZIP_FILE* ret = NULL;
 
 	ret = malloc(sizeof(*ret));
@@ -143,12 +305,7 @@ __attribute__((malloc)) static struct ZIP_FILE* bzip2_open(const char* file, con
 			}
 		}
 
-		ret->fp = fopen(file, "wb");
-		if (!ret->fp){
-			log_efopen(file);
-			free(ret);
-			return NULL;
-		}
+		ret->fp = fp;
 
 		if (BZ2_bzCompressInit(&(ret->strm.bzstrm), compression_level, 0, 30) != 0){
 			log_error("Failed to initialize compression operation");
@@ -160,12 +317,7 @@ __attribute__((malloc)) static struct ZIP_FILE* bzip2_open(const char* file, con
 		ret->strm.bzstrm.next_in = NULL;
 		ret->strm.zstrm.avail_in = 0;
 
-		ret->fp = fopen(file, "rb");
-		if (!ret->fp){
-			log_efopen(file);
-			free(ret);
-			return NULL;
-		}
+		ret->fp = fp;
 
 		if (BZ2_bzDecompressInit(&(ret->strm.bzstrm), 0, 0) != BZ_OK){
 			log_error("Failed to initialize decompression operation");
@@ -177,10 +329,309 @@ __attribute__((malloc)) static struct ZIP_FILE* bzip2_open(const char* file, con
 }
 #endif
 
+#ifndef NO_BZIP2_SUPPORT
+/* pbzip2-style parallel bzip2.
+ * every block of input becomes its own bzip2 stream, and the streams are concatenated, which bzip2 decompresses as one file.
+ * because every stream starts on a byte boundary with a known header, the decompressor can find the streams again and decode them in parallel */
+#define BZIP2_PARALLEL_READ_LEN   (1 << 20)
+/* a stream this long was not written in parallel, so it is decompressed sequentially instead */
+#define BZIP2_PARALLEL_MAX_STREAM (1 << 23)
+#define BZIP2_MAGIC_LEN           (10)
+
+struct bzip2_parallel{
+	int block_size_100k;
+	/* decompression read-ahead */
+	unsigned char* buf;
+	size_t buf_len;
+	size_t buf_size;
+	int eof;
+};
+
+static int bzip2_compress_block(struct zip_block* block, unsigned thread_index, void* ctx){
+	struct bzip2_parallel* bp = ctx;
+	size_t bound = block->in_len + block->in_len / 100 + 600;
+	unsigned out_len;
+	int res;
+
+	(void)thread_index;
+
+	if (block->out_size < bound){
+		unsigned char* tmp = realloc(block->out, bound);
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		block->out = tmp;
+		block->out_size = bound;
+	}
+
+	out_len = block->out_size;
+	res = BZ2_bzBuffToBuffCompress((char*)block->out, &out_len, (char*)block->in, block->in_len, bp->block_size_100k, 0, 30);
+	if (res != BZ_OK){
+		log_error_ex("bzip2 write error (%d)", res);
+		return -1;
+	}
+	block->out_len = out_len;
+	return 0;
+}
+
+static int bzip2_parallel_write(FILE* fp_in, struct ZIP_FILE* zfp){
+	struct bzip2_parallel bp;
+
+	memset(&bp, 0, sizeof(bp));
+	bp.block_size_100k = zfp->level >= 1 && zfp->level <= 9 ? zfp->level : 9;
+
+	return zip_parallel_compress(fp_in, zfp->fp, ZIP_GET_THREADS(zfp->flags), bp.block_size_100k * 100000, 0, bzip2_compress_block, NULL, &bp);
+}
+
+/* "BZh" + block size, followed by the magic of either the first block or the end of an empty stream */
+static int bzip2_is_stream_start(const unsigned char* ptr){
+	const unsigned char block_magic[] = { 0x31, 0x41, 0x59, 0x26, 0x53, 0x59 };
+	const unsigned char end_magic[] = { 0x17, 0x72, 0x45, 0x38, 0x50, 0x90 };
+
+	return ptr[0] == 'B' && ptr[1] == 'Z' && ptr[2] == 'h' && ptr[3] >= '1' && ptr[3] <= '9' &&
+		(memcmp(ptr + 4, block_magic, sizeof(block_magic)) == 0 || memcmp(ptr + 4, end_magic, sizeof(end_magic)) == 0);
+}
+
+static int bzip2_read_stream(struct zip_block* block, FILE* fp_in, void* ctx){
+	struct bzip2_parallel* bp = ctx;
+	size_t search = 1;
+	size_t end = 0;
+
+	if (bp->buf_len == 0 && bp->eof){
+		return 0;
+	}
+
+	/* find the start of the next stream */
+	for (;;){
+		while (search + BZIP2_MAGIC_LEN <= bp->buf_len){
+			if (bzip2_is_stream_start(bp->buf + search)){
+				end = search;
+				break;
+			}
+			search++;
+		}
+		if (end != 0){
+			break;
+		}
+		if (bp->eof){
+			end = bp->buf_len;
+			break;
+		}
+		if (bp->buf_len >= BZIP2_PARALLEL_MAX_STREAM){
+			log_debug("bzip2 stream is too long to be split");
+			return -1;
+		}
+
+		if (bp->buf_size - bp->buf_len < BZIP2_PARALLEL_READ_LEN){
+			unsigned char* tmp = realloc(bp->buf, bp->buf_size + BZIP2_PARALLEL_READ_LEN);
+			if (!tmp){
+				log_enomem();
+				return -1;
+			}
+			bp->buf = tmp;
+			bp->buf_size += BZIP2_PARALLEL_READ_LEN;
+		}
+		bp->buf_len += fread(bp->buf + bp->buf_len, 1, bp->buf_size - bp->buf_len, fp_in);
+		if (ferror(fp_in)){
+			log_efread("bzip2 input");
+			return -1;
+		}
+		if (feof(fp_in)){
+			bp->eof = 1;
+		}
+	}
+
+	if (block->in_size < end){
+		unsigned char* tmp = realloc(block->in_buf, end);
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		block->in_buf = tmp;
+		block->in_size = end;
+	}
+	memcpy(block->in_buf, bp->buf, end);
+	memmove(bp->buf, bp->buf + end, bp->buf_len - end);
+	bp->buf_len -= end;
+
+	block->in = block->in_buf;
+	block->in_len = end;
+	return 1;
+}
+
+static int bzip2_decompress_stream(struct zip_block* block, unsigned thread_index, void* ctx){
+	bz_stream strm;
+	int res;
+	int ret = 0;
+
+	(void)thread_index;
+	(void)ctx;
+
+	memset(&strm, 0, sizeof(strm));
+	if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK){
+		log_error("Failed to initialize decompression operation");
+		return -1;
+	}
+
+	strm.next_in = (char*)block->in;
+	strm.avail_in = block->in_len;
+	block->out_len = 0;
+
+	do{
+		if (block->out_size - block->out_len < BUFFER_LEN){
+			size_t new_size = block->out_size > 0 ? block->out_size * 2 : block->in_len * 4 + BUFFER_LEN;
+			unsigned char* tmp = realloc(block->out, new_size);
+			if (!tmp){
+				log_enomem();
+				ret = -1;
+				goto cleanup;
+			}
+			block->out = tmp;
+			block->out_size = new_size;
+		}
+
+		strm.next_out = (char*)block->out + block->out_len;
+		strm.avail_out = block->out_size - block->out_len;
+		res = BZ2_bzDecompress(&strm);
+		block->out_len = block->out_size - strm.avail_out;
+
+		if (res != BZ_OK && res != BZ_STREAM_END){
+			log_debug("bzip2 stream is not valid on its own");
+			ret = -1;
+			goto cleanup;
+		}
+		/* ran out of input before the stream ended, so this is not a whole stream */
+		if (res == BZ_OK && strm.avail_in == 0 && strm.avail_out != 0){
+			ret = -1;
+			goto cleanup;
+		}
+	}while (res != BZ_STREAM_END);
+
+	/* the split was a false positive within a stream */
+	if (strm.avail_in != 0){
+		ret = -1;
+	}
+
+cleanup:
+	BZ2_bzDecompressEnd(&strm);
+	return ret;
+}
+
+static int bzip2_parallel_read(struct ZIP_FILE* zfp, FILE* fp_out){
+	struct bzip2_parallel bp;
+	int ret;
+
+	memset(&bp, 0, sizeof(bp));
+	ret = zip_parallel_decompress(zfp->fp, fp_out, ZIP_GET_THREADS(zfp->flags), bzip2_read_stream, bzip2_decompress_stream, NULL, &bp);
+	free(bp.buf);
+	return ret;
+}
+
+/* starts decompressing the next of several concatenated streams.
+ * returns positive if there is another stream, 0 if not, or negative on failure */
+static int bzip2_next_stream(struct ZIP_FILE* zfp){
+	char* next_in = zfp->strm.bzstrm.next_in;
+	unsigned avail_in = zfp->strm.bzstrm.avail_in;
+
+	if (avail_in == 0){
+		int c = fgetc(zfp->fp);
+		if (c == EOF){
+			return 0;
+		}
+		ungetc(c, zfp->fp);
+	}
+
+	BZ2_bzDecompressEnd(&(zfp->strm.bzstrm));
+	memset(&(zfp->strm.bzstrm), 0, sizeof(zfp->strm.bzstrm));
+	if (BZ2_bzDecompressInit(&(zfp->strm.bzstrm), 0, 0) != BZ_OK){
+		log_error("Failed to initialize decompression operation");
+		return -1;
+	}
+	zfp->strm.bzstrm.next_in = next_in;
+	zfp->strm.bzstrm.avail_in = avail_in;
+	return 1;
+}
+#endif
+
 #ifndef NO_XZ_SUPPORT
-__attribute__((malloc)) static struct ZIP_FILE* xz_open(const char* file, const char* mode){
+/* the first liblzma version with a stable multithreaded decoder */
+#define XZ_MT_DECODER_VERSION (50040002)
+
+/* (re)initializes an xz stream.
+ * liblzma reuses the memory of a stream that already holds a coder of the same kind */
+static int xz_init(lzma_stream* strm, int write, uint32_t preset, unsigned threads, unsigned block_shift){
+	lzma_ret res;
+
+	if (write){
+		if (threads > 0){
+			/* the multithreaded encoder splits the input into independently compressed blocks.
+			 * the output is still a single standard .xz stream */
+			lzma_mt mt;
+
+			memset(&mt, 0, sizeof(mt));
+			mt.threads = threads;
+			mt.block_size = block_shift > 0 && block_shift < 63 ? (uint64_t)1 << block_shift : 0;
+			mt.timeout = 0;
+			mt.preset = preset;
+			mt.check = LZMA_CHECK_CRC64;
+
+			res = lzma_stream_encoder_mt(strm, &mt);
+		}
+		else{
+			res = lzma_easy_encoder(strm, preset, LZMA_CHECK_CRC64);
+		}
+
+		if (res != LZMA_OK){
+			log_error_ex("Error initializing LZMA compression operation (%d)", res);
+			return -1;
+		}
+		return 0;
+	}
+
+#if LZMA_VERSION >= XZ_MT_DECODER_VERSION
+	if (threads > 0){
+		/* only blocks whose sizes are stored in their headers can be decoded in parallel.
+		 * anything else (e.g. files from a single-threaded encoder) is decoded on one thread */
+		lzma_mt mt;
+
+		memset(&mt, 0, sizeof(mt));
+		mt.threads = threads;
+		mt.timeout = 0;
+		mt.memlimit_threading = lzma_physmem() / 4;
+		mt.memlimit_stop = UINT64_MAX;
+
+		res = lzma_stream_decoder_mt(strm, &mt);
+	}
+	else{
+		res = lzma_stream_decoder(strm, UINT64_MAX, 0);
+	}
+#else
+	(void)threads;
+	res = lzma_stream_decoder(strm, UINT64_MAX, 0);
+#endif
+	(void)block_shift;
+
+	if (res != LZMA_OK){
+		log_error_ex("Failed to initialize decompression operation (%d)", res);
+		return -1;
+	}
+	return 0;
+}
+
+/* converts a compression level and flags to an lzma preset, using the same defaults as xz_open() */
+static uint32_t xz_preset(int compression_level, unsigned flags){
+	uint32_t preset = compression_level >= 1 && compression_level <= 9 ? (uint32_t)compression_level : 3;
+	if (flags & XZ_EXTREME){
+		preset |= LZMA_PRESET_EXTREME;
+	}
+	return preset;
+}
+
+__attribute__((malloc)) static struct ZIP_FILE* xz_open(FILE* fp, const char* mode, unsigned threads, unsigned block_shift){
 	struct ZIP_FILE* ret = NULL;
 	lzma_stream xstrm = LZMA_STREAM_INIT;
+	uint32_t compression_level = 3;
 
 	ret = malloc(sizeof(*ret));
 	if (!ret){
@@ -193,7 +644,6 @@ __attribute__((malloc)) static struct ZIP_FILE* xz_open(const char* file, const
 	ret->write = strchr(mode, 'w') != NULL;
 
 	if (ret->write){
-		uint32_t compression_level = 3;
 		int i;
 
 		for (i = 0; i <= 9; ++i){
@@ -206,29 +656,85 @@ __attribute__((malloc)) static struct ZIP_FILE* xz_open(const char* file, const
 		if (strchr(mode, 'e') != NULL){
 			compression_level |= LZMA_PRESET_EXTREME;
 		}
+	}
 
-		ret->fp = fopen(file, "wb");
-		if (!ret->fp){
-			log_efopen(file);
-			free(ret);
-			return NULL;
-		}
+	ret->fp = fp;
+
+	if (xz_init(&(ret->strm.xzstrm), ret->write, compression_level, threads, block_shift) != 0){
+		free(ret);
+		return NULL;
+	}
+	return ret;
+}
+#endif
+
+#ifndef NO_ZSTD_SUPPORT
+/* 128MB window for long-distance matching.
+ * this is the largest window the decoder accepts without extra parameters, so the output stays readable by the zstd command line tool */
+#define ZSTD_LONG_WINDOWLOG (27)
+
+/* creates a compression context with the given level and flags */
+static ZSTD_CCtx* zstd_cctx_new(int compression_level, unsigned flags){
+	ZSTD_CCtx* cctx;
+	unsigned threads = ZIP_GET_THREADS(flags);
+	size_t res;
+
+	if (compression_level <= 0){
+		compression_level = ZSTD_CLEVEL_DEFAULT;
+	}
+	if (compression_level > ZSTD_maxCLevel()){
+		compression_level = ZSTD_maxCLevel();
+	}
+
+	cctx = ZSTD_createCCtx();
+	if (!cctx){
+		log_error("Failed to initialize compression operation");
+		return NULL;
+	}
+
+	res = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, compression_level);
+	if (ZSTD_isError(res)){
+		log_error_ex("Failed to set zstd compression level (%s)", ZSTD_getErrorName(res));
+		ZSTD_freeCCtx(cctx);
+		return NULL;
+	}
+
+	if (flags & ZSTD_LONG){
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, 1);
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, ZSTD_LONG_WINDOWLOG);
+	}
+
+	/* libzstd can be built without multithreading support, in which case the file is compressed on this thread */
+	if (threads > 0 && ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, threads))){
+		log_warning("This zstd library does not support multithreading. Compressing on a single thread.");
+	}
+	return cctx;
+}
+
+__attribute__((malloc)) static struct ZIP_FILE* zstd_open(FILE* fp, int write, int compression_level, unsigned flags){
+	struct ZIP_FILE* ret = NULL;
+
+	ret = malloc(sizeof(*ret));
+	if (!ret){
+		log_enomem();
+		return NULL;
+	}
+
+	ret->c_type = COMPRESSOR_ZSTD;
+	ret->write = write;
+
+	ret->fp = fp;
 
-		if (lzma_easy_encoder(&(ret->strm.xzstrm), compression_level, LZMA_CHECK_CRC64) != LZMA_OK){
-			log_error("Error initializing LZMA compression operation");
+	if (write){
+		ret->strm.zstd_cctx = zstd_cctx_new(compression_level, flags);
+		if (!ret->strm.zstd_cctx){
 			free(ret);
 			return NULL;
 		}
 	}
 	else{
-		ret->fp = fopen(file, "rb");
-		if (!ret->fp){
-			log_efopen(file);
-			free(ret);
-			return NULL;
-		}
-
-		if (lzma_stream_decoder(&(ret->strm.xzstrm), UINT64_MAX, 0) != LZMA_OK){
+		ret->strm.zstd_dctx = ZSTD_createDCtx();
+		if (!ret->strm.zstd_dctx){
 			log_error("Failed to initialize decompression operation");
 			free(ret);
 			return NULL;
@@ -238,7 +744,91 @@ __attribute__((malloc)) static struct ZIP_FILE* xz_open(const char* file, const
 }
 #endif
 
-__attribute__((malloc)) static struct ZIP_FILE* zip_open(const char* file, int write, enum compressor c_type, int compression_level, unsigned flags){
+/* ends a ZIP_FILE's stream and frees it without touching its file */
+static void zip_free(void* arg){
+	struct ZIP_FILE* zfp = arg;
+
+	if (zfp->write){
+		switch (zfp->c_type){
+#ifndef NO_GZIP_SUPPORT
+		case COMPRESSOR_GZIP:
+			deflateEnd(&(zfp->strm.zstrm));
+			break;
+#endif
+#ifndef NO_BZIP2_SUPPORT
+		case COMPRESSOR_BZIP2:
+			BZ2_bzCompressEnd(&(zfp->strm.bzstrm));
+			break;
+#endif
+#ifndef NO_XZ_SUPPORT
+		case COMPRESSOR_XZ:
+			lzma_end(&(zfp->strm.xzstrm));
+			break;
+#endif
+#ifndef NO_ZSTD_SUPPORT
+		case COMPRESSOR_ZSTD:
+			ZSTD_freeCCtx(zfp->strm.zstd_cctx);
+			break;
+#endif
+		default:
+			log_fatal("not supported");
+		}
+	}
+	else{
+		switch (zfp->c_type){
+#ifndef NO_GZIP_SUPPORT
+		case COMPRESSOR_GZIP:
+			inflateEnd(&(zfp->strm.zstrm));
+			break;
+#endif
+#ifndef NO_BZIP2_SUPPORT
+		case COMPRESSOR_BZIP2:
+			BZ2_bzDecompressEnd(&(zfp->strm.bzstrm));
+			break;
+#endif
+#ifndef NO_XZ_SUPPORT
+		case COMPRESSOR_XZ:
+			lzma_end(&(zfp->strm.xzstrm));
+			break;
+#endif
+#ifndef NO_ZSTD_SUPPORT
+		case COMPRESSOR_ZSTD:
+			ZSTD_freeDCtx(zfp->strm.zstd_dctx);
+			break;
+#endif
+		default:
+			log_fatal("not supported");
+		}
+	}
+
+	free(zfp);
+}
+
+/* returns a pooled ZIP_FILE's stream to the state it was in right after zip_open() */
+static int zip_reset(struct ZIP_FILE* zfp){
+	switch (zfp->c_type){
+#ifndef NO_GZIP_SUPPORT
+	case COMPRESSOR_GZIP:
+		zfp->strm.zstrm.next_in = Z_NULL;
+		zfp->strm.zstrm.avail_in = 0;
+		return (zfp->write ? deflateReset(&(zfp->strm.zstrm)) : inflateReset(&(zfp->strm.zstrm))) == Z_OK ? 0 : -1;
+#endif
+#ifndef NO_XZ_SUPPORT
+	case COMPRESSOR_XZ:
+		return xz_init(&(zfp->strm.xzstrm), zfp->write, xz_preset(zfp->level, zfp->flags), ZIP_GET_THREADS(zfp->flags), ZIP_GET_BLOCK_SHIFT(zfp->flags));
+#endif
+#ifndef NO_ZSTD_SUPPORT
+	case COMPRESSOR_ZSTD:
+		/* a session-only reset keeps the parameters given to zstd_open() */
+		return ZSTD_isError(zfp->write ? ZSTD_CCtx_reset(zfp->strm.zstd_cctx, ZSTD_reset_session_only) : ZSTD_DCtx_reset(zfp->strm.zstd_dctx, ZSTD_reset_session_only)) ? -1 : 0;
+#endif
+	default:
+		return -1;
+	}
+}
+
+__attribute__((malloc)) static struct ZIP_FILE* zip_open(FILE* fp, int write, enum compressor c_type, int compression_level, unsigned flags){
+	struct ZIP_FILE* ret = NULL;
 	char truemode[16];
 	int modeptr = 2;
 
@@ -246,6 +836,30 @@ __attribute__((malloc)) static struct ZIP_FILE* zip_open(const char* file, int w
 		return NULL;
 	}
 
+	/* reuse a stream this thread has already set up with the same settings instead of allocating a new one */
+	ret = ctxpool_take(write ? CTXPOOL_ZIP_COMPRESS : CTXPOOL_ZIP_DECOMPRESS, c_type, compression_level, flags);
+	if (ret){
+		if (zip_reset(ret) != 0){
+			zip_free(ret);
+		}
+		else{
+			ret->fp = fp;
+			return ret;
+		}
+	}
+
+#ifndef NO_ZSTD_SUPPORT
+	/* zstd levels go past 9, so they cannot be passed through a mode string */
+	if (c_type == COMPRESSOR_ZSTD){
+		ret = zstd_open(fp, write, compression_level, flags);
+		if (ret){
+			ret->level = compression_level;
+			ret->flags = flags;
+		}
+		return ret;
+	}
+#endif
+
 	truemode[0] = write ? 'w' : 'r';
 	truemode[1] = 'b';
 	if (compression_level >= 1 && compression_level <= 9){
@@ -291,76 +905,92 @@ __attribute__((malloc)) static struct ZIP_FILE* zip_open(const char* file, int w
 	switch (c_type){
 #ifndef NO_GZIP_SUPPORT
 	case COMPRESSOR_GZIP:
-		return gzip_open(file, truemode);
+		ret = gzip_open(fp, truemode);
+		break;
 #endif
 #ifndef NO_BZIP2_SUPPORT
 	case COMPRESSOR_BZIP2:
-		return bzip2_open(file, truemode);
+		ret = bzip2_open(fp, truemode);
+		break;
 #endif
 #ifndef NO_XZ_SUPPORT
 	case COMPRESSOR_XZ:
-		return xz_open(file, truemode);
+		ret = xz_open(fp, truemode, ZIP_GET_THREADS(flags), ZIP_GET_BLOCK_SHIFT(flags));
+		break;
 #endif
 	default:
 		log_error("not supported");
 		return NULL;
 	}
+
+	if (ret){
+		ret->level = compression_level;
+		ret->flags = flags;
+	}
+	return ret;
 }
 
+/* the caller closes the ZIP_FILE's file, since it was the one that opened it */
 static int zip_close(struct ZIP_FILE* zfp){
 	if (!zfp){
 		return -1;
 	}
 
-	if (zfp->write){
-		switch (zfp->c_type){
-#ifndef NO_GZIP_SUPPORT
-		case COMPRESSOR_GZIP:
-			deflateEnd(&(zfp->strm.zstrm));
-			break;
-#endif
-#ifndef NO_BZIP2_SUPPORT
-		case COMPRESSOR_BZIP2:
-			BZ2_bzCompressEnd(&(zfp->strm.bzstrm));
-			break;
-#endif
-#ifndef NO_XZ_SUPPORT
-		case COMPRESSOR_XZ:
-			lzma_end(&(zfp->strm.xzstrm));
-			break;
-#endif
-		default:
-			log_fatal("not supported");
-		}
+	zfp->fp = NULL;
+
+	/* bzip2 streams cannot be reset, so they are not worth keeping around */
+	if (zfp->c_type == COMPRESSOR_BZIP2){
+		zip_free(zfp);
+		return 0;
 	}
-	else{
-		switch (zfp->c_type){
-#ifndef NO_GZIP_SUPPORT
-		case COMPRESSOR_GZIP:
-			inflateEnd(&(zfp->strm.zstrm));
-			break;
-#endif
-#ifndef NO_BZIP2_SUPPORT
-		case COMPRESSOR_BZIP2:
-			BZ2_bzDecompressEnd(&(zfp->strm.bzstrm));
-			break;
-#endif
-#ifndef NO_XZ_SUPPORT
-		case COMPRESSOR_XZ:
-			lzma_end(&(zfp->strm.xzstrm));
-			break;
-#endif
-		default:
-			log_fatal("not supported");
+	ctxpool_give(zfp->write ? CTXPOOL_ZIP_COMPRESS : CTXPOOL_ZIP_DECOMPRESS, zfp->c_type, zfp->level, zfp->flags, zfp, zip_free);
+	return 0;
+}
+
+#ifndef NO_ZSTD_SUPPORT
+static int zstd_compress_write(FILE* fp_in, struct ZIP_FILE* zfp){
+	unsigned char inbuf[BUFFER_LEN];
+	unsigned char outbuf[BUFFER_LEN];
+	ZSTD_EndDirective mode;
+	int len;
+
+	do{
+		ZSTD_inBuffer input;
+		size_t remaining;
+
+		len = read_file(fp_in, inbuf, sizeof(inbuf));
+		if (len < 0){
+			return -1;
 		}
-	}
+		mode = (len == 0 || feof(fp_in)) ? ZSTD_e_end : ZSTD_e_continue;
 
-	if (fclose(zfp->fp) != 0){
-		log_efclose("file");
-	}
-	free(zfp);
+		input.src = inbuf;
+		input.size = len;
+		input.pos = 0;
+
+		/* with worker threads, zstd may hold on to input without producing output, so keep going until it is all consumed or the frame is finished */
+		do{
+			ZSTD_outBuffer output;
+
+			output.dst = outbuf;
+			output.size = sizeof(outbuf);
+			output.pos = 0;
+
+			remaining = ZSTD_compressStream2(zfp->strm.zstd_cctx, &output, &input, mode);
+			if (ZSTD_isError(remaining)){
+				log_error_ex("zstd write error (%s)", ZSTD_getErrorName(remaining));
+				return -1;
+			}
+
+			if (fwrite(outbuf, 1, output.pos, zfp->fp) != output.pos){
+				log_efwrite("file");
+				return -1;
+			}
+		}while (mode == ZSTD_e_end ? remaining != 0 : input.pos != input.size);
+	}while (mode != ZSTD_e_end);
 	return 0;
 }
+#endif
 
 static int zip_compress_write(FILE* fp_in, struct ZIP_FILE* zfp){
 	unsigned char inbuf[BUFFER_LEN];
@@ -368,35 +998,41 @@ static int zip_compress_write(FILE* fp_in, struct ZIP_FILE* zfp){
 	int avail_in = 0;
 	int avail_out = 0;
 	int action;
+	int action_finish;
 	int res = 0;
+	int res_stream_end;
 
 	switch (zfp->c_type){
 #ifndef NO_GZIP_SUPPORT
 	case COMPRESSOR_GZIP:
-		zfp->strm.zstrm.next_in = NULL;
-		zfp->strm.zstrm.avail_in = 0;
-		zfp->strm.zstrm.next_out = outbuf;
-		zfp->strm.zstrm.avail_out = sizeof(outbuf);
+		if (ZIP_GET_THREADS(zfp->flags) > 0){
+			return gzip_parallel_write(fp_in, zfp);
+		}
 		action = Z_NO_FLUSH;
+		action_finish = Z_FINISH;
+		res_stream_end = Z_STREAM_END;
 		break;
 #endif
 #ifndef NO_BZIP2_SUPPORT
 	case COMPRESSOR_BZIP2:
-		zfp->strm.bzstrm.next_in = NULL;
-		zfp->strm.bzstrm.avail_in = 0;
-		zfp->strm.bzstrm.next_out = (char*)outbuf;
-		zfp->strm.bzstrm.avail_out = sizeof(outbuf);
+		if (ZIP_GET_THREADS(zfp->flags) > 0){
+			return bzip2_parallel_write(fp_in, zfp);
+		}
 		action = BZ_RUN;
+		action_finish = BZ_FINISH;
+		res_stream_end = BZ_STREAM_END;
 		break;
 #endif
 #ifndef NO_XZ_SUPPORT
 	case COMPRESSOR_XZ:
-		zfp->strm.xzstrm.next_in = NULL;
-		zfp->strm.xzstrm.avail_in = 0;
-		zfp->strm.xzstrm.next_out = outbuf;
-		zfp->strm.xzstrm.avail_out = sizeof(outbuf);
 		action = LZMA_RUN;
+		action_finish = LZMA_FINISH;
+		res_stream_end = LZMA_STREAM_END;
 		break;
+#endif
+#ifndef NO_ZSTD_SUPPORT
+	case COMPRESSOR_ZSTD:
+		return zstd_compress_write(fp_in, zfp);
 #endif
 	default:
 		log_error("unsupported");
@@ -404,32 +1040,12 @@ static int zip_compress_write(FILE* fp_in, struct ZIP_FILE* zfp){
 	}
 
 	do{
-		size_t write_len;
-
 		avail_in = read_file(fp_in, inbuf, sizeof(inbuf));
+		if (avail_in < 0){
+			return -1;
+		}
 		if (avail_in == 0 || feof(fp_in)){
-			switch (zfp->c_type){
-#ifndef NO_GZIP_SUPPORT
-			case COMPRESSOR_GZIP:
-				action = Z_FINISH;
-				break;
-#endif
-#ifndef NO_BZIP2_SUPPORT
-			case COMPRESSOR_BZIP2:
-				if (res == BZ_STREAM_END){
-					return 0;
-				}
-				action = BZ_FINISH;
-				break;
-#endif
-#ifndef NO_XZ_SUPPORT
-			case COMPRESSOR_XZ:
-				action = LZMA_FINISH;
-				break;
-#endif
-			default:
-				;
-			}
+			action = action_finish;
 		}
 
 		switch (zfp->c_type){
@@ -437,42 +1053,18 @@ static int zip_compress_write(FILE* fp_in, struct ZIP_FILE* zfp){
 		case COMPRESSOR_GZIP:
 			zfp->strm.zstrm.next_in = inbuf;
 			zfp->strm.zstrm.avail_in = avail_in;
-			zfp->strm.zstrm.next_out = outbuf;
-			zfp->strm.zstrm.avail_out = sizeof(outbuf);
-			res = deflate(&(zfp->strm.zstrm), action);
-			if (res != Z_OK && res != Z_STREAM_END){
-				log_error_ex("gzip write error (%d)", res);
-				return -1;
-			}
-			avail_out = zfp->strm.zstrm.avail_out;
 			break;
 #endif
 #ifndef NO_BZIP2_SUPPORT
 		case COMPRESSOR_BZIP2:
 			zfp->strm.bzstrm.next_in = (char*)inbuf;
 			zfp->strm.bzstrm.avail_in = avail_in;
-			zfp->strm.bzstrm.next_out = (char*)outbuf;
-			zfp->strm.bzstrm.avail_out = sizeof(outbuf);
-			res = BZ2_bzCompress(&(zfp->strm.bzstrm), action);
-			if (res != BZ_OK && res != BZ_RUN_OK && res != BZ_FLUSH_OK && res != BZ_FINISH_OK && res != BZ_STREAM_END){
-				log_error_ex("bzip2 write error (%d)", res);
-				return -1;
-			}
-			avail_out = zfp->strm.bzstrm.avail_out;
 			break;
 #endif
 #ifndef NO_XZ_SUPPORT
 		case COMPRESSOR_XZ:
 			zfp->strm.xzstrm.next_in = inbuf;
 			zfp->strm.xzstrm.avail_in = avail_in;
-			zfp->strm.xzstrm.next_out = outbuf;
-			zfp->strm.xzstrm.avail_out = sizeof(outbuf);
-			res = lzma_code(&(zfp->strm.xzstrm), action);
-			if (res != LZMA_OK && res != LZMA_STREAM_END){
-				log_error_ex("xz write error (%d)", res);
-				return -1;
-			}
-			avail_out = zfp->strm.xzstrm.avail_out;
 			break;
 #endif
 		default:
@@ -480,40 +1072,158 @@ static int zip_compress_write(FILE* fp_in, struct ZIP_FILE* zfp){
 			return -1;
 		}
 
-		write_len = sizeof(outbuf) - avail_out;
-		if (fwrite(outbuf, 1, write_len, zfp->fp) != write_len){
+		/* the output of one call can be larger than outbuf (e.g. a multithreaded xz encoder returns whole blocks at once),
+		 * so keep going until all of the input is consumed, and when finishing, until the stream is complete */
+		do{
+			size_t write_len;
+
+			switch (zfp->c_type){
+#ifndef NO_GZIP_SUPPORT
+			case COMPRESSOR_GZIP:
+				zfp->strm.zstrm.next_out = outbuf;
+				zfp->strm.zstrm.avail_out = sizeof(outbuf);
+				res = deflate(&(zfp->strm.zstrm), action);
+				if (res != Z_OK && res != Z_STREAM_END){
+					log_error_ex("gzip write error (%d)", res);
+					return -1;
+				}
+				avail_in = zfp->strm.zstrm.avail_in;
+				avail_out = zfp->strm.zstrm.avail_out;
+				break;
+#endif
+#ifndef NO_BZIP2_SUPPORT
+			case COMPRESSOR_BZIP2:
+				zfp->strm.bzstrm.next_out = (char*)outbuf;
+				zfp->strm.bzstrm.avail_out = sizeof(outbuf);
+				res = BZ2_bzCompress(&(zfp->strm.bzstrm), action);
+				if (res != BZ_OK && res != BZ_RUN_OK && res != BZ_FLUSH_OK && res != BZ_FINISH_OK && res != BZ_STREAM_END){
+					log_error_ex("bzip2 write error (%d)", res);
+					return -1;
+				}
+				avail_in = zfp->strm.bzstrm.avail_in;
+				avail_out = zfp->strm.bzstrm.avail_out;
+				break;
+#endif
+#ifndef NO_XZ_SUPPORT
+			case COMPRESSOR_XZ:
+				zfp->strm.xzstrm.next_out = outbuf;
+				zfp->strm.xzstrm.avail_out = sizeof(outbuf);
+				res = lzma_code(&(zfp->strm.xzstrm), action);
+				if (res != LZMA_OK && res != LZMA_STREAM_END){
+					log_error_ex("xz write error (%d)", res);
+					return -1;
+				}
+				avail_in = zfp->strm.xzstrm.avail_in;
+				avail_out = zfp->strm.xzstrm.avail_out;
+				break;
+#endif
+			default:
+				log_fatal("unsupported");
+				return -1;
+			}
+
+			write_len = sizeof(outbuf) - avail_out;
+			if (fwrite(outbuf, 1, write_len, zfp->fp) != write_len){
+				log_efwrite("file");
+				return -1;
+			}
+		}while (avail_in != 0 || (action == action_finish && res != res_stream_end));
+	}while (action != action_finish);
+	return 0;
+}
+
+static int copy_tail(FILE* fp_in, FILE* fp_out){
+	unsigned char buffer[BUFFER_LEN];
+	int len;
+
+	while ((len = read_file(fp_in, buffer, sizeof(buffer))) > 0){
+		if (fwrite(buffer, 1, len, fp_out) != (size_t)len){
 			log_efwrite("file");
 			return -1;
 		}
-	}while (avail_in != 0);
-	return 0;
+	}
+	return len < 0 ? -1 : 0;
 }
 
 int zip_compress(const char* infile, const char* outfile, enum compressor c_type, int compression_level, unsigned flags){
+	return zip_compress_tail(infile, outfile, 0, c_type, compression_level, flags);
+}
+
+int zip_compress_tail(const char* infile, const char* outfile, unsigned long offset, enum compressor c_type, int compression_level, unsigned flags){
+	FILE* fp_out = NULL;
+	int ret = 0;
+
+	return_ifnull(outfile, -1);
+
+	if (c_type == COMPRESSOR_NONE && offset == 0 && !(flags & ZIP_SEEKABLE)){
+		return copy_file(infile, outfile);
+	}
+
+	fp_out = fopen(outfile, "wb");
+	if (!fp_out){
+		log_efopen(outfile);
+		return -1;
+	}
+
+	ret = zip_compress_fp(infile, fp_out, offset, c_type, compression_level, flags);
+
+	if (fclose(fp_out) != 0){
+		log_efclose(outfile);
+		ret = -1;
+	}
+	if (ret != 0){
+		remove(outfile);
+	}
+	return ret;
+}
+
+int zip_compress_fp(const char* infile, FILE* fp_out, unsigned long offset, enum compressor c_type, int compression_level, unsigned flags){
 	struct ZIP_FILE* zfp = NULL;
 	FILE* fp_in = NULL;
 	int ret = 0;
 
+	return_ifnull(infile, -1);
+	return_ifnull(fp_out, -1);
+
+	fp_in = fopen(infile, "rb");
+	if (!fp_in){
+		log_efopen(infile);
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (offset > 0 && fseek(fp_in, (long)offset, SEEK_SET) != 0){
+		log_error_ex2("Failed to seek to %lu in %s", offset, infile);
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (flags & ZIP_SEEKABLE){
+		if (seekable_compress(fp_in, fp_out, c_type, compression_level, flags) != 0){
+			log_error_ex("Failed to compress %s", infile);
+			ret = -1;
+		}
+		goto cleanup;
+	}
+
 	if (c_type == COMPRESSOR_LZ4){
-		return lz4_compress(infile, outfile, compression_level, flags);
+		if (lz4_compress(fp_in, fp_out, compression_level, flags) != 0){
+			log_error_ex("Failed to compress %s", infile);
+			ret = -1;
+		}
+		goto cleanup;
 	}
 
 	if (c_type == COMPRESSOR_NONE){
-		return copy_file(infile, outfile);
+		ret = copy_tail(fp_in, fp_out);
+		goto cleanup;
 	}
 
 	if (compression_level == 0){
 		compression_level = -1;
 	}
 
-	fp_in = fopen(infile, "rb");
-	if (!fp_in){
-		log_efopen(infile);
-		ret = -1;
-		goto cleanup;
-	}
-
-	zfp = zip_open(outfile, 1, c_type, compression_level, flags);
+	zfp = zip_open(fp_out, 1, c_type, compression_level, flags);
 	if (!zfp){
 		log_error("Failed to open ZIP_FILE for writing");
 		ret = -1;
@@ -527,14 +1237,57 @@ int zip_compress(const char* infile, const char* outfile, enum compressor c_type
 	}
 
 cleanup:
-	if (ret != 0){
-		remove(outfile);
-	}
 	zfp ? zip_close(zfp) : 0;
 	fp_in ? fclose(fp_in) : 0;
 	return ret;
 }
 
+#ifndef NO_ZSTD_SUPPORT
+static int zstd_decompress_read(struct ZIP_FILE* zfp, FILE* fp_out){
+	unsigned char inbuf[BUFFER_LEN];
+	unsigned char outbuf[BUFFER_LEN];
+	size_t res = 0;
+	int len;
+
+	while ((len = read_file(zfp->fp, inbuf, sizeof(inbuf))) > 0){
+		ZSTD_inBuffer input;
+		ZSTD_outBuffer output;
+
+		input.src = inbuf;
+		input.size = len;
+		input.pos = 0;
+
+		/* a full output buffer means zstd may still have data to flush even if all of the input was consumed, unless the frame just ended */
+		do{
+			output.dst = outbuf;
+			output.size = sizeof(outbuf);
+			output.pos = 0;
+
+			res = ZSTD_decompressStream(zfp->strm.zstd_dctx, &output, &input);
+			if (ZSTD_isError(res)){
+				log_error_ex("zstd read error (%s)", ZSTD_getErrorName(res));
+				return -1;
+			}
+
+			if (fwrite(outbuf, 1, output.pos, fp_out) != output.pos){
+				log_efwrite("file");
+				return -1;
+			}
+		}while (input.pos != input.size || (output.pos == output.size && res != 0));
+	}
+	if (len < 0){
+		return -1;
+	}
+
+	/* zstd returns 0 once a frame is completely decoded */
+	if (res != 0){
+		log_error("zstd read error (file is truncated)");
+		return -1;
+	}
+	return 0;
+}
+#endif
+
 static int zip_decompress_read(struct ZIP_FILE* zfp, FILE* fp_out){
 	unsigned char inbuf[BUFFER_LEN];
 	unsigned char outbuf[BUFFER_LEN];
@@ -558,6 +1311,17 @@ static int zip_decompress_read(struct ZIP_FILE* zfp, FILE* fp_out){
 #endif
 #ifndef NO_BZIP2_SUPPORT
 	case COMPRESSOR_BZIP2:
+		if (ZIP_GET_THREADS(zfp->flags) > 0){
+			if (bzip2_parallel_read(zfp, fp_out) == 0){
+				return 0;
+			}
+			/* not split into streams by a parallel compressor (or a false positive split), so start over sequentially */
+			log_debug("Falling back to sequential bzip2 decompression");
+			if (fseek(zfp->fp, 0, SEEK_SET) != 0 || fflush(fp_out) != 0 || ftruncate(fileno(fp_out), 0) != 0 || fseek(fp_out, 0, SEEK_SET) != 0){
+				log_error("Failed to restart bzip2 decompression");
+				return -1;
+			}
+		}
 		res_stream_end = BZ_STREAM_END;
 		zfp->strm.bzstrm.next_in = NULL;
 		zfp->strm.bzstrm.avail_in = 0;
@@ -575,6 +1339,10 @@ static int zip_decompress_read(struct ZIP_FILE* zfp, FILE* fp_out){
 		zfp->strm.xzstrm.avail_out = sizeof(outbuf);
 		action = LZMA_RUN;
 		break;
+#endif
+#ifndef NO_ZSTD_SUPPORT
+	case COMPRESSOR_ZSTD:
+		return zstd_decompress_read(zfp, fp_out);
 #endif
 	default:
 		log_error("unsupported");
@@ -654,8 +1422,18 @@ static int zip_decompress_read(struct ZIP_FILE* zfp, FILE* fp_out){
 				log_error_ex("bzip2 read error (%d)", res);
 				return -1;
 			}
-			avail_in = zfp->strm.xzstrm.avail_in;
 			avail_out = zfp->strm.bzstrm.avail_out;
+			/* concatenated streams (e.g. from a parallel compressor) are decompressed one after another */
+			if (res == BZ_STREAM_END){
+				int next = bzip2_next_stream(zfp);
+				if (next < 0){
+					return -1;
+				}
+				if (next > 0){
+					res = BZ_OK;
+				}
+			}
+			avail_in = zfp->strm.bzstrm.avail_in;
 			break;
 #endif
 #ifndef NO_XZ_SUPPORT
@@ -687,9 +1465,15 @@ static int zip_decompress_read(struct ZIP_FILE* zfp, FILE* fp_out){
 
 int zip_decompress(const char* infile, const char* outfile, enum compressor c_type, unsigned flags){
 	struct ZIP_FILE* zfp = NULL;
+	FILE* fp_in = NULL;
 	FILE* fp_out = NULL;
 	int ret = 0;
 
+	/* the container records its own compressor */
+	if (flags & ZIP_SEEKABLE){
+		return seekable_decompress(infile, outfile, flags);
+	}
+
 	if (c_type == COMPRESSOR_LZ4){
 		return lz4_decompress(infile, outfile, flags);
 	}
@@ -698,6 +1482,13 @@ int zip_decompress(const char* infile, const char* outfile, enum compressor c_ty
 		return copy_file(infile, outfile);
 	}
 
+	fp_in = fopen(infile, "rb");
+	if (!fp_in){
+		log_efopen(infile);
+		ret = -1;
+		goto cleanup;
+	}
+
 	fp_out = fopen(outfile, "wb");
 	if (!fp_out){
 		log_efopen(outfile);
@@ -705,7 +1496,7 @@ int zip_decompress(const char* infile, const char* outfile, enum compressor c_ty
 		goto cleanup;
 	}
 
-	zfp = zip_open(infile, 0, c_type, 0, flags);
+	zfp = zip_open(fp_in, 0, c_type, 0, flags);
 	if (!zfp){
 		log_error_ex("Failed to open ZIP_FILE for reading (%s)", infile);
 		ret = -1;
@@ -723,10 +1514,432 @@ cleanup:
 		remove(outfile);
 	}
 	zfp ? zip_close(zfp) : 0;
+	fp_in ? fclose(fp_in) : 0;
 	fp_out ? fclose(fp_out) : 0;
 	return ret;
 }
 
+/* zlib and bzip2 count bytes with unsigned ints, so larger buffers are fed to them in pieces */
+static unsigned clamp_uint(size_t len){
+	return len > UINT_MAX ? UINT_MAX : (unsigned)len;
+}
+
+struct zip_stream* zip_stream_new(enum compressor c_type, int write, int compression_level, unsigned flags){
+	struct zip_stream* zs;
+	int res = 0;
+
+	zs = calloc(1, sizeof(*zs));
+	if (!zs){
+		log_enomem();
+		return NULL;
+	}
+	zs->c_type = c_type;
+	zs->write = write;
+	zs->level = compression_level;
+
+	switch (c_type){
+#ifndef NO_GZIP_SUPPORT
+	case COMPRESSOR_GZIP:
+		zs->strm.zstrm.zalloc = zalloc;
+		zs->strm.zstrm.zfree = zfree;
+		zs->strm.zstrm.opaque = Z_NULL;
+		if (write){
+			int strategy = Z_DEFAULT_STRATEGY;
+			if (flags & GZIP_HUFFMAN_ONLY){
+				strategy = Z_HUFFMAN_ONLY;
+			}
+			else if (flags & GZIP_FILTERED){
+				strategy = Z_FILTERED;
+			}
+			else if (flags & GZIP_RLE){
+				strategy = Z_RLE;
+			}
+			res = deflateInit2(&(zs->strm.zstrm), compression_level >= 1 && compression_level <= 9 ? compression_level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, flags & GZIP_LOWMEM ? 3 : 9, strategy) == Z_OK ? 0 : -1;
+		}
+		else{
+			res = inflateInit2(&(zs->strm.zstrm), 15 + 16) == Z_OK ? 0 : -1;
+		}
+		break;
+#endif
+#ifndef NO_BZIP2_SUPPORT
+	case COMPRESSOR_BZIP2:
+		if (write){
+			res = BZ2_bzCompressInit(&(zs->strm.bzstrm), compression_level >= 1 && compression_level <= 9 ? compression_level : 9, 0, 30) == BZ_OK ? 0 : -1;
+		}
+		else{
+			res = BZ2_bzDecompressInit(&(zs->strm.bzstrm), 0, 0) == BZ_OK ? 0 : -1;
+		}
+		break;
+#endif
+#ifndef NO_XZ_SUPPORT
+	case COMPRESSOR_XZ:{
+		lzma_stream xstrm = LZMA_STREAM_INIT;
+		zs->strm.xzstrm = xstrm;
+		res = xz_init(&(zs->strm.xzstrm), write, xz_preset(compression_level, flags), ZIP_GET_THREADS(flags), ZIP_GET_BLOCK_SHIFT(flags));
+		break;
+	}
+#endif
+#ifndef NO_LZ4_SUPPORT
+	case COMPRESSOR_LZ4:
+		zs->lz4 = lz4_stream_new(write, compression_level, flags);
+		res = zs->lz4 ? 0 : -1;
+		break;
+#endif
+#ifndef NO_ZSTD_SUPPORT
+	case COMPRESSOR_ZSTD:
+		if (write){
+			zs->strm.zstd_cctx = zstd_cctx_new(compression_level, flags);
+			res = zs->strm.zstd_cctx ? 0 : -1;
+		}
+		else{
+			zs->strm.zstd_dctx = ZSTD_createDCtx();
+			res = zs->strm.zstd_dctx ? 0 : -1;
+		}
+		break;
+#endif
+	case COMPRESSOR_NONE:
+		break;
+	default:
+		log_error("not supported");
+		free(zs);
+		return NULL;
+	}
+
+	if (res != 0){
+		log_error_ex("Failed to initialize %s stream", compressor_tostring(c_type));
+		free(zs);
+		return NULL;
+	}
+	return zs;
+}
+
+/* runs a stream on a chunk of input.
+ * when finish is true, the input is the last there is.
+ * returns 0 once the end of the stream has been written/read (and all input was consumed), 1 if there is more to do, or negative on failure */
+static int zip_stream_step(struct zip_stream* zs, const unsigned char* in, size_t in_len, size_t* in_used, unsigned char* out, size_t out_size, size_t* out_len, int finish){
+	*in_used = 0;
+	*out_len = 0;
+
+	if (zs->write && zs->ended){
+		return 0;
+	}
+
+	switch (zs->c_type){
+#ifndef NO_GZIP_SUPPORT
+	case COMPRESSOR_GZIP:{
+		z_stream* strm = &(zs->strm.zstrm);
+		unsigned avail_in = clamp_uint(in_len);
+		unsigned avail_out = clamp_uint(out_size);
+		int res;
+
+		/* only the first gzip member is read */
+		if (zs->ended){
+			break;
+		}
+
+		strm->next_in = (unsigned char*)in;
+		strm->avail_in = avail_in;
+		strm->next_out = out;
+		strm->avail_out = avail_out;
+
+		res = zs->write ? deflate(strm, finish && avail_in == in_len ? Z_FINISH : Z_NO_FLUSH) : inflate(strm, Z_NO_FLUSH);
+		*in_used = avail_in - strm->avail_in;
+		*out_len = avail_out - strm->avail_out;
+
+		/* Z_BUF_ERROR only means no progress could be made */
+		if (res == Z_STREAM_END){
+			zs->ended = 1;
+		}
+		else if (res != Z_OK && res != Z_BUF_ERROR){
+			log_error_ex("gzip stream error (%d)", res);
+			return -1;
+		}
+		break;
+	}
+#endif
+#ifndef NO_BZIP2_SUPPORT
+	case COMPRESSOR_BZIP2:{
+		bz_stream* strm = &(zs->strm.bzstrm);
+		unsigned avail_in = clamp_uint(in_len);
+		unsigned avail_out = clamp_uint(out_size);
+		int res;
+
+		if (zs->ended){
+			break;
+		}
+
+		strm->next_in = (char*)in;
+		strm->avail_in = avail_in;
+		strm->next_out = (char*)out;
+		strm->avail_out = avail_out;
+
+		res = zs->write ? BZ2_bzCompress(strm, finish && avail_in == in_len ? BZ_FINISH : BZ_RUN) : BZ2_bzDecompress(strm);
+		*in_used = avail_in - strm->avail_in;
+		*out_len = avail_out - strm->avail_out;
+
+		if (res == BZ_STREAM_END){
+			zs->ended = 1;
+		}
+		/* BZ_RUN reports BZ_PARAM_ERROR when it cannot make any progress */
+		else if (res != BZ_OK && res != BZ_RUN_OK && res != BZ_FINISH_OK && !(res == BZ_PARAM_ERROR && *in_used == 0 && *out_len == 0)){
+			log_error_ex("bzip2 stream error (%d)", res);
+			return -1;
+		}
+		break;
+	}
+#endif
+#ifndef NO_XZ_SUPPORT
+	case COMPRESSOR_XZ:{
+		lzma_stream* strm = &(zs->strm.xzstrm);
+		lzma_ret res;
+
+		if (zs->ended){
+			break;
+		}
+
+		strm->next_in = in;
+		strm->avail_in = in_len;
+		strm->next_out = out;
+		strm->avail_out = out_size;
+
+		/* LZMA_FINISH also tells the decoder that no more input is coming */
+		res = lzma_code(strm, finish ? LZMA_FINISH : LZMA_RUN);
+		*in_used = in_len - strm->avail_in;
+		*out_len = out_size - strm->avail_out;
+
+		if (res == LZMA_STREAM_END){
+			zs->ended = 1;
+		}
+		else if (res != LZMA_OK && res != LZMA_BUF_ERROR){
+			log_error_ex("xz stream error (%d)", res);
+			return -1;
+		}
+		break;
+	}
+#endif
+#ifndef NO_LZ4_SUPPORT
+	case COMPRESSOR_LZ4:{
+		int res = lz4_stream_code(zs->lz4, in, in_len, in_used, out, out_size, out_len, finish);
+		if (res < 0){
+			return -1;
+		}
+		zs->ended = res == 0;
+		break;
+	}
+#endif
+#ifndef NO_ZSTD_SUPPORT
+	case COMPRESSOR_ZSTD:{
+		ZSTD_inBuffer input;
+		ZSTD_outBuffer output;
+		size_t res;
+
+		/* a finished frame has already been flushed, and asking for more would make the decompressor wait for the next frame's header */
+		if (!zs->write && zs->ended && in_len == 0){
+			break;
+		}
+
+		input.src = in;
+		input.size = in_len;
+		input.pos = 0;
+		output.dst = out;
+		output.size = out_size;
+		output.pos = 0;
+
+		res = zs->write ? ZSTD_compressStream2(zs->strm.zstd_cctx, &output, &input, finish ? ZSTD_e_end : ZSTD_e_continue) : ZSTD_decompressStream(zs->strm.zstd_dctx, &output, &input);
+		*in_used = input.pos;
+		*out_len = output.pos;
+
+		if (ZSTD_isError(res)){
+			log_error_ex("zstd stream error (%s)", ZSTD_getErrorName(res));
+			return -1;
+		}
+		/* when decompressing, 0 means a frame just ended. another one may follow it */
+		zs->ended = res == 0 && (finish || !zs->write);
+		break;
+	}
+#endif
+	case COMPRESSOR_NONE:
+		*in_used = *out_len = in_len < out_size ? in_len : out_size;
+		if (*out_len > 0){
+			memcpy(out, in, *out_len);
+		}
+		/* uncompressed data can end anywhere */
+		zs->ended = !zs->write || (finish && *in_used == in_len);
+		break;
+	default:
+		log_fatal("not supported");
+		return -1;
+	}
+
+	return zs->ended && *in_used == in_len ? 0 : 1;
+}
+
+int zip_stream_update(struct zip_stream* zs, const void* in, size_t in_len, size_t* in_used, void* out, size_t out_size, size_t* out_len){
+	return_ifnull(zs, -1);
+	return_ifnull(in_used, -1);
+	return_ifnull(out_len, -1);
+
+	return zip_stream_step(zs, in, in_len, in_used, out, out_size, out_len, 0) < 0 ? -1 : 0;
+}
+
+int zip_stream_finish(struct zip_stream* zs, void* out, size_t out_size, size_t* out_len){
+	size_t in_used;
+	int res;
+
+	return_ifnull(zs, -1);
+	return_ifnull(out_len, -1);
+
+	res = zip_stream_step(zs, NULL, 0, &in_used, out, out_size, out_len, 1);
+	if (res <= 0 || zs->write){
+		return res;
+	}
+
+	/* the decompressor may still be holding output back */
+	if (*out_len == out_size){
+		return 1;
+	}
+	log_error("The compressed data is truncated");
+	return -1;
+}
+
+void zip_stream_free(struct zip_stream* zs){
+	if (!zs){
+		return;
+	}
+
+	switch (zs->c_type){
+#ifndef NO_GZIP_SUPPORT
+	case COMPRESSOR_GZIP:
+		zs->write ? deflateEnd(&(zs->strm.zstrm)) : inflateEnd(&(zs->strm.zstrm));
+		break;
+#endif
+#ifndef NO_BZIP2_SUPPORT
+	case COMPRESSOR_BZIP2:
+		zs->write ? BZ2_bzCompressEnd(&(zs->strm.bzstrm)) : BZ2_bzDecompressEnd(&(zs->strm.bzstrm));
+		break;
+#endif
+#ifndef NO_XZ_SUPPORT
+	case COMPRESSOR_XZ:
+		lzma_end(&(zs->strm.xzstrm));
+		break;
+#endif
+#ifndef NO_LZ4_SUPPORT
+	case COMPRESSOR_LZ4:
+		lz4_stream_free(zs->lz4);
+		break;
+#endif
+#ifndef NO_ZSTD_SUPPORT
+	case COMPRESSOR_ZSTD:
+		zs->write ? ZSTD_freeCCtx(zs->strm.zstd_cctx) : ZSTD_freeDCtx(zs->strm.zstd_dctx);
+		break;
+#endif
+	default:
+		;
+	}
+	free(zs);
+}
+
+size_t zip_compress_bound(enum compressor c_type, size_t in_len, unsigned flags){
+	switch (c_type){
+#ifndef NO_GZIP_SUPPORT
+	case COMPRESSOR_GZIP:
+		/* zlib's bound for any memory level or strategy, plus the 18-byte gzip header and trailer */
+		return in_len + ((in_len + 7) >> 3) + ((in_len + 63) >> 6) + 5 + 18;
+#endif
+#ifndef NO_BZIP2_SUPPORT
+	case COMPRESSOR_BZIP2:
+		/* from the bzip2 manual: 1% larger + 600 bytes */
+		return in_len + in_len / 100 + 600;
+#endif
+#ifndef NO_XZ_SUPPORT
+	case COMPRESSOR_XZ:
+		return lzma_stream_buffer_bound(in_len);
+#endif
+#ifndef NO_LZ4_SUPPORT
+	case COMPRESSOR_LZ4:
+		return lz4_stream_bound(in_len, flags);
+#endif
+#ifndef NO_ZSTD_SUPPORT
+	case COMPRESSOR_ZSTD:
+		return ZSTD_compressBound(in_len);
+#endif
+	case COMPRESSOR_NONE:
+		return in_len;
+	default:
+		(void)flags;
+		return 0;
+	}
+}
+
+/* feeds all of the input through a stream and finishes it */
+static int zip_buffer_run(struct zip_stream* zs, const unsigned char* in, size_t in_len, unsigned char* out, size_t out_size, size_t* out_len){
+	size_t pos_in = 0;
+	size_t pos_out = 0;
+	int res;
+
+	do{
+		size_t used;
+		size_t len;
+
+		res = zip_stream_step(zs, in + pos_in, in_len - pos_in, &used, out + pos_out, out_size - pos_out, &len, 1);
+		if (res < 0){
+			return -1;
+		}
+		pos_in += used;
+		pos_out += len;
+
+		/* no progress means the output buffer is full or the input is incomplete */
+		if (res > 0 && used == 0 && len == 0){
+			break;
+		}
+	}while (res > 0);
+
+	*out_len = pos_out;
+	return res;
+}
+
+int zip_compress_buffer(const void* in, size_t in_len, void* out, size_t out_size, size_t* out_len, enum compressor c_type, int compression_level, unsigned flags){
+	struct zip_stream* zs = NULL;
+	int ret = 0;
+
+	return_ifnull(out_len, -1);
+
+	zs = zip_stream_new(c_type, 1, compression_level, flags);
+	if (!zs){
+		return -1;
+	}
+
+	ret = zip_buffer_run(zs, in, in_len, out, out_size, out_len);
+	if (ret > 0){
+		log_error_ex2("The output buffer is too small (%lu bytes for %lu bytes of input)", (unsigned long)out_size, (unsigned long)in_len);
+		ret = -1;
+	}
+
+	zip_stream_free(zs);
+	return ret;
+}
+
+int zip_decompress_buffer(const void* in, size_t in_len, void* out, size_t out_size, size_t* out_len, enum compressor c_type, unsigned flags){
+	struct zip_stream* zs = NULL;
+	int ret = 0;
+
+	return_ifnull(out_len, -1);
+
+	zs = zip_stream_new(c_type, 0, 0, flags);
+	if (!zs){
+		return -1;
+	}
+
+	ret = zip_buffer_run(zs, in, in_len, out, out_size, out_len);
+	if (ret > 0){
+		log_error("The compressed data is truncated, has trailing data, or does not fit in the output buffer");
+		ret = -1;
+	}
+
+	zip_stream_free(zs);
+	return ret;
+}
+
 const char* get_compression_extension(enum compressor comp){
 	switch (comp){
 #ifndef NO_GZIP_SUPPORT
@@ -744,6 +1957,10 @@ const char* get_compression_extension(enum compressor comp){
 #ifndef NO_LZ4_SUPPORT
 	case COMPRESSOR_LZ4:
 		return ".lz4";
+#endif
+#ifndef NO_ZSTD_SUPPORT
+	case COMPRESSOR_ZSTD:
+		return ".zst";
 #endif
 	case COMPRESSOR_NONE:
 		return "";
@@ -772,6 +1989,12 @@ enum compressor get_compressor_byname(const char* name){
 	if (sh_ncasecmp(name, "lz4") == 0){
 		return COMPRESSOR_LZ4;
 	}
+#ifndef NO_ZSTD_SUPPORT
+	if (sh_ncasecmp(name, "zstd") == 0 ||
+			sh_ncasecmp(name, "zst") == 0){
+		return COMPRESSOR_ZSTD;
+	}
+#endif
 	if (sh_ncasecmp(name, "none") == 0 ||
 			sh_ncasecmp(name, "off") == 0 ||
 			sh_ncasecmp(name, "no") == 0){
@@ -790,6 +2013,10 @@ const char* compressor_tostring(enum compressor c_type){
 		return "xz";
 	case COMPRESSOR_LZ4:
 		return "lz4";
+#ifndef NO_ZSTD_SUPPORT
+	case COMPRESSOR_ZSTD:
+		return "zstd";
+#endif
 	case COMPRESSOR_NONE:
 		return "none";
 	default:
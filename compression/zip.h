@@ -9,6 +9,10 @@
 #ifndef __COMPRESSION_ZIP_H
 #define __COMPRESSION_ZIP_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
 /**
  * @brief An enumeration that holds the possible compression algorithms
  */
@@ -52,6 +56,15 @@ enum compressor{
 	 * This algorithm is only included by default on a handful of Linux distros. Linux users will probably need to install lz4 to use this algorithm, while OSX/Windows users will need to download 7zip-ZS (regular 7zip does not have lz4 support).
 	 */
 	COMPRESSOR_LZ4,
+#endif
+#ifndef NO_ZSTD_SUPPORT
+	/**
+	 * @brief zstd.<br>
+	 * This algorithm offers compression ratios comparable to xz at its higher levels while decompressing several times as fast as gzip.<br>
+	 * It supports levels from 1-22, multithreaded compression, and long-distance matching for large files with repeated content.<br>
+	 * Linux users may need to install zstd to use this algorithm, while OSX/Windows users will need to download 7zip-ZS.
+	 */
+	COMPRESSOR_ZSTD,
 #endif
 	/**
 	 * @brief No compressor.<br>
@@ -60,6 +73,15 @@ enum compressor{
 	COMPRESSOR_NONE
 };
 
+/* options common to all compressors */
+#define ZIP_THREADS(n)          (((unsigned)(n) & 0xFF) << 24) /**< Compress using n worker threads. This is ignored by compressors that do not support multithreading. 0 compresses on the calling thread. */
+#define ZIP_GET_THREADS(flags)  (((unsigned)(flags) >> 24) & 0xFF) /**< Gets the amount of worker threads specified in a set of flags. */
+#define ZIP_BLOCK_SHIFT(n)      (((unsigned)(n) & 0xFF) << 16) /**< Split the input into blocks of 2^n bytes when compressing with multiple threads. 0 uses the compressor's default block size. */
+#define ZIP_GET_BLOCK_SHIFT(flags) (((unsigned)(flags) >> 16) & 0xFF) /**< Gets the log2 of the block size specified in a set of flags. */
+#define ZIP_SEEKABLE            (1 << 15) /**< Write a seekable container of independently compressed blocks with a trailing index instead of a single stream. The blocks are ZIP_BLOCK_SHIFT() bytes, or ZIP_SEEKABLE_BLOCK_SIZE by default. This must also be given to zip_decompress(). @see zip_seekable_open() */
+
+#define ZIP_SEEKABLE_BLOCK_SIZE (1 << 20) /**< The default size of a block in a seekable container. Larger blocks compress better, but more data needs to be decompressed to read a single byte. */
+
 /* gzip options */
 #define GZIP_NORMAL       (0)      /**< Do not use any special options. This flag is only valid by itself. */
 #define GZIP_HUFFMAN_ONLY (1 << 0) /**< Force Huffman enconding only (no string match). This flag is not valid with GZIP_FILTERED or GZIP_RLE */
@@ -76,6 +98,16 @@ enum compressor{
 
 /* lz4 options */
 #define LZ4_NORMAL (0)            /**< Do not use any special options. This flag is only valid by itself. */
+#define LZ4_BLOCK_4MB      (1 << 0) /**< Use 4MB blocks instead of 1MB when compressing with multiple threads. */
+#define LZ4_BLOCK_CHECKSUM (1 << 1) /**< Store a checksum after every block so corruption is detected as soon as the block is decompressed. */
+
+/* zstd options */
+#define ZSTD_NORMAL (0)            /**< Do not use any special options. This flag is only valid by itself. */
+#define ZSTD_LONG   (1 << 0)       /**< Use long-distance matching with a 128MB window. This improves compression ratios of large files with repeated content at the cost of memory usage. */
+#define ZSTD_DICT   (1 << 1)       /**< When backing up, train a dictionary on the backup's small files and compress them with it. Only full backups do this; watch-triggered backups compress normally. */
+
+#define ZIP_DICT_SIZE          (112640)     /**< The default size of a trained dictionary in bytes (110KB, same as the zstd command line tool). */
+#define ZIP_DICT_MAX_FILE_SIZE (128 * 1024) /**< Files up to this size are compressed with a dictionary and used as training samples. Larger files do not benefit from one. */
 
 /**
  * @brief Compresses a file.
@@ -90,7 +122,8 @@ enum compressor{
  * @param compression_level A value from 0-9 indicating how much the data should be compressed.<br>
  * A level of 1 runs the fastest but has the lowest compression ratios.<br>
  * A level of 9 runs the slowest but has the highest compression ratios.<br>
- * A level of 0 uses the default value.
+ * A level of 0 uses the default value.<br>
+ * zstd accepts levels from 0-22.
  *
  * @param flags Special flags to give to the compression algorithm.<br>
  *
@@ -99,6 +132,55 @@ enum compressor{
  */
 int zip_compress(const char* infile, const char* outfile, enum compressor c_type, int compression_level, unsigned flags);
 
+/**
+ * @brief Compresses the end of a file, starting at a specific offset.
+ * @see zip_compress()
+ *
+ * @param infile Path to the file that should be compressed.
+ *
+ * @param outfile Path of the resulting output file.<br>
+ * If this file already exists, it will be overwritten.
+ *
+ * @param offset The offset within infile to start compressing from.<br>
+ * An offset of 0 compresses the entire file.
+ *
+ * @param c_type The compression algorithm to use.
+ *
+ * @param compression_level A value from 0-9 (0-22 for zstd) indicating how much the data should be compressed.<br>
+ * A level of 0 uses the default value.
+ *
+ * @param flags Special flags to give to the compression algorithm.<br>
+ *
+ * @return 0 on success, or negative on failure.<br>
+ * On failure, the output file is automatically deleted.
+ */
+int zip_compress_tail(const char* infile, const char* outfile, unsigned long offset, enum compressor c_type, int compression_level, unsigned flags);
+
+/**
+ * @brief Compresses the end of a file into an already open stream.<br>
+ * The output is written strictly in order and is never seeked, so fp_out can be a pipe or any other stream (e.g. one that encrypts what is written to it).
+ * @see zip_compress_tail()
+ *
+ * @param infile Path to the file that should be compressed.
+ *
+ * @param fp_out The stream to write the compressed data to.<br>
+ * This FILE* must be opened in writing binary ("wb") mode. It is not closed.
+ *
+ * @param offset The offset within infile to start compressing from.<br>
+ * An offset of 0 compresses the entire file.
+ *
+ * @param c_type The compression algorithm to use.
+ *
+ * @param compression_level A value from 0-9 (0-22 for zstd) indicating how much the data should be compressed.<br>
+ * A level of 0 uses the default value.
+ *
+ * @param flags Special flags to give to the compression algorithm.<br>
+ *
+ * @return 0 on success, or negative on failure.<br>
+ * On failure, part of the output may have already been written.
+ */
+int zip_compress_fp(const char* infile, FILE* fp_out, unsigned long offset, enum compressor c_type, int compression_level, unsigned flags);
+
 /**
  * @brief Decompresses a file.
  *
@@ -110,13 +192,500 @@ int zip_compress(const char* infile, const char* outfile, enum compressor c_type
  * @param c_type The compression algorithm to use.
  *
  * @param flags Special flags to give to the decompression algorithm.<br>
- * At the moment, decompression does not have any flags available to it.
+ * At the moment, only ZIP_THREADS() and ZIP_SEEKABLE are used. ZIP_THREADS() is only used by xz, lz4, bzip2, and seekable containers.
  *
  * @return 0 on success, or negative on failure.<br>
  * On failure, the output file is automatically deleted.
  */
 int zip_decompress(const char* infile, const char* outfile, enum compressor c_type, unsigned flags);
 
+/**
+ * @brief An in-memory compression or decompression stream.<br>
+ * Input is pushed in and output is pulled out through caller-supplied buffers, so no temporary files are needed.
+ */
+struct zip_stream;
+
+/**
+ * @brief Creates an in-memory compression or decompression stream.<br>
+ * The output is byte-for-byte compatible with zip_compress() and zip_decompress().
+ *
+ * @param c_type The compression algorithm to use.<br>
+ * COMPRESSOR_NONE copies the input as-is.
+ *
+ * @param write True to compress, false to decompress.
+ *
+ * @param compression_level The compression level.<br>
+ * This is ignored when decompressing.
+ * @see zip_compress()
+ *
+ * @param flags Special flags to give to the compression algorithm.
+ *
+ * @return A new stream, or NULL on failure.<br>
+ * This stream must be freed with zip_stream_free() when no longer in use.
+ */
+struct zip_stream* zip_stream_new(enum compressor c_type, int write, int compression_level, unsigned flags);
+
+/**
+ * @brief Pushes data through a stream.<br>
+ * This consumes as much input as it can without overrunning the output buffer, so it should be called again with the remaining input if *in_used is less than in_len.
+ *
+ * @param zs The stream.
+ *
+ * @param in The input data.
+ *
+ * @param in_len The length of the input data.
+ *
+ * @param in_used Set to the amount of input bytes consumed.
+ *
+ * @param out The buffer to write output to.
+ *
+ * @param out_size The size of the output buffer.
+ *
+ * @param out_len Set to the amount of output bytes written.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int zip_stream_update(struct zip_stream* zs, const void* in, size_t in_len, size_t* in_used, void* out, size_t out_size, size_t* out_len);
+
+/**
+ * @brief Flushes the rest of a stream's output.<br>
+ * When compressing, this writes the end of the compressed data. When decompressing, this verifies that the compressed data was complete.
+ *
+ * @param zs The stream.
+ *
+ * @param out The buffer to write output to.
+ *
+ * @param out_size The size of the output buffer.
+ *
+ * @param out_len Set to the amount of output bytes written.
+ *
+ * @return 0 if all output has been written, positive if the output buffer filled up and this function must be called again, or negative on failure (e.g. truncated input).
+ */
+int zip_stream_finish(struct zip_stream* zs, void* out, size_t out_size, size_t* out_len);
+
+/**
+ * @brief Frees a stream.
+ *
+ * @param zs The stream to free.<br>
+ * If this is NULL, this function does nothing.
+ *
+ * @return void
+ */
+void zip_stream_free(struct zip_stream* zs);
+
+/**
+ * @brief Gets the largest size in-memory compressed data could be.
+ *
+ * @param c_type The compression algorithm.
+ *
+ * @param in_len The length of the uncompressed data.
+ *
+ * @param flags The flags the data will be compressed with.
+ *
+ * @return An output buffer size that zip_compress_buffer() is guaranteed to fit into, or 0 if the compressor is invalid.
+ */
+size_t zip_compress_bound(enum compressor c_type, size_t in_len, unsigned flags);
+
+/**
+ * @brief Compresses a buffer in one step.<br>
+ * This is meant for small inputs; use a zip_stream for anything that should not be held in memory all at once.
+ *
+ * @param in The data to compress.
+ *
+ * @param in_len The length of the data.
+ *
+ * @param out The buffer to write the compressed data to.
+ *
+ * @param out_size The size of the output buffer.<br>
+ * If this is at least zip_compress_bound(), the compressed data is guaranteed to fit.
+ *
+ * @param out_len Set to the length of the compressed data.
+ *
+ * @param c_type The compression algorithm to use.
+ *
+ * @param compression_level The compression level.
+ * @see zip_compress()
+ *
+ * @param flags Special flags to give to the compression algorithm.
+ *
+ * @return 0 on success, or negative on failure, including if the compressed data does not fit in the output buffer.
+ */
+int zip_compress_buffer(const void* in, size_t in_len, void* out, size_t out_size, size_t* out_len, enum compressor c_type, int compression_level, unsigned flags);
+
+/**
+ * @brief Decompresses a buffer in one step.
+ *
+ * @param in The compressed data.
+ *
+ * @param in_len The length of the compressed data.
+ *
+ * @param out The buffer to write the decompressed data to.
+ *
+ * @param out_size The size of the output buffer.
+ *
+ * @param out_len Set to the length of the decompressed data.
+ *
+ * @param c_type The compression algorithm to use.
+ *
+ * @param flags Special flags to give to the decompression algorithm.
+ *
+ * @return 0 on success, or negative on failure, including if the input is truncated or the decompressed data does not fit in the output buffer.
+ */
+int zip_decompress_buffer(const void* in, size_t in_len, void* out, size_t out_size, size_t* out_len, enum compressor c_type, unsigned flags);
+
+/**
+ * @brief Picks compression levels that keep up with a target throughput.<br>
+ * The compression stage reports how long each piece of input took to compress and how long the stages after it (e.g. encryption and upload) took to process it.<br>
+ * When compression is the bottleneck, the level goes down. When compression is well ahead of the target and of the downstream stages, the level goes up, since the idle CPU time may as well buy a better ratio.
+ */
+struct zip_adapt;
+
+#define ZIP_ADAPT_WINDOW    (4 << 20) /**< The amount of input in bytes measured between level changes. Smaller windows react faster, but small files make the timings noisy. */
+#define ZIP_ADAPT_MAX_LEVEL (19)     /**< The highest level an adaptive level controller uses. zstd's levels above this need a lot of memory for very little gain. */
+
+/**
+ * @brief Creates an adaptive level controller.
+ *
+ * @param c_type The compressor the levels are for.<br>
+ * Levels range from 1-9, or 1-ZIP_ADAPT_MAX_LEVEL for zstd. COMPRESSOR_NONE always uses level 0.
+ *
+ * @param start_level The level to start at.<br>
+ * 0 starts at the compressor's default level.
+ *
+ * @param target_rate The throughput to keep up with in bytes per second.<br>
+ * 0 only keeps up with the downstream stages.
+ *
+ * @return A new controller, or NULL on failure.<br>
+ * This must be freed with zip_adapt_free() when no longer in use.
+ */
+struct zip_adapt* zip_adapt_new(enum compressor c_type, int start_level, double target_rate);
+
+/**
+ * @brief Gets the level to compress the next piece of input with.
+ *
+ * @param za The controller.
+ *
+ * @return The compression level.
+ */
+int zip_adapt_level(const struct zip_adapt* za);
+
+/**
+ * @brief Reports how long a piece of input compressed at zip_adapt_level() took to get through the pipeline.<br>
+ * The level is reconsidered once ZIP_ADAPT_WINDOW bytes have been reported.
+ *
+ * @param za The controller.
+ *
+ * @param bytes The amount of uncompressed input.
+ *
+ * @param compress_secs The time taken to compress the input in seconds.
+ *
+ * @param downstream_secs The time taken by the stages after compression in seconds, or 0 if there are none.
+ *
+ * @return void
+ */
+void zip_adapt_update(struct zip_adapt* za, uint64_t bytes, double compress_secs, double downstream_secs);
+
+/**
+ * @brief Gets the amount of input that was compressed at a level, for reporting.
+ *
+ * @param za The controller.
+ *
+ * @param level The compression level.
+ *
+ * @return The amount of uncompressed bytes reported at that level.
+ */
+uint64_t zip_adapt_level_bytes(const struct zip_adapt* za, int level);
+
+/**
+ * @brief Frees an adaptive level controller.
+ *
+ * @param za The controller to free.<br>
+ * If this is NULL, this function does nothing.
+ *
+ * @return void
+ */
+void zip_adapt_free(struct zip_adapt* za);
+
+/**
+ * @brief A seekable container opened for random access.<br>
+ * Only the blocks that overlap the requested range are read and decompressed.
+ */
+struct zip_seekable;
+
+/**
+ * @brief Opens a file compressed with ZIP_SEEKABLE for random access.<br>
+ * The compressor is stored in the container, so it does not need to be given.
+ *
+ * @param file Path to the compressed file.
+ *
+ * @return The opened container, or NULL on failure (e.g. the file is not a seekable container or its index is corrupt).<br>
+ * This must be closed with zip_seekable_close() when no longer in use.
+ */
+struct zip_seekable* zip_seekable_open(const char* file);
+
+/**
+ * @brief Gets the decompressed size of a seekable container.
+ *
+ * @param zsk The container.
+ *
+ * @return The decompressed size in bytes.
+ */
+uint64_t zip_seekable_size(const struct zip_seekable* zsk);
+
+/**
+ * @brief Reads decompressed data from anywhere within a seekable container.<br>
+ * Each block that is read is checked against the checksum stored in the index.
+ *
+ * @param zsk The container.
+ *
+ * @param offset The offset within the decompressed data to start reading from.
+ *
+ * @param out The buffer to read into.
+ *
+ * @param len The amount of bytes to read.
+ *
+ * @param out_len The amount of bytes actually read.<br>
+ * This is less than len if the end of the data was reached.
+ *
+ * @return 0 on success, or negative on failure (e.g. a block is corrupt).
+ */
+int zip_seekable_read(struct zip_seekable* zsk, uint64_t offset, void* out, size_t len, size_t* out_len);
+
+/**
+ * @brief Reads a seekable container's index from the last bytes of its data, so it can be decompressed in order with zip_seekable_decode().<br>
+ * This is for containers that cannot be read randomly, such as ones that are encrypted.
+ *
+ * @param tail The last bytes of the container.
+ *
+ * @param tail_len The length of tail.<br>
+ * This only needs to cover the index, but how long that is is only known once the footer has been read.
+ *
+ * @param container_len The length of the whole container.
+ *
+ * @param needed Set to the amount of trailing bytes needed if tail_len is not enough to cover the index, or 0 otherwise.
+ *
+ * @return The container, or NULL on failure or if more trailing bytes are needed.<br>
+ * This must be closed with zip_seekable_close() when no longer in use.
+ */
+struct zip_seekable* zip_seekable_from_tail(const void* tail, size_t tail_len, uint64_t container_len, size_t* needed);
+
+/**
+ * @brief Decompresses a container opened with zip_seekable_from_tail() as its data is fed in from the beginning.<br>
+ * Each block is checked against the checksum stored in the index once all of it has been fed in.
+ *
+ * @param zsk The container.
+ *
+ * @param in The next bytes of the container.
+ *
+ * @param in_len The length of in.
+ *
+ * @param in_used The amount of bytes consumed from in.<br>
+ * This is less than in_len if a block was completed, in which case the rest should be fed in again.
+ *
+ * @param out Set to the decompressed block if one was completed.<br>
+ * This is only valid until the next call.
+ *
+ * @param out_len The length of the decompressed block, or 0 if no block was completed.
+ *
+ * @return 0 on success, or negative on failure (e.g. a block is corrupt).
+ */
+int zip_seekable_decode(struct zip_seekable* zsk, const void* in, size_t in_len, size_t* in_used, const void** out, size_t* out_len);
+
+/**
+ * @brief Checks that all of a container has been fed into zip_seekable_decode().
+ *
+ * @param zsk The container.
+ *
+ * @param container_len The length of the whole container.
+ *
+ * @return 0 if every block was decompressed and nothing else followed the index, or negative if not.
+ */
+int zip_seekable_decode_end(const struct zip_seekable* zsk, uint64_t container_len);
+
+/**
+ * @brief Closes a seekable container.
+ *
+ * @param zsk The container to close.<br>
+ * If this is NULL, this function does nothing.
+ *
+ * @return void
+ */
+void zip_seekable_close(struct zip_seekable* zsk);
+
+/**
+ * @brief A zstd dictionary.<br>
+ * Small files start out with an empty window, so they barely compress on their own. A dictionary trained on similar files gives them a window to match against.
+ */
+struct zip_dict;
+
+#ifndef NO_ZSTD_SUPPORT
+/**
+ * @brief Trains a zstd dictionary on a set of files.
+ *
+ * @param files The files to use as samples.<br>
+ * At most ZIP_DICT_MAX_FILE_SIZE bytes of each file are read, and reading stops once there are 100 times as many sample bytes as dict_size.
+ *
+ * @param n_files The amount of files.
+ *
+ * @param dict_size The maximum size of the dictionary in bytes.<br>
+ * ZIP_DICT_SIZE is a good default.
+ *
+ * @return A new dictionary, or NULL on failure (e.g. there was not enough sample data).<br>
+ * This dictionary must be freed with zip_dict_free() when no longer in use.
+ */
+struct zip_dict* zip_dict_train(const char* const* files, size_t n_files, size_t dict_size);
+
+/**
+ * @brief Loads a dictionary that was saved with zip_dict_save().
+ *
+ * @param file The path of the dictionary.
+ *
+ * @return The dictionary, or NULL on failure.<br>
+ * This dictionary must be freed with zip_dict_free() when no longer in use.
+ */
+struct zip_dict* zip_dict_load(const char* file);
+
+/**
+ * @brief Makes a dictionary from data in memory, e.g. a saved dictionary that was decrypted without writing it to disk.
+ * @see zip_dict_load()
+ *
+ * @param data The contents of a file saved with zip_dict_save().<br>
+ * This is copied, so it can be freed afterwards.
+ *
+ * @param len The length of the data.
+ *
+ * @return The dictionary, or NULL on failure.<br>
+ * This dictionary must be freed with zip_dict_free() when no longer in use.
+ */
+struct zip_dict* zip_dict_from_buffer(const void* data, size_t len);
+
+/**
+ * @brief Saves a dictionary to disk.<br>
+ * The file is in the same format the zstd command line tool uses, so it can be used with "zstd -D".
+ *
+ * @param dict The dictionary.
+ *
+ * @param file The path to save it to.<br>
+ * If this file already exists, it will be overwritten.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int zip_dict_save(const struct zip_dict* dict, const char* file);
+
+/**
+ * @brief Gets the id of a dictionary.<br>
+ * This id is stored in every frame compressed with the dictionary, so the matching dictionary can be found when decompressing.
+ * @see zip_file_dict_id()
+ *
+ * @param dict The dictionary.
+ *
+ * @return The dictionary's id.
+ */
+unsigned zip_dict_id(const struct zip_dict* dict);
+
+/**
+ * @brief Frees a dictionary.
+ *
+ * @param dict The dictionary to free.<br>
+ * If this is NULL, this function does nothing.
+ *
+ * @return void
+ */
+void zip_dict_free(struct zip_dict* dict);
+
+/**
+ * @brief Makes a zstd stream compress or decompress with a dictionary.<br>
+ * This must be called before any data goes through the stream.
+ *
+ * @param zs The stream.
+ *
+ * @param dict The dictionary.<br>
+ * This must remain valid until the stream is freed.
+ *
+ * @return 0 on success, or negative on failure (e.g. the stream does not use zstd).
+ */
+int zip_stream_set_dict(struct zip_stream* zs, struct zip_dict* dict);
+
+/**
+ * @brief Compresses a file with zstd and a dictionary.
+ * @see zip_compress()
+ *
+ * @param infile Path to the file that should be compressed.
+ *
+ * @param outfile Path of the resulting output file.<br>
+ * If this file already exists, it will be overwritten.
+ *
+ * @param compression_level A value from 0-22. 0 uses the default level.
+ *
+ * @param flags zstd flags.
+ *
+ * @param dict The dictionary to use.
+ *
+ * @return 0 on success, or negative on failure.<br>
+ * On failure, the output file is automatically deleted.
+ */
+int zip_compress_dict(const char* infile, const char* outfile, int compression_level, unsigned flags, struct zip_dict* dict);
+
+/**
+ * @brief Compresses a file with zstd and a dictionary into an already open stream.
+ * @see zip_compress_dict()
+ * @see zip_compress_fp()
+ *
+ * @param infile Path to the file that should be compressed.
+ *
+ * @param fp_out The stream to write the compressed data to.<br>
+ * This FILE* must be opened in writing binary ("wb") mode. It is not closed.
+ *
+ * @param compression_level A value from 0-22. 0 uses the default level.
+ *
+ * @param flags zstd flags.
+ *
+ * @param dict The dictionary to use.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int zip_compress_dict_fp(const char* infile, FILE* fp_out, int compression_level, unsigned flags, struct zip_dict* dict);
+
+/**
+ * @brief Decompresses a file that was compressed with zip_compress_dict().
+ *
+ * @param infile Path to the file that should be decompressed.
+ *
+ * @param outfile Path of the resulting output file.<br>
+ * If this file already exists, it will be overwritten.
+ *
+ * @param flags zstd flags.
+ *
+ * @param dict The dictionary the file was compressed with.
+ *
+ * @return 0 on success, or negative on failure.<br>
+ * On failure, the output file is automatically deleted.
+ */
+int zip_decompress_dict(const char* infile, const char* outfile, unsigned flags, struct zip_dict* dict);
+
+/**
+ * @brief Gets the id of the dictionary a zstd file was compressed with.
+ *
+ * @param file Path to the compressed file.
+ *
+ * @return The dictionary id, or 0 if the file does not need a dictionary or could not be read.
+ */
+unsigned zip_file_dict_id(const char* file);
+
+/**
+ * @brief Gets the id of the dictionary zstd data was compressed with.
+ * @see zip_file_dict_id()
+ *
+ * @param data The start of the compressed data.<br>
+ * This needs to hold the frame header, which is at most 18 bytes.
+ *
+ * @param len The length of the data.
+ *
+ * @return The dictionary id, or 0 if the data does not need a dictionary or is not zstd.
+ */
+unsigned zip_buffer_dict_id(const void* data, size_t len);
+#endif
+
 /**
  * @brief Gets a file extension from a compressor value (e.g. COMPRESSOR_GZIP -> ".gz")
  *
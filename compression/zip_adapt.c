@@ -0,0 +1,141 @@
+/** @file compression/zip_adapt.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "zip.h"
+#include "../log.h"
+#include <stdlib.h>
+
+/* compression has to be this much faster than the goal before the level goes up.
+ * a higher level can easily be half as fast, so without some headroom the level would go up and down every window */
+#define ZIP_ADAPT_HEADROOM (1.5)
+/* and this much slower before it goes down */
+#define ZIP_ADAPT_SLACK (0.9)
+
+struct zip_adapt{
+	int level;
+	int min_level;
+	int max_level;
+	double target_rate;
+	/* measurements since the last level change */
+	uint64_t window_bytes;
+	double window_compress_secs;
+	double window_downstream_secs;
+	uint64_t level_bytes[ZIP_ADAPT_MAX_LEVEL + 1];
+};
+
+static int default_level(enum compressor c_type){
+	switch (c_type){
+#ifndef NO_GZIP_SUPPORT
+	case COMPRESSOR_GZIP:
+		return 6;
+#endif
+#ifndef NO_BZIP2_SUPPORT
+	case COMPRESSOR_BZIP2:
+		return 9;
+#endif
+#ifndef NO_XZ_SUPPORT
+	case COMPRESSOR_XZ:
+		return 6;
+#endif
+#ifndef NO_ZSTD_SUPPORT
+	case COMPRESSOR_ZSTD:
+		return 3;
+#endif
+	default:
+		return 1;
+	}
+}
+
+struct zip_adapt* zip_adapt_new(enum compressor c_type, int start_level, double target_rate){
+	struct zip_adapt* za;
+
+	za = calloc(1, sizeof(*za));
+	if (!za){
+		log_enomem();
+		return NULL;
+	}
+
+	if (c_type == COMPRESSOR_NONE){
+		za->min_level = za->max_level = 0;
+	}
+	else{
+		za->min_level = 1;
+		za->max_level = 9;
+#ifndef NO_ZSTD_SUPPORT
+		if (c_type == COMPRESSOR_ZSTD){
+			za->max_level = ZIP_ADAPT_MAX_LEVEL;
+		}
+#endif
+	}
+
+	za->level = start_level > 0 ? start_level : default_level(c_type);
+	if (za->level < za->min_level){
+		za->level = za->min_level;
+	}
+	if (za->level > za->max_level){
+		za->level = za->max_level;
+	}
+	za->target_rate = target_rate > 0 ? target_rate : 0;
+	return za;
+}
+
+int zip_adapt_level(const struct zip_adapt* za){
+	return za ? za->level : 0;
+}
+
+void zip_adapt_update(struct zip_adapt* za, uint64_t bytes, double compress_secs, double downstream_secs){
+	double compress_rate;
+	double goal = 0;
+
+	if (!za){
+		return;
+	}
+
+	za->level_bytes[za->level] += bytes;
+	za->window_bytes += bytes;
+	za->window_compress_secs += compress_secs > 0 ? compress_secs : 0;
+	za->window_downstream_secs += downstream_secs > 0 ? downstream_secs : 0;
+	if (za->window_bytes < ZIP_ADAPT_WINDOW || za->window_compress_secs <= 0){
+		return;
+	}
+
+	/* compression only has to keep up with the slower of the target and the stages after it */
+	compress_rate = za->window_bytes / za->window_compress_secs;
+	if (za->window_downstream_secs > 0){
+		goal = za->window_bytes / za->window_downstream_secs;
+	}
+	if (za->target_rate > 0 && (goal == 0 || za->target_rate < goal)){
+		goal = za->target_rate;
+	}
+
+	if (goal > 0){
+		if (compress_rate < goal * ZIP_ADAPT_SLACK && za->level > za->min_level){
+			za->level--;
+			log_debug_ex("Compression is the bottleneck. Lowering level to %d", za->level);
+		}
+		else if (compress_rate > goal * ZIP_ADAPT_HEADROOM && za->level < za->max_level){
+			za->level++;
+			log_debug_ex("Compression is ahead of the pipeline. Raising level to %d", za->level);
+		}
+	}
+
+	za->window_bytes = 0;
+	za->window_compress_secs = 0;
+	za->window_downstream_secs = 0;
+}
+
+uint64_t zip_adapt_level_bytes(const struct zip_adapt* za, int level){
+	if (!za || level < 0 || level > ZIP_ADAPT_MAX_LEVEL){
+		return 0;
+	}
+	return za->level_bytes[level];
+}
+
+void zip_adapt_free(struct zip_adapt* za){
+	free(za);
+}
@@ -0,0 +1,439 @@
+/** @file compression/zip_dict.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef NO_ZSTD_SUPPORT
+
+#define __ZIP_INTERNAL
+#include "zip.h"
+#include "zip_file.h"
+#include "../log.h"
+#include "../filehelper.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <zstd.h>
+#include <zdict.h>
+
+/* zstd recommends about 100 times as much sample data as the size of the dictionary */
+#define ZIP_DICT_SAMPLE_FACTOR (100)
+/* the largest a zstd frame header can be. ZSTD_FRAMEHEADERSIZE_MAX is only visible with ZSTD_STATIC_LINKING_ONLY */
+#define ZSTD_HEADER_MAX (18)
+
+struct zip_dict{
+	unsigned char* data;
+	size_t len;
+	unsigned id;
+	/* digested forms of the dictionary, made the first time they are needed */
+	ZSTD_CDict* cdict;
+	int cdict_level;
+	ZSTD_DDict* ddict;
+};
+
+static struct zip_dict* zip_dict_new(unsigned char* data, size_t len){
+	struct zip_dict* dict;
+
+	dict = calloc(1, sizeof(*dict));
+	if (!dict){
+		log_enomem();
+		free(data);
+		return NULL;
+	}
+	dict->data = data;
+	dict->len = len;
+	dict->id = ZDICT_getDictID(data, len);
+	return dict;
+}
+
+/* appends up to max_len bytes of a file to the sample buffer */
+static int read_sample(const char* file, unsigned char* samples, size_t max_len, size_t* out_len){
+	FILE* fp;
+	int len;
+
+	fp = fopen(file, "rb");
+	if (!fp){
+		log_efopen(file);
+		return -1;
+	}
+
+	len = read_file(fp, samples, max_len);
+	if (fclose(fp) != 0){
+		log_efclose(file);
+	}
+	if (len < 0){
+		return -1;
+	}
+	*out_len = len;
+	return 0;
+}
+
+struct zip_dict* zip_dict_train(const char* const* files, size_t n_files, size_t dict_size){
+	unsigned char* samples = NULL;
+	size_t* sample_sizes = NULL;
+	unsigned n_samples = 0;
+	size_t samples_len = 0;
+	size_t samples_max;
+	unsigned char* data = NULL;
+	size_t res;
+	size_t i;
+
+	return_ifnull(files, NULL);
+
+	if (dict_size == 0){
+		dict_size = ZIP_DICT_SIZE;
+	}
+	samples_max = dict_size * ZIP_DICT_SAMPLE_FACTOR;
+
+	samples = malloc(samples_max);
+	sample_sizes = malloc((n_files + 1) * sizeof(*sample_sizes));
+	data = malloc(dict_size);
+	if (!samples || !sample_sizes || !data){
+		log_enomem();
+		goto cleanup_fail;
+	}
+
+	for (i = 0; i < n_files && samples_len < samples_max; ++i){
+		size_t max_len = samples_max - samples_len;
+		size_t len;
+
+		if (max_len > ZIP_DICT_MAX_FILE_SIZE){
+			max_len = ZIP_DICT_MAX_FILE_SIZE;
+		}
+
+		/* an unreadable sample only makes the dictionary a little worse */
+		if (read_sample(files[i], samples + samples_len, max_len, &len) != 0 || len == 0){
+			log_warning_ex("Skipping dictionary sample %s", files[i]);
+			continue;
+		}
+		sample_sizes[n_samples] = len;
+		samples_len += len;
+		n_samples++;
+	}
+
+	res = ZDICT_trainFromBuffer(data, dict_size, samples, sample_sizes, n_samples);
+	if (ZDICT_isError(res)){
+		log_error_ex("Failed to train dictionary (%s)", ZDICT_getErrorName(res));
+		goto cleanup_fail;
+	}
+
+	free(samples);
+	free(sample_sizes);
+	return zip_dict_new(data, res);
+
+cleanup_fail:
+	free(samples);
+	free(sample_sizes);
+	free(data);
+	return NULL;
+}
+
+struct zip_dict* zip_dict_load(const char* file){
+	FILE* fp = NULL;
+	unsigned char* data = NULL;
+	long len;
+
+	return_ifnull(file, NULL);
+
+	fp = fopen(file, "rb");
+	if (!fp){
+		log_efopen(file);
+		goto cleanup_fail;
+	}
+
+	if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0){
+		log_error_ex2("Failed to determine the size of %s (%s)", file, strerror(errno));
+		goto cleanup_fail;
+	}
+	if (len == 0){
+		log_error_ex("%s is empty", file);
+		goto cleanup_fail;
+	}
+
+	data = malloc(len);
+	if (!data){
+		log_enomem();
+		goto cleanup_fail;
+	}
+
+	if (read_file(fp, data, len) != len){
+		log_error_ex("Failed to read dictionary %s", file);
+		goto cleanup_fail;
+	}
+
+	if (fclose(fp) != 0){
+		log_efclose(file);
+	}
+	return zip_dict_new(data, len);
+
+cleanup_fail:
+	fp ? fclose(fp) : 0;
+	free(data);
+	return NULL;
+}
+
+struct zip_dict* zip_dict_from_buffer(const void* data, size_t len){
+	unsigned char* copy;
+
+	return_ifnull(data, NULL);
+
+	if (len == 0){
+		log_error("The dictionary is empty");
+		return NULL;
+	}
+
+	copy = malloc(len);
+	if (!copy){
+		log_enomem();
+		return NULL;
+	}
+	memcpy(copy, data, len);
+	return zip_dict_new(copy, len);
+}
+
+int zip_dict_save(const struct zip_dict* dict, const char* file){
+	FILE* fp = NULL;
+	int ret = 0;
+
+	return_ifnull(dict, -1);
+	return_ifnull(file, -1);
+
+	fp = fopen(file, "wb");
+	if (!fp){
+		log_efopen(file);
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (fwrite(dict->data, 1, dict->len, fp) != dict->len){
+		log_efwrite(file);
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	if (fp && fclose(fp) != 0){
+		log_efclose(file);
+		ret = -1;
+	}
+	if (ret != 0){
+		remove(file);
+	}
+	return ret;
+}
+
+unsigned zip_dict_id(const struct zip_dict* dict){
+	return dict ? dict->id : 0;
+}
+
+void zip_dict_free(struct zip_dict* dict){
+	if (!dict){
+		return;
+	}
+	ZSTD_freeCDict(dict->cdict);
+	ZSTD_freeDDict(dict->ddict);
+	free(dict->data);
+	free(dict);
+}
+
+int zip_stream_set_dict(struct zip_stream* zs, struct zip_dict* dict){
+	size_t res;
+
+	return_ifnull(zs, -1);
+	return_ifnull(dict, -1);
+
+	if (zs->c_type != COMPRESSOR_ZSTD){
+		log_error("Dictionaries are only supported by zstd");
+		return -1;
+	}
+
+	/* digesting the dictionary is the expensive part, so it is done once and shared by every stream */
+	if (zs->write){
+		int level = zs->level > 0 ? zs->level : ZSTD_CLEVEL_DEFAULT;
+
+		if (dict->cdict && dict->cdict_level != level){
+			ZSTD_freeCDict(dict->cdict);
+			dict->cdict = NULL;
+		}
+		if (!dict->cdict){
+			dict->cdict = ZSTD_createCDict(dict->data, dict->len, level);
+			if (!dict->cdict){
+				log_error("Failed to digest the compression dictionary");
+				return -1;
+			}
+			dict->cdict_level = level;
+		}
+		res = ZSTD_CCtx_refCDict(zs->strm.zstd_cctx, dict->cdict);
+	}
+	else{
+		if (!dict->ddict){
+			dict->ddict = ZSTD_createDDict(dict->data, dict->len);
+			if (!dict->ddict){
+				log_error("Failed to digest the decompression dictionary");
+				return -1;
+			}
+		}
+		res = ZSTD_DCtx_refDDict(zs->strm.zstd_dctx, dict->ddict);
+	}
+
+	if (ZSTD_isError(res)){
+		log_error_ex("Failed to set the dictionary (%s)", ZSTD_getErrorName(res));
+		return -1;
+	}
+	return 0;
+}
+
+/* runs a file through a stream into another file */
+static int stream_file(struct zip_stream* zs, FILE* fp_in, FILE* fp_out){
+	unsigned char inbuf[BUFFER_LEN];
+	unsigned char outbuf[BUFFER_LEN];
+	size_t out_len;
+	int len;
+	int res;
+
+	while ((len = read_file(fp_in, inbuf, sizeof(inbuf))) > 0){
+		size_t pos = 0;
+
+		while (pos < (size_t)len){
+			size_t in_used;
+
+			if (zip_stream_update(zs, inbuf + pos, len - pos, &in_used, outbuf, sizeof(outbuf), &out_len) != 0){
+				return -1;
+			}
+			if (fwrite(outbuf, 1, out_len, fp_out) != out_len){
+				log_efwrite("file");
+				return -1;
+			}
+			pos += in_used;
+		}
+	}
+	if (len < 0){
+		return -1;
+	}
+
+	do{
+		res = zip_stream_finish(zs, outbuf, sizeof(outbuf), &out_len);
+		if (res < 0){
+			return -1;
+		}
+		if (fwrite(outbuf, 1, out_len, fp_out) != out_len){
+			log_efwrite("file");
+			return -1;
+		}
+	}while (res > 0);
+	return 0;
+}
+
+/* runs an already opened file through a stream with the given dictionary */
+static int zip_dict_run_fp(FILE* fp_in, FILE* fp_out, int write, int compression_level, unsigned flags, struct zip_dict* dict){
+	struct zip_stream* zs;
+	int ret = 0;
+
+	zs = zip_stream_new(COMPRESSOR_ZSTD, write, compression_level, flags);
+	if (!zs || zip_stream_set_dict(zs, dict) != 0){
+		zip_stream_free(zs);
+		return -1;
+	}
+
+	if (stream_file(zs, fp_in, fp_out) != 0){
+		log_error_ex("Failed to %s file", write ? "compress" : "decompress");
+		ret = -1;
+	}
+
+	zip_stream_free(zs);
+	return ret;
+}
+
+static int zip_dict_run(const char* infile, const char* outfile, int write, int compression_level, unsigned flags, struct zip_dict* dict){
+	FILE* fp_in = NULL;
+	FILE* fp_out = NULL;
+	int ret = 0;
+
+	return_ifnull(infile, -1);
+	return_ifnull(outfile, -1);
+	return_ifnull(dict, -1);
+
+	fp_in = fopen(infile, "rb");
+	if (!fp_in){
+		log_efopen(infile);
+		ret = -1;
+		goto cleanup;
+	}
+
+	fp_out = fopen(outfile, "wb");
+	if (!fp_out){
+		log_efopen(outfile);
+		ret = -1;
+		goto cleanup;
+	}
+
+	ret = zip_dict_run_fp(fp_in, fp_out, write, compression_level, flags, dict);
+
+cleanup:
+	fp_in ? fclose(fp_in) : 0;
+	if (fp_out && fclose(fp_out) != 0){
+		log_efclose(outfile);
+		ret = -1;
+	}
+	if (ret != 0){
+		remove(outfile);
+	}
+	return ret;
+}
+
+int zip_compress_dict(const char* infile, const char* outfile, int compression_level, unsigned flags, struct zip_dict* dict){
+	return zip_dict_run(infile, outfile, 1, compression_level, flags, dict);
+}
+
+int zip_compress_dict_fp(const char* infile, FILE* fp_out, int compression_level, unsigned flags, struct zip_dict* dict){
+	FILE* fp_in;
+	int ret;
+
+	return_ifnull(infile, -1);
+	return_ifnull(fp_out, -1);
+	return_ifnull(dict, -1);
+
+	fp_in = fopen(infile, "rb");
+	if (!fp_in){
+		log_efopen(infile);
+		return -1;
+	}
+
+	ret = zip_dict_run_fp(fp_in, fp_out, 1, compression_level, flags, dict);
+	fclose(fp_in);
+	return ret;
+}
+
+int zip_decompress_dict(const char* infile, const char* outfile, unsigned flags, struct zip_dict* dict){
+	return zip_dict_run(infile, outfile, 0, 0, flags, dict);
+}
+
+unsigned zip_file_dict_id(const char* file){
+	unsigned char header[ZSTD_HEADER_MAX];
+	FILE* fp;
+	int len;
+
+	return_ifnull(file, 0);
+
+	fp = fopen(file, "rb");
+	if (!fp){
+		log_efopen(file);
+		return 0;
+	}
+	len = read_file(fp, header, sizeof(header));
+	if (fclose(fp) != 0){
+		log_efclose(file);
+	}
+	return len > 0 ? zip_buffer_dict_id(header, len) : 0;
+}
+
+unsigned zip_buffer_dict_id(const void* data, size_t len){
+	return_ifnull(data, 0);
+	return ZSTD_getDictID_fromFrame(data, len);
+}
+
+#endif
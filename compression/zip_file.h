@@ -25,6 +25,9 @@
 #ifndef NO_XZ_SUPPORT
 #include <lzma.h>
 #endif
+#ifndef NO_ZSTD_SUPPORT
+#include <zstd.h>
+#endif
 
 /**
  * @brief A structure containing information for compressing/decompressing a file.
@@ -34,11 +37,32 @@ struct ZIP_FILE{
 	FILE* fp;               /**< @brief The file that's being compressed/decompressed. */
 	unsigned write;         /**< @brief A boolean value that's true if the ZIP_FILE is compressing. */
 	enum compressor c_type; /**< @brief An enumeration that shows which compression algorithm is being used. */
+	int level;              /**< @brief The compression level given to zip_open(). */
+	unsigned flags;         /**< @brief The flags given to zip_open(). */
 	union tag_strm{         /**< @brief A stream (de)compression structure that depends on which compression algorithm is being used. */
 		z_stream zstrm;     /**< @brief gzip (de)compression stream. */
 		bz_stream bzstrm;   /**< @brief bzip2 (de)compression stream. */
 		lzma_stream xzstrm; /**< @brief xz (de)compression stream. */
+#ifndef NO_ZSTD_SUPPORT
+		ZSTD_CCtx* zstd_cctx; /**< @brief zstd compression context. */
+		ZSTD_DCtx* zstd_dctx; /**< @brief zstd decompression context. */
+#endif
 	}strm;
 };
 
+struct lz4_stream;
+
+/**
+ * @brief The state of an in-memory compression/decompression stream.
+ * @see zip_stream_new()
+ */
+struct zip_stream{
+	enum compressor c_type; /**< @brief The compression algorithm being used. */
+	int write;              /**< @brief True if the stream is compressing. */
+	int level;              /**< @brief The compression level given to zip_stream_new(). */
+	int ended;              /**< @brief True once the end of the compressed data has been written or read. */
+	union tag_strm strm;    /**< @brief The codec's stream structure. This is unused by lz4. */
+	struct lz4_stream* lz4; /**< @brief The lz4 stream state, or NULL if lz4 is not being used. */
+};
+
 #endif
@@ -12,7 +12,9 @@
 #include "zip_lz4.h"
 #include "zip.h"
 #include "../log.h"
+#include "../ctxpool.h"
 #include "../filehelper.h"
+#include "zip_parallel.h"
 #include <lz4.h>
 #include <lz4hc.h>
 #include <lz4frame.h>
@@ -20,7 +22,7 @@
 #include <string.h>
 #include <stdlib.h>
 
-static int lz4_compress_write(FILE* fp_in, FILE* fp_out, int compression_level, LZ4F_compressionContext_t ctx){
+static int lz4_compress_write(FILE* fp_in, FILE* fp_out, int compression_level, unsigned flags, LZ4F_compressionContext_t ctx){
 	unsigned char inbuf[BUFFER_LEN];
 	unsigned char* outbuf = NULL;
 	size_t outbuf_len = 0;
@@ -36,6 +38,9 @@ static int lz4_compress_write(FILE* fp_in, FILE* fp_out, int compression_level,
 		{0, 0, 0} /* reserved */
 	};
 	prefs.compressionLevel = compression_level;
+	if (flags & LZ4_BLOCK_CHECKSUM){
+		prefs.frameInfo.blockChecksumFlag = LZ4F_blockChecksumEnabled;
+	}
 
 	outbuf_len = LZ4F_compressBound(sizeof(inbuf), &prefs);
 	outbuf = malloc(LZ4F_compressBound(outbuf_len, &prefs));
@@ -94,32 +99,300 @@ static int lz4_compress_write(FILE* fp_in, FILE* fp_out, int compression_level,
 	return 0;
 }
 
-int lz4_compress(const char* infile, const char* outfile, int compression_level, unsigned flags){
-	FILE* fp_in = NULL;
-	FILE* fp_out = NULL;
-	LZ4F_compressionContext_t ctx = NULL;
+#ifndef LZ4F_HEADER_SIZE_MAX
+#define LZ4F_HEADER_SIZE_MAX 19
+#endif
+
+/* parallel lz4.
+ * with independent blocks, every block of the frame can be compressed and decompressed on its own.
+ * each worker produces a block with its own LZ4F context, and the main thread writes one frame header, the blocks in order, and the end mark */
+struct lz4_parallel{
+	LZ4F_preferences_t prefs;
+	unsigned char header[LZ4F_HEADER_SIZE_MAX];
+	size_t header_len;
+	size_t block_size;
+	int block_checksum;
+};
+
+static void lz4_parallel_prefs(LZ4F_preferences_t* prefs, int compression_level, unsigned flags){
+	memset(prefs, 0, sizeof(*prefs));
+	prefs->frameInfo.blockSizeID = flags & LZ4_BLOCK_4MB ? LZ4F_max4MB : LZ4F_max1MB;
+	prefs->frameInfo.blockMode = LZ4F_blockIndependent;
+	prefs->frameInfo.contentChecksumFlag = LZ4F_noContentChecksum;
+	prefs->frameInfo.blockChecksumFlag = flags & LZ4_BLOCK_CHECKSUM ? LZ4F_blockChecksumEnabled : LZ4F_noBlockChecksum;
+	prefs->compressionLevel = compression_level;
+	/* every LZ4F_compressUpdate() call emits its input as a complete block */
+	prefs->autoFlush = 1;
+}
+
+/* LZ4F_resetDecompressionContext() first appeared in 1.8.0. before that, a decompression context cannot be safely reused after a partial frame */
+#define LZ4_DCTX_RESET_VERSION (10800)
+
+static void lz4_cctx_free(void* cctx){
+	LZ4F_freeCompressionContext(cctx);
+}
+
+#if LZ4_VERSION_NUMBER >= LZ4_DCTX_RESET_VERSION
+static void lz4_dctx_free(void* dctx){
+	LZ4F_freeDecompressionContext(dctx);
+}
+#endif
+
+/* gets a compression context for the calling worker.
+ * LZ4F_compressBegin() starts a fresh frame, so a context from a previous block can be reused as-is */
+static LZ4F_cctx* lz4_cctx_get(void){
+	LZ4F_cctx* cctx = ctxpool_take(CTXPOOL_LZ4F_CCTX, 0, 0, 0);
 	size_t err;
-	int ret = 0;
 
-	(void)flags;
+	if (cctx){
+		return cctx;
+	}
 
-	err = LZ4F_createCompressionContext(&ctx, LZ4F_VERSION);
+	err = LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
 	if (LZ4F_isError(err)){
 		log_error("Failed to create LZ4 compression context");
+		return NULL;
+	}
+	return cctx;
+}
+
+/* gets a decompression context for the calling worker */
+static LZ4F_dctx* lz4_dctx_get(void){
+	LZ4F_dctx* dctx;
+	size_t err;
+
+#if LZ4_VERSION_NUMBER >= LZ4_DCTX_RESET_VERSION
+	dctx = ctxpool_take(CTXPOOL_LZ4F_DCTX, 0, 0, 0);
+	if (dctx){
+		LZ4F_resetDecompressionContext(dctx);
+		return dctx;
+	}
+#endif
+
+	err = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+	if (LZ4F_isError(err)){
+		log_error("Failed to create LZ4 decompression context");
+		return NULL;
+	}
+	return dctx;
+}
+
+static void lz4_dctx_put(LZ4F_dctx* dctx){
+#if LZ4_VERSION_NUMBER >= LZ4_DCTX_RESET_VERSION
+	ctxpool_give(CTXPOOL_LZ4F_DCTX, 0, 0, 0, dctx, lz4_dctx_free);
+#else
+	LZ4F_freeDecompressionContext(dctx);
+#endif
+}
+
+static int lz4_compress_block(struct zip_block* block, unsigned thread_index, void* ctx){
+	struct lz4_parallel* lp = ctx;
+	LZ4F_cctx* cctx = NULL;
+	unsigned char header[LZ4F_HEADER_SIZE_MAX];
+	size_t bound;
+	size_t len;
+	int ret = 0;
+
+	(void)thread_index;
+
+	cctx = lz4_cctx_get();
+	if (!cctx){
+		return -1;
+	}
+
+	bound = LZ4F_compressBound(block->in_len, &lp->prefs);
+	if (block->out_size < bound){
+		unsigned char* tmp = realloc(block->out, bound);
+		if (!tmp){
+			log_enomem();
+			ret = -1;
+			goto cleanup;
+		}
+		block->out = tmp;
+		block->out_size = bound;
+	}
+
+	/* the context needs a frame header before it accepts data, but only the main thread's header is written */
+	len = LZ4F_compressBegin(cctx, header, sizeof(header), &lp->prefs);
+	if (LZ4F_isError(len)){
+		log_error_ex("Failed to write LZ4 header (%s)", LZ4F_getErrorName(len));
 		ret = -1;
 		goto cleanup;
 	}
 
-	fp_in = fopen(infile, "rb");
-	if (!fp_in){
-		log_efopen(infile);
+	len = LZ4F_compressUpdate(cctx, block->out, block->out_size, block->in, block->in_len, NULL);
+	if (LZ4F_isError(len)){
+		log_error_ex("LZ4 compression error (%s)", LZ4F_getErrorName(len));
 		ret = -1;
 		goto cleanup;
 	}
+	block->out_len = len;
 
-	fp_out = fopen(outfile, "wb");
-	if (!fp_out){
-		log_efopen(outfile);
+cleanup:
+	ctxpool_give(CTXPOOL_LZ4F_CCTX, 0, 0, 0, cctx, lz4_cctx_free);
+	return ret;
+}
+
+static int lz4_compress_parallel(FILE* fp_in, FILE* fp_out, int compression_level, unsigned flags, LZ4F_compressionContext_t ctx){
+	struct lz4_parallel lp;
+	unsigned char buf[LZ4F_HEADER_SIZE_MAX + 16];
+	size_t len;
+
+	lz4_parallel_prefs(&lp.prefs, compression_level, flags);
+	lp.block_size = flags & LZ4_BLOCK_4MB ? (1 << 22) : (1 << 20);
+
+	len = LZ4F_compressBegin(ctx, buf, sizeof(buf), &lp.prefs);
+	if (LZ4F_isError(len)){
+		log_error_ex("Failed to write LZ4 header (%s)", LZ4F_getErrorName(len));
+		return -1;
+	}
+	if (fwrite(buf, 1, len, fp_out) != len){
+		log_efwrite("lz4 output");
+		return -1;
+	}
+
+	if (zip_parallel_compress(fp_in, fp_out, ZIP_GET_THREADS(flags), lp.block_size, 0, lz4_compress_block, NULL, &lp) != 0){
+		return -1;
+	}
+
+	/* no data went through this context, so this is just the end mark */
+	len = LZ4F_compressEnd(ctx, buf, sizeof(buf), NULL);
+	if (LZ4F_isError(len)){
+		log_error("Failed to finish lz4 output");
+		return -1;
+	}
+	if (fwrite(buf, 1, len, fp_out) != len){
+		log_efwrite("lz4 output");
+		return -1;
+	}
+	return 0;
+}
+
+static int lz4_read_block(struct zip_block* block, FILE* fp_in, void* ctx){
+	struct lz4_parallel* lp = ctx;
+	unsigned char size_le[4];
+	unsigned long block_len;
+	size_t total;
+
+	if (fread(size_le, 1, sizeof(size_le), fp_in) != sizeof(size_le)){
+		log_error("Unexpected end of lz4 input file");
+		return -1;
+	}
+
+	block_len = (unsigned long)size_le[0] | ((unsigned long)size_le[1] << 8) | ((unsigned long)size_le[2] << 16) | ((unsigned long)size_le[3] << 24);
+	if (block_len == 0){
+		/* end mark */
+		return 0;
+	}
+	/* the high bit marks an uncompressed block */
+	block_len &= 0x7FFFFFFFUL;
+	if (block_len > lp->block_size){
+		log_error("Invalid LZ4 block size (possibly corrupted file)");
+		return -1;
+	}
+
+	/* each block is decompressed as the only block of a frame, so it gets a copy of the frame header */
+	total = lp->header_len + sizeof(size_le) + block_len + (lp->block_checksum ? 4 : 0);
+	if (block->in_size < total){
+		unsigned char* tmp = realloc(block->in_buf, total);
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		block->in_buf = tmp;
+		block->in_size = total;
+	}
+
+	memcpy(block->in_buf, lp->header, lp->header_len);
+	memcpy(block->in_buf + lp->header_len, size_le, sizeof(size_le));
+	if (fread(block->in_buf + lp->header_len + sizeof(size_le), 1, total - lp->header_len - sizeof(size_le), fp_in) != total - lp->header_len - sizeof(size_le)){
+		log_error("Unexpected end of lz4 input file");
+		return -1;
+	}
+
+	block->in = block->in_buf;
+	block->in_len = total;
+	return 1;
+}
+
+static int lz4_decompress_block(struct zip_block* block, unsigned thread_index, void* ctx){
+	struct lz4_parallel* lp = ctx;
+	LZ4F_dctx* dctx = NULL;
+	const unsigned char* src = block->in;
+	size_t src_left = block->in_len;
+	size_t err;
+	int ret = 0;
+
+	(void)thread_index;
+
+	dctx = lz4_dctx_get();
+	if (!dctx){
+		return -1;
+	}
+
+	if (block->out_size < lp->block_size){
+		unsigned char* tmp = realloc(block->out, lp->block_size);
+		if (!tmp){
+			log_enomem();
+			ret = -1;
+			goto cleanup;
+		}
+		block->out = tmp;
+		block->out_size = lp->block_size;
+	}
+
+	block->out_len = 0;
+	while (src_left > 0){
+		size_t dst_len = block->out_size - block->out_len;
+		size_t src_len = src_left;
+
+		/* this also verifies the block checksum if there is one */
+		err = LZ4F_decompress(dctx, block->out + block->out_len, &dst_len, src, &src_len, NULL);
+		if (LZ4F_isError(err)){
+			log_error_ex("LZ4 decompression error (%s)", LZ4F_getErrorName(err));
+			ret = -1;
+			goto cleanup;
+		}
+		if (src_len == 0 && dst_len == 0){
+			log_error("LZ4 decompression error (block does not fit)");
+			ret = -1;
+			goto cleanup;
+		}
+
+		src += src_len;
+		src_left -= src_len;
+		block->out_len += dst_len;
+	}
+
+cleanup:
+	lz4_dctx_put(dctx);
+	return ret;
+}
+
+static int lz4_decompress_parallel(FILE* fp_in, FILE* fp_out, const unsigned char* header, size_t header_len, const LZ4F_frameInfo_t* info, size_t block_size, unsigned threads){
+	struct lz4_parallel lp;
+
+	memcpy(lp.header, header, header_len);
+	lp.header_len = header_len;
+	lp.block_size = block_size;
+	lp.block_checksum = info->blockChecksumFlag == LZ4F_blockChecksumEnabled;
+
+	if (fseek(fp_in, (long)header_len, SEEK_SET) != 0){
+		log_error("Failed to seek past the lz4 frame header");
+		return -1;
+	}
+
+	return zip_parallel_decompress(fp_in, fp_out, threads, lz4_read_block, lz4_decompress_block, NULL, &lp);
+}
+
+int lz4_compress(FILE* fp_in, FILE* fp_out, int compression_level, unsigned flags){
+	LZ4F_compressionContext_t ctx = NULL;
+	size_t err;
+	int ret = 0;
+
+	err = LZ4F_createCompressionContext(&ctx, LZ4F_VERSION);
+	if (LZ4F_isError(err)){
+		log_error("Failed to create LZ4 compression context");
 		ret = -1;
 		goto cleanup;
 	}
@@ -130,7 +403,14 @@ int lz4_compress(const char* infile, const char* outfile, int compression_level,
 	else{
 		compression_level = 0;
 	}
-	if (lz4_compress_write(fp_in, fp_out, compression_level, ctx) != 0){
+	if (ZIP_GET_THREADS(flags) > 0){
+		if (lz4_compress_parallel(fp_in, fp_out, compression_level, flags, ctx) != 0){
+			log_error("Error compressing file");
+			ret = -1;
+			goto cleanup;
+		}
+	}
+	else if (lz4_compress_write(fp_in, fp_out, compression_level, flags, ctx) != 0){
 		log_error("Error compressing file");
 		ret = -1;
 		goto cleanup;
@@ -138,11 +418,6 @@ int lz4_compress(const char* infile, const char* outfile, int compression_level,
 
 cleanup:
 	LZ4F_freeCompressionContext(ctx);
-	fp_in ? fclose(fp_in) : 0;
-	if (fp_out && fclose(fp_out) != 0){
-		log_efclose(fp_out);
-		ret = -1;
-	}
 	return ret;
 }
 
@@ -196,7 +471,7 @@ static int lz4_decompress_internal(FILE* fp_in, FILE* fp_out, unsigned char* inb
 	return 0;
 }
 
-static int lz4_decompress_read(FILE* fp_in, FILE* fp_out, LZ4F_dctx* dctx){
+static int lz4_decompress_read(FILE* fp_in, FILE* fp_out, unsigned threads, LZ4F_dctx* dctx){
 	unsigned char inbuf[BUFFER_LEN];
 	size_t block_size = 0;
 	size_t in_len = 0;
@@ -236,6 +511,15 @@ static int lz4_decompress_read(FILE* fp_in, FILE* fp_out, LZ4F_dctx* dctx){
 		return -1;
 	}
 
+	/* blocks can only be decompressed on their own if they do not reference each other, and the content checksum needs all of the data in order */
+	if (threads > 0 && info.blockMode == LZ4F_blockIndependent && info.contentChecksumFlag == LZ4F_noContentChecksum && header_len <= LZ4F_HEADER_SIZE_MAX){
+		if (lz4_decompress_parallel(fp_in, fp_out, inbuf, header_len, &info, block_size, threads) != 0){
+			log_error("Failed to decompress data");
+			return -1;
+		}
+		return 0;
+	}
+
 	if (lz4_decompress_internal(fp_in, fp_out, inbuf, sizeof(inbuf), block_size, in_len, header_len, dctx) != 0){
 		log_error("Failed to decompress data");
 		return -1;
@@ -251,8 +535,6 @@ int lz4_decompress(const char* infile, const char* outfile, unsigned flags){
 	size_t err;
 	int ret = 0;
 
-	(void)flags;
-
 	err = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
 	if (LZ4F_isError(err)){
 		log_error("Failed to create LZ4 compression context");
@@ -274,7 +556,7 @@ int lz4_decompress(const char* infile, const char* outfile, unsigned flags){
 		goto cleanup;
 	}
 
-	if (lz4_decompress_read(fp_in, fp_out, dctx) != 0){
+	if (lz4_decompress_read(fp_in, fp_out, ZIP_GET_THREADS(flags), dctx) != 0){
 		log_error("Error decompressing file");
 		ret = -1;
 		goto cleanup;
@@ -290,4 +572,184 @@ cleanup:
 	return ret;
 }
 
+
+/* in-memory lz4.
+ * LZ4F_compressUpdate() needs room for a worst-case block, so compressed data goes through an internal buffer before it is copied to the caller */
+struct lz4_stream{
+	int write;
+	LZ4F_cctx* cctx;
+	LZ4F_dctx* dctx;
+	LZ4F_preferences_t prefs;
+	unsigned char* buf;
+	size_t buf_size;
+	size_t buf_len;
+	size_t buf_pos;
+	/* compression: the end mark was written. decompression: the last hint from LZ4F_decompress() */
+	int ended;
+	size_t hint;
+};
+
+/* same frame settings as lz4_compress_write() */
+static void lz4_stream_prefs(LZ4F_preferences_t* prefs, int compression_level, unsigned flags){
+	memset(prefs, 0, sizeof(*prefs));
+	prefs->frameInfo.blockSizeID = LZ4F_max256KB;
+	prefs->frameInfo.blockMode = LZ4F_blockLinked;
+	prefs->frameInfo.blockChecksumFlag = flags & LZ4_BLOCK_CHECKSUM ? LZ4F_blockChecksumEnabled : LZ4F_noBlockChecksum;
+	prefs->compressionLevel = compression_level;
+}
+
+struct lz4_stream* lz4_stream_new(int write, int compression_level, unsigned flags){
+	struct lz4_stream* ls;
+	size_t err;
+
+	ls = calloc(1, sizeof(*ls));
+	if (!ls){
+		log_enomem();
+		return NULL;
+	}
+	ls->write = write;
+
+	if (!write){
+		err = LZ4F_createDecompressionContext(&ls->dctx, LZ4F_VERSION);
+		if (LZ4F_isError(err)){
+			log_error("Failed to create LZ4 decompression context");
+			free(ls);
+			return NULL;
+		}
+		/* nonzero until a whole frame has been read */
+		ls->hint = 1;
+		return ls;
+	}
+
+	lz4_stream_prefs(&ls->prefs, compression_level, flags);
+
+	err = LZ4F_createCompressionContext(&ls->cctx, LZ4F_VERSION);
+	if (LZ4F_isError(err)){
+		log_error("Failed to create LZ4 compression context");
+		free(ls);
+		return NULL;
+	}
+
+	ls->buf_size = LZ4F_compressBound(BUFFER_LEN, &ls->prefs);
+	if (ls->buf_size < LZ4F_HEADER_SIZE_MAX){
+		ls->buf_size = LZ4F_HEADER_SIZE_MAX;
+	}
+	ls->buf = malloc(ls->buf_size);
+	if (!ls->buf){
+		log_enomem();
+		lz4_stream_free(ls);
+		return NULL;
+	}
+
+	err = LZ4F_compressBegin(ls->cctx, ls->buf, ls->buf_size, &ls->prefs);
+	if (LZ4F_isError(err)){
+		log_error_ex("Failed to write LZ4 header (%s)", LZ4F_getErrorName(err));
+		lz4_stream_free(ls);
+		return NULL;
+	}
+	ls->buf_len = err;
+	return ls;
+}
+
+static int lz4_stream_compress(struct lz4_stream* ls, const unsigned char* in, size_t in_len, size_t* in_used, unsigned char* out, size_t out_size, size_t* out_len, int finish){
+	for (;;){
+		size_t n = ls->buf_len - ls->buf_pos;
+		size_t len;
+
+		if (n > out_size - *out_len){
+			n = out_size - *out_len;
+		}
+		if (n > 0){
+			memcpy(out + *out_len, ls->buf + ls->buf_pos, n);
+		}
+		ls->buf_pos += n;
+		*out_len += n;
+		if (ls->buf_pos < ls->buf_len){
+			return 1;
+		}
+		ls->buf_pos = ls->buf_len = 0;
+
+		if (*in_used < in_len){
+			size_t chunk = in_len - *in_used < BUFFER_LEN ? in_len - *in_used : BUFFER_LEN;
+
+			len = LZ4F_compressUpdate(ls->cctx, ls->buf, ls->buf_size, in + *in_used, chunk, NULL);
+			if (LZ4F_isError(len)){
+				log_error_ex("LZ4 compression error (%s)", LZ4F_getErrorName(len));
+				return -1;
+			}
+			ls->buf_len = len;
+			*in_used += chunk;
+		}
+		else if (finish && !ls->ended){
+			len = LZ4F_compressEnd(ls->cctx, ls->buf, ls->buf_size, NULL);
+			if (LZ4F_isError(len)){
+				log_error_ex("Failed to finish lz4 output (%s)", LZ4F_getErrorName(len));
+				return -1;
+			}
+			ls->buf_len = len;
+			ls->ended = 1;
+		}
+		else{
+			return ls->ended ? 0 : 1;
+		}
+	}
+}
+
+static int lz4_stream_decompress(struct lz4_stream* ls, const unsigned char* in, size_t in_len, size_t* in_used, unsigned char* out, size_t out_size, size_t* out_len){
+	/* at the end of a frame, asking for more would only make the decompressor wait for the next frame's header */
+	if (ls->hint == 0 && in_len == 0){
+		return 0;
+	}
+
+	do{
+		size_t src_len = in_len - *in_used;
+		size_t dst_len = out_size - *out_len;
+		size_t hint;
+
+		hint = LZ4F_decompress(ls->dctx, out + *out_len, &dst_len, in + *in_used, &src_len, NULL);
+		if (LZ4F_isError(hint)){
+			log_error_ex("LZ4 decompression error (%s)", LZ4F_getErrorName(hint));
+			return -1;
+		}
+		*in_used += src_len;
+		*out_len += dst_len;
+		ls->hint = hint;
+
+		/* stop at the end of a frame for the same reason as above */
+		if ((src_len == 0 && dst_len == 0) || (hint == 0 && *in_used == in_len)){
+			break;
+		}
+	}while (*in_used < in_len || *out_len < out_size);
+
+	return ls->hint == 0 ? 0 : 1;
+}
+
+/* returns 0 if the stream is at the end of a frame, 1 if it is not, or negative on failure */
+int lz4_stream_code(struct lz4_stream* ls, const unsigned char* in, size_t in_len, size_t* in_used, unsigned char* out, size_t out_size, size_t* out_len, int finish){
+	*in_used = 0;
+	*out_len = 0;
+
+	if (ls->write){
+		return lz4_stream_compress(ls, in, in_len, in_used, out, out_size, out_len, finish);
+	}
+	return lz4_stream_decompress(ls, in, in_len, in_used, out, out_size, out_len);
+}
+
+void lz4_stream_free(struct lz4_stream* ls){
+	if (!ls){
+		return;
+	}
+	ls->cctx ? LZ4F_freeCompressionContext(ls->cctx) : 0;
+	ls->dctx ? LZ4F_freeDecompressionContext(ls->dctx) : 0;
+	free(ls->buf);
+	free(ls);
+}
+
+size_t lz4_stream_bound(size_t in_len, unsigned flags){
+	LZ4F_preferences_t prefs;
+
+	lz4_stream_prefs(&prefs, 0, flags);
+	return LZ4F_compressFrameBound(in_len, &prefs);
+}
+
 #endif
@@ -15,7 +15,12 @@
 
 #include "zip.h"
 
-int lz4_compress(const char* infile, const char* outfile, int compression_level, unsigned flags);
+int lz4_compress(FILE* fp_in, FILE* fp_out, int compression_level, unsigned flags);
 int lz4_decompress(const char* infile, const char* outfile, unsigned flags);
 
+struct lz4_stream* lz4_stream_new(int write, int compression_level, unsigned flags);
+int lz4_stream_code(struct lz4_stream* ls, const unsigned char* in, size_t in_len, size_t* in_used, unsigned char* out, size_t out_size, size_t* out_len, int finish);
+void lz4_stream_free(struct lz4_stream* ls);
+size_t lz4_stream_bound(size_t in_len, unsigned flags);
+
 #endif
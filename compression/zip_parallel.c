@@ -0,0 +1,235 @@
+/** @file compression/zip_parallel.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#define __ZIP_INTERNAL
+#include "zip_parallel.h"
+#include "../log.h"
+#include "../filehelper.h"
+#include "../threadpool.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct zip_block_job{
+	struct zip_block block;
+	zip_block_compress_fn compress;
+	void* ctx;
+};
+
+static void zip_block_job_run(void* arg, unsigned thread_index){
+	struct zip_block_job* job = arg;
+	job->block.status = job->compress(&job->block, thread_index, job->ctx);
+}
+
+static int write_block_default(struct zip_block* block, FILE* fp_out, void* ctx){
+	(void)ctx;
+	if (fwrite(block->out, 1, block->out_len, fp_out) != block->out_len){
+		log_efwrite("file");
+		return -1;
+	}
+	return 0;
+}
+
+/* processes n jobs on the threadpool and writes them in order */
+static int run_batch(struct threadpool* tp, struct zip_block_job* jobs, size_t n, FILE* fp_out, zip_block_write_fn write, void* ctx){
+	size_t i;
+
+	for (i = 0; i < n; ++i){
+		if (tp_submit(tp, zip_block_job_run, &jobs[i]) != 0){
+			tp_wait(tp);
+			return -1;
+		}
+	}
+	tp_wait(tp);
+
+	for (i = 0; i < n; ++i){
+		if (jobs[i].block.status != 0){
+			log_error("Failed to process block");
+			return -1;
+		}
+		if (write(&jobs[i].block, fp_out, ctx) != 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void free_jobs(struct zip_block_job* jobs, size_t n_jobs){
+	size_t i;
+
+	if (!jobs){
+		return;
+	}
+	for (i = 0; i < n_jobs; ++i){
+		free(jobs[i].block.in_buf);
+		free(jobs[i].block.out);
+	}
+	free(jobs);
+}
+
+int zip_parallel_compress(FILE* fp_in, FILE* fp_out, unsigned threads, size_t block_size, size_t dict_size, zip_block_compress_fn compress, zip_block_write_fn write, void* ctx){
+	struct threadpool* tp = NULL;
+	struct zip_block_job* jobs = NULL;
+	unsigned char* buf = NULL;
+	size_t n_jobs;
+	/* the last dict_size bytes of the previous batch are kept directly in front of the new input */
+	size_t dict_avail = 0;
+	int eof = 0;
+	int ret = 0;
+
+	if (!write){
+		write = write_block_default;
+	}
+
+	n_jobs = (threads > 0 ? threads : 1) * ZIP_PARALLEL_BATCH_FACTOR;
+
+	buf = malloc(dict_size + n_jobs * block_size);
+	jobs = calloc(n_jobs, sizeof(*jobs));
+	if (!buf || !jobs){
+		log_enomem();
+		ret = -1;
+		goto cleanup;
+	}
+
+	tp = tp_new(threads);
+	if (!tp){
+		log_error("Failed to create threadpool");
+		ret = -1;
+		goto cleanup;
+	}
+
+	do{
+		unsigned char* dict_start = buf + dict_size - dict_avail;
+		size_t pos = dict_size;
+		size_t n = 0;
+		size_t keep;
+
+		while (n < n_jobs){
+			int len = read_file(fp_in, buf + pos, block_size);
+			if (len < 0){
+				ret = -1;
+				goto cleanup;
+			}
+			/* an empty input still gets one (empty) final block */
+			if (len == 0 && n > 0){
+				eof = 1;
+				break;
+			}
+
+			jobs[n].block.in = buf + pos;
+			jobs[n].block.in_len = len;
+			jobs[n].block.dict_len = (size_t)(buf + pos - dict_start) < dict_size ? (size_t)(buf + pos - dict_start) : dict_size;
+			jobs[n].block.dict = buf + pos - jobs[n].block.dict_len;
+			jobs[n].block.last = 0;
+			jobs[n].block.status = 0;
+			jobs[n].compress = compress;
+			jobs[n].ctx = ctx;
+			pos += len;
+			n++;
+
+			if ((size_t)len < block_size){
+				eof = 1;
+				break;
+			}
+		}
+
+		/* the final block has to be marked before it is compressed, so peek for the end of the file */
+		if (!eof){
+			int c = fgetc(fp_in);
+			if (c == EOF){
+				eof = 1;
+			}
+			else{
+				ungetc(c, fp_in);
+			}
+		}
+		if (eof){
+			jobs[n - 1].block.last = 1;
+		}
+
+		if (run_batch(tp, jobs, n, fp_out, write, ctx) != 0){
+			ret = -1;
+			goto cleanup;
+		}
+
+		keep = (size_t)(buf + pos - dict_start) < dict_size ? (size_t)(buf + pos - dict_start) : dict_size;
+		memmove(buf + dict_size - keep, buf + pos - keep, keep);
+		dict_avail = keep;
+	}while (!eof);
+
+cleanup:
+	tp_free(tp);
+	free_jobs(jobs, n_jobs);
+	free(buf);
+	return ret;
+}
+
+int zip_parallel_decompress(FILE* fp_in, FILE* fp_out, unsigned threads, zip_block_read_fn read, zip_block_compress_fn decompress, zip_block_write_fn write, void* ctx){
+	struct threadpool* tp = NULL;
+	struct zip_block_job* jobs = NULL;
+	size_t n_jobs;
+	int eof = 0;
+	int ret = 0;
+
+	if (!write){
+		write = write_block_default;
+	}
+
+	n_jobs = (threads > 0 ? threads : 1) * ZIP_PARALLEL_BATCH_FACTOR;
+
+	jobs = calloc(n_jobs, sizeof(*jobs));
+	if (!jobs){
+		log_enomem();
+		ret = -1;
+		goto cleanup;
+	}
+
+	tp = tp_new(threads);
+	if (!tp){
+		log_error("Failed to create threadpool");
+		ret = -1;
+		goto cleanup;
+	}
+
+	do{
+		size_t n = 0;
+
+		while (n < n_jobs){
+			int res;
+
+			jobs[n].block.in = NULL;
+			jobs[n].block.in_len = 0;
+			jobs[n].block.dict = NULL;
+			jobs[n].block.dict_len = 0;
+			jobs[n].block.last = 0;
+			jobs[n].block.status = 0;
+			jobs[n].compress = decompress;
+			jobs[n].ctx = ctx;
+
+			res = read(&jobs[n].block, fp_in, ctx);
+			if (res < 0){
+				ret = -1;
+				goto cleanup;
+			}
+			if (res == 0){
+				eof = 1;
+				break;
+			}
+			n++;
+		}
+
+		if (run_batch(tp, jobs, n, fp_out, write, ctx) != 0){
+			ret = -1;
+			goto cleanup;
+		}
+	}while (!eof);
+
+cleanup:
+	tp_free(tp);
+	free_jobs(jobs, n_jobs);
+	return ret;
+}
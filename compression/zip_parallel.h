@@ -0,0 +1,129 @@
+/** @file compression/zip_parallel.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __COMPRESSION_ZIP_PARALLEL_H
+#define __COMPRESSION_ZIP_PARALLEL_H
+
+#ifndef __ZIP_INTERNAL
+#error "Include zip.h, not zip_parallel.h"
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**
+ * @brief The amount of blocks read per worker thread before waiting for all of them to be compressed.
+ */
+#define ZIP_PARALLEL_BATCH_FACTOR (2)
+
+/**
+ * @brief A block of input that is compressed independently on a worker thread.
+ */
+struct zip_block{
+	const unsigned char* in;   /**< @brief The input data. */
+	size_t in_len;             /**< @brief The length of the input data. */
+	unsigned char* in_buf;     /**< @brief A buffer owned by the block that a read function can place the input in. The read function must (re)allocate this as needed. */
+	size_t in_size;            /**< @brief The amount of bytes allocated for in_buf. */
+	const unsigned char* dict; /**< @brief The input data directly preceding this block, for compressors that use preset dictionaries. */
+	size_t dict_len;           /**< @brief The length of the dictionary. This is 0 for the first block. */
+	int last;                  /**< @brief True if this is the final block of the input. */
+	unsigned char* out;        /**< @brief The compressed data. The compression function must (re)allocate this as needed. */
+	size_t out_len;            /**< @brief The length of the compressed data. */
+	size_t out_size;           /**< @brief The amount of bytes allocated for the compressed data. */
+	unsigned long check;       /**< @brief A compressor-specific checksum of the block (e.g. crc32). */
+	int status;                /**< @brief 0 if the block was compressed successfully, or negative on failure. */
+};
+
+/**
+ * @brief Compresses or decompresses a single block on a worker thread.
+ *
+ * @param block The block to process.<br>
+ * The function must fill block->out, block->out_len, and optionally block->check.
+ *
+ * @param thread_index The index of the worker thread, from 0 to threads - 1.
+ *
+ * @param ctx The context given to zip_parallel_compress().
+ *
+ * @return 0 on success, or negative on failure.
+ */
+typedef int (*zip_block_compress_fn)(struct zip_block* block, unsigned thread_index, void* ctx);
+
+/**
+ * @brief Reads the next compressed unit (e.g. a block or stream) of a file on the calling thread.
+ *
+ * @param block The block to fill.<br>
+ * The function must point block->in at the data, usually within block->in_buf.
+ *
+ * @param fp_in The input file.
+ *
+ * @param ctx The context given to zip_parallel_decompress().
+ *
+ * @return Positive if a unit was read, 0 if there are no more units, or negative on failure.
+ */
+typedef int (*zip_block_read_fn)(struct zip_block* block, FILE* fp_in, void* ctx);
+
+/**
+ * @brief Writes a processed block on the calling thread.<br>
+ * Blocks are written in the same order as they appear in the input.
+ *
+ * @param block The compressed block.
+ *
+ * @param fp_out The output file.
+ *
+ * @param ctx The context given to zip_parallel_compress().
+ *
+ * @return 0 on success, or negative on failure.
+ */
+typedef int (*zip_block_write_fn)(struct zip_block* block, FILE* fp_out, void* ctx);
+
+/**
+ * @brief Splits a file into fixed-size blocks, compresses them in parallel, and writes them in order.<br>
+ * At least one block is always produced, even if the input is empty, so the final block can terminate the stream.
+ *
+ * @param fp_in The file to read from.
+ *
+ * @param fp_out The file to write to.
+ *
+ * @param threads The amount of worker threads to use.
+ *
+ * @param block_size The size of each block in bytes.
+ *
+ * @param dict_size The maximum amount of preceding input to give each block as block->dict.
+ *
+ * @param compress The function that compresses each block.
+ *
+ * @param write The function that writes each block, or NULL to write block->out as-is.
+ *
+ * @param ctx A context to pass to compress and write.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int zip_parallel_compress(FILE* fp_in, FILE* fp_out, unsigned threads, size_t block_size, size_t dict_size, zip_block_compress_fn compress, zip_block_write_fn write, void* ctx);
+
+/**
+ * @brief Reads a compressed file unit by unit, decompresses the units in parallel, and writes them in order.
+ *
+ * @param fp_in The file to read from.
+ *
+ * @param fp_out The file to write to.
+ *
+ * @param threads The amount of worker threads to use.
+ *
+ * @param read The function that splits the input into units.
+ *
+ * @param decompress The function that decompresses each unit.
+ *
+ * @param write The function that writes each unit, or NULL to write block->out as-is.
+ *
+ * @param ctx A context to pass to read, decompress, and write.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int zip_parallel_decompress(FILE* fp_in, FILE* fp_out, unsigned threads, zip_block_read_fn read, zip_block_compress_fn decompress, zip_block_write_fn write, void* ctx);
+
+#endif
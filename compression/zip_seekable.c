@@ -0,0 +1,649 @@
+/** @file compression/zip_seekable.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#define __ZIP_INTERNAL
+#include "zip_seekable.h"
+#include "zip.h"
+#include "zip_parallel.h"
+#include "../log.h"
+#include "../crc32c.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* a seekable container is laid out as follows. all integers are little-endian.
+ *
+ * block 0 .. block n-1: each block is a complete stream of the container's compressor
+ * index:  n entries of
+ *         u64 decompressed offset
+ *         u64 compressed offset
+ *         u32 compressed length
+ *         u32 decompressed length
+ *         u32 crc32c of the decompressed data
+ * footer: u64 n
+ *         u32 block size
+ *         u32 crc32c of the index
+ *         u8  compressor
+ *         u8  version
+ *         u16 reserved
+ *         8 byte magic
+ */
+#define SEEKABLE_MAGIC "EZBSEEK1"
+#define SEEKABLE_VERSION (1)
+#define SEEKABLE_ENTRY_LEN (28)
+#define SEEKABLE_FOOTER_LEN (28)
+
+struct seekable_entry{
+	uint64_t u_off;
+	uint64_t c_off;
+	uint32_t c_len;
+	uint32_t u_len;
+	uint32_t crc;
+};
+
+struct zip_seekable{
+	FILE* fp;
+	enum compressor c_type;
+	uint32_t block_size;
+	struct seekable_entry* entries;
+	size_t n_entries;
+	/* the most recently decompressed block, since reads tend to be sequential */
+	unsigned char* cache;
+	size_t cache_index;
+	int cache_valid;
+	unsigned char* in_buf;
+	size_t in_size;
+	uint32_t index_crc;
+	/* where zip_seekable_decode() is up to */
+	uint64_t decode_pos;
+	size_t decode_next;
+	size_t decode_len;
+};
+
+static void put_u16(unsigned char* ptr, unsigned val){
+	ptr[0] = val & 0xFF;
+	ptr[1] = (val >> 8) & 0xFF;
+}
+
+static void put_u32(unsigned char* ptr, uint32_t val){
+	put_u16(ptr, val & 0xFFFF);
+	put_u16(ptr + 2, val >> 16);
+}
+
+static void put_u64(unsigned char* ptr, uint64_t val){
+	put_u32(ptr, (uint32_t)(val & 0xFFFFFFFFUL));
+	put_u32(ptr + 4, (uint32_t)(val >> 32));
+}
+
+static uint32_t get_u32(const unsigned char* ptr){
+	return (uint32_t)ptr[0] | (uint32_t)ptr[1] << 8 | (uint32_t)ptr[2] << 16 | (uint32_t)ptr[3] << 24;
+}
+
+static uint64_t get_u64(const unsigned char* ptr){
+	return (uint64_t)get_u32(ptr) | (uint64_t)get_u32(ptr + 4) << 32;
+}
+
+static int grow_buffer(unsigned char** buf, size_t* size, size_t len){
+	unsigned char* tmp;
+
+	if (*size >= len){
+		return 0;
+	}
+	tmp = realloc(*buf, len);
+	if (!tmp){
+		log_enomem();
+		return -1;
+	}
+	*buf = tmp;
+	*size = len;
+	return 0;
+}
+
+struct seekable_writer{
+	enum compressor c_type;
+	int level;
+	/* flags given to each block, which is compressed on a single thread */
+	unsigned block_flags;
+	struct seekable_entry* entries;
+	size_t n_entries;
+	size_t entries_size;
+	uint64_t u_off;
+	uint64_t c_off;
+};
+
+static int seekable_compress_block(struct zip_block* block, unsigned thread_index, void* ctx){
+	struct seekable_writer* sw = ctx;
+	size_t bound = zip_compress_bound(sw->c_type, block->in_len, sw->block_flags);
+	(void)thread_index;
+
+	if (grow_buffer(&block->out, &block->out_size, bound) != 0){
+		return -1;
+	}
+	if (zip_compress_buffer(block->in, block->in_len, block->out, block->out_size, &block->out_len, sw->c_type, sw->level, sw->block_flags) != 0){
+		return -1;
+	}
+	block->check = crc32c(0, block->in, block->in_len);
+	return 0;
+}
+
+static int seekable_write_block(struct zip_block* block, FILE* fp_out, void* ctx){
+	struct seekable_writer* sw = ctx;
+	struct seekable_entry* e;
+
+	/* the pipeline ends with an empty block when the input is a multiple of the block size */
+	if (block->in_len == 0){
+		return 0;
+	}
+
+	if (sw->n_entries == sw->entries_size){
+		size_t size = sw->entries_size ? sw->entries_size * 2 : 64;
+		struct seekable_entry* tmp = realloc(sw->entries, size * sizeof(*tmp));
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		sw->entries = tmp;
+		sw->entries_size = size;
+	}
+
+	if (fwrite(block->out, 1, block->out_len, fp_out) != block->out_len){
+		log_efwrite("file");
+		return -1;
+	}
+
+	e = &sw->entries[sw->n_entries];
+	e->u_off = sw->u_off;
+	e->c_off = sw->c_off;
+	e->c_len = (uint32_t)block->out_len;
+	e->u_len = (uint32_t)block->in_len;
+	e->crc = (uint32_t)block->check;
+	sw->n_entries++;
+	sw->u_off += block->in_len;
+	sw->c_off += block->out_len;
+	return 0;
+}
+
+static int seekable_write_index(const struct seekable_writer* sw, uint32_t block_size, FILE* fp_out){
+	unsigned char entry[SEEKABLE_ENTRY_LEN];
+	unsigned char footer[SEEKABLE_FOOTER_LEN];
+	uint32_t crc = 0;
+	size_t i;
+
+	for (i = 0; i < sw->n_entries; ++i){
+		put_u64(entry, sw->entries[i].u_off);
+		put_u64(entry + 8, sw->entries[i].c_off);
+		put_u32(entry + 16, sw->entries[i].c_len);
+		put_u32(entry + 20, sw->entries[i].u_len);
+		put_u32(entry + 24, sw->entries[i].crc);
+		crc = crc32c(crc, entry, sizeof(entry));
+		if (fwrite(entry, 1, sizeof(entry), fp_out) != sizeof(entry)){
+			log_efwrite("file");
+			return -1;
+		}
+	}
+
+	put_u64(footer, sw->n_entries);
+	put_u32(footer + 8, block_size);
+	put_u32(footer + 12, crc);
+	footer[16] = (unsigned char)sw->c_type;
+	footer[17] = SEEKABLE_VERSION;
+	put_u16(footer + 18, 0);
+	memcpy(footer + 20, SEEKABLE_MAGIC, 8);
+	if (fwrite(footer, 1, sizeof(footer), fp_out) != sizeof(footer)){
+		log_efwrite("file");
+		return -1;
+	}
+	return 0;
+}
+
+int seekable_compress(FILE* fp_in, FILE* fp_out, enum compressor c_type, int compression_level, unsigned flags){
+	struct seekable_writer sw;
+	unsigned block_shift = ZIP_GET_BLOCK_SHIFT(flags);
+	uint32_t block_size = block_shift > 0 && block_shift < 31 ? (uint32_t)1 << block_shift : ZIP_SEEKABLE_BLOCK_SIZE;
+	int ret = 0;
+
+	memset(&sw, 0, sizeof(sw));
+	sw.c_type = c_type;
+	sw.level = compression_level;
+	sw.block_flags = flags & ~(ZIP_THREADS(0xFF) | ZIP_BLOCK_SHIFT(0xFF) | ZIP_SEEKABLE);
+
+	if (zip_parallel_compress(fp_in, fp_out, ZIP_GET_THREADS(flags), block_size, 0, seekable_compress_block, seekable_write_block, &sw) != 0){
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (seekable_write_index(&sw, block_size, fp_out) != 0){
+		log_error("Failed to write block index");
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	free(sw.entries);
+	return ret;
+}
+
+/* reads the footer at the end of a container container_len bytes long.
+ * returns the length of the index in front of it, or negative on failure */
+static long seekable_parse_footer(struct zip_seekable* zsk, const unsigned char* footer, uint64_t container_len, const char* name){
+	uint64_t n;
+
+	if (container_len < SEEKABLE_FOOTER_LEN || memcmp(footer + 20, SEEKABLE_MAGIC, 8) != 0){
+		log_error_ex("%s is not a seekable container", name);
+		return -1;
+	}
+	if (footer[17] != SEEKABLE_VERSION){
+		log_error_ex2("%s has unsupported seekable container version %d", name, footer[17]);
+		return -1;
+	}
+
+	n = get_u64(footer);
+	zsk->block_size = get_u32(footer + 8);
+	zsk->index_crc = get_u32(footer + 12);
+	zsk->c_type = (enum compressor)footer[16];
+	if (n > (container_len - SEEKABLE_FOOTER_LEN) / SEEKABLE_ENTRY_LEN || zsk->block_size == 0){
+		log_error_ex("The index of %s is corrupt", name);
+		return -1;
+	}
+	zsk->n_entries = (size_t)n;
+	return (long)(zsk->n_entries * SEEKABLE_ENTRY_LEN);
+}
+
+static int seekable_parse_index(struct zip_seekable* zsk, const unsigned char* index, const char* name){
+	uint64_t u_off = 0;
+	uint64_t c_off = 0;
+	size_t i;
+
+	if (crc32c(0, index, zsk->n_entries * SEEKABLE_ENTRY_LEN) != zsk->index_crc){
+		log_error_ex("The index of %s is corrupt", name);
+		return -1;
+	}
+
+	zsk->entries = malloc(zsk->n_entries * sizeof(*zsk->entries) + 1);
+	if (!zsk->entries){
+		log_enomem();
+		return -1;
+	}
+
+	/* the blocks must be contiguous, or a lookup could land in the wrong one */
+	for (i = 0; i < zsk->n_entries; ++i){
+		struct seekable_entry* e = &zsk->entries[i];
+		const unsigned char* ptr = index + i * SEEKABLE_ENTRY_LEN;
+
+		e->u_off = get_u64(ptr);
+		e->c_off = get_u64(ptr + 8);
+		e->c_len = get_u32(ptr + 16);
+		e->u_len = get_u32(ptr + 20);
+		e->crc = get_u32(ptr + 24);
+		if (e->u_off != u_off || e->c_off != c_off || e->u_len > zsk->block_size){
+			log_error_ex("The index of %s is corrupt", name);
+			return -1;
+		}
+		u_off += e->u_len;
+		c_off += e->c_len;
+	}
+	return 0;
+}
+
+static int seekable_read_index(struct zip_seekable* zsk, const char* file){
+	unsigned char footer[SEEKABLE_FOOTER_LEN];
+	unsigned char* index = NULL;
+	long file_len;
+	long index_len;
+	int ret = 0;
+
+	if (fseek(zsk->fp, 0, SEEK_END) != 0 || (file_len = ftell(zsk->fp)) < 0){
+		log_error_ex2("Failed to determine the size of %s (%s)", file, strerror(errno));
+		return -1;
+	}
+	if (file_len < SEEKABLE_FOOTER_LEN || fseek(zsk->fp, file_len - SEEKABLE_FOOTER_LEN, SEEK_SET) != 0 ||
+			fread(footer, 1, sizeof(footer), zsk->fp) != sizeof(footer)){
+		log_error_ex("%s is not a seekable container", file);
+		return -1;
+	}
+	if ((index_len = seekable_parse_footer(zsk, footer, (uint64_t)file_len, file)) < 0){
+		return -1;
+	}
+
+	index = malloc(index_len + 1);
+	if (!index){
+		log_enomem();
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (fseek(zsk->fp, file_len - SEEKABLE_FOOTER_LEN - index_len, SEEK_SET) != 0 ||
+			fread(index, 1, index_len, zsk->fp) != (size_t)index_len){
+		log_efread(file);
+		ret = -1;
+		goto cleanup;
+	}
+	ret = seekable_parse_index(zsk, index, file);
+
+cleanup:
+	free(index);
+	return ret;
+}
+
+struct zip_seekable* zip_seekable_open(const char* file){
+	struct zip_seekable* zsk;
+
+	return_ifnull(file, NULL);
+
+	zsk = calloc(1, sizeof(*zsk));
+	if (!zsk){
+		log_enomem();
+		return NULL;
+	}
+
+	zsk->fp = fopen(file, "rb");
+	if (!zsk->fp){
+		log_efopen(file);
+		zip_seekable_close(zsk);
+		return NULL;
+	}
+
+	if (seekable_read_index(zsk, file) != 0){
+		zip_seekable_close(zsk);
+		return NULL;
+	}
+	return zsk;
+}
+
+uint64_t zip_seekable_size(const struct zip_seekable* zsk){
+	const struct seekable_entry* last;
+
+	if (!zsk || zsk->n_entries == 0){
+		return 0;
+	}
+	last = &zsk->entries[zsk->n_entries - 1];
+	return last->u_off + last->u_len;
+}
+
+/* decompresses a block into out, which must be at least block_size bytes */
+static int seekable_load_block(struct zip_seekable* zsk, size_t index, unsigned char* out){
+	const struct seekable_entry* e = &zsk->entries[index];
+	size_t out_len;
+
+	if (grow_buffer(&zsk->in_buf, &zsk->in_size, e->c_len) != 0){
+		return -1;
+	}
+	if (fseek(zsk->fp, (long)e->c_off, SEEK_SET) != 0 || fread(zsk->in_buf, 1, e->c_len, zsk->fp) != e->c_len){
+		log_error_ex("Failed to read block %lu", (unsigned long)index);
+		return -1;
+	}
+	if (zip_decompress_buffer(zsk->in_buf, e->c_len, out, zsk->block_size, &out_len, zsk->c_type, 0) != 0 ||
+			out_len != e->u_len || crc32c(0, out, out_len) != e->crc){
+		log_error_ex("Block %lu is corrupt", (unsigned long)index);
+		return -1;
+	}
+	return 0;
+}
+
+int zip_seekable_read(struct zip_seekable* zsk, uint64_t offset, void* out, size_t len, size_t* out_len){
+	unsigned char* dst = out;
+	size_t lo;
+	size_t hi;
+
+	return_ifnull(zsk, -1);
+	return_ifnull(out_len, -1);
+
+	*out_len = 0;
+	if (offset >= zip_seekable_size(zsk)){
+		return 0;
+	}
+
+	if (!zsk->cache){
+		zsk->cache = malloc(zsk->block_size);
+		if (!zsk->cache){
+			log_enomem();
+			return -1;
+		}
+	}
+
+	/* find the last block starting at or before the offset */
+	lo = 0;
+	hi = zsk->n_entries - 1;
+	while (lo < hi){
+		size_t mid = lo + (hi - lo + 1) / 2;
+		if (zsk->entries[mid].u_off <= offset){
+			lo = mid;
+		}
+		else{
+			hi = mid - 1;
+		}
+	}
+
+	for (; lo < zsk->n_entries && *out_len < len; ++lo){
+		const struct seekable_entry* e = &zsk->entries[lo];
+		uint64_t start = offset + *out_len - e->u_off;
+		size_t n = e->u_len - (size_t)start;
+
+		if (!zsk->cache_valid || zsk->cache_index != lo){
+			zsk->cache_valid = 0;
+			if (seekable_load_block(zsk, lo, zsk->cache) != 0){
+				return -1;
+			}
+			zsk->cache_index = lo;
+			zsk->cache_valid = 1;
+		}
+
+		if (n > len - *out_len){
+			n = len - *out_len;
+		}
+		memcpy(dst + *out_len, zsk->cache + start, n);
+		*out_len += n;
+	}
+	return 0;
+}
+
+void zip_seekable_close(struct zip_seekable* zsk){
+	if (!zsk){
+		return;
+	}
+	zsk->fp ? fclose(zsk->fp) : 0;
+	free(zsk->entries);
+	free(zsk->cache);
+	free(zsk->in_buf);
+	free(zsk);
+}
+
+struct zip_seekable* zip_seekable_from_tail(const void* tail, size_t tail_len, uint64_t container_len, size_t* needed){
+	const unsigned char* end = (const unsigned char*)tail + tail_len;
+	const struct seekable_entry* last;
+	struct zip_seekable* zsk;
+	long index_len;
+
+	return_ifnull(tail, NULL);
+	return_ifnull(needed, NULL);
+
+	*needed = 0;
+	if (tail_len < SEEKABLE_FOOTER_LEN || tail_len > container_len){
+		log_error("The container is too short to be seekable");
+		return NULL;
+	}
+
+	zsk = calloc(1, sizeof(*zsk));
+	if (!zsk){
+		log_enomem();
+		return NULL;
+	}
+
+	if ((index_len = seekable_parse_footer(zsk, end - SEEKABLE_FOOTER_LEN, container_len, "The container")) < 0){
+		zip_seekable_close(zsk);
+		return NULL;
+	}
+	if ((size_t)index_len > tail_len - SEEKABLE_FOOTER_LEN){
+		*needed = (size_t)index_len + SEEKABLE_FOOTER_LEN;
+		zip_seekable_close(zsk);
+		return NULL;
+	}
+	if (seekable_parse_index(zsk, end - SEEKABLE_FOOTER_LEN - index_len, "The container") != 0){
+		zip_seekable_close(zsk);
+		return NULL;
+	}
+	/* the index must be right behind the last block, or the blocks would be decoded from the wrong bytes */
+	last = zsk->n_entries > 0 ? &zsk->entries[zsk->n_entries - 1] : NULL;
+	if ((last ? last->c_off + last->c_len : 0) != container_len - SEEKABLE_FOOTER_LEN - index_len){
+		log_error("The index of the container is corrupt");
+		zip_seekable_close(zsk);
+		return NULL;
+	}
+	return zsk;
+}
+
+int zip_seekable_decode(struct zip_seekable* zsk, const void* in, size_t in_len, size_t* in_used, const void** out, size_t* out_len){
+	const struct seekable_entry* e;
+	size_t n;
+
+	return_ifnull(zsk, -1);
+	return_ifnull(in_used, -1);
+	return_ifnull(out, -1);
+	return_ifnull(out_len, -1);
+
+	*out = NULL;
+	*out_len = 0;
+
+	/* everything after the last block is the index, which has already been read */
+	if (zsk->decode_next == zsk->n_entries){
+		*in_used = in_len;
+		zsk->decode_pos += in_len;
+		return 0;
+	}
+	e = &zsk->entries[zsk->decode_next];
+
+	if (grow_buffer(&zsk->in_buf, &zsk->in_size, e->c_len) != 0){
+		return -1;
+	}
+	if (!zsk->cache){
+		zsk->cache = malloc(zsk->block_size);
+		if (!zsk->cache){
+			log_enomem();
+			return -1;
+		}
+	}
+
+	n = e->c_len - zsk->decode_len;
+	if (n > in_len){
+		n = in_len;
+	}
+	memcpy(zsk->in_buf + zsk->decode_len, in, n);
+	zsk->decode_len += n;
+	zsk->decode_pos += n;
+	*in_used = n;
+	if (zsk->decode_len < e->c_len){
+		return 0;
+	}
+
+	zsk->cache_valid = 0;
+	if (zip_decompress_buffer(zsk->in_buf, e->c_len, zsk->cache, zsk->block_size, out_len, zsk->c_type, 0) != 0 ||
+			*out_len != e->u_len || crc32c(0, zsk->cache, *out_len) != e->crc){
+		log_error_ex("Block %lu is corrupt", (unsigned long)zsk->decode_next);
+		*out_len = 0;
+		return -1;
+	}
+	zsk->cache_index = zsk->decode_next;
+	zsk->cache_valid = 1;
+	zsk->decode_next++;
+	zsk->decode_len = 0;
+	*out = zsk->cache;
+	return 0;
+}
+
+int zip_seekable_decode_end(const struct zip_seekable* zsk, uint64_t container_len){
+	return_ifnull(zsk, -1);
+
+	if (zsk->decode_next != zsk->n_entries || zsk->decode_pos != container_len){
+		log_error("The seekable container does not match its index");
+		return -1;
+	}
+	return 0;
+}
+
+struct seekable_reader{
+	const struct zip_seekable* zsk;
+	size_t next;
+};
+
+static int seekable_read_block(struct zip_block* block, FILE* fp_in, void* ctx){
+	struct seekable_reader* sr = ctx;
+	const struct seekable_entry* e;
+
+	if (sr->next == sr->zsk->n_entries){
+		return 0;
+	}
+	e = &sr->zsk->entries[sr->next];
+
+	if (grow_buffer(&block->in_buf, &block->in_size, e->c_len) != 0){
+		return -1;
+	}
+	if (fseek(fp_in, (long)e->c_off, SEEK_SET) != 0 || fread(block->in_buf, 1, e->c_len, fp_in) != e->c_len){
+		log_error_ex("Failed to read block %lu", (unsigned long)sr->next);
+		return -1;
+	}
+	block->in = block->in_buf;
+	block->in_len = e->c_len;
+	block->check = e->crc;
+	sr->next++;
+	return 1;
+}
+
+static int seekable_decompress_block(struct zip_block* block, unsigned thread_index, void* ctx){
+	struct seekable_reader* sr = ctx;
+	(void)thread_index;
+
+	if (grow_buffer(&block->out, &block->out_size, sr->zsk->block_size) != 0){
+		return -1;
+	}
+	if (zip_decompress_buffer(block->in, block->in_len, block->out, block->out_size, &block->out_len, sr->zsk->c_type, 0) != 0 ||
+			crc32c(0, block->out, block->out_len) != block->check){
+		log_error("Block is corrupt");
+		return -1;
+	}
+	return 0;
+}
+
+int seekable_decompress(const char* infile, const char* outfile, unsigned flags){
+	struct seekable_reader sr;
+	struct zip_seekable* zsk = NULL;
+	FILE* fp_out = NULL;
+	int ret = 0;
+
+	zsk = zip_seekable_open(infile);
+	if (!zsk){
+		ret = -1;
+		goto cleanup;
+	}
+
+	fp_out = fopen(outfile, "wb");
+	if (!fp_out){
+		log_efopen(outfile);
+		ret = -1;
+		goto cleanup;
+	}
+
+	sr.zsk = zsk;
+	sr.next = 0;
+	if (zip_parallel_decompress(zsk->fp, fp_out, ZIP_GET_THREADS(flags), seekable_read_block, seekable_decompress_block, NULL, &sr) != 0){
+		log_error_ex("Failed to decompress %s", infile);
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	zip_seekable_close(zsk);
+	if (fp_out && fclose(fp_out) != 0){
+		log_efclose(outfile);
+		ret = -1;
+	}
+	if (ret != 0){
+		remove(outfile);
+	}
+	return ret;
+}
@@ -0,0 +1,21 @@
+/** @file compression/zip_seekable.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __COMPRESSION_ZIP_SEEKABLE_H
+#define __COMPRESSION_ZIP_SEEKABLE_H
+
+#ifndef __ZIP_INTERNAL
+#error "Include zip.h, not zip_seekable.h"
+#endif
+
+#include "zip.h"
+
+int seekable_compress(FILE* fp_in, FILE* fp_out, enum compressor c_type, int compression_level, unsigned flags);
+int seekable_decompress(const char* infile, const char* outfile, unsigned flags);
+
+#endif
@@ -0,0 +1,149 @@
+/** @file crc32c.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "crc32c.h"
+#include <pthread.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <cpuid.h>
+#define CRC32C_X86
+#elif defined(__aarch64__) && defined(__linux__) && defined(__GNUC__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC32C_ARM
+#endif
+
+/* the reversed Castagnoli polynomial */
+#define CRC32C_POLY (0x82F63B78UL)
+
+/* table[k][b] is the crc of byte b followed by k zero bytes, so 8 bytes can be processed per step */
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/* both of these take and return the crc without its initial and final inversion */
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char* ptr, size_t len);
+static uint32_t (*crc32c_impl)(uint32_t crc, const unsigned char* ptr, size_t len) = crc32c_sw;
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char* ptr, size_t len){
+	while (len >= 8){
+		uint32_t lo = crc ^ ((uint32_t)ptr[0] | (uint32_t)ptr[1] << 8 | (uint32_t)ptr[2] << 16 | (uint32_t)ptr[3] << 24);
+		crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+			crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+			crc32c_table[3][ptr[4]] ^ crc32c_table[2][ptr[5]] ^
+			crc32c_table[1][ptr[6]] ^ crc32c_table[0][ptr[7]];
+		ptr += 8;
+		len -= 8;
+	}
+	while (len > 0){
+		crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *ptr) & 0xFF];
+		ptr++;
+		len--;
+	}
+	return crc;
+}
+
+/* the crc32 instructions compute exactly this polynomial, several bytes per cycle.
+ * they are written in assembly so this file does not need to be built with -msse4.2 or -march=armv8-a+crc, and still runs on cpus without them */
+#if defined(CRC32C_X86)
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char* ptr, size_t len){
+#if defined(__x86_64__)
+	uint64_t crc64 = crc;
+
+	while (len >= 8){
+		uint64_t word;
+		memcpy(&word, ptr, sizeof(word));
+		__asm__("crc32q %1, %0" : "+r"(crc64) : "rm"(word));
+		ptr += 8;
+		len -= 8;
+	}
+	crc = (uint32_t)crc64;
+#else
+	while (len >= 4){
+		uint32_t word;
+		memcpy(&word, ptr, sizeof(word));
+		__asm__("crc32l %1, %0" : "+r"(crc) : "rm"(word));
+		ptr += 4;
+		len -= 4;
+	}
+#endif
+	while (len > 0){
+		__asm__("crc32b %1, %0" : "+r"(crc) : "rm"(*ptr));
+		ptr++;
+		len--;
+	}
+	return crc;
+}
+
+static int crc32c_hw_supported(void){
+	unsigned eax, ebx, ecx, edx;
+
+	return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2);
+}
+#elif defined(CRC32C_ARM)
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char* ptr, size_t len){
+	while (len >= 8){
+		uint64_t word;
+		memcpy(&word, ptr, sizeof(word));
+		__asm__(".arch_extension crc\n\tcrc32cx %w0, %w0, %x1" : "+r"(crc) : "r"(word));
+		ptr += 8;
+		len -= 8;
+	}
+	while (len > 0){
+		uint32_t byte = *ptr;
+		__asm__(".arch_extension crc\n\tcrc32cb %w0, %w0, %w1" : "+r"(crc) : "r"(byte));
+		ptr++;
+		len--;
+	}
+	return crc;
+}
+
+static int crc32c_hw_supported(void){
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#endif
+
+static void crc32c_init(void){
+	unsigned i;
+	unsigned k;
+
+	for (i = 0; i < 256; ++i){
+		uint32_t crc = i;
+		for (k = 0; k < 8; ++k){
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		}
+		crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; ++i){
+		for (k = 1; k < 8; ++k){
+			uint32_t prev = crc32c_table[k - 1][i];
+			crc32c_table[k][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+		}
+	}
+
+#if defined(CRC32C_X86) || defined(CRC32C_ARM)
+	if (crc32c_hw_supported()){
+		crc32c_impl = crc32c_hw;
+	}
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len){
+	pthread_once(&crc32c_once, crc32c_init);
+	return ~crc32c_impl(~crc, data, len);
+}
+
+uint32_t crc32c_portable(uint32_t crc, const void* data, size_t len){
+	pthread_once(&crc32c_once, crc32c_init);
+	return ~crc32c_sw(~crc, data, len);
+}
+
+int crc32c_hardware(void){
+	pthread_once(&crc32c_once, crc32c_init);
+	return crc32c_impl != crc32c_sw;
+}
@@ -0,0 +1,54 @@
+/** @file crc32c.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __CRC32C_H
+#define __CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Calculates the CRC-32C (Castagnoli) of a buffer.<br>
+ * This is the checksum used by iSCSI, ext4, and btrfs. It detects more errors than zlib's CRC-32 and is cheap enough to check at disk speed.<br>
+ * The CPU's CRC32 instructions (SSE4.2 on x86, the ARMv8 CRC extension on ARM) are used if it has them.
+ * @see crc32c_hardware()
+ *
+ * @param crc The CRC of the data preceding this buffer, or 0 for the first buffer.<br>
+ * This allows the CRC of a large input to be calculated piece by piece.
+ *
+ * @param data The data to checksum.
+ *
+ * @param len The length of the data in bytes.
+ *
+ * @return The CRC-32C of all the data so far.
+ */
+uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+
+/**
+ * @brief Calculates the CRC-32C of a buffer without the CPU's CRC32 instructions.<br>
+ * This gives the same result as crc32c(). It is only useful for checking the two against each other.
+ * @see crc32c()
+ *
+ * @param crc The CRC of the data preceding this buffer, or 0 for the first buffer.
+ *
+ * @param data The data to checksum.
+ *
+ * @param len The length of the data in bytes.
+ *
+ * @return The CRC-32C of all the data so far.
+ */
+uint32_t crc32c_portable(uint32_t crc, const void* data, size_t len);
+
+/**
+ * @brief Checks if crc32c() uses the CPU's CRC32 instructions.
+ *
+ * @return 1 if it does, 0 if it uses the table-driven fallback.
+ */
+int crc32c_hardware(void);
+
+#endif
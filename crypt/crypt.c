@@ -9,6 +9,7 @@
 #include "crypt.h"
 #include "../filehelper.h"
 #include "../log.h"
+#include "../ctxpool.h"
 #include <errno.h>
 #include <openssl/err.h>
 #include "../progressbar.h"
@@ -16,6 +17,7 @@
 #include <termios.h>
 #include <sys/stat.h>
 #include <openssl/evp.h>
+#include <openssl/kdf.h>
 #include <openssl/rand.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -208,6 +210,67 @@ int crypt_gen_keys(const void* data, int data_len, const EVP_MD* md, int iterati
 	return 0;
 }
 
+int crypt_hkdf(const unsigned char* key, size_t key_len, const unsigned char* salt, size_t salt_len, const char* info, unsigned char* out, size_t out_len){
+	EVP_PKEY_CTX* pctx = NULL;
+	int ret = 0;
+
+	return_ifnull(key, -1);
+	return_ifnull(info, -1);
+	return_ifnull(out, -1);
+
+	pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+	if (!pctx ||
+			EVP_PKEY_derive_init(pctx) <= 0 ||
+			EVP_PKEY_CTX_set_hkdf_md(pctx, EVP_sha256()) <= 0 ||
+			(salt_len > 0 && EVP_PKEY_CTX_set1_hkdf_salt(pctx, salt, salt_len) <= 0) ||
+			EVP_PKEY_CTX_set1_hkdf_key(pctx, key, key_len) <= 0 ||
+			EVP_PKEY_CTX_add1_hkdf_info(pctx, (const unsigned char*)info, strlen(info)) <= 0 ||
+			EVP_PKEY_derive(pctx, out, &out_len) <= 0){
+		log_error("Failed to derive key");
+		ERR_print_errors_fp(stderr);
+		ret = -1;
+	}
+
+	EVP_PKEY_CTX_free(pctx);
+	return ret;
+}
+
+int crypt_gen_keys_hkdf(const unsigned char* key, size_t key_len, struct crypt_keys* fk){
+	unsigned char buf[EVP_MAX_KEY_LENGTH + EVP_MAX_IV_LENGTH];
+	int ret = 0;
+
+	return_ifnull(key, -1);
+	return_ifnull(fk, -1);
+
+	if (fk->flag_encryption_set == 0){
+		log_error("Encryption type was not set (call crypt_set_encryption())");
+		return -1;
+	}
+
+	fk->key_length = EVP_CIPHER_key_length(fk->encryption);
+	fk->iv_length = EVP_CIPHER_iv_length(fk->encryption);
+
+	fk->key = malloc(fk->key_length);
+	fk->iv = malloc(fk->iv_length);
+	if (!fk->key || !fk->iv){
+		log_enomem();
+		return -1;
+	}
+
+	/* the key and iv come from one derivation so they are independent of each other */
+	if (fk->key_length + fk->iv_length > 0 && crypt_hkdf(key, key_len, fk->salt, sizeof(fk->salt), "ezbackup file key", buf, fk->key_length + fk->iv_length) != 0){
+		ret = -1;
+		goto cleanup;
+	}
+	memcpy(fk->key, buf, fk->key_length);
+	memcpy(fk->iv, buf + fk->key_length, fk->iv_length);
+	fk->flag_keys_set = 1;
+
+cleanup:
+	OPENSSL_cleanse(buf, sizeof(buf));
+	return ret;
+}
+
 void crypt_free(struct crypt_keys* fk){
 	if (!fk){
 		return;
@@ -236,14 +299,58 @@ void crypt_reset(struct crypt_keys* fk){
 	memset(fk, 0, sizeof(*fk));
 }
 
+/* a cipher context along with a buffer big enough for any update's output.
+ * encrypted data is usually longer than input data, so the buffer has room for an extra block */
+struct crypt_ctx{
+	EVP_CIPHER_CTX* ctx;
+	unsigned char outbuffer[BUFFER_LEN + EVP_MAX_BLOCK_LENGTH];
+};
+
+static void crypt_ctx_free(void* arg){
+	struct crypt_ctx* cc = arg;
+	EVP_CIPHER_CTX_free(cc->ctx);
+	free(cc);
+}
+
+/* gets a cipher context for the calling thread, reusing one from a previous file if possible */
+static struct crypt_ctx* crypt_ctx_get(void){
+	struct crypt_ctx* cc = ctxpool_take(CTXPOOL_CIPHER, 0, 0, 0);
+
+	if (cc){
+		return cc;
+	}
+
+	cc = malloc(sizeof(*cc));
+	if (!cc){
+		log_enomem();
+		return NULL;
+	}
+	cc->ctx = EVP_CIPHER_CTX_new();
+	if (!cc->ctx){
+		log_error("Failed to initialize EVP_CIPHER_CTX");
+		ERR_print_errors_fp(stderr);
+		free(cc);
+		return NULL;
+	}
+	return cc;
+}
+
+/* the key schedule and any plaintext are wiped before the context goes back in the pool */
+static void crypt_ctx_put(struct crypt_ctx* cc){
+	EVP_CIPHER_CTX_reset(cc->ctx);
+	OPENSSL_cleanse(cc->outbuffer, sizeof(cc->outbuffer));
+	ctxpool_give(CTXPOOL_CIPHER, 0, 0, 0, cc, crypt_ctx_free);
+}
+
 /* encrypts the file
  * returns 0 on success or err on error */
 int crypt_encrypt_ex(const char* in, struct crypt_keys* fk, const char* out, int verbose, const char* progress_msg){
 	/* do not want null terminator */
 	const char salt_prefix[8] = { 'S', 'a', 'l', 't', 'e', 'd', '_', '_'};
-	EVP_CIPHER_CTX* ctx = NULL;
+	struct crypt_ctx* cc = NULL;
+	EVP_CIPHER_CTX* ctx;
 	unsigned char inbuffer[BUFFER_LEN];
-	unsigned char* outbuffer = NULL;
+	unsigned char* outbuffer;
 	FILE* fp_in = NULL;
 	FILE* fp_out = NULL;
 	int inlen;
@@ -301,25 +408,14 @@ int crypt_encrypt_ex(const char* in, struct crypt_keys* fk, const char* out, int
 		p = start_progress(progress_msg, st.st_size);
 	}
 
-	/* allocating space for outbuffer */
-
-	/* encrypted data is usually longer than input data,
-	 * so we must use malloc instead of just making another
-	 * buffer[BUFFER_LEN] */
-	outbuffer = malloc(BUFFER_LEN + EVP_CIPHER_block_size(fk->encryption));
-	if (!outbuffer){
-		log_enomem();
-		ret = -1;
-		goto cleanup;
-	}
-
 	/* initializing encryption thingy */
-	ctx = EVP_CIPHER_CTX_new();
-	if (!ctx){
-		log_error("Failed to initialize EVP_CIPHER_CTX");
-		ERR_print_errors_fp(stderr);
+	cc = crypt_ctx_get();
+	if (!cc){
+		ret = -1;
 		goto cleanup;
 	}
+	ctx = cc->ctx;
+	outbuffer = cc->outbuffer;
 	if (EVP_EncryptInit_ex(ctx, fk->encryption, NULL, fk->key, fk->iv) != 1){
 		log_error("Failed to initialize encryption");
 		ERR_print_errors_fp(stderr);
@@ -368,10 +464,9 @@ cleanup:
 	if (ret != 0){
 		remove(out);
 	}
-	if (ctx){
-		EVP_CIPHER_CTX_free(ctx);
+	if (cc){
+		crypt_ctx_put(cc);
 	}
-	free(outbuffer);
 	return ret;
 }
 
@@ -435,10 +530,10 @@ int crypt_extract_salt(const char* in, struct crypt_keys* fk){
 /* decrypts the file
  * returns 0 on success or err on error */
 int crypt_decrypt_ex(const char* in, struct crypt_keys* fk, const char* out, int verbose, const char* progress_msg){
-	/* do not want null terminator */
-	EVP_CIPHER_CTX* ctx = NULL;
+	struct crypt_ctx* cc = NULL;
+	EVP_CIPHER_CTX* ctx;
 	unsigned char inbuffer[BUFFER_LEN];
-	unsigned char* outbuffer = NULL;
+	unsigned char* outbuffer;
 	FILE* fp_in = NULL;
 	FILE* fp_out = NULL;
 	int inlen;
@@ -479,18 +574,6 @@ int crypt_decrypt_ex(const char* in, struct crypt_keys* fk, const char* out, int
 		goto cleanup;
 	}
 
-	/* isn't the decrypted length supposed to be lower than
-	 * the encrypted length?
-	 *
-	 * apparently not. that's why we have to do this malloc.
-	 */
-	outbuffer = malloc(BUFFER_LEN + EVP_CIPHER_block_size(fk->encryption));
-	if (!outbuffer){
-		log_enomem();
-		ret = -1;
-		goto cleanup;
-	}
-
 	/* preparing progress bar */
 	if (verbose){
 		struct stat st;
@@ -506,16 +589,16 @@ int crypt_decrypt_ex(const char* in, struct crypt_keys* fk, const char* out, int
 		p = start_progress(progress_msg, st.st_size);
 	}
 
-	/* no need for malloc() like above, since the decrypted
-	 * data is shorter than encrypted. */
-
-	/* initializing cipher context */
-	ctx = EVP_CIPHER_CTX_new();
-	if (!ctx){
-		log_error("Failed to initialize EVP_CIPHER_CTX");
-		ERR_print_errors_fp(stderr);
+	/* initializing cipher context.
+	 * isn't the decrypted length supposed to be lower than the encrypted length?
+	 * apparently not, so the same oversized buffer is used. */
+	cc = crypt_ctx_get();
+	if (!cc){
+		ret = -1;
 		goto cleanup;
 	}
+	ctx = cc->ctx;
+	outbuffer = cc->outbuffer;
 	if (EVP_DecryptInit_ex(ctx, fk->encryption, NULL, fk->key, fk->iv) != 1){
 		log_error("Failed to intitialize decryption process");
 		ERR_print_errors_fp(stderr);
@@ -562,9 +645,8 @@ cleanup:
 	if (ret != 0){
 		remove(out);
 	}
-	free(outbuffer);
-	if (ctx){
-		EVP_CIPHER_CTX_free(ctx);
+	if (cc){
+		crypt_ctx_put(cc);
 	}
 	return ret;
 }
@@ -572,3 +654,193 @@ cleanup:
 int crypt_decrypt(const char* in, struct crypt_keys* fk, const char* fp_out){
 	return crypt_decrypt_ex(in, fk, fp_out, 0, NULL);
 }
+
+#define CRYPT_SALT_HEADER_LEN (16)
+
+struct crypt_stream{
+	struct crypt_ctx* cc;
+	int encrypt;
+	/* how much of the "Salted__" + salt header has been written or read so far */
+	int header_pos;
+	unsigned char header[CRYPT_SALT_HEADER_LEN];
+};
+
+struct crypt_stream* crypt_stream_new(struct crypt_keys* fk, int encrypt){
+	const char salt_prefix[8] = { 'S', 'a', 'l', 't', 'e', 'd', '_', '_' };
+	struct crypt_stream* cs;
+
+	return_ifnull(fk, NULL);
+
+	if (fk->flag_keys_set == 0){
+		log_error("Encryption keys were not generated (call crypt_gen_keys())");
+		return NULL;
+	}
+	if (!encrypt && fk->flag_salt_extracted == 0){
+		log_error("Salt was not extracted from the file (call crypt_extract_salt())");
+		return NULL;
+	}
+
+	cs = calloc(1, sizeof(*cs));
+	if (!cs){
+		log_enomem();
+		return NULL;
+	}
+	cs->encrypt = encrypt;
+	/* when encrypting, this is the header to write. when decrypting, this is the header the file should have */
+	memcpy(cs->header, salt_prefix, sizeof(salt_prefix));
+	memcpy(cs->header + sizeof(salt_prefix), fk->salt, sizeof(fk->salt));
+
+	cs->cc = crypt_ctx_get();
+	if (!cs->cc){
+		free(cs);
+		return NULL;
+	}
+	if (EVP_CipherInit_ex(cs->cc->ctx, fk->encryption, NULL, fk->key, fk->iv, encrypt) != 1){
+		log_error("Failed to initialize cipher");
+		ERR_print_errors_fp(stderr);
+		crypt_stream_free(cs);
+		return NULL;
+	}
+	return cs;
+}
+
+/* writes the rest of the header when encrypting, or checks it against the expected one when decrypting */
+static int crypt_stream_header(struct crypt_stream* cs, const unsigned char** in, int* in_len, unsigned char** out, int* out_len){
+	if (cs->encrypt){
+		memcpy(*out, cs->header + cs->header_pos, CRYPT_SALT_HEADER_LEN - cs->header_pos);
+		*out += CRYPT_SALT_HEADER_LEN - cs->header_pos;
+		*out_len += CRYPT_SALT_HEADER_LEN - cs->header_pos;
+		cs->header_pos = CRYPT_SALT_HEADER_LEN;
+		return 0;
+	}
+
+	while (cs->header_pos < CRYPT_SALT_HEADER_LEN && *in_len > 0){
+		if (**in != cs->header[cs->header_pos]){
+			log_error(cs->header_pos < 8 ? "File is not of the correct format" : "The file's salt does not match the one the keys were generated with");
+			return -1;
+		}
+		cs->header_pos++;
+		(*in)++;
+		(*in_len)--;
+	}
+	return 0;
+}
+
+int crypt_stream_update(struct crypt_stream* cs, const unsigned char* in, int in_len, unsigned char* out, int* out_len){
+	int len;
+
+	return_ifnull(cs, -1);
+	return_ifnull(out, -1);
+	return_ifnull(out_len, -1);
+
+	*out_len = 0;
+	if (cs->header_pos < CRYPT_SALT_HEADER_LEN && crypt_stream_header(cs, &in, &in_len, &out, out_len) != 0){
+		return -1;
+	}
+	if (in_len <= 0){
+		return 0;
+	}
+
+	if (EVP_CipherUpdate(cs->cc->ctx, out, &len, in, in_len) != 1){
+		log_error(cs->encrypt ? "Failed to encrypt data completely" : "Failed to decrypt data completely");
+		ERR_print_errors_fp(stderr);
+		return -1;
+	}
+	*out_len += len;
+	return 0;
+}
+
+int crypt_stream_final(struct crypt_stream* cs, unsigned char* out, int* out_len){
+	int len;
+
+	return_ifnull(cs, -1);
+	return_ifnull(out, -1);
+	return_ifnull(out_len, -1);
+
+	*out_len = 0;
+	if (cs->header_pos < CRYPT_SALT_HEADER_LEN){
+		if (!cs->encrypt){
+			log_error("The encrypted data is missing its header");
+			return -1;
+		}
+		crypt_stream_header(cs, NULL, NULL, &out, out_len);
+	}
+
+	if (EVP_CipherFinal_ex(cs->cc->ctx, out, &len) != 1){
+		log_error(cs->encrypt ? "Failed to write padding data" : "Failed to finish decryption (the data or password is probably wrong)");
+		ERR_print_errors_fp(stderr);
+		return -1;
+	}
+	*out_len += len;
+	return 0;
+}
+
+void crypt_stream_free(struct crypt_stream* cs){
+	if (!cs){
+		return;
+	}
+	if (cs->cc){
+		crypt_ctx_put(cs->cc);
+	}
+	free(cs);
+}
+
+static int crypt_stream_fp(FILE* fp_in, struct crypt_keys* fk, FILE* fp_out, int encrypt){
+	struct crypt_stream* cs;
+	unsigned char inbuffer[BUFFER_LEN];
+	unsigned char* outbuffer;
+	int inlen;
+	int outlen;
+	int ret = 0;
+
+	return_ifnull(fp_in, -1);
+	return_ifnull(fp_out, -1);
+
+	cs = crypt_stream_new(fk, encrypt);
+	if (!cs){
+		return -1;
+	}
+	/* the pooled context's buffer has room for a full buffer plus a block, but not the header as well */
+	outbuffer = malloc(sizeof(inbuffer) + CRYPT_STREAM_OVERHEAD);
+	if (!outbuffer){
+		log_enomem();
+		crypt_stream_free(cs);
+		return -1;
+	}
+
+	while ((inlen = read_file(fp_in, inbuffer, sizeof(inbuffer))) > 0){
+		if (crypt_stream_update(cs, inbuffer, inlen, outbuffer, &outlen) != 0){
+			ret = -1;
+			goto cleanup;
+		}
+		if (fwrite(outbuffer, 1, outlen, fp_out) != (size_t)outlen){
+			log_efwrite("file");
+			ret = -1;
+			goto cleanup;
+		}
+	}
+	if (inlen < 0 || crypt_stream_final(cs, outbuffer, &outlen) != 0){
+		ret = -1;
+		goto cleanup;
+	}
+	if (fwrite(outbuffer, 1, outlen, fp_out) != (size_t)outlen){
+		log_efwrite("file");
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	crypt_scrub(inbuffer, sizeof(inbuffer));
+	crypt_scrub(outbuffer, sizeof(inbuffer) + CRYPT_STREAM_OVERHEAD);
+	free(outbuffer);
+	crypt_stream_free(cs);
+	return ret;
+}
+
+int crypt_encrypt_fp(FILE* fp_in, struct crypt_keys* fk, FILE* fp_out){
+	return crypt_stream_fp(fp_in, fk, fp_out, 1);
+}
+
+int crypt_decrypt_fp(FILE* fp_in, struct crypt_keys* fk, FILE* fp_out){
+	return crypt_stream_fp(fp_in, fk, fp_out, 0);
+}
@@ -10,6 +10,7 @@
 #define __CRYPT_CRYPT_H
 
 #include <openssl/evp.h>
+#include <stdio.h>
 
 #ifndef __GNUC__
 #define __attribute__(x)
@@ -20,6 +21,17 @@
  */
 struct crypt_keys;
 
+/**
+ * @brief Encrypts or decrypts data a buffer at a time.
+ */
+struct crypt_stream;
+
+/**
+ * @brief The most a crypt_stream's output can be longer than its input.<br>
+ * This covers the salt header and a block of padding.
+ */
+#define CRYPT_STREAM_OVERHEAD (16 + EVP_MAX_BLOCK_LENGTH)
+
 /**
  * @brief Generates a new crypt keys structure.
  *
@@ -133,6 +145,46 @@ int crypt_set_salt(const unsigned char salt[8], struct crypt_keys* fk);
  */
 int crypt_gen_keys(const void* data, int data_len, const EVP_MD* md, int iterations, struct crypt_keys* fk);
 
+/**
+ * @brief Derives a key from another key using HKDF (RFC 5869) with SHA-256.<br>
+ * Unlike crypt_gen_keys(), this is meant for input that is already a strong key, so it is fast.
+ *
+ * @param key The input key.
+ *
+ * @param key_len The length of the input key in bytes.
+ *
+ * @param salt A value that makes the output unique (e.g. a random per-file value).<br>
+ * This can be NULL if salt_len is 0.
+ *
+ * @param salt_len The length of the salt in bytes.
+ *
+ * @param info A string that separates keys derived for different purposes.
+ *
+ * @param out The buffer to write the derived key to.
+ *
+ * @param out_len The length of the derived key in bytes.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int crypt_hkdf(const unsigned char* key, size_t key_len, const unsigned char* salt, size_t salt_len, const char* info, unsigned char* out, size_t out_len);
+
+/**
+ * @brief Generates a key and iv from a master key and the salt using HKDF.<br>
+ * This is a fast alternative to crypt_gen_keys() when the master key was already derived from a password with a strong KDF (e.g. crypt_master_new()).<br>
+ * The salt must be generated or extracted before this function is called.
+ * @see crypt_gen_salt()
+ * @see crypt_extract_salt()
+ *
+ * @param key The master key.
+ *
+ * @param key_len The length of the master key in bytes.
+ *
+ * @param fk A crypt keys structure with its encryption type and salt set.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int crypt_gen_keys_hkdf(const unsigned char* key, size_t key_len, struct crypt_keys* fk);
+
 /**
  * @brief Encrypts a file using a crypt keys structure.<br>
  * This function must be called after crypt_gen_keys().<br>
@@ -225,6 +277,104 @@ int crypt_decrypt_ex(const char* in, struct crypt_keys* fk, const char* out, int
  */
 int crypt_extract_salt(const char* in, struct crypt_keys* fk);
 
+/**
+ * @brief Starts encrypting or decrypting data a buffer at a time.<br>
+ * The data is in the same format as crypt_encrypt() and crypt_decrypt() use, but does not have to come from or go to a file.<br>
+ * This function must be called after crypt_gen_keys(), and for decryption after crypt_extract_salt() as well.
+ * @see crypt_gen_keys()
+ *
+ * @param fk The crypt keys structure to use.<br>
+ * This must stay valid while the stream is in use.
+ *
+ * @param encrypt 1 to encrypt, 0 to decrypt.
+ *
+ * @return A new crypt_stream, or NULL on failure.<br>
+ * This must be freed with crypt_stream_free() when no longer in use.
+ */
+struct crypt_stream* crypt_stream_new(struct crypt_keys* fk, int encrypt) __attribute__((malloc));
+
+/**
+ * @brief Encrypts or decrypts the next part of the data.<br>
+ * When encrypting, the salt header is written before the first output. When decrypting, the header is read from the start of the input and checked against the keys' salt.
+ *
+ * @param cs The crypt_stream.
+ *
+ * @param in The data to process.
+ *
+ * @param in_len The length of the data.
+ *
+ * @param out Where to write the output.<br>
+ * This must have room for at least in_len + CRYPT_STREAM_OVERHEAD bytes.
+ *
+ * @param out_len Set to the amount of bytes written to out.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int crypt_stream_update(struct crypt_stream* cs, const unsigned char* in, int in_len, unsigned char* out, int* out_len);
+
+/**
+ * @brief Finishes encrypting or decrypting.<br>
+ * When decrypting, this is where a wrong key or damaged data is usually detected.
+ *
+ * @param cs The crypt_stream.
+ *
+ * @param out Where to write the last of the output.<br>
+ * This must have room for at least CRYPT_STREAM_OVERHEAD bytes.
+ *
+ * @param out_len Set to the amount of bytes written to out.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int crypt_stream_final(struct crypt_stream* cs, unsigned char* out, int* out_len);
+
+/**
+ * @brief Frees a crypt_stream.<br>
+ * The cipher state is scrubbed.
+ *
+ * @param cs The crypt_stream to free.<br>
+ * If this is NULL, this function does nothing.
+ *
+ * @return void
+ */
+void crypt_stream_free(struct crypt_stream* cs);
+
+/**
+ * @brief Encrypts one stream into another.<br>
+ * The input is read strictly in order and the output is never seeked, so either can be a pipe.<br>
+ * This function must be called after crypt_gen_keys().
+ * @see crypt_encrypt()
+ *
+ * @param fp_in The stream to encrypt.<br>
+ * This FILE* must be opened in reading binary ("rb") mode.
+ *
+ * @param fk The crypt keys structure to encrypt with.
+ *
+ * @param fp_out The stream to write the encrypted data to.<br>
+ * This FILE* must be opened in writing binary ("wb") mode.<br>
+ * Neither stream is closed, and nothing is removed on failure.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int crypt_encrypt_fp(FILE* fp_in, struct crypt_keys* fk, FILE* fp_out);
+
+/**
+ * @brief Decrypts one stream into another.<br>
+ * This function must be called after crypt_gen_keys() and crypt_extract_salt().
+ * @see crypt_decrypt()
+ *
+ * @param fp_in The stream to decrypt, starting at its salt header.<br>
+ * This FILE* must be opened in reading binary ("rb") mode.
+ *
+ * @param fk The crypt keys structure to decrypt with.
+ *
+ * @param fp_out The stream to write the decrypted data to.<br>
+ * This FILE* must be opened in writing binary ("wb") mode.<br>
+ * Neither stream is closed, and nothing is removed on failure.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int crypt_decrypt_fp(FILE* fp_in, struct crypt_keys* fk, FILE* fp_out);
+
 /**
  * @brief Frees all memory associated with a crypt keys structure.<br>
  * This also scrubs sensitive data like encryption keys and the initialization vector.
@@ -0,0 +1,671 @@
+/** @file crypt/crypt_aead.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "crypt_aead.h"
+#include "crypt.h"
+#include "../log.h"
+#include "../filehelper.h"
+#include "../threadpool.h"
+#include <openssl/err.h>
+#include <openssl/rand.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* an encrypted file is laid out as follows. all integers are little-endian.
+ *
+ * header: 8 byte magic
+ *         u8  version
+ *         u8  cipher
+ *         u8  log2 of the chunk size
+ *         u8  reserved
+ *         16 byte salt
+ *         4 bytes reserved
+ * chunk 0 .. chunk n-1: the ciphertext of chunk_size bytes of plaintext (the last chunk can be shorter), followed by its tag
+ *
+ * every chunk is sealed with the file key under the nonce
+ *         u64 chunk index
+ *         3 zero bytes
+ *         u8  1 if this is the last chunk, 0 if not
+ * and the header as associated data, so chunks cannot be moved, the header cannot be changed,
+ * and the file cannot be cut off at a chunk boundary without decryption failing. */
+#define AEAD_MAGIC "EZBAEAD1"
+#define AEAD_VERSION (1)
+#define AEAD_NONCE_LEN (12)
+#define AEAD_KEY_LEN (32)
+#define AEAD_KEY_INFO "ezbackup aead file key"
+#define AEAD_MIN_SHIFT (12)
+#define AEAD_MAX_SHIFT (24)
+#define AEAD_CHUNK_SHIFT (20)
+/* how many chunks each thread gets per batch */
+#define AEAD_BATCH_FACTOR (4)
+
+struct aead_params{
+	unsigned char header[CRYPT_AEAD_HEADER_LEN];
+	const EVP_CIPHER* cipher;
+	unsigned char key[AEAD_KEY_LEN];
+	size_t chunk_size;
+};
+
+struct aead_run{
+	const struct aead_params* params;
+	int enc;
+	/* one context per worker thread, each keyed the first time that thread uses it */
+	EVP_CIPHER_CTX** ctxs;
+	unsigned n_ctxs;
+};
+
+struct aead_job{
+	struct aead_run* run;
+	uint64_t index;
+	int last;
+	unsigned char* in;
+	size_t in_len;
+	unsigned char* out;
+	size_t out_len;
+	int status;
+};
+
+const EVP_CIPHER* crypt_aead_to_evp(enum crypt_aead_cipher cipher){
+	switch (cipher){
+	case CRYPT_AEAD_AES_256_GCM:
+		return EVP_aes_256_gcm();
+	case CRYPT_AEAD_CHACHA20_POLY1305:
+		return EVP_chacha20_poly1305();
+	default:
+		return NULL;
+	}
+}
+
+enum crypt_aead_cipher crypt_aead_from_evp(const EVP_CIPHER* cipher){
+	if (!cipher){
+		return CRYPT_AEAD_NONE;
+	}
+	if (EVP_CIPHER_nid(cipher) == NID_aes_256_gcm){
+		return CRYPT_AEAD_AES_256_GCM;
+	}
+	if (EVP_CIPHER_nid(cipher) == NID_chacha20_poly1305){
+		return CRYPT_AEAD_CHACHA20_POLY1305;
+	}
+	return CRYPT_AEAD_NONE;
+}
+
+static void make_nonce(unsigned char nonce[AEAD_NONCE_LEN], uint64_t index, int last){
+	int i;
+
+	for (i = 0; i < 8; ++i){
+		nonce[i] = (index >> (8 * i)) & 0xFF;
+	}
+	nonce[8] = nonce[9] = nonce[10] = 0;
+	nonce[11] = last ? 1 : 0;
+}
+
+static int derive_key(struct aead_params* ap, const unsigned char* key, size_t key_len){
+	return crypt_hkdf(key, key_len, ap->header + 12, CRYPT_AEAD_SALT_LEN, AEAD_KEY_INFO, ap->key, sizeof(ap->key));
+}
+
+/* validates a header and fills in everything but the key */
+static int parse_header(struct aead_params* ap){
+	const unsigned char* h = ap->header;
+
+	if (memcmp(h, AEAD_MAGIC, 8) != 0){
+		log_error("File is not an encrypted chunked file");
+		return -1;
+	}
+	if (h[8] != AEAD_VERSION){
+		log_error_ex("Unsupported encrypted file version %d", h[8]);
+		return -1;
+	}
+	ap->cipher = crypt_aead_to_evp(h[9]);
+	if (!ap->cipher){
+		log_error_ex("Unknown cipher %d in encrypted file", h[9]);
+		return -1;
+	}
+	if (h[10] < AEAD_MIN_SHIFT || h[10] > AEAD_MAX_SHIFT){
+		log_error_ex("Invalid chunk size 2^%d in encrypted file", h[10]);
+		return -1;
+	}
+	ap->chunk_size = (size_t)1 << h[10];
+	return 0;
+}
+
+int crypt_aead_chunk(EVP_CIPHER_CTX* ctx, const unsigned char* aad, size_t aad_len, int enc, uint64_t index, int last, const unsigned char* in, size_t in_len, unsigned char* out, size_t* out_len){
+	unsigned char nonce[AEAD_NONCE_LEN];
+	unsigned char tag[CRYPT_AEAD_TAG_LEN];
+	int len;
+	int final_len;
+
+	if (!enc){
+		if (in_len < CRYPT_AEAD_TAG_LEN){
+			log_error("Encrypted chunk is too short");
+			return -1;
+		}
+		in_len -= CRYPT_AEAD_TAG_LEN;
+		memcpy(tag, in + in_len, CRYPT_AEAD_TAG_LEN);
+	}
+
+	make_nonce(nonce, index, last);
+	if (EVP_CipherInit_ex(ctx, NULL, NULL, NULL, nonce, enc) != 1 ||
+			EVP_CipherUpdate(ctx, NULL, &len, aad, aad_len) != 1 ||
+			EVP_CipherUpdate(ctx, out, &len, in, in_len) != 1){
+		log_error("Failed to process chunk");
+		ERR_print_errors_fp(stderr);
+		return -1;
+	}
+
+	if (!enc && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, CRYPT_AEAD_TAG_LEN, tag) != 1){
+		log_error("Failed to set chunk tag");
+		ERR_print_errors_fp(stderr);
+		return -1;
+	}
+	if (EVP_CipherFinal_ex(ctx, out + len, &final_len) != 1){
+		if (!enc){
+			log_error_ex("Chunk %lu failed authentication", (unsigned long)index);
+		}
+		else{
+			log_error("Failed to finish chunk");
+		}
+		return -1;
+	}
+	len += final_len;
+
+	if (enc){
+		if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, CRYPT_AEAD_TAG_LEN, out + len) != 1){
+			log_error("Failed to get chunk tag");
+			ERR_print_errors_fp(stderr);
+			return -1;
+		}
+		len += CRYPT_AEAD_TAG_LEN;
+	}
+	*out_len = len;
+	return 0;
+}
+
+/* seals or opens a single chunk of a file. the context must already be keyed */
+static int aead_chunk(EVP_CIPHER_CTX* ctx, const struct aead_params* ap, int enc, uint64_t index, int last, const unsigned char* in, size_t in_len, unsigned char* out, size_t* out_len){
+	return crypt_aead_chunk(ctx, ap->header, sizeof(ap->header), enc, index, last, in, in_len, out, out_len);
+}
+
+static EVP_CIPHER_CTX* keyed_ctx(const struct aead_params* ap, int enc){
+	EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+
+	if (!ctx){
+		log_error("Failed to initialize EVP_CIPHER_CTX");
+		return NULL;
+	}
+	/* the key schedule is computed once here. each chunk after this only sets the nonce */
+	if (EVP_CipherInit_ex(ctx, ap->cipher, NULL, ap->key, NULL, enc) != 1){
+		log_error("Failed to initialize cipher");
+		ERR_print_errors_fp(stderr);
+		EVP_CIPHER_CTX_free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+static void aead_job_run(void* arg, unsigned thread_index){
+	struct aead_job* job = arg;
+	struct aead_run* run = job->run;
+
+	if (thread_index >= run->n_ctxs){
+		job->status = -1;
+		return;
+	}
+	if (!run->ctxs[thread_index] && (run->ctxs[thread_index] = keyed_ctx(run->params, run->enc)) == NULL){
+		job->status = -1;
+		return;
+	}
+	job->status = aead_chunk(run->ctxs[thread_index], run->params, run->enc, job->index, job->last, job->in, job->in_len, job->out, &job->out_len);
+}
+
+/* processes n jobs on the threadpool and writes them in order */
+static int run_batch(struct threadpool* tp, struct aead_job* jobs, size_t n, FILE* fp_out, const char* out){
+	size_t i;
+
+	for (i = 0; i < n; ++i){
+		if (tp_submit(tp, aead_job_run, &jobs[i]) != 0){
+			tp_wait(tp);
+			return -1;
+		}
+	}
+	tp_wait(tp);
+
+	for (i = 0; i < n; ++i){
+		if (jobs[i].status != 0){
+			return -1;
+		}
+		if (fwrite(jobs[i].out, 1, jobs[i].out_len, fp_out) != jobs[i].out_len){
+			log_efwrite(out);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void free_run(struct aead_run* run, struct aead_job* jobs, size_t n_jobs){
+	size_t i;
+
+	if (run->ctxs){
+		for (i = 0; i < run->n_ctxs; ++i){
+			EVP_CIPHER_CTX_free(run->ctxs[i]);
+		}
+		free(run->ctxs);
+	}
+	if (jobs){
+		for (i = 0; i < n_jobs; ++i){
+			if (jobs[i].in){
+				crypt_scrub(jobs[i].in, run->params->chunk_size + CRYPT_AEAD_TAG_LEN);
+				free(jobs[i].in);
+			}
+			if (jobs[i].out){
+				crypt_scrub(jobs[i].out, run->params->chunk_size + CRYPT_AEAD_TAG_LEN);
+				free(jobs[i].out);
+			}
+		}
+		free(jobs);
+	}
+}
+
+static int init_run(struct aead_run* run, const struct aead_params* ap, int enc, unsigned threads, struct aead_job** jobs, size_t* n_jobs){
+	size_t i;
+
+	run->params = ap;
+	run->enc = enc;
+	run->n_ctxs = threads > 0 ? threads : 1;
+	run->ctxs = calloc(run->n_ctxs, sizeof(*run->ctxs));
+
+	*n_jobs = run->n_ctxs * AEAD_BATCH_FACTOR;
+	*jobs = calloc(*n_jobs, sizeof(**jobs));
+	if (!run->ctxs || !*jobs){
+		log_enomem();
+		return -1;
+	}
+	for (i = 0; i < *n_jobs; ++i){
+		(*jobs)[i].run = run;
+		(*jobs)[i].in = malloc(ap->chunk_size + CRYPT_AEAD_TAG_LEN);
+		(*jobs)[i].out = malloc(ap->chunk_size + CRYPT_AEAD_TAG_LEN);
+		if (!(*jobs)[i].in || !(*jobs)[i].out){
+			log_enomem();
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int crypt_aead_encrypt(const char* in, const char* out, enum crypt_aead_cipher cipher, const unsigned char* key, size_t key_len, unsigned threads){
+	return crypt_aead_encrypt_salt(in, out, cipher, key, key_len, NULL, threads);
+}
+
+int crypt_aead_encrypt_salt(const char* in, const char* out, enum crypt_aead_cipher cipher, const unsigned char* key, size_t key_len, const unsigned char* salt, unsigned threads){
+	FILE* fp_in = NULL;
+	FILE* fp_out = NULL;
+	int ret = 0;
+
+	return_ifnull(in, -1);
+	return_ifnull(out, -1);
+	return_ifnull(key, -1);
+
+	fp_in = fopen(in, "rb");
+	if (!fp_in){
+		log_efopen(in);
+		ret = -1;
+		goto cleanup;
+	}
+
+	fp_out = fopen(out, "wb");
+	if (!fp_out){
+		log_efopen(out);
+		ret = -1;
+		goto cleanup;
+	}
+
+	ret = crypt_aead_encrypt_fp(fp_in, fp_out, cipher, key, key_len, salt, threads);
+
+cleanup:
+	fp_in ? fclose(fp_in) : 0;
+	if (fp_out && fclose(fp_out) != 0){
+		log_efclose(out);
+		ret = -1;
+	}
+	if (ret != 0){
+		remove(out);
+	}
+	return ret;
+}
+
+int crypt_aead_encrypt_fp(FILE* fp_in, FILE* fp_out, enum crypt_aead_cipher cipher, const unsigned char* key, size_t key_len, const unsigned char* salt, unsigned threads){
+	struct aead_params ap;
+	struct aead_run run;
+	struct aead_job* jobs = NULL;
+	size_t n_jobs = 0;
+	struct threadpool* tp = NULL;
+	uint64_t index = 0;
+	int eof = 0;
+	int ret = 0;
+
+	return_ifnull(fp_in, -1);
+	return_ifnull(fp_out, -1);
+	return_ifnull(key, -1);
+
+	memset(&ap, 0, sizeof(ap));
+	memset(&run, 0, sizeof(run));
+
+	memcpy(ap.header, AEAD_MAGIC, 8);
+	ap.header[8] = AEAD_VERSION;
+	ap.header[9] = cipher;
+	ap.header[10] = AEAD_CHUNK_SHIFT;
+	if (salt){
+		memcpy(ap.header + 12, salt, CRYPT_AEAD_SALT_LEN);
+	}
+	else if (RAND_bytes(ap.header + 12, CRYPT_AEAD_SALT_LEN) != 1){
+		log_error("Failed to generate salt");
+		ERR_print_errors_fp(stderr);
+		ret = -1;
+		goto cleanup;
+	}
+	if (parse_header(&ap) != 0 || derive_key(&ap, key, key_len) != 0){
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (fwrite(ap.header, 1, sizeof(ap.header), fp_out) != sizeof(ap.header)){
+		log_efwrite("file");
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (init_run(&run, &ap, 1, threads, &jobs, &n_jobs) != 0){
+		ret = -1;
+		goto cleanup;
+	}
+
+	tp = tp_new(threads);
+	if (!tp){
+		log_error("Failed to create threadpool");
+		ret = -1;
+		goto cleanup;
+	}
+
+	do{
+		size_t n = 0;
+
+		while (n < n_jobs){
+			int len = read_file(fp_in, jobs[n].in, ap.chunk_size);
+			if (len < 0){
+				ret = -1;
+				goto cleanup;
+			}
+			/* an empty input still gets one (empty) final chunk */
+			if (len == 0 && (n > 0 || index > 0)){
+				eof = 1;
+				break;
+			}
+
+			jobs[n].index = index++;
+			jobs[n].in_len = len;
+			jobs[n].last = 0;
+			jobs[n].status = 0;
+			n++;
+
+			if ((size_t)len < ap.chunk_size){
+				eof = 1;
+				break;
+			}
+		}
+
+		/* the last chunk has to be marked before it is sealed, so peek for the end of the file */
+		if (!eof){
+			int c = fgetc(fp_in);
+			if (c == EOF){
+				eof = 1;
+			}
+			else{
+				ungetc(c, fp_in);
+			}
+		}
+		if (eof && n == 0){
+			/* the previous batch ended exactly at the end of the file, but was already sealed as not last */
+			log_error("Failed to detect the end of the input");
+			ret = -1;
+			goto cleanup;
+		}
+		if (eof){
+			jobs[n - 1].last = 1;
+		}
+
+		if (run_batch(tp, jobs, n, fp_out, "file") != 0){
+			log_error("Failed to encrypt file");
+			ret = -1;
+			goto cleanup;
+		}
+	}while (!eof);
+
+cleanup:
+	tp_free(tp);
+	free_run(&run, jobs, n_jobs);
+	crypt_scrub(ap.key, sizeof(ap.key));
+	return ret;
+}
+
+/* reads the header of an open encrypted file and derives its key.
+ * the amount of chunks is determined from the length of the file */
+static int read_params(FILE* fp, const char* file, const unsigned char* key, size_t key_len, struct aead_params* ap, uint64_t* n_chunks, long* body_len){
+	long file_len;
+	long stride;
+
+	if (fseek(fp, 0, SEEK_END) != 0 || (file_len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0){
+		log_error_ex2("Failed to determine the size of %s (%s)", file, strerror(errno));
+		return -1;
+	}
+
+	if (fread(ap->header, 1, sizeof(ap->header), fp) != sizeof(ap->header)){
+		log_error_ex("%s is too short to be an encrypted file", file);
+		return -1;
+	}
+	if (parse_header(ap) != 0){
+		return -1;
+	}
+
+	*body_len = file_len - CRYPT_AEAD_HEADER_LEN;
+	stride = ap->chunk_size + CRYPT_AEAD_TAG_LEN;
+	*n_chunks = *body_len / stride;
+	if (*body_len % stride != 0){
+		if (*body_len % stride < CRYPT_AEAD_TAG_LEN){
+			log_error_ex("%s is truncated", file);
+			return -1;
+		}
+		(*n_chunks)++;
+	}
+	if (*n_chunks == 0){
+		log_error_ex("%s is truncated", file);
+		return -1;
+	}
+
+	return derive_key(ap, key, key_len);
+}
+
+int crypt_aead_decrypt(const char* in, const char* out, const unsigned char* key, size_t key_len, unsigned threads){
+	struct aead_params ap;
+	struct aead_run run;
+	struct aead_job* jobs = NULL;
+	size_t n_jobs = 0;
+	struct threadpool* tp = NULL;
+	FILE* fp_in = NULL;
+	FILE* fp_out = NULL;
+	uint64_t n_chunks;
+	uint64_t index = 0;
+	long body_len;
+	int ret = 0;
+
+	return_ifnull(in, -1);
+	return_ifnull(out, -1);
+	return_ifnull(key, -1);
+
+	memset(&ap, 0, sizeof(ap));
+	memset(&run, 0, sizeof(run));
+
+	fp_in = fopen(in, "rb");
+	if (!fp_in){
+		log_efopen(in);
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (read_params(fp_in, in, key, key_len, &ap, &n_chunks, &body_len) != 0){
+		ret = -1;
+		goto cleanup;
+	}
+
+	fp_out = fopen(out, "wb");
+	if (!fp_out){
+		log_efopen(out);
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (init_run(&run, &ap, 0, threads, &jobs, &n_jobs) != 0){
+		ret = -1;
+		goto cleanup;
+	}
+
+	tp = tp_new(threads);
+	if (!tp){
+		log_error("Failed to create threadpool");
+		ret = -1;
+		goto cleanup;
+	}
+
+	while (index < n_chunks){
+		size_t n;
+
+		for (n = 0; n < n_jobs && index < n_chunks; ++n, ++index){
+			size_t stride = ap.chunk_size + CRYPT_AEAD_TAG_LEN;
+			size_t len = index == n_chunks - 1 ? (size_t)(body_len - (long)(index * stride)) : stride;
+
+			if (fread(jobs[n].in, 1, len, fp_in) != len){
+				log_error_ex("Failed to read from %s", in);
+				ret = -1;
+				goto cleanup;
+			}
+			jobs[n].index = index;
+			jobs[n].in_len = len;
+			jobs[n].last = index == n_chunks - 1;
+			jobs[n].status = 0;
+		}
+
+		if (run_batch(tp, jobs, n, fp_out, out) != 0){
+			log_error_ex("Failed to decrypt %s", in);
+			ret = -1;
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	tp_free(tp);
+	free_run(&run, jobs, n_jobs);
+	crypt_scrub(ap.key, sizeof(ap.key));
+	fp_in ? fclose(fp_in) : 0;
+	if (fp_out && fclose(fp_out) != 0){
+		log_efclose(out);
+		ret = -1;
+	}
+	if (ret != 0 && fp_out){
+		remove(out);
+	}
+	return ret;
+}
+
+struct crypt_aead_file{
+	FILE* fp;
+	struct aead_params params;
+	uint64_t n_chunks;
+	long body_len;
+	EVP_CIPHER_CTX* ctx;
+	unsigned char* in_buf;
+};
+
+struct crypt_aead_file* crypt_aead_open(const char* file, const unsigned char* key, size_t key_len){
+	struct crypt_aead_file* caf;
+
+	return_ifnull(file, NULL);
+	return_ifnull(key, NULL);
+
+	caf = calloc(1, sizeof(*caf));
+	if (!caf){
+		log_enomem();
+		return NULL;
+	}
+
+	caf->fp = fopen(file, "rb");
+	if (!caf->fp){
+		log_efopen(file);
+		goto cleanup_fail;
+	}
+
+	if (read_params(caf->fp, file, key, key_len, &caf->params, &caf->n_chunks, &caf->body_len) != 0){
+		goto cleanup_fail;
+	}
+
+	caf->in_buf = malloc(caf->params.chunk_size + CRYPT_AEAD_TAG_LEN);
+	if (!caf->in_buf){
+		log_enomem();
+		goto cleanup_fail;
+	}
+
+	caf->ctx = keyed_ctx(&caf->params, 0);
+	if (!caf->ctx){
+		goto cleanup_fail;
+	}
+	return caf;
+
+cleanup_fail:
+	crypt_aead_close(caf);
+	return NULL;
+}
+
+uint64_t crypt_aead_chunks(const struct crypt_aead_file* caf){
+	return caf ? caf->n_chunks : 0;
+}
+
+int crypt_aead_read_chunk(struct crypt_aead_file* caf, uint64_t index, unsigned char* out, size_t* out_len){
+	size_t stride;
+	size_t len;
+	long offset;
+
+	return_ifnull(caf, -1);
+	return_ifnull(out, -1);
+	return_ifnull(out_len, -1);
+
+	if (index >= caf->n_chunks){
+		log_error_ex2("Chunk %lu is past the end of the file (%lu chunks)", (unsigned long)index, (unsigned long)caf->n_chunks);
+		return -1;
+	}
+
+	stride = caf->params.chunk_size + CRYPT_AEAD_TAG_LEN;
+	offset = (long)(index * stride);
+	len = index == caf->n_chunks - 1 ? (size_t)(caf->body_len - offset) : stride;
+
+	if (fseek(caf->fp, CRYPT_AEAD_HEADER_LEN + offset, SEEK_SET) != 0 || fread(caf->in_buf, 1, len, caf->fp) != len){
+		log_error_ex("Failed to read chunk %lu", (unsigned long)index);
+		return -1;
+	}
+
+	return aead_chunk(caf->ctx, &caf->params, 0, index, index == caf->n_chunks - 1, caf->in_buf, len, out, out_len);
+}
+
+void crypt_aead_close(struct crypt_aead_file* caf){
+	if (!caf){
+		return;
+	}
+	caf->fp ? fclose(caf->fp) : 0;
+	EVP_CIPHER_CTX_free(caf->ctx);
+	free(caf->in_buf);
+	crypt_scrub(caf->params.key, sizeof(caf->params.key));
+	free(caf);
+}
@@ -0,0 +1,234 @@
+/** @file crypt/crypt_aead.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __CRYPT_CRYPT_AEAD_H
+#define __CRYPT_CRYPT_AEAD_H
+
+#include <openssl/evp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef __GNUC__
+#define __attribute__(x)
+#endif
+
+#define CRYPT_AEAD_SALT_LEN   (16)      /**< @brief The length of the random value each file's key is derived with. */
+#define CRYPT_AEAD_TAG_LEN    (16)      /**< @brief The length of the authentication tag after each chunk. */
+#define CRYPT_AEAD_HEADER_LEN (32)      /**< @brief The length of the header at the start of an encrypted file. */
+#define CRYPT_AEAD_CHUNK_SIZE (1 << 20) /**< @brief The amount of plaintext in each chunk, except for the last. */
+
+/**
+ * @brief The authenticated ciphers a chunked file can be encrypted with.
+ */
+enum crypt_aead_cipher{
+	CRYPT_AEAD_NONE              = 0, /**< @brief Not an authenticated cipher. */
+	CRYPT_AEAD_AES_256_GCM       = 1, /**< @brief AES-256 in GCM mode. This is the fastest choice on CPUs with AES instructions. */
+	CRYPT_AEAD_CHACHA20_POLY1305 = 2  /**< @brief ChaCha20-Poly1305. This is the fastest choice on CPUs without AES instructions. */
+};
+
+/**
+ * @brief An encrypted file opened for random access.
+ */
+struct crypt_aead_file;
+
+/**
+ * @brief Determines which authenticated cipher an EVP_CIPHER is.
+ *
+ * @param cipher The cipher (e.g. EVP_aes_256_gcm()).
+ *
+ * @return The equivalent crypt_aead_cipher, or CRYPT_AEAD_NONE if it is not one.
+ */
+enum crypt_aead_cipher crypt_aead_from_evp(const EVP_CIPHER* cipher);
+
+/**
+ * @brief Gets the EVP_CIPHER for an authenticated cipher.
+ *
+ * @param cipher The cipher.
+ *
+ * @return The equivalent EVP_CIPHER, or NULL if cipher is CRYPT_AEAD_NONE or unknown.
+ */
+const EVP_CIPHER* crypt_aead_to_evp(enum crypt_aead_cipher cipher);
+
+/**
+ * @brief Seals or opens a single chunk with the same nonce scheme as the chunked file format.<br>
+ * This is for other formats built out of independently authenticated chunks.
+ *
+ * @param ctx A context already initialized with an authenticated cipher and key.
+ *
+ * @param aad Data that is authenticated along with the chunk (e.g. a header), or NULL.
+ *
+ * @param aad_len The length of aad.
+ *
+ * @param enc 1 to seal, 0 to open.
+ *
+ * @param index The index of the chunk. Each chunk sealed with a key must have a different index/last pair.
+ *
+ * @param last Nonzero if this is the last chunk.
+ *
+ * @param in The plaintext to seal, or the ciphertext and tag to open.
+ *
+ * @param in_len The length of in.
+ *
+ * @param out The output buffer.<br>
+ * This must be at least in_len + CRYPT_AEAD_TAG_LEN bytes when sealing, and in_len bytes when opening.
+ *
+ * @param out_len The number of bytes written to out.
+ *
+ * @return 0 on success, or negative on failure (including if the chunk fails authentication).
+ */
+int crypt_aead_chunk(EVP_CIPHER_CTX* ctx, const unsigned char* aad, size_t aad_len, int enc, uint64_t index, int last, const unsigned char* in, size_t in_len, unsigned char* out, size_t* out_len);
+
+/**
+ * @brief Encrypts a file in independently authenticated chunks.<br>
+ * Each file gets its own key derived from the given key and a random salt, and each chunk is sealed under a nonce made from its index and whether it is the last chunk.<br>
+ * Reordering, modifying, or truncating the chunks is therefore detected when decrypting.
+ *
+ * @param in Path to the file to encrypt.
+ *
+ * @param out Path to write the encrypted file to.<br>
+ * If this file already exists, it will be overwritten.<br>
+ * If this function fails, the output file is removed.
+ *
+ * @param cipher The cipher to use.
+ *
+ * @param key The key to encrypt with.<br>
+ * Each file's key is derived from this, so the same key can be used for many files.
+ *
+ * @param key_len The length of the key in bytes.
+ *
+ * @param threads The amount of worker threads to encrypt chunks on.<br>
+ * 0 encrypts on the calling thread.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int crypt_aead_encrypt(const char* in, const char* out, enum crypt_aead_cipher cipher, const unsigned char* key, size_t key_len, unsigned threads);
+
+/**
+ * @brief Encrypts a file in independently authenticated chunks with a chosen salt instead of a random one.<br>
+ * The output only depends on the input, key, and salt, so this can be used for convergent encryption.<br>
+ * The salt must be unique for each distinct input (e.g. derived from a keyed hash of it), since equal salts mean equal keys and nonces.
+ * @see crypt_aead_encrypt()
+ *
+ * @param in Path to the file to encrypt.
+ *
+ * @param out Path to write the encrypted file to.<br>
+ * If this function fails, the output file is removed.
+ *
+ * @param cipher The cipher to use.
+ *
+ * @param key The key to encrypt with.
+ *
+ * @param key_len The length of the key in bytes.
+ *
+ * @param salt CRYPT_AEAD_SALT_LEN bytes to derive the file key with.<br>
+ * If this is NULL, a random salt is used.
+ *
+ * @param threads The amount of worker threads to encrypt chunks on.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int crypt_aead_encrypt_salt(const char* in, const char* out, enum crypt_aead_cipher cipher, const unsigned char* key, size_t key_len, const unsigned char* salt, unsigned threads);
+
+/**
+ * @brief Encrypts a stream in independently authenticated chunks.<br>
+ * The input is read strictly in order, so it can be a pipe (e.g. the output of a compressor), and the output is written exactly once.
+ * @see crypt_aead_encrypt_salt()
+ *
+ * @param fp_in The stream to encrypt.<br>
+ * This FILE* must be opened in reading binary ("rb") mode.
+ *
+ * @param fp_out The stream to write the encrypted data to.<br>
+ * This FILE* must be opened in writing binary ("wb") mode.<br>
+ * Neither stream is closed, and nothing is removed on failure.
+ *
+ * @param cipher The cipher to use.
+ *
+ * @param key The key to encrypt with.
+ *
+ * @param key_len The length of the key in bytes.
+ *
+ * @param salt CRYPT_AEAD_SALT_LEN bytes to derive the file key with, or NULL to use a random salt.
+ *
+ * @param threads The amount of worker threads to encrypt chunks on.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int crypt_aead_encrypt_fp(FILE* fp_in, FILE* fp_out, enum crypt_aead_cipher cipher, const unsigned char* key, size_t key_len, const unsigned char* salt, unsigned threads);
+
+/**
+ * @brief Decrypts a file encrypted with crypt_aead_encrypt().
+ *
+ * @param in Path to the file to decrypt.
+ *
+ * @param out Path to write the decrypted file to.<br>
+ * If this file already exists, it will be overwritten.<br>
+ * If this function fails (e.g. a chunk fails authentication), the output file is removed.
+ *
+ * @param key The key the file was encrypted with.
+ *
+ * @param key_len The length of the key in bytes.
+ *
+ * @param threads The amount of worker threads to decrypt chunks on.<br>
+ * 0 decrypts on the calling thread.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int crypt_aead_decrypt(const char* in, const char* out, const unsigned char* key, size_t key_len, unsigned threads);
+
+/**
+ * @brief Opens an encrypted file for random access.
+ *
+ * @param file Path to the encrypted file.
+ *
+ * @param key The key the file was encrypted with.
+ *
+ * @param key_len The length of the key in bytes.
+ *
+ * @return The opened file, or NULL on failure (e.g. it is not a chunked file or it was truncated).<br>
+ * This must be closed with crypt_aead_close() when no longer in use.
+ */
+struct crypt_aead_file* crypt_aead_open(const char* file, const unsigned char* key, size_t key_len) __attribute__((malloc));
+
+/**
+ * @brief Gets the amount of chunks in an encrypted file.
+ *
+ * @param caf The encrypted file.
+ *
+ * @return The amount of chunks. This is at least 1.
+ */
+uint64_t crypt_aead_chunks(const struct crypt_aead_file* caf);
+
+/**
+ * @brief Decrypts a single chunk of an encrypted file.<br>
+ * The chunk at index i holds the plaintext starting at i * CRYPT_AEAD_CHUNK_SIZE.
+ *
+ * @param caf The encrypted file.
+ *
+ * @param index The index of the chunk.
+ *
+ * @param out The buffer to decrypt into.<br>
+ * This must be at least CRYPT_AEAD_CHUNK_SIZE bytes.
+ *
+ * @param out_len The amount of plaintext in the chunk.
+ *
+ * @return 0 on success, or negative on failure (e.g. the chunk fails authentication).
+ */
+int crypt_aead_read_chunk(struct crypt_aead_file* caf, uint64_t index, unsigned char* out, size_t* out_len);
+
+/**
+ * @brief Closes an encrypted file and scrubs its key.
+ *
+ * @param caf The file to close.<br>
+ * If this is NULL, this function does nothing.
+ *
+ * @return void
+ */
+void crypt_aead_close(struct crypt_aead_file* caf);
+
+#endif
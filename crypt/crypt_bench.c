@@ -0,0 +1,281 @@
+/** @file crypt/crypt_bench.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "crypt_bench.h"
+#include "crypt.h"
+#include "../log.h"
+#include <openssl/err.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <cpuid.h>
+#define CRYPT_BENCH_X86
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRYPT_BENCH_ARM
+#endif
+
+/* the security floor. anything not on these lists is never picked automatically, no matter how fast it is */
+static const char* const auto_ciphers[] = {
+	"AES-256-GCM",
+	"ChaCha20-Poly1305"
+};
+
+static const char* const auto_mds[] = {
+	"SHA256",
+	"SHA512",
+	"SHA512-256",
+	"SHA3-256",
+	"BLAKE2b512",
+	"BLAKE2s256"
+};
+
+#define ARRAY_LEN(x) (sizeof(x) / sizeof(x[0]))
+
+unsigned crypt_cpu_features(void){
+	unsigned features = 0;
+#if defined(CRYPT_BENCH_X86)
+	unsigned eax, ebx, ecx, edx;
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)){
+		features |= (ecx & bit_AES) ? CRYPT_CPU_AES : 0;
+		features |= (ecx & bit_PCLMUL) ? CRYPT_CPU_PCLMUL : 0;
+	}
+	if (__get_cpuid_max(0, NULL) >= 7){
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		/* bit_SHA and bit_AVX2 are missing from older cpuid.h */
+		features |= (ebx & (1U << 29)) ? CRYPT_CPU_SHA : 0;
+		features |= (ebx & (1U << 5)) ? CRYPT_CPU_AVX2 : 0;
+	}
+#elif defined(CRYPT_BENCH_ARM)
+	unsigned long hwcap = getauxval(AT_HWCAP);
+
+	features |= (hwcap & HWCAP_AES) ? CRYPT_CPU_AES : 0;
+	features |= (hwcap & HWCAP_PMULL) ? CRYPT_CPU_PCLMUL : 0;
+	features |= (hwcap & HWCAP_SHA2) ? CRYPT_CPU_SHA : 0;
+#endif
+	return features;
+}
+
+static double now_secs(void){
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+double crypt_bench_cipher(const EVP_CIPHER* cipher){
+	EVP_CIPHER_CTX* ctx = NULL;
+	unsigned char key[EVP_MAX_KEY_LENGTH];
+	unsigned char iv[EVP_MAX_IV_LENGTH];
+	unsigned char* in = NULL;
+	unsigned char* out = NULL;
+	double bytes = 0;
+	double start;
+	double elapsed;
+	double ret = -1;
+	int len;
+
+	return_ifnull(cipher, -1);
+
+	in = calloc(1, CRYPT_BENCH_BUFFER_LEN);
+	out = malloc(CRYPT_BENCH_BUFFER_LEN + EVP_MAX_BLOCK_LENGTH);
+	ctx = EVP_CIPHER_CTX_new();
+	if (!in || !out || !ctx){
+		log_enomem();
+		goto cleanup;
+	}
+
+	gen_csrand(key, sizeof(key));
+	gen_csrand(iv, sizeof(iv));
+	if (EVP_EncryptInit_ex(ctx, cipher, NULL, key, iv) != 1){
+		log_error_ex("Failed to initialize %s", EVP_CIPHER_name(cipher));
+		ERR_print_errors_fp(stderr);
+		goto cleanup;
+	}
+
+	start = now_secs();
+	do{
+		if (EVP_EncryptUpdate(ctx, out, &len, in, CRYPT_BENCH_BUFFER_LEN) != 1){
+			log_error_ex("Failed to encrypt with %s", EVP_CIPHER_name(cipher));
+			ERR_print_errors_fp(stderr);
+			goto cleanup;
+		}
+		bytes += CRYPT_BENCH_BUFFER_LEN;
+		elapsed = now_secs() - start;
+	}while (elapsed < CRYPT_BENCH_SECONDS);
+
+	ret = bytes / elapsed;
+
+cleanup:
+	EVP_CIPHER_CTX_free(ctx);
+	OPENSSL_cleanse(key, sizeof(key));
+	free(in);
+	free(out);
+	return ret;
+}
+
+double crypt_bench_md(const EVP_MD* md){
+	EVP_MD_CTX* ctx = NULL;
+	unsigned char* in = NULL;
+	double bytes = 0;
+	double start;
+	double elapsed;
+	double ret = -1;
+
+	return_ifnull(md, -1);
+
+	in = calloc(1, CRYPT_BENCH_BUFFER_LEN);
+	ctx = EVP_MD_CTX_create();
+	if (!in || !ctx){
+		log_enomem();
+		goto cleanup;
+	}
+
+	if (EVP_DigestInit_ex(ctx, md, NULL) != 1){
+		log_error_ex("Failed to initialize %s", EVP_MD_name(md));
+		ERR_print_errors_fp(stderr);
+		goto cleanup;
+	}
+
+	start = now_secs();
+	do{
+		if (EVP_DigestUpdate(ctx, in, CRYPT_BENCH_BUFFER_LEN) != 1){
+			log_error_ex("Failed to hash with %s", EVP_MD_name(md));
+			ERR_print_errors_fp(stderr);
+			goto cleanup;
+		}
+		bytes += CRYPT_BENCH_BUFFER_LEN;
+		elapsed = now_secs() - start;
+	}while (elapsed < CRYPT_BENCH_SECONDS);
+
+	ret = bytes / elapsed;
+
+cleanup:
+	EVP_MD_CTX_destroy(ctx);
+	free(in);
+	return ret;
+}
+
+static const EVP_CIPHER* best_cipher = NULL;
+static const EVP_MD* best_md = NULL;
+static pthread_once_t cipher_once = PTHREAD_ONCE_INIT;
+static pthread_once_t md_once = PTHREAD_ONCE_INIT;
+
+static void pick_cipher(void){
+	double best_rate = 0;
+	size_t i;
+
+	for (i = 0; i < ARRAY_LEN(auto_ciphers); ++i){
+		const EVP_CIPHER* cipher = EVP_get_cipherbyname(auto_ciphers[i]);
+		double rate;
+
+		if (!cipher){
+			continue;
+		}
+		rate = crypt_bench_cipher(cipher);
+		if (rate > best_rate){
+			best_rate = rate;
+			best_cipher = cipher;
+		}
+	}
+	if (best_cipher){
+		log_info_ex2("Picked %s (%.0f MB/s)", EVP_CIPHER_name(best_cipher), best_rate / 1048576.0);
+	}
+}
+
+static void pick_md(void){
+	double best_rate = 0;
+	size_t i;
+
+	for (i = 0; i < ARRAY_LEN(auto_mds); ++i){
+		const EVP_MD* md = EVP_get_digestbyname(auto_mds[i]);
+		double rate;
+
+		if (!md){
+			continue;
+		}
+		rate = crypt_bench_md(md);
+		if (rate > best_rate){
+			best_rate = rate;
+			best_md = md;
+		}
+	}
+	if (best_md){
+		log_info_ex2("Picked %s (%.0f MB/s)", EVP_MD_name(best_md), best_rate / 1048576.0);
+	}
+}
+
+const EVP_CIPHER* crypt_auto_cipher(void){
+	pthread_once(&cipher_once, pick_cipher);
+	if (!best_cipher){
+		log_error("None of the automatically selectable ciphers are available");
+	}
+	return best_cipher;
+}
+
+const EVP_MD* crypt_auto_md(void){
+	pthread_once(&md_once, pick_md);
+	if (!best_md){
+		log_error("None of the automatically selectable digests are available");
+	}
+	return best_md;
+}
+
+int crypt_benchmark(FILE* fp){
+	/* the usual suspects besides the candidates, so users can see what they would be giving up */
+	const char* const other_ciphers[] = {"AES-128-GCM", "AES-256-CBC", "AES-256-CTR", "CAMELLIA-256-CBC", "SEED-CBC", "BF-CBC", "DES-EDE3-CBC"};
+	const char* const other_mds[] = {"MD5", "SHA1"};
+	unsigned features = crypt_cpu_features();
+	size_t i;
+
+	return_ifnull(fp, -1);
+
+	fprintf(fp, "CPU: AES %s, carry-less multiply %s, SHA %s, AVX2 %s\n",
+			features & CRYPT_CPU_AES ? "yes" : "no",
+			features & CRYPT_CPU_PCLMUL ? "yes" : "no",
+			features & CRYPT_CPU_SHA ? "yes" : "no",
+			features & CRYPT_CPU_AVX2 ? "yes" : "no");
+
+	fprintf(fp, "\nCiphers (* = eligible for auto):\n");
+	for (i = 0; i < ARRAY_LEN(auto_ciphers) + ARRAY_LEN(other_ciphers); ++i){
+		const char* name = i < ARRAY_LEN(auto_ciphers) ? auto_ciphers[i] : other_ciphers[i - ARRAY_LEN(auto_ciphers)];
+		const EVP_CIPHER* cipher = EVP_get_cipherbyname(name);
+		double rate = cipher ? crypt_bench_cipher(cipher) : -1;
+
+		if (rate < 0){
+			fprintf(fp, "%c %-20s unavailable\n", i < ARRAY_LEN(auto_ciphers) ? '*' : ' ', name);
+		}
+		else{
+			fprintf(fp, "%c %-20s %10.1f MB/s\n", i < ARRAY_LEN(auto_ciphers) ? '*' : ' ', name, rate / 1048576.0);
+		}
+	}
+
+	fprintf(fp, "\nDigests (* = eligible for auto):\n");
+	for (i = 0; i < ARRAY_LEN(auto_mds) + ARRAY_LEN(other_mds); ++i){
+		const char* name = i < ARRAY_LEN(auto_mds) ? auto_mds[i] : other_mds[i - ARRAY_LEN(auto_mds)];
+		const EVP_MD* md = EVP_get_digestbyname(name);
+		double rate = md ? crypt_bench_md(md) : -1;
+
+		if (rate < 0){
+			fprintf(fp, "%c %-20s unavailable\n", i < ARRAY_LEN(auto_mds) ? '*' : ' ', name);
+		}
+		else{
+			fprintf(fp, "%c %-20s %10.1f MB/s\n", i < ARRAY_LEN(auto_mds) ? '*' : ' ', name, rate / 1048576.0);
+		}
+	}
+
+	if (crypt_auto_cipher() && crypt_auto_md()){
+		fprintf(fp, "\nauto picks %s and %s\n", EVP_CIPHER_name(crypt_auto_cipher()), EVP_MD_name(crypt_auto_md()));
+	}
+	return 0;
+}
@@ -0,0 +1,80 @@
+/** @file crypt/crypt_bench.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __CRYPT_CRYPT_BENCH_H
+#define __CRYPT_CRYPT_BENCH_H
+
+#include <openssl/evp.h>
+#include <stdio.h>
+
+#define CRYPT_BENCH_BUFFER_LEN (1 << 20) /**< @brief The size of the in-memory buffer each algorithm is timed on. */
+#define CRYPT_BENCH_SECONDS    (0.1)     /**< @brief How long each algorithm is timed for. */
+
+/**
+ * @brief CPU instructions that make some algorithms much faster.
+ */
+enum crypt_cpu_feature{
+	CRYPT_CPU_AES = 1 << 0, /**< @brief AES instructions (AES-NI on x86, the ARMv8 crypto extensions on ARM). */
+	CRYPT_CPU_PCLMUL = 1 << 1, /**< @brief Carry-less multiplication, which GCM uses to compute its tag. */
+	CRYPT_CPU_SHA = 1 << 2, /**< @brief SHA-256 instructions. */
+	CRYPT_CPU_AVX2 = 1 << 3 /**< @brief 256-bit vector instructions, which ChaCha20 and BLAKE2 use. */
+};
+
+/**
+ * @brief Checks which of the crypt_cpu_feature instructions this CPU has.
+ *
+ * @return A bitmask of crypt_cpu_feature values.
+ */
+unsigned crypt_cpu_features(void);
+
+/**
+ * @brief Measures how fast a cipher encrypts data in memory.
+ *
+ * @param cipher The cipher to time.
+ *
+ * @return The throughput in bytes per second, or negative on failure.
+ */
+double crypt_bench_cipher(const EVP_CIPHER* cipher);
+
+/**
+ * @brief Measures how fast a digest hashes data in memory.
+ *
+ * @param md The digest to time.
+ *
+ * @return The throughput in bytes per second, or negative on failure.
+ */
+double crypt_bench_md(const EVP_MD* md);
+
+/**
+ * @brief Picks the fastest cipher on this machine that meets the security floor.<br>
+ * Only authenticated ciphers with 256-bit keys (AES-256-GCM and ChaCha20-Poly1305) are considered.<br>
+ * The result is computed once and cached.
+ *
+ * @return The fastest cipher, or NULL if none of them are available.
+ */
+const EVP_CIPHER* crypt_auto_cipher(void);
+
+/**
+ * @brief Picks the fastest digest on this machine that meets the security floor.<br>
+ * Only unbroken digests with at least 256 bits of output (SHA-2, SHA-3, and BLAKE2) are considered.<br>
+ * The result is computed once and cached.
+ *
+ * @return The fastest digest, or NULL if none of them are available.
+ */
+const EVP_MD* crypt_auto_md(void);
+
+/**
+ * @brief Times every candidate cipher and digest and prints the results.
+ *
+ * @param fp The stream to print to (e.g. stdout).
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int crypt_benchmark(FILE* fp);
+
+#endif
@@ -8,12 +8,19 @@
 
 #include "crypt_easy.h"
 #include "crypt.h"
+#include "crypt_aead.h"
+#include "crypt_master.h"
 #include "crypt_getpassword.h"
 #include "../log.h"
 #include "../coredumps.h"
 #include "../filehelper.h"
 #include "../strings/stringhelper.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 int easy_encrypt(const char* in, const char* out, const char* enc_algorithm, int verbose, const char* password){
 	const EVP_CIPHER* cipher = crypt_get_cipher(enc_algorithm);
@@ -68,6 +75,16 @@ int easy_encrypt(const char* in, const char* out, const char* enc_algorithm, int
 		}
 	}
 
+	/* authenticated ciphers use the chunked format, which derives its own keys from the password */
+	if (crypt_aead_from_evp(cipher) != CRYPT_AEAD_NONE){
+		const char* pw = password ? password : passwd;
+		if (crypt_aead_encrypt(in, out, crypt_aead_from_evp(cipher), (const unsigned char*)pw, strlen(pw), 0) != 0){
+			log_debug("crypt_aead_encrypt() failed");
+			ret = -1;
+		}
+		goto cleanup;
+	}
+
 	if ((crypt_gen_keys(password ? (unsigned char*)password : (unsigned char*)passwd, password ? strlen(password) : strlen(passwd), NULL, 1, fk)) != 0){
 		crypt_scrub(passwd, strlen(passwd));
 		log_debug("crypt_gen_keys() failed");
@@ -127,7 +144,7 @@ int easy_decrypt(const char* in, const char* out, const char* enc_algorithm, int
 		goto cleanup;
 	}
 
-	if (crypt_extract_salt(in, fk) != 0){
+	if (crypt_aead_from_evp(cipher) == CRYPT_AEAD_NONE && crypt_extract_salt(in, fk) != 0){
 		log_debug("crypt_extract_salt() failed");
 		ret = -1;
 		goto cleanup;
@@ -142,6 +159,15 @@ int easy_decrypt(const char* in, const char* out, const char* enc_algorithm, int
 		}
 	}
 
+	if (crypt_aead_from_evp(cipher) != CRYPT_AEAD_NONE){
+		const char* pw = password ? password : passwd;
+		if (crypt_aead_decrypt(in, out, (const unsigned char*)pw, strlen(pw), 0) != 0){
+			log_debug("crypt_aead_decrypt() failed");
+			ret = -1;
+		}
+		goto cleanup;
+	}
+
 	if ((crypt_gen_keys(password ? (unsigned char*)password : (unsigned char*)passwd, password ? strlen(password) : strlen(passwd), NULL, 1, fk)) != 0){
 		crypt_scrub(passwd, strlen(passwd));
 		log_debug("crypt_gen_keys() failed");
@@ -238,3 +264,479 @@ cleanup:
 
 	return ret;
 }
+
+/* encrypts with a random salt, or with one taken from the content id if it is not NULL */
+static int encrypt_master(const char* in, const char* out, const char* enc_algorithm, int verbose, const struct crypt_master* cm, const unsigned char* id, unsigned threads){
+	const EVP_CIPHER* cipher = crypt_get_cipher(enc_algorithm);
+	struct crypt_keys* fk = NULL;
+	char* verbose_msg = NULL;
+	int ret = 0;
+
+	return_ifnull(cm, -1);
+
+	if (!cipher){
+		log_error("Could not load proper encryption algorithm.");
+		return -1;
+	}
+
+	if (crypt_aead_from_evp(cipher) != CRYPT_AEAD_NONE){
+		return crypt_aead_encrypt_salt(in, out, crypt_aead_from_evp(cipher), crypt_master_key(cm), CRYPT_MASTER_KEY_LEN, id, threads);
+	}
+
+	if ((fk = crypt_new()) == NULL ||
+			crypt_set_encryption(cipher, fk) != 0 ||
+			(id ? crypt_set_salt(id, fk) : crypt_gen_salt(fk)) != 0 ||
+			crypt_gen_keys_hkdf(crypt_master_key(cm), CRYPT_MASTER_KEY_LEN, fk) != 0){
+		log_debug("Failed to generate file keys");
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (verbose){
+		verbose_msg = sh_concat(sh_concat(sh_dup("Encrypting "), out), "...");
+	}
+	if (crypt_encrypt_ex(in, fk, out, verbose, verbose_msg ? verbose_msg : "Encrypting file...") != 0){
+		log_debug("crypt_encrypt() failed");
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	fk ? crypt_free(fk) : (void)0;
+	free(verbose_msg);
+	return ret;
+}
+
+int easy_encrypt_master(const char* in, const char* out, const char* enc_algorithm, int verbose, const struct crypt_master* cm, unsigned threads){
+	return encrypt_master(in, out, enc_algorithm, verbose, cm, NULL, threads);
+}
+
+int easy_encrypt_convergent(const char* in, const char* out, const char* enc_algorithm, int verbose, const struct crypt_master* cm, const unsigned char id[CRYPT_CONTENT_ID_LEN], unsigned threads){
+	return_ifnull(id, -1);
+	return encrypt_master(in, out, enc_algorithm, verbose, cm, id, threads);
+}
+
+int easy_decrypt_master(const char* in, const char* out, const char* enc_algorithm, int verbose, const struct crypt_master* cm, unsigned threads){
+	const EVP_CIPHER* cipher = crypt_get_cipher(enc_algorithm);
+	struct crypt_keys* fk = NULL;
+	char* verbose_msg = NULL;
+	int ret = 0;
+
+	return_ifnull(cm, -1);
+
+	if (!cipher){
+		log_error("Failed to load proper encryption algorithm");
+		return -1;
+	}
+
+	if (crypt_aead_from_evp(cipher) != CRYPT_AEAD_NONE){
+		return crypt_aead_decrypt(in, out, crypt_master_key(cm), CRYPT_MASTER_KEY_LEN, threads);
+	}
+
+	if ((fk = crypt_new()) == NULL ||
+			crypt_set_encryption(cipher, fk) != 0 ||
+			crypt_extract_salt(in, fk) != 0 ||
+			crypt_gen_keys_hkdf(crypt_master_key(cm), CRYPT_MASTER_KEY_LEN, fk) != 0){
+		log_debug("Failed to generate file keys");
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (verbose){
+		verbose_msg = sh_concat(sh_concat(sh_dup("Decrypting "), in), "...");
+	}
+	if (crypt_decrypt_ex(in, fk, out, verbose, verbose_msg ? verbose_msg : "Decrypting file...") != 0){
+		log_debug("crypt_decrypt() failed");
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	fk ? crypt_free(fk) : (void)0;
+	free(verbose_msg);
+	return ret;
+}
+
+int easy_encrypt_master_inplace(const char* in_out, const char* enc_algorithm, int verbose, const struct crypt_master* cm, unsigned threads){
+	struct TMPFILE* tfp_tmp = NULL;
+	int ret = 0;
+
+	tfp_tmp = temp_fopen();
+	if (!tfp_tmp){
+		log_error("Failed to make temporary file");
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (rename_file(in_out, tfp_tmp->name) != 0){
+		log_error("Failed to move file to temporary location");
+		ret = -1;
+		goto cleanup;
+	}
+	temp_fflush(tfp_tmp);
+
+	if (easy_encrypt_master(tfp_tmp->name, in_out, enc_algorithm, verbose, cm, threads) != 0){
+		log_error("easy_encrypt_master() failed");
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	if (ret != 0 && tfp_tmp){
+		rename_file(tfp_tmp->name, in_out);
+	}
+	tfp_tmp ? remove(tfp_tmp->name) : 0;
+	tfp_tmp ? temp_fclose(tfp_tmp) : (void)0;
+
+	return ret;
+}
+
+int easy_decrypt_master_inplace(const char* in_out, const char* enc_algorithm, int verbose, const struct crypt_master* cm, unsigned threads){
+	struct TMPFILE* tfp_tmp = NULL;
+	int ret = 0;
+
+	tfp_tmp = temp_fopen();
+	if (!tfp_tmp){
+		log_error("Failed to generate temporary file");
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (rename_file(in_out, tfp_tmp->name) != 0){
+		log_error("Failed to move file to temporary location");
+		ret = -1;
+		goto cleanup;
+	}
+	temp_fflush(tfp_tmp);
+
+	if (easy_decrypt_master(tfp_tmp->name, in_out, enc_algorithm, verbose, cm, threads) != 0){
+		log_error("easy_decrypt_master() failed");
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	if (ret != 0 && tfp_tmp){
+		rename_file(tfp_tmp->name, in_out);
+	}
+	tfp_tmp ? remove(tfp_tmp->name) : 0;
+	tfp_tmp ? temp_fclose(tfp_tmp) : (void)0;
+
+	return ret;
+}
+
+int easy_encrypt_convergent_inplace(const char* in_out, const char* enc_algorithm, int verbose, const struct crypt_master* cm, const unsigned char id[CRYPT_CONTENT_ID_LEN], unsigned threads){
+	struct TMPFILE* tfp_tmp = NULL;
+	int ret = 0;
+
+	tfp_tmp = temp_fopen();
+	if (!tfp_tmp){
+		log_error("Failed to make temporary file");
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (rename_file(in_out, tfp_tmp->name) != 0){
+		log_error("Failed to move file to temporary location");
+		ret = -1;
+		goto cleanup;
+	}
+	temp_fflush(tfp_tmp);
+
+	if (easy_encrypt_convergent(tfp_tmp->name, in_out, enc_algorithm, verbose, cm, id, threads) != 0){
+		log_error("easy_encrypt_convergent() failed");
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	if (ret != 0 && tfp_tmp){
+		rename_file(tfp_tmp->name, in_out);
+	}
+	tfp_tmp ? remove(tfp_tmp->name) : 0;
+	tfp_tmp ? temp_fclose(tfp_tmp) : (void)0;
+
+	return ret;
+}
+
+/* the writer hands out the write end of a pipe. a thread reads the other end and encrypts it straight into the output file,
+ * so whatever is written (e.g. compressed data) reaches the disk once, already encrypted */
+struct easy_writer{
+	FILE* fp;
+	FILE* fp_pipe;
+	FILE* fp_out;
+	char* out;
+	const struct crypt_master* cm;
+	enum crypt_aead_cipher aead;
+	struct crypt_keys* fk;
+	unsigned threads;
+	pthread_t thread;
+	int thread_started;
+	int status;
+};
+
+static void* easy_writer_thread(void* arg){
+	struct easy_writer* ew = arg;
+	unsigned char buf[BUFFER_LEN];
+
+	if (ew->aead != CRYPT_AEAD_NONE){
+		ew->status = crypt_aead_encrypt_fp(ew->fp_pipe, ew->fp_out, ew->aead, crypt_master_key(ew->cm), CRYPT_MASTER_KEY_LEN, NULL, ew->threads);
+	}
+	else{
+		ew->status = crypt_encrypt_fp(ew->fp_pipe, ew->fk, ew->fp_out);
+	}
+
+	/* keep reading until the writer is done, so it never blocks on (or gets SIGPIPE from) a pipe nobody reads */
+	while (read_file(ew->fp_pipe, buf, sizeof(buf)) > 0);
+	return NULL;
+}
+
+struct easy_writer* easy_encrypt_master_fopen(const char* out, const char* enc_algorithm, const struct crypt_master* cm, unsigned threads){
+	const EVP_CIPHER* cipher = crypt_get_cipher(enc_algorithm);
+	struct easy_writer* ew;
+	int fds[2] = { -1, -1 };
+
+	return_ifnull(out, NULL);
+	return_ifnull(cm, NULL);
+
+	if (!cipher){
+		log_error("Could not load proper encryption algorithm.");
+		return NULL;
+	}
+
+	ew = calloc(1, sizeof(*ew));
+	if (!ew){
+		log_enomem();
+		return NULL;
+	}
+	ew->cm = cm;
+	ew->threads = threads;
+	ew->aead = crypt_aead_from_evp(cipher);
+
+	if (ew->aead == CRYPT_AEAD_NONE && ((ew->fk = crypt_new()) == NULL ||
+			crypt_set_encryption(cipher, ew->fk) != 0 ||
+			crypt_gen_salt(ew->fk) != 0 ||
+			crypt_gen_keys_hkdf(crypt_master_key(cm), CRYPT_MASTER_KEY_LEN, ew->fk) != 0)){
+		log_debug("Failed to generate file keys");
+		goto cleanup_fail;
+	}
+
+	ew->out = sh_dup(out);
+	if (!ew->out){
+		goto cleanup_fail;
+	}
+	ew->fp_out = fopen(out, "wb");
+	if (!ew->fp_out){
+		log_efopen(out);
+		goto cleanup_fail;
+	}
+
+	if (pipe(fds) != 0){
+		log_error_ex("Failed to create pipe (%s)", strerror(errno));
+		goto cleanup_fail;
+	}
+	ew->fp_pipe = fdopen(fds[0], "rb");
+	ew->fp = ew->fp_pipe ? fdopen(fds[1], "wb") : NULL;
+	if (!ew->fp){
+		log_error_ex("Failed to open pipe (%s)", strerror(errno));
+		ew->fp_pipe ? (void)0 : (void)close(fds[0]);
+		close(fds[1]);
+		goto cleanup_fail;
+	}
+
+	if (pthread_create(&ew->thread, NULL, easy_writer_thread, ew) != 0){
+		log_error("Failed to start encryption thread");
+		goto cleanup_fail;
+	}
+	ew->thread_started = 1;
+	return ew;
+
+cleanup_fail:
+	easy_writer_close(ew, 1);
+	return NULL;
+}
+
+FILE* easy_writer_fp(struct easy_writer* ew){
+	return ew ? ew->fp : NULL;
+}
+
+int easy_writer_close(struct easy_writer* ew, int discard){
+	int ret;
+
+	if (!ew){
+		return -1;
+	}
+
+	/* closing the write end is what tells the thread the input is over */
+	if (ew->fp && fclose(ew->fp) != 0){
+		log_efclose("pipe");
+		discard = 1;
+	}
+	if (ew->thread_started){
+		pthread_join(ew->thread, NULL);
+	}
+	else{
+		discard = 1;
+	}
+	ew->fp_pipe ? fclose(ew->fp_pipe) : 0;
+	if (ew->fp_out && fclose(ew->fp_out) != 0){
+		log_efclose(ew->out);
+		discard = 1;
+	}
+
+	ret = discard || ew->status != 0 ? -1 : 0;
+	if (ret != 0 && ew->fp_out){
+		remove(ew->out);
+	}
+
+	ew->fk ? crypt_free(ew->fk) : (void)0;
+	free(ew->out);
+	free(ew);
+	return ret;
+}
+
+/* the reader decrypts a chunk (or one buffer of a stream) at a time into its own buffer, then hands that out as it is asked for */
+struct easy_reader{
+	struct crypt_aead_file* caf;
+	uint64_t chunk;
+	struct crypt_keys* fk;
+	struct crypt_stream* cs;
+	FILE* fp;
+	char* in;
+	unsigned char* buf;
+	size_t buf_size;
+	size_t buf_len;
+	size_t buf_pos;
+	int done;
+};
+
+struct easy_reader* easy_decrypt_master_open(const char* in, const char* enc_algorithm, const struct crypt_master* cm){
+	const EVP_CIPHER* cipher = crypt_get_cipher(enc_algorithm);
+	struct easy_reader* er;
+
+	return_ifnull(in, NULL);
+	return_ifnull(cm, NULL);
+
+	if (!cipher){
+		log_error("Failed to load proper encryption algorithm");
+		return NULL;
+	}
+
+	er = calloc(1, sizeof(*er));
+	if (!er){
+		log_enomem();
+		return NULL;
+	}
+	er->in = sh_dup(in);
+	if (!er->in){
+		goto cleanup_fail;
+	}
+
+	if (crypt_aead_from_evp(cipher) != CRYPT_AEAD_NONE){
+		er->caf = crypt_aead_open(in, crypt_master_key(cm), CRYPT_MASTER_KEY_LEN);
+		if (!er->caf){
+			goto cleanup_fail;
+		}
+		er->buf_size = CRYPT_AEAD_CHUNK_SIZE;
+	}
+	else{
+		if ((er->fk = crypt_new()) == NULL ||
+				crypt_set_encryption(cipher, er->fk) != 0 ||
+				crypt_extract_salt(in, er->fk) != 0 ||
+				crypt_gen_keys_hkdf(crypt_master_key(cm), CRYPT_MASTER_KEY_LEN, er->fk) != 0){
+			log_debug("Failed to generate file keys");
+			goto cleanup_fail;
+		}
+		er->cs = crypt_stream_new(er->fk, 0);
+		er->fp = er->cs ? fopen(in, "rb") : NULL;
+		if (!er->fp){
+			er->cs ? log_efopen(in) : (void)0;
+			goto cleanup_fail;
+		}
+		er->buf_size = BUFFER_LEN + CRYPT_STREAM_OVERHEAD;
+	}
+
+	er->buf = malloc(er->buf_size);
+	if (!er->buf){
+		log_enomem();
+		goto cleanup_fail;
+	}
+	return er;
+
+cleanup_fail:
+	easy_reader_close(er);
+	return NULL;
+}
+
+/* decrypts the next chunk or buffer. this can produce nothing, e.g. when a stream's first buffer is mostly its salt header */
+static int easy_reader_fill(struct easy_reader* er){
+	er->buf_pos = 0;
+	er->buf_len = 0;
+
+	if (er->caf){
+		if (er->chunk >= crypt_aead_chunks(er->caf)){
+			er->done = 1;
+			return 0;
+		}
+		return crypt_aead_read_chunk(er->caf, er->chunk++, er->buf, &er->buf_len);
+	}
+	else{
+		unsigned char in[BUFFER_LEN];
+		int in_len;
+		int out_len = 0;
+
+		in_len = read_file(er->fp, in, sizeof(in));
+		if (in_len < 0){
+			log_efread(er->in);
+			return -1;
+		}
+		if (in_len == 0){
+			er->done = 1;
+			if (crypt_stream_final(er->cs, er->buf, &out_len) != 0){
+				return -1;
+			}
+		}
+		else if (crypt_stream_update(er->cs, in, in_len, er->buf, &out_len) != 0){
+			return -1;
+		}
+		er->buf_len = out_len;
+		return 0;
+	}
+}
+
+int easy_reader_read(struct easy_reader* er, unsigned char* out, size_t out_size, size_t* out_len){
+	size_t n;
+
+	return_ifnull(er, -1);
+	return_ifnull(out_len, -1);
+
+	*out_len = 0;
+	while (er->buf_pos == er->buf_len && !er->done){
+		if (easy_reader_fill(er) != 0){
+			log_error_ex("Failed to decrypt %s", er->in);
+			er->done = 1;
+			return -1;
+		}
+	}
+
+	n = er->buf_len - er->buf_pos < out_size ? er->buf_len - er->buf_pos : out_size;
+	memcpy(out, er->buf + er->buf_pos, n);
+	er->buf_pos += n;
+	*out_len = n;
+	return 0;
+}
+
+void easy_reader_close(struct easy_reader* er){
+	if (!er){
+		return;
+	}
+	/* the buffer holds plaintext */
+	er->buf ? crypt_scrub(er->buf, er->buf_size) : 0;
+	free(er->buf);
+	crypt_aead_close(er->caf);
+	crypt_stream_free(er->cs);
+	er->fk ? crypt_free(er->fk) : (void)0;
+	er->fp ? fclose(er->fp) : 0;
+	free(er->in);
+	free(er);
+}
@@ -9,6 +9,9 @@
 #ifndef __CRYPT_CRYPT_EASY_H
 #define __CRYPT_CRYPT_EASY_H
 
+#include "crypt_master.h"
+#include <stdio.h>
+
 /**
  * @brief Encrypts a file.
  *
@@ -81,4 +84,231 @@ int easy_encrypt_inplace(const char* in_out, const char* enc_algorithm, int verb
  */
 int easy_decrypt_inplace(const char* in_out, const char* enc_algorithm, int verbose, const char* password);
 
+/**
+ * @brief Encrypts a file with a key derived from a master key.<br>
+ * Unlike easy_encrypt(), no password-based key derivation is done, so this is cheap enough to call for every file in a backup.
+ *
+ * @param in Path to a file to encrypt.
+ *
+ * @param out Path to write the encrypted file to.<br>
+ * If this function fails, the output file is removed.
+ *
+ * @param enc_algorithm The encryption algorithm to use (e.g. "AES-256-GCM")
+ *
+ * @param verbose Any value besides 0 shows a progress bar.
+ *
+ * @param cm The master key, made once with crypt_master_new().
+ *
+ * @param threads The amount of worker threads to encrypt with.<br>
+ * This is only used by authenticated ciphers (e.g. "AES-256-GCM"). 0 encrypts on the calling thread.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int easy_encrypt_master(const char* in, const char* out, const char* enc_algorithm, int verbose, const struct crypt_master* cm, unsigned threads);
+
+/**
+ * @brief Encrypts a file deterministically, so files with the same contents encrypt to the same output.<br>
+ * The salt is taken from the file's content id instead of being random. This lets encrypted files be deduplicated, at the cost of revealing which encrypted files have the same contents.<br>
+ * The output is decrypted with easy_decrypt_master().
+ *
+ * @param in Path to a file to encrypt.
+ *
+ * @param out Path to write the encrypted file to.<br>
+ * If this function fails, the output file is removed.
+ *
+ * @param enc_algorithm The encryption algorithm to use (e.g. "AES-256-GCM").<br>
+ * Authenticated ciphers should be used, as their salt is long enough that different contents never share a key.
+ *
+ * @param verbose Any value besides 0 shows a progress bar.
+ *
+ * @param cm The master key.
+ *
+ * @param id The content id of the input file from crypt_master_content_id().
+ *
+ * @param threads The amount of worker threads to encrypt with.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int easy_encrypt_convergent(const char* in, const char* out, const char* enc_algorithm, int verbose, const struct crypt_master* cm, const unsigned char id[CRYPT_CONTENT_ID_LEN], unsigned threads);
+
+/**
+ * @brief Decrypts a file encrypted with easy_encrypt_master().
+ *
+ * @param in Path to a file to decrypt.
+ *
+ * @param out Path to write the decrypted file to.<br>
+ * If this function fails, the output file is removed.
+ *
+ * @param enc_algorithm The decryption algorithm to use (e.g. "AES-256-GCM")
+ *
+ * @param verbose Any value besides 0 shows a progress bar.
+ *
+ * @param cm The master key the file was encrypted with.
+ *
+ * @param threads The amount of worker threads to decrypt with.<br>
+ * This is only used by authenticated ciphers (e.g. "AES-256-GCM"). 0 decrypts on the calling thread.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int easy_decrypt_master(const char* in, const char* out, const char* enc_algorithm, int verbose, const struct crypt_master* cm, unsigned threads);
+
+/**
+ * @brief Encrypts a file in place with a key derived from a master key.
+ * @see easy_encrypt_master()
+ *
+ * @param in_out Path to a file to encrypt.<br>
+ * If this function fails, the file is unchanged.
+ *
+ * @param enc_algorithm The encryption algorithm to use (e.g. "AES-256-GCM")
+ *
+ * @param verbose Any value besides 0 shows a progress bar.
+ *
+ * @param cm The master key.
+ *
+ * @param threads The amount of worker threads to encrypt with.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int easy_encrypt_master_inplace(const char* in_out, const char* enc_algorithm, int verbose, const struct crypt_master* cm, unsigned threads);
+
+/**
+ * @brief Decrypts a file in place that was encrypted with a key derived from a master key.
+ * @see easy_decrypt_master()
+ *
+ * @param in_out Path to a file to decrypt.<br>
+ * If this function fails, the file is unchanged.
+ *
+ * @param enc_algorithm The decryption algorithm to use (e.g. "AES-256-GCM")
+ *
+ * @param verbose Any value besides 0 shows a progress bar.
+ *
+ * @param cm The master key the file was encrypted with.
+ *
+ * @param threads The amount of worker threads to decrypt with.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int easy_decrypt_master_inplace(const char* in_out, const char* enc_algorithm, int verbose, const struct crypt_master* cm, unsigned threads);
+
+/**
+ * @brief Encrypts a file in place deterministically.
+ * @see easy_encrypt_convergent()
+ *
+ * @param in_out Path to a file to encrypt.<br>
+ * If this function fails, the file is unchanged.
+ *
+ * @param enc_algorithm The encryption algorithm to use (e.g. "AES-256-GCM")
+ *
+ * @param verbose Any value besides 0 shows a progress bar.
+ *
+ * @param cm The master key.
+ *
+ * @param id The content id of the file from crypt_master_content_id().
+ *
+ * @param threads The amount of worker threads to encrypt with.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int easy_encrypt_convergent_inplace(const char* in_out, const char* enc_algorithm, int verbose, const struct crypt_master* cm, const unsigned char id[CRYPT_CONTENT_ID_LEN], unsigned threads);
+
+/**
+ * @brief A stream that encrypts everything written to it into a file.
+ */
+struct easy_writer;
+
+/**
+ * @brief Opens a stream that encrypts what is written to it with a key derived from a master key.<br>
+ * Encryption runs on another thread as the data arrives, so the output is written once instead of being written in plaintext and encrypted afterwards.<br>
+ * The result can be read by easy_decrypt_master() like any other file it encrypted.
+ * @see easy_encrypt_master()
+ *
+ * @param out Path to write the encrypted file to.<br>
+ * If this file already exists, it will be overwritten.
+ *
+ * @param enc_algorithm The encryption algorithm to use (e.g. "AES-256-GCM")
+ *
+ * @param cm The master key.<br>
+ * This must stay valid until the writer is closed.
+ *
+ * @param threads The amount of worker threads to encrypt with.<br>
+ * This is only used by authenticated ciphers (e.g. "AES-256-GCM").
+ *
+ * @return A new writer, or NULL on failure.<br>
+ * This must be closed with easy_writer_close().
+ */
+struct easy_writer* easy_encrypt_master_fopen(const char* out, const char* enc_algorithm, const struct crypt_master* cm, unsigned threads);
+
+/**
+ * @brief Gets the FILE* to write plaintext to.<br>
+ * The stream is a pipe, so it cannot be seeked.
+ *
+ * @param ew The writer.
+ *
+ * @return The writer's FILE*.<br>
+ * This must not be closed directly; use easy_writer_close() instead.
+ */
+FILE* easy_writer_fp(struct easy_writer* ew);
+
+/**
+ * @brief Finishes encrypting and closes a writer.
+ *
+ * @param ew The writer.<br>
+ * This is freed whether or not this function succeeds.
+ *
+ * @param discard Any value besides 0 throws away the output, e.g. because writing the plaintext failed.
+ *
+ * @return 0 on success, or negative on failure (including if discard was set).<br>
+ * On failure, the output file is removed.
+ */
+int easy_writer_close(struct easy_writer* ew, int discard);
+
+/**
+ * @brief A stream that decrypts a file into memory.
+ */
+struct easy_reader;
+
+/**
+ * @brief Opens a file encrypted with a key derived from a master key, so it can be decrypted a buffer at a time.<br>
+ * This reads anything easy_encrypt_master(), easy_encrypt_convergent(), or an easy_writer wrote. The plaintext is never written to disk.
+ * @see easy_decrypt_master()
+ *
+ * @param in Path to the encrypted file.
+ *
+ * @param enc_algorithm The encryption algorithm the file was encrypted with (e.g. "AES-256-GCM")
+ *
+ * @param cm The master key.<br>
+ * This only needs to stay valid until this function returns.
+ *
+ * @return A new reader, or NULL on failure.<br>
+ * This must be closed with easy_reader_close().
+ */
+struct easy_reader* easy_decrypt_master_open(const char* in, const char* enc_algorithm, const struct crypt_master* cm);
+
+/**
+ * @brief Decrypts the next part of a file.<br>
+ * Authenticated ciphers check each chunk before any of it is returned. Other ciphers only detect a wrong key or damaged data at the end of the file.
+ *
+ * @param er The reader.
+ *
+ * @param out The buffer to decrypt into.
+ *
+ * @param out_size The size of the buffer.
+ *
+ * @param out_len Set to the amount of bytes decrypted into the buffer.<br>
+ * This is only 0 at the end of the file.
+ *
+ * @return 0 on success, or negative on failure (e.g. the file is damaged or the key is wrong).
+ */
+int easy_reader_read(struct easy_reader* er, unsigned char* out, size_t out_size, size_t* out_len);
+
+/**
+ * @brief Closes a reader and scrubs its plaintext and keys.
+ *
+ * @param er The reader to close.<br>
+ * If this is NULL, this function does nothing.
+ *
+ * @return void
+ */
+void easy_reader_close(struct easy_reader* er);
+
 #endif
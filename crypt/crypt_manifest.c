@@ -0,0 +1,639 @@
+/** @file crypt/crypt_manifest.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "crypt_manifest.h"
+#include "crypt.h"
+#include "../log.h"
+#include "../filehelper.h"
+#include <openssl/err.h>
+#include <openssl/rand.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* a manifest is laid out as follows. all integers are little-endian.
+ *
+ * header:  8 byte magic
+ *          u8  version
+ *          u8  cipher
+ *          2 bytes reserved
+ *          16 byte salt
+ *          4 bytes reserved
+ * block 0 .. block n-1:
+ *          u32 plaintext length
+ *          ciphertext and tag of whole checksum list entries ("/path/to/file\0ABCDEF\n")
+ * index:   u32 plaintext length
+ *          ciphertext and tag of, for each block: u64 offset, u32 plaintext length, the first filename in it and a '\0'
+ * trailer: u64 offset of the index
+ *          u64 number of blocks
+ *          8 byte magic
+ *
+ * block i is sealed under the chunk nonce for (i, 0) and the index under (n, 1), both with the header as associated data,
+ * so blocks cannot be moved or dropped without the index or the block failing authentication.
+ * entries never straddle two blocks, so any entry can be found by decrypting exactly one of them. */
+#define MANIFEST_MAGIC "EZBMAN01"
+#define MANIFEST_TRAILER_MAGIC "EZBMIDX1"
+#define MANIFEST_VERSION (1)
+#define MANIFEST_KEY_LEN (32)
+#define MANIFEST_KEY_INFO "ezbackup manifest key"
+#define MANIFEST_TRAILER_LEN (24)
+/* a cached block index that means nothing is cached */
+#define MANIFEST_NO_BLOCK ((size_t)-1)
+
+struct manifest_block{
+	uint64_t offset;
+	uint32_t len;
+	const char* first;
+};
+
+struct crypt_manifest{
+	FILE* fp;
+	unsigned char header[CRYPT_MANIFEST_HEADER_LEN];
+	EVP_CIPHER_CTX* ctx;
+	struct manifest_block* blocks;
+	size_t n_blocks;
+	unsigned char* index;
+	/* the last block decrypted */
+	unsigned char* buf;
+	size_t buf_len;
+	size_t buf_block;
+	unsigned char* in_buf;
+	/* where crypt_manifest_next() is */
+	size_t next_block;
+	size_t next_pos;
+};
+
+static void put_u32(unsigned char* p, uint32_t x){
+	int i;
+
+	for (i = 0; i < 4; ++i){
+		p[i] = (x >> (8 * i)) & 0xFF;
+	}
+}
+
+static void put_u64(unsigned char* p, uint64_t x){
+	int i;
+
+	for (i = 0; i < 8; ++i){
+		p[i] = (x >> (8 * i)) & 0xFF;
+	}
+}
+
+static uint32_t get_u32(const unsigned char* p){
+	uint32_t x = 0;
+	int i;
+
+	for (i = 3; i >= 0; --i){
+		x = (x << 8) | p[i];
+	}
+	return x;
+}
+
+static uint64_t get_u64(const unsigned char* p){
+	uint64_t x = 0;
+	int i;
+
+	for (i = 7; i >= 0; --i){
+		x = (x << 8) | p[i];
+	}
+	return x;
+}
+
+/* makes a context keyed with the manifest key for this header */
+static EVP_CIPHER_CTX* manifest_ctx(const unsigned char* header, const unsigned char* key, size_t key_len, int enc){
+	const EVP_CIPHER* cipher = crypt_aead_to_evp(header[9]);
+	unsigned char mkey[MANIFEST_KEY_LEN];
+	EVP_CIPHER_CTX* ctx = NULL;
+
+	if (!cipher){
+		log_error_ex("Unknown cipher %d in manifest", header[9]);
+		return NULL;
+	}
+	if (crypt_hkdf(key, key_len, header + 12, 16, MANIFEST_KEY_INFO, mkey, sizeof(mkey)) != 0){
+		return NULL;
+	}
+
+	ctx = EVP_CIPHER_CTX_new();
+	if (!ctx || EVP_CipherInit_ex(ctx, cipher, NULL, mkey, NULL, enc) != 1){
+		log_error("Failed to initialize manifest cipher");
+		ERR_print_errors_fp(stderr);
+		EVP_CIPHER_CTX_free(ctx);
+		ctx = NULL;
+	}
+	crypt_scrub(mkey, sizeof(mkey));
+	return ctx;
+}
+
+/* appends to a growable buffer */
+static int append(unsigned char** buf, size_t* len, size_t* cap, const void* data, size_t data_len){
+	if (*len + data_len > *cap){
+		size_t new_cap = *cap ? *cap : 4096;
+		void* tmp;
+
+		while (new_cap < *len + data_len){
+			new_cap *= 2;
+		}
+		tmp = realloc(*buf, new_cap);
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		*buf = tmp;
+		*cap = new_cap;
+	}
+	memcpy(*buf + *len, data, data_len);
+	*len += data_len;
+	return 0;
+}
+
+/* writes one length-prefixed sealed chunk */
+static int write_sealed(FILE* fp, EVP_CIPHER_CTX* ctx, const unsigned char* header, uint64_t index, int last, const unsigned char* in, size_t in_len, unsigned char** out, size_t* out_cap){
+	unsigned char len_buf[4];
+	size_t out_len;
+
+	if (*out_cap < in_len + CRYPT_AEAD_TAG_LEN){
+		void* tmp = realloc(*out, in_len + CRYPT_AEAD_TAG_LEN);
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		*out = tmp;
+		*out_cap = in_len + CRYPT_AEAD_TAG_LEN;
+	}
+
+	if (crypt_aead_chunk(ctx, header, CRYPT_MANIFEST_HEADER_LEN, 1, index, last, in, in_len, *out, &out_len) != 0){
+		return -1;
+	}
+	put_u32(len_buf, in_len);
+	if (fwrite(len_buf, 1, sizeof(len_buf), fp) != sizeof(len_buf) || fwrite(*out, 1, out_len, fp) != out_len){
+		log_efwrite("manifest");
+		return -1;
+	}
+	return 0;
+}
+
+int crypt_manifest_seal(FILE* in, const char* out_file, enum crypt_aead_cipher cipher, const unsigned char* key, size_t key_len){
+	unsigned char header[CRYPT_MANIFEST_HEADER_LEN];
+	unsigned char trailer[MANIFEST_TRAILER_LEN];
+	unsigned char num[12];
+	EVP_CIPHER_CTX* ctx = NULL;
+	FILE* fp = NULL;
+	struct element* e;
+	unsigned char* block = NULL;
+	size_t block_len = 0;
+	size_t block_cap = 0;
+	unsigned char* index = NULL;
+	size_t index_len = 0;
+	size_t index_cap = 0;
+	unsigned char* out = NULL;
+	size_t out_cap = 0;
+	uint64_t offset = CRYPT_MANIFEST_HEADER_LEN;
+	uint64_t n_blocks = 0;
+	int ret = 0;
+
+	return_ifnull(in, -1);
+	return_ifnull(out_file, -1);
+	return_ifnull(key, -1);
+
+	if (!file_opened_for_reading(in)){
+		log_emode();
+		return -1;
+	}
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, MANIFEST_MAGIC, 8);
+	header[8] = MANIFEST_VERSION;
+	header[9] = cipher;
+	if (RAND_bytes(header + 12, 16) != 1){
+		log_error("Failed to generate salt");
+		ERR_print_errors_fp(stderr);
+		return -1;
+	}
+
+	ctx = manifest_ctx(header, key, key_len, 1);
+	if (!ctx){
+		ret = -1;
+		goto cleanup;
+	}
+
+	fp = fopen(out_file, "wb");
+	if (!fp){
+		log_efopen(out_file);
+		ret = -1;
+		goto cleanup;
+	}
+	if (fwrite(header, 1, sizeof(header), fp) != sizeof(header)){
+		log_efwrite(out_file);
+		ret = -1;
+		goto cleanup;
+	}
+
+	for (;;){
+		size_t e_len = 0;
+
+		e = get_next_checksum_element(in);
+		if (e){
+			e_len = strlen(e->file) + strlen(e->checksum) + 2;
+		}
+
+		/* flush the block at the end or when the next entry would not fit */
+		if (block_len > 0 && (!e || block_len + e_len > CRYPT_MANIFEST_BLOCK_SIZE)){
+			put_u64(num, offset);
+			put_u32(num + 8, block_len);
+			if (append(&index, &index_len, &index_cap, num, sizeof(num)) != 0 ||
+					/* the block starts with its first filename, '\0' included */
+					append(&index, &index_len, &index_cap, block, strlen((char*)block) + 1) != 0 ||
+					write_sealed(fp, ctx, header, n_blocks, 0, block, block_len, &out, &out_cap) != 0){
+				free_element(e);
+				ret = -1;
+				goto cleanup;
+			}
+			offset += 4 + block_len + CRYPT_AEAD_TAG_LEN;
+			n_blocks++;
+			block_len = 0;
+		}
+
+		if (!e){
+			break;
+		}
+
+		if (append(&block, &block_len, &block_cap, e->file, strlen(e->file) + 1) != 0 ||
+				append(&block, &block_len, &block_cap, e->checksum, strlen(e->checksum)) != 0 ||
+				append(&block, &block_len, &block_cap, "\n", 1) != 0){
+			free_element(e);
+			ret = -1;
+			goto cleanup;
+		}
+		free_element(e);
+	}
+	if (ferror(in)){
+		log_efread("checksum file");
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (write_sealed(fp, ctx, header, n_blocks, 1, index, index_len, &out, &out_cap) != 0){
+		ret = -1;
+		goto cleanup;
+	}
+
+	put_u64(trailer, offset);
+	put_u64(trailer + 8, n_blocks);
+	memcpy(trailer + 16, MANIFEST_TRAILER_MAGIC, 8);
+	if (fwrite(trailer, 1, sizeof(trailer), fp) != sizeof(trailer)){
+		log_efwrite(out_file);
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	if (fp && fclose(fp) != 0){
+		log_efclose(out_file);
+		ret = -1;
+	}
+	if (fp && ret != 0){
+		remove(out_file);
+	}
+	EVP_CIPHER_CTX_free(ctx);
+	if (block){
+		crypt_scrub(block, block_cap);
+	}
+	free(block);
+	free(index);
+	free(out);
+	return ret;
+}
+
+int crypt_manifest_detect(FILE* fp){
+	unsigned char magic[8];
+	size_t len;
+
+	return_ifnull(fp, -1);
+
+	if (fseek(fp, 0, SEEK_SET) != 0){
+		log_error("Failed to rewind checksum file");
+		return -1;
+	}
+	len = fread(magic, 1, sizeof(magic), fp);
+	if (ferror(fp)){
+		log_efread("checksum file");
+		return -1;
+	}
+	if (fseek(fp, 0, SEEK_SET) != 0){
+		log_error("Failed to rewind checksum file");
+		return -1;
+	}
+	return len == sizeof(magic) && memcmp(magic, MANIFEST_MAGIC, sizeof(magic)) == 0;
+}
+
+/* reads and opens the length-prefixed chunk at offset into cm->buf */
+static int read_sealed(struct crypt_manifest* cm, uint64_t offset, uint64_t index, int last, size_t expected_len){
+	unsigned char len_buf[4];
+	size_t len;
+	void* tmp;
+
+	if (fseek(cm->fp, (long)offset, SEEK_SET) != 0 || fread(len_buf, 1, sizeof(len_buf), cm->fp) != sizeof(len_buf)){
+		log_error_ex("Failed to read manifest block %lu", (unsigned long)index);
+		return -1;
+	}
+	len = get_u32(len_buf);
+	if (len > CRYPT_MANIFEST_MAX_BLOCK || (!last && len != expected_len)){
+		log_error_ex("Manifest block %lu has an invalid length", (unsigned long)index);
+		return -1;
+	}
+
+	tmp = realloc(cm->in_buf, len + CRYPT_AEAD_TAG_LEN);
+	if (!tmp){
+		log_enomem();
+		return -1;
+	}
+	cm->in_buf = tmp;
+	tmp = realloc(cm->buf, len + 1);
+	if (!tmp){
+		log_enomem();
+		return -1;
+	}
+	cm->buf = tmp;
+
+	cm->buf_block = MANIFEST_NO_BLOCK;
+	if (fread(cm->in_buf, 1, len + CRYPT_AEAD_TAG_LEN, cm->fp) != len + CRYPT_AEAD_TAG_LEN){
+		log_error_ex("Manifest block %lu is truncated", (unsigned long)index);
+		return -1;
+	}
+	if (crypt_aead_chunk(cm->ctx, cm->header, sizeof(cm->header), 0, index, last, cm->in_buf, len + CRYPT_AEAD_TAG_LEN, cm->buf, &cm->buf_len) != 0){
+		return -1;
+	}
+	/* so the last filename in a block can be treated as a string even if the block is damaged */
+	cm->buf[cm->buf_len] = '\0';
+	return 0;
+}
+
+static int load_block(struct crypt_manifest* cm, size_t index){
+	if (cm->buf_block == index){
+		return 0;
+	}
+	if (read_sealed(cm, cm->blocks[index].offset, index, 0, cm->blocks[index].len) != 0){
+		return -1;
+	}
+	cm->buf_block = index;
+	return 0;
+}
+
+static int parse_index(struct crypt_manifest* cm, size_t len){
+	size_t pos = 0;
+	size_t i;
+
+	/* every block takes at least 13 bytes of index */
+	if (cm->n_blocks > len / 13){
+		log_error("Manifest index is damaged");
+		return -1;
+	}
+
+	cm->blocks = malloc((cm->n_blocks ? cm->n_blocks : 1) * sizeof(*cm->blocks));
+	if (!cm->blocks){
+		log_enomem();
+		return -1;
+	}
+
+	for (i = 0; i < cm->n_blocks; ++i){
+		const unsigned char* end;
+
+		if (len - pos < 13 || (end = memchr(cm->index + pos + 12, '\0', len - pos - 12)) == NULL){
+			log_error("Manifest index is damaged");
+			return -1;
+		}
+		cm->blocks[i].offset = get_u64(cm->index + pos);
+		cm->blocks[i].len = get_u32(cm->index + pos + 8);
+		cm->blocks[i].first = (const char*)cm->index + pos + 12;
+		pos = end - cm->index + 1;
+	}
+	if (pos != len){
+		log_error("Manifest index is damaged");
+		return -1;
+	}
+	return 0;
+}
+
+struct crypt_manifest* crypt_manifest_open(FILE* fp, const unsigned char* key, size_t key_len){
+	struct crypt_manifest* cm;
+	unsigned char trailer[MANIFEST_TRAILER_LEN];
+
+	return_ifnull(fp, NULL);
+	return_ifnull(key, NULL);
+
+	cm = calloc(1, sizeof(*cm));
+	if (!cm){
+		log_enomem();
+		return NULL;
+	}
+	cm->fp = fp;
+	cm->buf_block = MANIFEST_NO_BLOCK;
+
+	if (fseek(fp, 0, SEEK_SET) != 0 || fread(cm->header, 1, sizeof(cm->header), fp) != sizeof(cm->header) || memcmp(cm->header, MANIFEST_MAGIC, 8) != 0){
+		log_error("File is not an encrypted manifest");
+		goto cleanup_fail;
+	}
+	if (cm->header[8] != MANIFEST_VERSION){
+		log_error_ex("Unsupported manifest version %d", cm->header[8]);
+		goto cleanup_fail;
+	}
+	if (fseek(fp, -MANIFEST_TRAILER_LEN, SEEK_END) != 0 || fread(trailer, 1, sizeof(trailer), fp) != sizeof(trailer) || memcmp(trailer + 16, MANIFEST_TRAILER_MAGIC, 8) != 0){
+		log_error("Manifest is truncated");
+		goto cleanup_fail;
+	}
+	cm->n_blocks = get_u64(trailer + 8);
+
+	cm->ctx = manifest_ctx(cm->header, key, key_len, 0);
+	if (!cm->ctx){
+		goto cleanup_fail;
+	}
+
+	/* the index is read like any other block, then kept. the block count is part of its nonce, so a wrong one fails here */
+	if (read_sealed(cm, get_u64(trailer), cm->n_blocks, 1, 0) != 0){
+		log_error("Failed to decrypt the manifest index. The password may be wrong");
+		goto cleanup_fail;
+	}
+	cm->index = cm->buf;
+	cm->buf = NULL;
+	if (parse_index(cm, cm->buf_len) != 0){
+		goto cleanup_fail;
+	}
+
+	cm->buf_len = 0;
+	cm->buf_block = MANIFEST_NO_BLOCK;
+	return cm;
+
+cleanup_fail:
+	crypt_manifest_close(cm);
+	return NULL;
+}
+
+/* parses the entry at *pos in the current block */
+static int parse_entry(const struct crypt_manifest* cm, size_t* pos, const char** file, const char** checksum, size_t* checksum_len){
+	const char* p = (const char*)cm->buf + *pos;
+	const char* end = (const char*)cm->buf + cm->buf_len;
+	const char* sep;
+	const char* nl;
+
+	if ((sep = memchr(p, '\0', end - p)) == NULL || (nl = memchr(sep, '\n', end - sep)) == NULL){
+		log_error_ex("Manifest block %lu is damaged", (unsigned long)cm->buf_block);
+		return -1;
+	}
+	*file = p;
+	*checksum = sep + 1;
+	*checksum_len = nl - (sep + 1);
+	*pos = nl + 1 - (const char*)cm->buf;
+	return 0;
+}
+
+int crypt_manifest_search(struct crypt_manifest* cm, const char* key, char** checksum){
+	size_t low = 0;
+	size_t high;
+	size_t pos = 0;
+
+	return_ifnull(cm, -1);
+	return_ifnull(key, -1);
+	return_ifnull(checksum, -1);
+
+	*checksum = NULL;
+
+	if (cm->n_blocks == 0 || strcmp(key, cm->blocks[0].first) < 0){
+		return 1;
+	}
+
+	/* find the last block whose first filename is <= key */
+	high = cm->n_blocks - 1;
+	while (low < high){
+		size_t mid = low + (high - low + 1) / 2;
+
+		if (strcmp(cm->blocks[mid].first, key) <= 0){
+			low = mid;
+		}
+		else{
+			high = mid - 1;
+		}
+	}
+
+	if (load_block(cm, low) != 0){
+		return -1;
+	}
+
+	while (pos < cm->buf_len){
+		const char* file;
+		const char* cs;
+		size_t cs_len;
+		int res;
+
+		if (parse_entry(cm, &pos, &file, &cs, &cs_len) != 0){
+			return -1;
+		}
+		res = strcmp(key, file);
+		if (res == 0){
+			*checksum = malloc(cs_len + 1);
+			if (!*checksum){
+				log_enomem();
+				return -1;
+			}
+			memcpy(*checksum, cs, cs_len);
+			(*checksum)[cs_len] = '\0';
+			return 0;
+		}
+		/* the block is sorted, so it is not further on */
+		if (res < 0){
+			break;
+		}
+	}
+	return 1;
+}
+
+struct element* crypt_manifest_next(struct crypt_manifest* cm){
+	struct element* e;
+	const char* file;
+	const char* cs;
+	size_t cs_len;
+	size_t file_len;
+
+	return_ifnull(cm, NULL);
+
+	/* searches can replace the current block, in which case it is read again */
+	while (cm->buf_block != cm->next_block || cm->next_pos >= cm->buf_len){
+		if (cm->buf_block == cm->next_block){
+			cm->next_block++;
+			cm->next_pos = 0;
+		}
+		if (cm->next_block >= cm->n_blocks){
+			return NULL;
+		}
+		if (load_block(cm, cm->next_block) != 0){
+			return NULL;
+		}
+	}
+
+	if (parse_entry(cm, &cm->next_pos, &file, &cs, &cs_len) != 0){
+		return NULL;
+	}
+	file_len = strlen(file);
+
+	e = malloc(sizeof(*e));
+	if (!e){
+		log_enomem();
+		return NULL;
+	}
+	e->file = malloc(file_len + 1);
+	e->checksum = malloc(cs_len + 1);
+	if (!e->file || !e->checksum){
+		log_enomem();
+		free_element(e);
+		return NULL;
+	}
+	memcpy(e->file, file, file_len + 1);
+	memcpy(e->checksum, cs, cs_len);
+	e->checksum[cs_len] = '\0';
+	return e;
+}
+
+int crypt_manifest_rewind(struct crypt_manifest* cm){
+	return_ifnull(cm, -1);
+
+	cm->next_block = 0;
+	cm->next_pos = 0;
+	return 0;
+}
+
+static int manifest_search(void* data, const char* key, char** checksum){
+	return crypt_manifest_search(data, key, checksum);
+}
+
+static struct element* manifest_next(void* data){
+	return crypt_manifest_next(data);
+}
+
+static int manifest_rewind(void* data){
+	return crypt_manifest_rewind(data);
+}
+
+void crypt_manifest_source(struct crypt_manifest* cm, struct checksum_source* out){
+	out->search = manifest_search;
+	out->next = manifest_next;
+	out->rewind = manifest_rewind;
+	out->data = cm;
+}
+
+void crypt_manifest_close(struct crypt_manifest* cm){
+	if (!cm){
+		return;
+	}
+	EVP_CIPHER_CTX_free(cm->ctx);
+	if (cm->buf){
+		crypt_scrub(cm->buf, cm->buf_len);
+	}
+	free(cm->buf);
+	free(cm->in_buf);
+	free(cm->index);
+	free(cm->blocks);
+	free(cm);
+}
@@ -0,0 +1,135 @@
+/** @file crypt/crypt_manifest.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __CRYPT_CRYPT_MANIFEST_H
+#define __CRYPT_CRYPT_MANIFEST_H
+
+#include "crypt_aead.h"
+#include "../checksum.h"
+#include "../checksumsort.h"
+#include <stdio.h>
+
+#define CRYPT_MANIFEST_HEADER_LEN  (32)       /**< @brief The length of an encrypted manifest's header. */
+#define CRYPT_MANIFEST_BLOCK_SIZE  (1 << 16)  /**< @brief How much of the checksum list (64KB) goes in each block. A lookup decrypts one block. */
+#define CRYPT_MANIFEST_MAX_BLOCK   (1 << 24)  /**< @brief The largest block that will be read, so a damaged manifest cannot ask for an absurd amount of memory. */
+
+/**
+ * @brief An encrypted manifest opened for searching and reading.
+ */
+struct crypt_manifest;
+
+/**
+ * @brief Encrypts a sorted checksum list into a manifest.<br>
+ * The list is split into blocks of about CRYPT_MANIFEST_BLOCK_SIZE that are each authenticated on their own, so one can be decrypted without the others.<br>
+ * An index of the first filename in each block is encrypted after them, so a lookup only needs to decrypt the index once and then the one block the filename would be in.
+ *
+ * @param in A sorted checksum list.<br>
+ * This FILE* must be opened in reading binary ("rb") mode.
+ * @see sort_checksum_file()
+ *
+ * @param out_file Path to write the manifest to.<br>
+ * This file is overwritten if it exists, and removed on failure.
+ *
+ * @param cipher The cipher to encrypt with.
+ *
+ * @param key The key to derive the manifest key from (e.g. a master key).
+ * @see crypt_master_key()
+ *
+ * @param key_len The length of the key.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int crypt_manifest_seal(FILE* in, const char* out_file, enum crypt_aead_cipher cipher, const unsigned char* key, size_t key_len);
+
+/**
+ * @brief Checks if a file is an encrypted manifest or a plain checksum list.
+ *
+ * @param fp The file to check.<br>
+ * This FILE* must be opened in reading binary ("rb") mode.<br>
+ * It is rewound afterwards.
+ *
+ * @return 1 if it is an encrypted manifest, 0 if not, or negative on failure.
+ */
+int crypt_manifest_detect(FILE* fp);
+
+/**
+ * @brief Opens an encrypted manifest.<br>
+ * This decrypts and authenticates the index, but none of the blocks.
+ *
+ * @param fp The manifest.<br>
+ * This FILE* must be opened in reading binary ("rb") mode, and must stay open until the manifest is closed.
+ *
+ * @param key The key the manifest was sealed with.
+ *
+ * @param key_len The length of the key.
+ *
+ * @return The opened manifest, or NULL on failure (including if the key is wrong or the manifest was tampered with).<br>
+ * This must be closed with crypt_manifest_close() when no longer in use.
+ */
+struct crypt_manifest* crypt_manifest_open(FILE* fp, const unsigned char* key, size_t key_len);
+
+/**
+ * @brief Searches an encrypted manifest for a filename, and returns its checksum if it exists.<br>
+ * Only the block that the filename would be in is decrypted. The last block decrypted is kept, so nearby lookups decrypt nothing.
+ *
+ * @param cm The manifest.
+ *
+ * @param key The filename to search for.
+ *
+ * @param checksum A pointer to the output checksum location.<br>
+ * The output will be a null-terminated hexadecimal checksum string, or NULL if the key could not be found or there was an error.<br>
+ * This value must be free()'d when no longer in use.
+ *
+ * @return 0 on success, positive if the checksum could not be found, negative on error.
+ */
+int crypt_manifest_search(struct crypt_manifest* cm, const char* key, char** checksum);
+
+/**
+ * @brief Reads the next element of an encrypted manifest.<br>
+ * Blocks are read and decrypted in order, so this is as fast as reading the file.
+ *
+ * @param cm The manifest.
+ *
+ * @return The next element, or NULL on end-of-file or error.<br>
+ * This must be freed with free_element() when no longer in use.
+ */
+struct element* crypt_manifest_next(struct crypt_manifest* cm);
+
+/**
+ * @brief Makes crypt_manifest_next() start again from the first element.
+ *
+ * @param cm The manifest.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int crypt_manifest_rewind(struct crypt_manifest* cm);
+
+/**
+ * @brief Makes a checksum_source that reads an encrypted manifest.
+ *
+ * @param cm The manifest.<br>
+ * This must stay open while the source is in use.
+ *
+ * @param out The checksum_source to fill in.
+ *
+ * @return void
+ */
+void crypt_manifest_source(struct crypt_manifest* cm, struct checksum_source* out);
+
+/**
+ * @brief Closes an encrypted manifest.<br>
+ * The FILE* it was opened with is not closed.
+ *
+ * @param cm The manifest to close.<br>
+ * If this is NULL, this function does nothing.
+ *
+ * @return void
+ */
+void crypt_manifest_close(struct crypt_manifest* cm);
+
+#endif
@@ -0,0 +1,251 @@
+/** @file crypt/crypt_master.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "crypt_master.h"
+#include "crypt.h"
+#include "../log.h"
+#include "../filehelper.h"
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* a key file is laid out as follows
+ *
+ * 8 byte magic
+ * u8  version
+ * u8  log2 of the scrypt cost parameter N
+ * u8  scrypt block size r
+ * u8  scrypt parallelization p
+ * 4 bytes reserved
+ * 16 byte salt
+ * 32 byte check value derived from the master key, so a wrong password is caught before anything is encrypted with it */
+#define MASTER_MAGIC "EZBKEY01"
+#define MASTER_VERSION (1)
+#define MASTER_CHECK_INFO "ezbackup key check"
+#define MASTER_CHECK_LEN (32)
+#define MASTER_CONTENT_INFO "ezbackup content id key"
+/* limits on the parameters read from a key file, so a damaged one cannot ask for an absurd amount of memory */
+#define MASTER_MIN_LOG2_N (10)
+#define MASTER_MAX_LOG2_N (22)
+#define MASTER_MAX_R (32)
+#define MASTER_MAX_P (16)
+
+struct crypt_master{
+	unsigned char key[CRYPT_MASTER_KEY_LEN];
+};
+
+struct key_file{
+	unsigned log2_n;
+	unsigned r;
+	unsigned p;
+	unsigned char salt[CRYPT_MASTER_SALT_LEN];
+	unsigned char check[MASTER_CHECK_LEN];
+};
+
+static int read_key_file(const char* file, struct key_file* kf){
+	unsigned char buf[CRYPT_MASTER_FILE_LEN];
+	FILE* fp;
+	int len;
+
+	fp = fopen(file, "rb");
+	if (!fp){
+		log_efopen(file);
+		return -1;
+	}
+	len = read_file(fp, buf, sizeof(buf));
+	if (fclose(fp) != 0){
+		log_efclose(file);
+	}
+
+	if (len != sizeof(buf) || memcmp(buf, MASTER_MAGIC, 8) != 0){
+		log_error_ex("%s is not a key file", file);
+		return -1;
+	}
+	if (buf[8] != MASTER_VERSION){
+		log_error_ex("Unsupported key file version %d", buf[8]);
+		return -1;
+	}
+
+	kf->log2_n = buf[9];
+	kf->r = buf[10];
+	kf->p = buf[11];
+	if (kf->log2_n < MASTER_MIN_LOG2_N || kf->log2_n > MASTER_MAX_LOG2_N || kf->r < 1 || kf->r > MASTER_MAX_R || kf->p < 1 || kf->p > MASTER_MAX_P){
+		log_error_ex("%s has invalid key derivation parameters", file);
+		return -1;
+	}
+	memcpy(kf->salt, buf + 16, sizeof(kf->salt));
+	memcpy(kf->check, buf + 32, sizeof(kf->check));
+	return 0;
+}
+
+static int write_key_file(const char* file, const struct key_file* kf){
+	unsigned char buf[CRYPT_MASTER_FILE_LEN];
+	FILE* fp;
+	int ret = 0;
+
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, MASTER_MAGIC, 8);
+	buf[8] = MASTER_VERSION;
+	buf[9] = kf->log2_n;
+	buf[10] = kf->r;
+	buf[11] = kf->p;
+	memcpy(buf + 16, kf->salt, sizeof(kf->salt));
+	memcpy(buf + 32, kf->check, sizeof(kf->check));
+
+	fp = fopen(file, "wb");
+	if (!fp){
+		log_efopen(file);
+		return -1;
+	}
+	if (fwrite(buf, 1, sizeof(buf), fp) != sizeof(buf)){
+		log_efwrite(file);
+		ret = -1;
+	}
+	if (fclose(fp) != 0){
+		log_efclose(file);
+		ret = -1;
+	}
+	if (ret != 0){
+		remove(file);
+	}
+	return ret;
+}
+
+static int derive(const char* password, const struct key_file* kf, unsigned char key[CRYPT_MASTER_KEY_LEN], unsigned char check[MASTER_CHECK_LEN]){
+	uint64_t n = (uint64_t)1 << kf->log2_n;
+	/* scrypt needs 128 * r * (n + p + 2) bytes. openssl refuses anything over 32MB unless told otherwise */
+	uint64_t maxmem = 128 * (uint64_t)kf->r * (n + kf->p + 2) + 1048576;
+
+	if (EVP_PBE_scrypt(password, strlen(password), kf->salt, sizeof(kf->salt), n, kf->r, kf->p, maxmem, key, CRYPT_MASTER_KEY_LEN) != 1){
+		log_error("Failed to derive master key");
+		ERR_print_errors_fp(stderr);
+		return -1;
+	}
+	return crypt_hkdf(key, CRYPT_MASTER_KEY_LEN, NULL, 0, MASTER_CHECK_INFO, check, MASTER_CHECK_LEN);
+}
+
+struct crypt_master* crypt_master_new(const char* password, const char* key_file){
+	struct crypt_master* cm;
+	struct key_file kf;
+	unsigned char check[MASTER_CHECK_LEN];
+
+	return_ifnull(password, NULL);
+	return_ifnull(key_file, NULL);
+
+	cm = malloc(sizeof(*cm));
+	if (!cm){
+		log_enomem();
+		return NULL;
+	}
+
+	if (file_exists(key_file)){
+		if (read_key_file(key_file, &kf) != 0 || derive(password, &kf, cm->key, check) != 0){
+			goto cleanup_fail;
+		}
+		if (CRYPTO_memcmp(check, kf.check, sizeof(check)) != 0){
+			log_error("The password does not match the one this backup was made with");
+			goto cleanup_fail;
+		}
+	}
+	else{
+		kf.log2_n = CRYPT_MASTER_LOG2_N;
+		kf.r = CRYPT_MASTER_R;
+		kf.p = CRYPT_MASTER_P;
+		if (RAND_bytes(kf.salt, sizeof(kf.salt)) != 1){
+			log_error("Failed to generate salt");
+			ERR_print_errors_fp(stderr);
+			goto cleanup_fail;
+		}
+		if (derive(password, &kf, cm->key, kf.check) != 0 || write_key_file(key_file, &kf) != 0){
+			goto cleanup_fail;
+		}
+	}
+
+	OPENSSL_cleanse(check, sizeof(check));
+	return cm;
+
+cleanup_fail:
+	OPENSSL_cleanse(check, sizeof(check));
+	crypt_master_free(cm);
+	return NULL;
+}
+
+const unsigned char* crypt_master_key(const struct crypt_master* cm){
+	return cm ? cm->key : NULL;
+}
+
+int crypt_master_content_id(const struct crypt_master* cm, const char* file, unsigned char out[CRYPT_CONTENT_ID_LEN]){
+	unsigned char key[32];
+	unsigned char buf[BUFFER_LEN];
+	EVP_PKEY* pkey = NULL;
+	EVP_MD_CTX* ctx = NULL;
+	FILE* fp = NULL;
+	size_t out_len = CRYPT_CONTENT_ID_LEN;
+	int len;
+	int ret = 0;
+
+	return_ifnull(cm, -1);
+	return_ifnull(file, -1);
+	return_ifnull(out, -1);
+
+	/* a separate key, so the id says nothing about the keys files are encrypted with */
+	if (crypt_hkdf(cm->key, sizeof(cm->key), NULL, 0, MASTER_CONTENT_INFO, key, sizeof(key)) != 0){
+		ret = -1;
+		goto cleanup;
+	}
+
+	fp = fopen(file, "rb");
+	if (!fp){
+		log_efopen(file);
+		ret = -1;
+		goto cleanup;
+	}
+
+	pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_HMAC, NULL, key, sizeof(key));
+	ctx = EVP_MD_CTX_create();
+	if (!pkey || !ctx || EVP_DigestSignInit(ctx, NULL, EVP_sha256(), NULL, pkey) != 1){
+		log_error("Failed to initialize HMAC");
+		ERR_print_errors_fp(stderr);
+		ret = -1;
+		goto cleanup;
+	}
+
+	while ((len = read_file(fp, buf, sizeof(buf))) > 0){
+		if (EVP_DigestSignUpdate(ctx, buf, len) != 1){
+			log_error("Failed to update HMAC");
+			ret = -1;
+			goto cleanup;
+		}
+	}
+	if (len < 0 || EVP_DigestSignFinal(ctx, out, &out_len) != 1){
+		log_error_ex("Failed to hash %s", file);
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	fp ? fclose(fp) : 0;
+	EVP_MD_CTX_destroy(ctx);
+	EVP_PKEY_free(pkey);
+	OPENSSL_cleanse(key, sizeof(key));
+	OPENSSL_cleanse(buf, sizeof(buf));
+	return ret;
+}
+
+void crypt_master_free(struct crypt_master* cm){
+	if (!cm){
+		return;
+	}
+	OPENSSL_cleanse(cm->key, sizeof(cm->key));
+	free(cm);
+}
@@ -0,0 +1,82 @@
+/** @file crypt/crypt_master.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __CRYPT_CRYPT_MASTER_H
+#define __CRYPT_CRYPT_MASTER_H
+
+#include <stddef.h>
+
+#ifndef __GNUC__
+#define __attribute__(x)
+#endif
+
+#define CRYPT_MASTER_KEY_LEN  (32)       /**< @brief The length of a master key in bytes. */
+#define CRYPT_MASTER_SALT_LEN (16)       /**< @brief The length of the salt the master key is derived with. */
+#define CRYPT_MASTER_FILE_LEN (64)       /**< @brief The length of a key file. */
+#define CRYPT_MASTER_LOG2_N   (17)       /**< @brief log2 of the scrypt cost parameter new key files are made with. */
+#define CRYPT_MASTER_R        (8)        /**< @brief The scrypt block size new key files are made with. */
+#define CRYPT_MASTER_P        (1)        /**< @brief The scrypt parallelization new key files are made with. */
+#define CRYPT_CONTENT_ID_LEN  (32)       /**< @brief The length of a content id in bytes. */
+
+/**
+ * @brief A key derived from a password, that every file's key is derived from in turn.
+ */
+struct crypt_master;
+
+/**
+ * @brief Derives a master key from a password.<br>
+ * This is deliberately slow and memory-hard (scrypt), so it should be done once per backup rather than once per file.<br>
+ * The parameters and salt are kept in a key file, which holds nothing secret but is needed to derive the same key again.
+ *
+ * @param password The password.
+ *
+ * @param key_file Path to the key file.<br>
+ * If this file exists, its salt and parameters are used, and the password is checked against it.<br>
+ * If it does not exist, it is created with a random salt and the default parameters.
+ *
+ * @return The master key, or NULL on failure (including if the password does not match the key file).<br>
+ * This must be freed with crypt_master_free() when no longer in use.
+ */
+struct crypt_master* crypt_master_new(const char* password, const char* key_file) __attribute__((malloc));
+
+/**
+ * @brief Gets the raw bytes of a master key.
+ *
+ * @param cm The master key.
+ *
+ * @return A pointer to CRYPT_MASTER_KEY_LEN bytes.<br>
+ * This pointer is invalidated when the master key is freed.
+ */
+const unsigned char* crypt_master_key(const struct crypt_master* cm);
+
+/**
+ * @brief Computes a keyed hash (HMAC-SHA256) of a file's contents.<br>
+ * Files with the same contents have the same id, but without the master key it cannot be computed, so it does not reveal whether someone else has a given file.<br>
+ * This is used to make convergent encryption deterministic and to detect duplicate files.
+ *
+ * @param cm The master key.
+ *
+ * @param file Path to the file.
+ *
+ * @param out The buffer to write the CRYPT_CONTENT_ID_LEN byte id to.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int crypt_master_content_id(const struct crypt_master* cm, const char* file, unsigned char out[CRYPT_CONTENT_ID_LEN]);
+
+/**
+ * @brief Scrubs and frees a master key.
+ *
+ * @param cm The master key to free.<br>
+ * If this is NULL, this function does nothing.
+ *
+ * @return void
+ */
+void crypt_master_free(struct crypt_master* cm);
+
+#endif
@@ -0,0 +1,135 @@
+/** @file ctxpool.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "ctxpool.h"
+#include "log.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ctxpool_entry{
+	enum ctxpool_type type;
+	int id;
+	int level;
+	unsigned flags;
+	void* ctx;
+	ctxpool_free_fn free_fn;
+};
+
+/* oldest entry first */
+struct ctxpool{
+	struct ctxpool_entry entries[CTXPOOL_MAX];
+	size_t len;
+};
+
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+static int pool_key_ok = 0;
+
+static void pool_free(void* arg){
+	struct ctxpool* pool = arg;
+	size_t i;
+
+	for (i = 0; i < pool->len; ++i){
+		pool->entries[i].free_fn(pool->entries[i].ctx);
+	}
+	free(pool);
+}
+
+static void pool_key_create(void){
+	/* the destructor frees a worker's contexts when the thread exits */
+	pool_key_ok = pthread_key_create(&pool_key, pool_free) == 0;
+}
+
+static struct ctxpool* get_pool(int create){
+	struct ctxpool* pool;
+
+	pthread_once(&pool_key_once, pool_key_create);
+	if (!pool_key_ok){
+		return NULL;
+	}
+
+	pool = pthread_getspecific(pool_key);
+	if (!pool && create){
+		pool = calloc(1, sizeof(*pool));
+		if (!pool){
+			log_enomem();
+			return NULL;
+		}
+		if (pthread_setspecific(pool_key, pool) != 0){
+			free(pool);
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+static void remove_entry(struct ctxpool* pool, size_t index){
+	memmove(&pool->entries[index], &pool->entries[index + 1], (pool->len - index - 1) * sizeof(*pool->entries));
+	pool->len--;
+}
+
+void* ctxpool_take(enum ctxpool_type type, int id, int level, unsigned flags){
+	struct ctxpool* pool = get_pool(0);
+	size_t i;
+
+	if (!pool){
+		return NULL;
+	}
+
+	/* newest first, since that one is the most likely to still be in cache */
+	for (i = pool->len; i > 0; --i){
+		struct ctxpool_entry* e = &pool->entries[i - 1];
+		if (e->type == type && e->id == id && e->level == level && e->flags == flags){
+			void* ctx = e->ctx;
+			remove_entry(pool, i - 1);
+			return ctx;
+		}
+	}
+	return NULL;
+}
+
+void ctxpool_give(enum ctxpool_type type, int id, int level, unsigned flags, void* ctx, ctxpool_free_fn free_fn){
+	struct ctxpool* pool;
+	struct ctxpool_entry* e;
+
+	if (!ctx){
+		return;
+	}
+
+	pool = get_pool(1);
+	if (!pool){
+		free_fn(ctx);
+		return;
+	}
+
+	if (pool->len == CTXPOOL_MAX){
+		pool->entries[0].free_fn(pool->entries[0].ctx);
+		remove_entry(pool, 0);
+	}
+
+	e = &pool->entries[pool->len];
+	e->type = type;
+	e->id = id;
+	e->level = level;
+	e->flags = flags;
+	e->ctx = ctx;
+	e->free_fn = free_fn;
+	pool->len++;
+}
+
+void ctxpool_clear(void){
+	struct ctxpool* pool = get_pool(0);
+
+	if (!pool){
+		return;
+	}
+
+	pthread_setspecific(pool_key, NULL);
+	pool_free(pool);
+}
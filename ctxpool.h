@@ -0,0 +1,86 @@
+/** @file ctxpool.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __CTXPOOL_H
+#define __CTXPOOL_H
+
+/**
+ * @brief The maximum amount of idle contexts a single thread keeps.<br>
+ * When this is exceeded, the least recently returned context is freed.
+ */
+#define CTXPOOL_MAX (8)
+
+/**
+ * @brief The kinds of contexts that can be pooled.
+ */
+enum ctxpool_type{
+	CTXPOOL_ZIP_COMPRESS   = 0, /**< @brief A struct ZIP_FILE opened for compression. */
+	CTXPOOL_ZIP_DECOMPRESS = 1, /**< @brief A struct ZIP_FILE opened for decompression. */
+	CTXPOOL_DEFLATE_RAW    = 2, /**< @brief A raw deflate stream used by the parallel gzip compressor. */
+	CTXPOOL_LZ4F_CCTX      = 3, /**< @brief An LZ4F compression context. */
+	CTXPOOL_LZ4F_DCTX      = 4, /**< @brief An LZ4F decompression context. */
+	CTXPOOL_DIGEST         = 5, /**< @brief An EVP_MD_CTX. */
+	CTXPOOL_CIPHER         = 6  /**< @brief An EVP_CIPHER_CTX along with its output buffer. */
+};
+
+/**
+ * @brief Frees a pooled context.
+ *
+ * @param ctx The context to free.
+ *
+ * @return void
+ */
+typedef void (*ctxpool_free_fn)(void* ctx);
+
+/**
+ * @brief Takes an idle context belonging to the calling thread out of its pool.<br>
+ * A context is only returned if it was given back with the exact same type, id, level, and flags.
+ *
+ * @param type The kind of context.
+ *
+ * @param id A type-specific identifier (e.g. the compressor).
+ *
+ * @param level A type-specific level (e.g. the compression level).
+ *
+ * @param flags Type-specific flags.
+ *
+ * @return The context, or NULL if the calling thread has no matching idle context.<br>
+ * The caller owns the context and must reset it before use.
+ */
+void* ctxpool_take(enum ctxpool_type type, int id, int level, unsigned flags);
+
+/**
+ * @brief Gives a context back to the calling thread's pool so a later ctxpool_take() can reuse it.<br>
+ * The context is freed with free_fn when the thread exits, when the pool is full, or when ctxpool_clear() is called.
+ *
+ * @param type The kind of context.
+ *
+ * @param id A type-specific identifier.
+ *
+ * @param level A type-specific level.
+ *
+ * @param flags Type-specific flags.
+ *
+ * @param ctx The context.<br>
+ * If this is NULL, this function does nothing.
+ *
+ * @param free_fn The function that frees this context.
+ *
+ * @return void
+ */
+void ctxpool_give(enum ctxpool_type type, int id, int level, unsigned flags, void* ctx, ctxpool_free_fn free_fn);
+
+/**
+ * @brief Frees every idle context belonging to the calling thread.<br>
+ * Worker threads do this automatically when they exit.
+ *
+ * @return void
+ */
+void ctxpool_clear(void);
+
+#endif
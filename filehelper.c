@@ -270,3 +270,95 @@ int mkdir_recursive(const char* dir){
 	sa_free(components);
 	return 0;
 }
+
+/* creates buf[0..len), where buf[len] may be anything */
+static int mkdir_cached_n(char* buf, size_t len, struct string_set* known){
+	size_t parent_len;
+	char c;
+	int ret;
+
+	/* an empty path is the root directory */
+	if (len == 0 || ss_find_n(known, buf, len)){
+		return 1;
+	}
+
+	c = buf[len];
+	buf[len] = '\0';
+
+	if (mkdir(buf, 0755) == 0){
+		ret = 0;
+	}
+	else if (errno == ENOENT){
+		for (parent_len = len; parent_len > 0 && buf[parent_len - 1] != '/'; --parent_len);
+		if (parent_len == 0){
+			log_error_ex("Cannot create parent directory of %s", buf);
+			ret = -1;
+			goto cleanup;
+		}
+
+		if (mkdir_cached_n(buf, parent_len - 1, known) < 0){
+			ret = -1;
+			goto cleanup;
+		}
+
+		if (mkdir(buf, 0755) == 0){
+			ret = 0;
+		}
+		else if (errno == EEXIST && directory_exists(buf)){
+			ret = 1;
+		}
+		else{
+			log_error_ex2("Failed to make directory %s (%s)", buf, strerror(errno));
+			ret = -1;
+			goto cleanup;
+		}
+	}
+	else if (errno == EEXIST && directory_exists(buf)){
+		ret = 1;
+	}
+	else{
+		log_error_ex2("Failed to make directory %s (%s)", buf, strerror(errno));
+		ret = -1;
+		goto cleanup;
+	}
+
+	/* the cache only saves work, so failing to add to it is not fatal */
+	if (!ss_intern_n(known, buf, len)){
+		log_warning_ex("Failed to cache directory %s", buf);
+	}
+
+cleanup:
+	buf[len] = c;
+	return ret;
+}
+
+int mkdir_recursive_cached(const char* dir, struct string_set* known){
+	char* buf;
+	size_t len;
+	int ret;
+
+	return_ifnull(dir, -1);
+	return_ifnull(known, -1);
+
+	len = strlen(dir);
+	while (len > 0 && dir[len - 1] == '/'){
+		len--;
+	}
+
+	if (ss_find_n(known, dir, len)){
+		return 1;
+	}
+
+	buf = malloc(len + 1);
+	if (!buf){
+		log_enomem();
+		return -1;
+	}
+	memcpy(buf, dir, len);
+	buf[len] = '\0';
+
+	ret = mkdir_cached_n(buf, len, known);
+
+	free(buf);
+	return ret;
+}
@@ -9,6 +9,7 @@
 #ifndef __FILEHELPER_H
 #define __FILEHELPER_H
 
+#include "strings/stringset.h"
 #include <stdio.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -178,4 +179,18 @@ int file_exists(const char* path);
  */
 int mkdir_recursive(const char* dir);
 
+/**
+ * @brief Creates a directory and its parent directories, skipping every directory already known to exist.<br>
+ * Each directory is created or checked at most once per string set, so this is far cheaper than mkdir_recursive() when many files share the same output directories.
+ * @see mkdir_recursive()
+ *
+ * @param dir The directory to create.
+ *
+ * @param known A string set of directories known to exist.<br>
+ * Directories that this function creates or finds are added to it.
+ *
+ * @return 0 if the directory was created, positive if it already exists, or negative on failure.
+ */
+int mkdir_recursive_cached(const char* dir, struct string_set* known);
+
 #endif
@@ -29,6 +29,10 @@ struct fi_stack{
 	}**dir_stack;
 
 	size_t dir_stack_len;
+
+	/* reused by every call to fi_next_path() */
+	char* path;
+	size_t path_size;
 };
 
 static void free_directory(struct directory* dir){
@@ -115,10 +119,10 @@ struct fi_stack* fi_start(const char* dir){
 	return fis;
 }
 
-char* fi_next(struct fi_stack* fis){
-	char* path = NULL;
+const char* fi_next_path(struct fi_stack* fis){
 	struct directory* dir = NULL;
 	struct stat st;
+	size_t len;
 
 	dir = directory_peek(fis);
 	if (!dir){
@@ -130,39 +134,61 @@ char* fi_next(struct fi_stack* fis){
 	if (!dir->dnt){
 		log_info_ex("Out of directory entries in %s", dir->name);
 		directory_pop(fis);
-		return fi_next(fis);
+		return fi_next_path(fis);
 	}
 
 	if (!strcmp(dir->dnt->d_name, ".") || !strcmp(dir->dnt->d_name, "..")){
-		return fi_next(fis);
+		return fi_next_path(fis);
 	}
 
 	/* generate path to directory */
-	/* +3: +1 for each '\0', +1 for '/' */
-	path = malloc(strlen(dir->name) + strlen(dir->dnt->d_name) + 3);
-	if (!path){
-		log_enomem();
-		return NULL;
+	/* +2: +1 for '\0', +1 for '/' */
+	len = strlen(dir->name) + strlen(dir->dnt->d_name) + 2;
+	if (len > fis->path_size){
+		char* tmp = realloc(fis->path, len);
+		if (!tmp){
+			log_enomem();
+			return NULL;
+		}
+		fis->path = tmp;
+		fis->path_size = len;
 	}
-	strcpy(path, dir->name);
+	strcpy(fis->path, dir->name);
 	/* append filename */
-	if (path[strlen(path) - 1] != '/'){
-		strcat(path, "/");
+	if (fis->path[strlen(fis->path) - 1] != '/'){
+		strcat(fis->path, "/");
 	}
-	strcat(path, dir->dnt->d_name);
+	strcat(fis->path, dir->dnt->d_name);
 
 	/* lstat does not follow symlinks unlike stat */
 	/* XOPEN extension */
-	lstat(path, &st);
+	lstat(fis->path, &st);
 	/* check if file is actually a directory */
 	if (S_ISDIR(st.st_mode)){
 		/* if so, recursively enum files on that dir */
-		directory_push(path, fis);
-		free(path);
-		return fi_next(fis);
+		directory_push(fis->path, fis);
+		return fi_next_path(fis);
 	}
 
-	return path;
+	return fis->path;
+}
+
+char* fi_next(struct fi_stack* fis){
+	const char* path;
+	char* ret;
+
+	path = fi_next_path(fis);
+	if (!path){
+		return NULL;
+	}
+
+	ret = malloc(strlen(path) + 1);
+	if (!ret){
+		log_enomem();
+		return NULL;
+	}
+	strcpy(ret, path);
+	return ret;
 }
 
 int fi_skip_current_dir(struct fi_stack* fis){
@@ -179,6 +205,7 @@ void fi_end(struct fi_stack* fis){
 	if (!fis){
 		return;
 	}
+	free(fis->path);
 	if (!fis->dir_stack){
 		free(fis);
 		return;
@@ -36,6 +36,17 @@ struct fi_stack* fi_start(const char* dir) __attribute__((malloc));
  */
 char* fi_next(struct fi_stack* fis) __attribute__((malloc));
 
+/**
+ * @brief Returns the next filename in the fi_stack structure without allocating a copy of it.
+ *
+ * @param fis A fi_stack* structure returned by fi_start()
+ * @see fi_start()
+ *
+ * @return The next filename in the fi_stack* structure, or NULL if there are not any left/there was an error.<br>
+ * This string belongs to the fi_stack* structure and is only valid until the next call to fi_next_path(), fi_next(), or fi_end().
+ */
+const char* fi_next_path(struct fi_stack* fis);
+
 /**
  * @brief Stops iterating files through the current directory and moves on to the next if there is one.
  *
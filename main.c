@@ -10,6 +10,10 @@
 #include "options/options.h"
 #include "options/options_menu.h"
 #include "backup.h"
+#include "watch.h"
+#include "scrub.h"
+#include "verify.h"
+#include "crypt/crypt_bench.h"
 
 int main(int argc, char** argv){
 	struct options* opt = NULL;
@@ -38,6 +42,13 @@ int main(int argc, char** argv){
 		}
 	}
 
+	/* only a backup may benchmark for "auto". verify has to use what the backup recorded, and the rest do not use the algorithms */
+	if ((op == OP_BACKUP || op == OP_WATCH || op == OP_VERIFY) && options_resolve_auto(opt, op != OP_VERIFY) != 0){
+		log_error("Failed to choose the algorithms");
+		ret = 1;
+		goto cleanup;
+	}
+
 	switch (op){
 	case OP_BACKUP:
 		if (backup(opt) != 0){
@@ -49,6 +60,30 @@ int main(int argc, char** argv){
 		ret = 1;
 		goto cleanup;
 		break;
+	case OP_WATCH:
+		if (watch_run(opt) != 0){
+			log_error("Watch failed");
+			ret = 1;
+		}
+		break;
+	case OP_BENCHMARK:
+		if (crypt_benchmark(stdout) != 0){
+			log_error("Benchmark failed");
+			ret = 1;
+		}
+		break;
+	case OP_SCRUB:
+		if ((ret = scrub(opt)) != 0){
+			log_error(ret > 0 ? "Scrub found damaged objects" : "Scrub failed");
+			ret = 1;
+		}
+		break;
+	case OP_VERIFY:
+		if ((ret = verify(opt)) != 0){
+			log_error(ret > 0 ? "Verify found files that cannot be restored" : "Verify failed");
+			ret = 1;
+		}
+		break;
 	case OP_EXIT:
 		ret = 0;
 		goto cleanup;
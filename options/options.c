@@ -11,6 +11,7 @@
 #include "options_file.h"
 #include "../log.h"
 #include "../crypt/base16.h"
+#include "../crypt/crypt_bench.h"
 #include "../filehelper.h"
 #include "../strings/stringhelper.h"
 #include "../compression/zip.h"
@@ -58,18 +59,28 @@ void version(void){
 void usage(const char* progname){
 	return_ifnull(progname, ;);
 
-	printf("Usage: %s (backup|restore|configure) [options]\n", progname);
+	printf("Usage: %s (backup|restore|configure|watch|scrub|verify) [options]\n", progname);
 	printf("Options:\n");
 	printf("\t-c, --compressor <gz|bz2|...>\n");
-	printf("\t-C, --checksum <md5|sha1|...>\n");
+	printf("\t-a, --adapt <MB/s>\n");
+	printf("\t-b, --block-size <bytes>\n");
+	printf("\t-B, --benchmark-crypto\n");
+	printf("\t-C, --checksum <auto|sha256|sha1|...>\n");
 	printf("\t-d, --directories </dir1 /dir2 /...>\n");
-	printf("\t-e, --encryption <aes-256-cbc|seed-ctr|...>\n");
+	printf("\t-D, --dictionary (zstd only)\n");
+	printf("\t-E, --convergent\n");
+	printf("\t-e, --encryption <auto|aes-256-gcm|aes-256-cbc|...>\n");
 	printf("\t-h, --help\n");
 	printf("\t-i, --cloud <mega|...>\n");
 	printf("\t-I, --upload_directory </dir1/dir2/...>\n");
+	printf("\t-l, --level <0-9|0-22 for zstd>\n");
 	printf("\t-o, --output </out/dir>\n");
 	printf("\t-p, --password <password>\n");
 	printf("\t-q, --quiet\n");
+	printf("\t-r, --rate <MB/s> (verify only)\n");
+	printf("\t-S, --seekable\n");
+	printf("\t-t, --threads <n>\n");
+	printf("\t-T, --tree-hash\n");
 	printf("\t-u, --username <username>\n");
 	printf("\t-x, --exclude </dir1 /dir2 /...>\n");
 }
@@ -117,6 +128,7 @@ static int get_default_backup_directory(char** out){
  * index of bad argument on bad argument */
 int parse_options_cmdline(int argc, char** argv, struct options** output, enum operation* out_op){
 	int i;
+	int dictionary = 0;
 	struct options* out = *output;
 
 	if (out){
@@ -147,13 +159,70 @@ int parse_options_cmdline(int argc, char** argv, struct options** output, enum o
 			++i;
 			out->c_type = get_compressor_byname(argv[i]);
 		}
+		/* compression level */
+		else if (!strcmp(argv[i], "-l") ||
+				!strcmp(argv[i], "--level")){
+			++i;
+			out->c_level = atoi(argv[i]);
+		}
+		/* adaptive compression level */
+		else if (!strcmp(argv[i], "-a") ||
+				!strcmp(argv[i], "--adapt")){
+			++i;
+			out->c_adapt_rate = strtoul(argv[i], NULL, 10);
+		}
+		/* verify read rate */
+		else if (!strcmp(argv[i], "-r") ||
+				!strcmp(argv[i], "--rate")){
+			++i;
+			out->verify_rate = strtoul(argv[i], NULL, 10);
+		}
+		/* compression threads */
+		else if (!strcmp(argv[i], "-t") ||
+				!strcmp(argv[i], "--threads")){
+			++i;
+			out->c_flags &= ~ZIP_THREADS(0xFF);
+			out->c_flags |= ZIP_THREADS(atoi(argv[i]));
+		}
+		/* compression block size */
+		else if (!strcmp(argv[i], "-b") ||
+				!strcmp(argv[i], "--block-size")){
+			unsigned long block_size;
+			unsigned shift = 0;
+
+			++i;
+			/* rounded up to the next power of 2, up to 2GB */
+			block_size = strtoul(argv[i], NULL, 10);
+			while (shift < 31 && (1UL << shift) < block_size){
+				shift++;
+			}
+			out->c_flags &= ~ZIP_BLOCK_SHIFT(0xFF);
+			out->c_flags |= ZIP_BLOCK_SHIFT(shift);
+		}
+		/* seekable container */
+		else if (!strcmp(argv[i], "-S") ||
+				!strcmp(argv[i], "--seekable")){
+			out->c_flags |= ZIP_SEEKABLE;
+		}
+		/* train a zstd dictionary for small files */
+		else if (!strcmp(argv[i], "-D") ||
+				!strcmp(argv[i], "--dictionary")){
+			dictionary = 1;
+		}
 		/* checksum */
 		else if (!strcmp(argv[i], "-C") ||
 				!strcmp(argv[i], "--checksum")){
 			/* check next argument */
 			++i;
 			OpenSSL_add_all_algorithms();
-			out->hash_algorithm = EVP_get_digestbyname(argv[i]);
+			/* benchmarking is left until the operation is known. see options_resolve_auto() */
+			if (argv[i] && !strcmp(argv[i], "auto")){
+				out->flags.bits.flag_auto_hash = 1;
+			}
+			else{
+				out->hash_algorithm = EVP_get_digestbyname(argv[i]);
+				out->flags.bits.flag_auto_hash = 0;
+			}
 		}
 		/* encryption */
 		else if (!strcmp(argv[i], "-e") ||
@@ -161,7 +230,28 @@ int parse_options_cmdline(int argc, char** argv, struct options** output, enum o
 			/* next argument */
 			++i;
 			OpenSSL_add_all_algorithms();
-			out->enc_algorithm = EVP_get_cipherbyname(argv[i]);
+			if (argv[i] && !strcmp(argv[i], "auto")){
+				out->flags.bits.flag_auto_cipher = 1;
+			}
+			else{
+				out->enc_algorithm = EVP_get_cipherbyname(argv[i]);
+				out->flags.bits.flag_auto_cipher = 0;
+			}
+		}
+		/* time the ciphers and digests instead of backing up */
+		else if (!strcmp(argv[i], "-B") ||
+				!strcmp(argv[i], "--benchmark-crypto")){
+			*out_op = OP_BENCHMARK;
+		}
+		/* encrypt identical files identically so they can be deduplicated */
+		else if (!strcmp(argv[i], "-E") ||
+				!strcmp(argv[i], "--convergent")){
+			out->flags.bits.flag_convergent = 1;
+		}
+		/* hash large files in parallel leaves */
+		else if (!strcmp(argv[i], "-T") ||
+				!strcmp(argv[i], "--tree-hash")){
+			out->flags.bits.flag_tree_hash = 1;
 		}
 		/* verbose */
 		else if (!strcmp(argv[i], "-q") ||
@@ -239,6 +329,15 @@ int parse_options_cmdline(int argc, char** argv, struct options** output, enum o
 			else if (!strcmp(argv[i], "configure")){
 				*out_op = OP_CONFIGURE;
 			}
+			else if (!strcmp(argv[i], "watch")){
+				*out_op = OP_WATCH;
+			}
+			else if (!strcmp(argv[i], "scrub")){
+				*out_op = OP_SCRUB;
+			}
+			else if (!strcmp(argv[i], "verify")){
+				*out_op = OP_VERIFY;
+			}
 			else{
 				return i;
 			}
@@ -251,10 +350,21 @@ int parse_options_cmdline(int argc, char** argv, struct options** output, enum o
 	if (out->directories->len == 0){
 		sa_add(out->directories, "/");
 	}
+	/* the other compressors use this bit for something else.
+	 * dictionary-compressed files are plain zstd frames, which a seekable backup could not restore */
+	if (dictionary && out->c_type == COMPRESSOR_ZSTD){
+		if (out->c_flags & ZIP_SEEKABLE){
+			log_warning("--dictionary cannot be used with --seekable. Compressing without a dictionary");
+		}
+		else{
+			out->c_flags |= ZSTD_DICT;
+		}
+	}
 	if (!out->output_directory && get_default_backup_directory(&out->output_directory) != 0){
 		log_error("Could not determine output directory");
 		return -1;
 	}
+	*output = out;
 	return 0;
 }
 
@@ -272,6 +382,8 @@ struct options* options_new(void){
 	opt->c_type = COMPRESSOR_GZIP;
 	opt->c_level = 0;
 	memset(&(opt->c_flags), 0, sizeof(opt->c_flags));
+	opt->c_adapt_rate = 0;
+	opt->verify_rate = 0;
 	if (get_default_backup_directory(&(opt->output_directory)) != 0){
 		log_debug("Failed to make backup directory");
 		return NULL;
@@ -413,6 +525,16 @@ int parse_options_fromfile(const char* file, struct options** output){
 		opt->c_flags = *(unsigned*)entries[res]->value;
 	}
 
+	res = binsearch_opt_entries((const struct opt_entry* const*)entries, entries_len, "C_ADAPT_RATE");
+	if (res >= 0){
+		opt->c_adapt_rate = *(unsigned*)entries[res]->value;
+	}
+
+	res = binsearch_opt_entries((const struct opt_entry* const*)entries, entries_len, "VERIFY_RATE");
+	if (res >= 0){
+		opt->verify_rate = *(unsigned*)entries[res]->value;
+	}
+
 	res = binsearch_opt_entries((const struct opt_entry* const*)entries, entries_len, "OUTPUT_DIRECTORY");
 	if (res >= 0){
 		free(opt->output_directory);
@@ -585,6 +707,14 @@ int write_options_tofile(const char* file, const struct options* opt){
 		log_warning("Failed to add C_FLAGS to file");
 	}
 
+	if (add_option_tofile(fp, "C_ADAPT_RATE", &(opt->c_adapt_rate), sizeof(opt->c_adapt_rate)) != 0){
+		log_warning("Failed to add C_ADAPT_RATE to file");
+	}
+
+	if (add_option_tofile(fp, "VERIFY_RATE", &(opt->verify_rate), sizeof(opt->verify_rate)) != 0){
+		log_warning("Failed to add VERIFY_RATE to file");
+	}
+
 	if (add_option_tofile(fp, "OUTPUT_DIRECTORY", opt->output_directory, strlen(opt->output_directory) + 1) != 0){
 		log_warning("Failed to add OUTPUT_DIRECTORY to file");
 	}
@@ -670,6 +800,14 @@ int options_cmp(const struct options* opt1, const struct options* opt2){
 		return (long)opt1->c_flags - (long)opt2->c_flags;
 	}
 
+	if (opt1->c_adapt_rate != opt2->c_adapt_rate){
+		return (long)opt1->c_adapt_rate - (long)opt2->c_adapt_rate;
+	}
+
+	if (opt1->verify_rate != opt2->verify_rate){
+		return (long)opt1->verify_rate - (long)opt2->verify_rate;
+	}
+
 	if (sh_cmp_nullsafe(opt1->output_directory, opt2->output_directory) != 0){
 		return sh_cmp_nullsafe(opt1->output_directory, opt2->output_directory);
 	}
@@ -775,6 +913,135 @@ cleanup:
 	return ret;
 }
 
+static char* algorithms_filename(const struct options* opt){
+	return sh_concat_path(sh_dup(opt->output_directory), OPTIONS_ALGORITHMS_FILE);
+}
+
+/* a recorded algorithm with no name means none was used */
+static const char* recorded_name(const struct opt_entry* entry){
+	const char* name = entry->value;
+
+	return name && entry->value_len > 0 && name[0] != '\0' ? name : NULL;
+}
+
+int options_resolve_auto(struct options* opt, int benchmark){
+	struct opt_entry** entries = NULL;
+	size_t entries_len = 0;
+	char* file = NULL;
+	int res;
+	int ret = 0;
+
+	if (!opt->flags.bits.flag_auto_hash && !opt->flags.bits.flag_auto_cipher){
+		return 0;
+	}
+
+	file = algorithms_filename(opt);
+	if (!file){
+		log_error("Failed to determine the recorded algorithms file");
+		ret = -1;
+		goto cleanup;
+	}
+
+	/* a backup that already exists keeps the algorithms it was made with, even if a different machine would pick others */
+	if (file_exists(file)){
+		if (read_option_file(file, &entries, &entries_len) != 0){
+			log_error_ex("Failed to read the recorded algorithms from %s", file);
+			ret = -1;
+			goto cleanup;
+		}
+		/* a name that cannot be looked up must not quietly turn into no checksum or no encryption */
+		res = binsearch_opt_entries((const struct opt_entry* const*)entries, entries_len, "HASH_ALGORITHM");
+		if (opt->flags.bits.flag_auto_hash && res >= 0){
+			const char* name = recorded_name(entries[res]);
+
+			opt->hash_algorithm = name ? EVP_get_digestbyname(name) : NULL;
+			if (name && !opt->hash_algorithm){
+				log_error_ex2("The checksum algorithm %s recorded in %s is not available", name, file);
+				ret = -1;
+				goto cleanup;
+			}
+			opt->flags.bits.flag_auto_hash = 0;
+		}
+		res = binsearch_opt_entries((const struct opt_entry* const*)entries, entries_len, "ENC_ALGORITHM");
+		if (opt->flags.bits.flag_auto_cipher && res >= 0){
+			const char* name = recorded_name(entries[res]);
+
+			opt->enc_algorithm = name ? EVP_get_cipherbyname(name) : NULL;
+			if (name && !opt->enc_algorithm){
+				log_error_ex2("The encryption algorithm %s recorded in %s is not available", name, file);
+				ret = -1;
+				goto cleanup;
+			}
+			if (!name){
+				log_warning_ex("This backup was made without encryption, so \"-e auto\" does not encrypt it (%s)", file);
+			}
+			opt->flags.bits.flag_auto_cipher = 0;
+		}
+	}
+
+	/* benchmarking could pick algorithms the backup was never made with */
+	if (!benchmark && (opt->flags.bits.flag_auto_hash || opt->flags.bits.flag_auto_cipher)){
+		log_error_ex("No algorithms are recorded in %s, so \"auto\" cannot be resolved. Give the algorithms explicitly", file);
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (opt->flags.bits.flag_auto_hash){
+		if ((opt->hash_algorithm = crypt_auto_md()) == NULL){
+			log_error("Failed to choose a checksum algorithm");
+			ret = -1;
+			goto cleanup;
+		}
+		opt->flags.bits.flag_auto_hash = 0;
+	}
+	if (opt->flags.bits.flag_auto_cipher){
+		if ((opt->enc_algorithm = crypt_auto_cipher()) == NULL){
+			log_error("Failed to choose an encryption algorithm");
+			ret = -1;
+			goto cleanup;
+		}
+		opt->flags.bits.flag_auto_cipher = 0;
+	}
+
+cleanup:
+	free_opt_entry_array(entries, entries_len);
+	free(file);
+	return ret;
+}
+
+int options_record_algorithms(const struct options* opt){
+	FILE* fp = NULL;
+	char* file = NULL;
+	const char* hash_name = opt->hash_algorithm ? EVP_MD_name(opt->hash_algorithm) : NULL;
+	const char* enc_name = opt->enc_algorithm ? EVP_CIPHER_name(opt->enc_algorithm) : NULL;
+	int ret = 0;
+
+	file = algorithms_filename(opt);
+	if (!file){
+		log_error("Failed to determine the recorded algorithms file");
+		ret = -1;
+		goto cleanup;
+	}
+
+	fp = create_option_file(file);
+	if (!fp){
+		log_error("Failed to create option file");
+		ret = -1;
+		goto cleanup;
+	}
+	if (add_option_tofile(fp, "HASH_ALGORITHM", hash_name, hash_name ? strlen(hash_name) + 1 : 0) != 0 ||
+			add_option_tofile(fp, "ENC_ALGORITHM", enc_name, enc_name ? strlen(enc_name) + 1 : 0) != 0){
+		log_error_ex("Failed to write the algorithms to %s", file);
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	fp ? fclose(fp) : 0;
+	free(file);
+	return ret;
+}
+
 const char* operation_tostring(enum operation op){
 	switch (op){
 	case OP_BACKUP:
@@ -785,6 +1052,14 @@ const char* operation_tostring(enum operation op){
 		return "Configure";
 	case OP_EXIT:
 		return "Exit";
+	case OP_WATCH:
+		return "Watch";
+	case OP_BENCHMARK:
+		return "Benchmark";
+	case OP_SCRUB:
+		return "Scrub";
+	case OP_VERIFY:
+		return "Verify";
 	default:
 		log_einval_u(op);
 		return NULL;
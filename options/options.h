@@ -18,6 +18,8 @@
 #define __attribute__(x)
 #endif
 
+#define OPTIONS_ALGORITHMS_FILE "algorithms" /**< The file within the output directory that records the algorithms a backup was made with. */
+
 /**
  * @brief An operation for the main program to perform.
  */
@@ -26,7 +28,11 @@ enum operation{
 	OP_BACKUP  = 1,   /**< @brief Backup. */
 	OP_RESTORE = 2,   /**< @brief Restore. */
 	OP_CONFIGURE = 3, /**< @brief Configure. */
-	OP_EXIT = 4       /**< @brief Exit. */
+	OP_EXIT = 4,      /**< @brief Exit. */
+	OP_WATCH = 5,     /**< @brief Watch the backup directories for changes. */
+	OP_BENCHMARK = 6, /**< @brief Time the available ciphers and digests. */
+	OP_SCRUB = 7,     /**< @brief Check the stored objects against their block checksums. */
+	OP_VERIFY = 8     /**< @brief Decrypt, decompress, and rehash the stored files in memory to check that they can be restored. */
 };
 
 /**
@@ -42,11 +48,17 @@ struct options{
 	enum compressor       c_type;           /**< @brief The compression algorithm to use. */
 	int                   c_level;          /**< @brief The compression level to use. 0 uses the default level. */
 	unsigned              c_flags;          /**< @brief The compression flags to use. */
+	unsigned              c_adapt_rate;     /**< @brief If not 0, the compression level adapts to keep up with this many MB/s, starting at c_level. */
+	unsigned              verify_rate;      /**< @brief If not 0, verify reads the stored files at no more than this many MB/s, so it can run in the background. */
 	char*                 output_directory; /**< @brief The backup directory on disk. This must be dynamically allocated. */
 	struct cloud_options* cloud_options;    /**< @brief The cloud options to use. This cannot be NULL, but its members can be. */
 	union tagflags{                         /**< @brief The special flags to use. This can be represented as a series of bits or as an unsigned integer. */
 		struct tagbits{
 			unsigned      flag_verbose: 1;  /**< @brief Verbose output. */
+			unsigned      flag_convergent: 1; /**< @brief Encrypt identical files identically, so they are only stored once. */
+			unsigned      flag_tree_hash: 1; /**< @brief Hash large files as a Merkle tree on several threads, and keep their leaf hashes. */
+			unsigned      flag_auto_hash: 1; /**< @brief hash_algorithm is to be chosen by options_resolve_auto(). */
+			unsigned      flag_auto_cipher: 1; /**< @brief enc_algorithm is to be chosen by options_resolve_auto(). */
 		}bits;
 		unsigned          dword;            /**< @brief All flags as an unsigned integer. */
 	}flags;
@@ -179,6 +191,33 @@ int get_prev_options(struct options** out);
  */
 int set_prev_options(const struct options* opt);
 
+/**
+ * @brief Picks the algorithms that were given as "auto" on the command line.<br>
+ * If the output directory has algorithms recorded by options_record_algorithms(), those are reused, so a backup keeps the algorithms it was made with.<br>
+ * Otherwise the ciphers and digests are benchmarked and the fastest ones are chosen, if benchmark allows it.
+ * @see crypt_auto_cipher()
+ * @see crypt_auto_md()
+ *
+ * @param opt The options structure.<br>
+ * Its flag_auto_hash and flag_auto_cipher flags are cleared once their algorithms are chosen.
+ *
+ * @param benchmark Non-zero to benchmark if nothing is recorded, or 0 to fail instead.<br>
+ * Only a backup should benchmark. Anything that reads an existing backup needs the algorithms it was made with.
+ *
+ * @return 0 on success, or negative on failure (e.g. a recorded algorithm is not available).
+ */
+int options_resolve_auto(struct options* opt, int benchmark);
+
+/**
+ * @brief Records the checksum and encryption algorithms in OPTIONS_ALGORITHMS_FILE within the output directory, so options_resolve_auto() picks them again next time.<br>
+ * Nothing else is written, so the passwords do not end up next to the backup.
+ *
+ * @param opt The options structure.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int options_record_algorithms(const struct options* opt);
+
 /**
  * @brief Converts an enum operation to its string equivalent.
  *
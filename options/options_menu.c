@@ -10,6 +10,7 @@
 #include "../cli.h"
 #include "../crypt/crypt.h"
 #include "../crypt/crypt_getpassword.h"
+#include "../crypt/crypt_bench.h"
 #include "../log.h"
 #include "../strings/stringhelper.h"
 #include "../readline_include.h"
@@ -109,6 +110,7 @@ int menu_compressor(struct options* opt){
 		"bzip2 (higher compression, slower)",
 		"xz    (highest compression, slowest)",
 		"lz4   (fastest, lowest compression)",
+		"zstd  (high compression, fast)",
 		"none",
 		"Exit"
 	};
@@ -117,11 +119,12 @@ int menu_compressor(struct options* opt){
 		COMPRESSOR_BZIP2,
 		COMPRESSOR_XZ,
 		COMPRESSOR_LZ4,
+		COMPRESSOR_ZSTD,
 		COMPRESSOR_NONE
 	};
 
 	res = display_menu(options_compressor, ARRAY_SIZE(options_compressor), "Select a compression algorithm");
-	if (res == 5){
+	if (res == 6){
 		return 0;
 	}
 	opt->c_type = list_compressor[res];
@@ -135,6 +138,7 @@ int menu_checksum(struct options* opt){
 		"sha256 (less collisions, slower)",
 		"sha512 (lowest collisions, slowest)",
 		"md5    (fastest, most collisions)",
+		"auto   (fastest secure hash on this machine)",
 		"none",
 		"Exit"
 	};
@@ -147,9 +151,16 @@ int menu_checksum(struct options* opt){
 	};
 
 	res = display_menu(options_checksum, ARRAY_SIZE(options_checksum), "Select a checksum algorithm");
-	if (res == 5){
+	if (res == 6){
 		return 0;
 	}
+	if (res == 4){
+		opt->hash_algorithm = crypt_auto_md();
+		return opt->hash_algorithm ? 0 : -1;
+	}
+	if (res == 5){
+		res = 4;
+	}
 	opt->hash_algorithm = list_checksum[res] ? (list_checksum[res])() : NULL;
 	return 0;
 }
@@ -165,6 +176,7 @@ int menu_encryption(struct options* opt){
 		"SEED",
 		"Blowfish",
 		"Triple DES (EDE3)",
+		"Auto (fastest authenticated cipher on this machine)",
 		"None",
 		"Exit"
 	};
@@ -201,10 +213,14 @@ int menu_encryption(struct options* opt){
 
 	res_encryption = display_menu(options_encryption, ARRAY_SIZE(options_encryption), "Select an encryption algorithm");
 	if (res_encryption == 5){
+		opt->enc_algorithm = crypt_auto_cipher();
+		return opt->enc_algorithm ? 0 : -1;
+	}
+	if (res_encryption == 6){
 		opt->enc_algorithm = NULL;
 		return 0;
 	}
-	if (res_encryption == 6){
+	if (res_encryption == 7){
 		return 0;
 	}
 
@@ -0,0 +1,112 @@
+/** @file scrub.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "scrub.h"
+#include "blockcrc.h"
+#include "crc32c.h"
+#include "fileiterator.h"
+#include "filehelper.h"
+#include "log.h"
+#include "strings/stringhelper.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static double now_secs(void){
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int scrub_directory(const char* output_directory, FILE* report){
+	struct fi_stack* fis = NULL;
+	char* crc_dir = NULL;
+	const char* sidecar;
+	unsigned long n_objects = 0;
+	unsigned long n_bad = 0;
+	double bytes = 0;
+	double t_start;
+	double elapsed;
+	int ret = 0;
+
+	return_ifnull(output_directory, -1);
+	return_ifnull(report, -1);
+
+	crc_dir = sh_concat_path(sh_dup(output_directory), SCRUB_CRC_DIR);
+	if (!crc_dir){
+		log_error("Failed to determine block checksum directory");
+		return -1;
+	}
+	if (!directory_exists(crc_dir)){
+		log_error_ex("%s does not exist. Nothing to scrub.", crc_dir);
+		ret = -1;
+		goto cleanup;
+	}
+
+	fis = fi_start(crc_dir);
+	if (!fis){
+		log_error_ex("Failed to fi_start in directory %s", crc_dir);
+		ret = -1;
+		goto cleanup;
+	}
+
+	t_start = now_secs();
+	while ((sidecar = fi_next_path(fis)) != NULL){
+		/* the sidecar is at the object's path within the output directory, moved under crc/ */
+		char* object = sh_concat_path(sh_dup(output_directory), sidecar + strlen(crc_dir));
+		uint64_t* bad = NULL;
+		size_t n;
+		size_t i;
+		int res;
+
+		if (!object){
+			ret = -1;
+			break;
+		}
+
+		n_objects++;
+		if (!file_exists(object)){
+			fprintf(report, "MISSING\t%s\n", object);
+			n_bad++;
+		}
+		else if ((res = block_crc_check(object, sidecar, &bad, &n)) < 0){
+			fprintf(report, "UNREADABLE\t%s\n", sidecar);
+			n_bad++;
+		}
+		else{
+			for (i = 0; i < n; ++i){
+				uint64_t offset = bad[i] << BLOCK_CRC_SHIFT;
+				fprintf(report, "CORRUPT\t%s\t%lu\t%lu\t%lu\n", object, (unsigned long)bad[i], (unsigned long)offset, 1UL << BLOCK_CRC_SHIFT);
+			}
+			n_bad += res > 0;
+			bytes += get_file_size(object);
+		}
+
+		free(bad);
+		free(object);
+	}
+	elapsed = now_secs() - t_start;
+
+	fprintf(report, "Scrubbed %lu objects (%.1f MB) in %.1fs at %.1f MB/s using %s CRC-32C. %lu damaged.\n",
+			n_objects, bytes / 1048576.0, elapsed, elapsed > 0 ? bytes / 1048576.0 / elapsed : 0.0,
+			crc32c_hardware() ? "hardware" : "software", n_bad);
+	if (ret == 0){
+		ret = n_bad > 0;
+	}
+
+cleanup:
+	fi_end(fis);
+	free(crc_dir);
+	return ret;
+}
+
+int scrub(const struct options* opt){
+	return_ifnull(opt, -1);
+	return scrub_directory(opt->output_directory, stdout);
+}
@@ -0,0 +1,45 @@
+/** @file scrub.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __SCRUB_H
+#define __SCRUB_H
+
+#include "options/options.h"
+#include <stdio.h>
+
+#define SCRUB_CRC_DIR "crc" /**< @brief The directory within the output directory that holds the block checksums of each object, at the same path the object has within the output directory. */
+
+/**
+ * @brief Checks every object in an output directory against its block checksums.<br>
+ * Objects are only read, never decrypted or decompressed, so this needs no password and runs at disk speed.<br>
+ * <br>
+ * Each problem is written to the report as one tab-separated line:<br>
+ * `CORRUPT\tOBJECT\tBLOCK\tOFFSET\tLENGTH` for a block that does not match,<br>
+ * `MISSING\tOBJECT` for an object that no longer exists,<br>
+ * `UNREADABLE\tSIDECAR` for block checksums that cannot be read or are damaged themselves.
+ * @see block_crc_check()
+ *
+ * @param output_directory The output directory.
+ *
+ * @param report The file to write problems and a summary to.
+ *
+ * @return 0 if every object is intact, positive if any problems were found, or negative on failure.
+ */
+int scrub_directory(const char* output_directory, FILE* report);
+
+/**
+ * @brief Scrubs the output directory in an options structure, writing the report to stdout.
+ * @see scrub_directory()
+ *
+ * @param opt The options structure to use.
+ *
+ * @return 0 if every object is intact, positive if any problems were found, or negative on failure.
+ */
+int scrub(const struct options* opt);
+
+#endif
@@ -0,0 +1,183 @@
+/** @file strings/arena.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "arena.h"
+#include "../log.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* every allocation is rounded up to a multiple of this */
+union arena_align{
+	long l;
+	double d;
+	void* p;
+};
+#define ARENA_ALIGN (sizeof(union arena_align))
+
+struct arena_chunk{
+	struct arena_chunk* next;
+	size_t size;
+	size_t used;
+	union arena_align data[1];
+};
+
+struct arena{
+	struct arena_chunk* head;
+	struct arena_chunk* current;
+	size_t chunk_size;
+};
+
+static struct arena_chunk* chunk_new(size_t size){
+	struct arena_chunk* chunk;
+
+	chunk = malloc(offsetof(struct arena_chunk, data) + size);
+	if (!chunk){
+		log_enomem();
+		return NULL;
+	}
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
+}
+
+struct arena* arena_new(size_t chunk_size){
+	struct arena* a;
+
+	a = malloc(sizeof(*a));
+	if (!a){
+		log_enomem();
+		return NULL;
+	}
+
+	a->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+	a->head = chunk_new(a->chunk_size);
+	if (!a->head){
+		free(a);
+		return NULL;
+	}
+	a->current = a->head;
+	return a;
+}
+
+void* arena_alloc(struct arena* a, size_t size){
+	struct arena_chunk* chunk;
+	void* ret;
+
+	return_ifnull(a, NULL);
+
+	size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+	if (size == 0){
+		size = ARENA_ALIGN;
+	}
+
+	/* chunks past current are empty leftovers from before the last reset */
+	for (chunk = a->current; chunk && chunk->size - chunk->used < size; chunk = chunk->next);
+
+	if (!chunk){
+		chunk = chunk_new(size > a->chunk_size ? size : a->chunk_size);
+		if (!chunk){
+			return NULL;
+		}
+		chunk->next = a->current->next;
+		a->current->next = chunk;
+	}
+	a->current = chunk;
+
+	ret = (unsigned char*)chunk->data + chunk->used;
+	chunk->used += size;
+	return ret;
+}
+
+char* arena_dup_n(struct arena* a, const char* str, size_t len){
+	char* ret;
+
+	return_ifnull(str, NULL);
+
+	ret = arena_alloc(a, len + 1);
+	if (!ret){
+		return NULL;
+	}
+	memcpy(ret, str, len);
+	ret[len] = '\0';
+	return ret;
+}
+
+char* arena_dup(struct arena* a, const char* str){
+	return_ifnull(str, NULL);
+	return arena_dup_n(a, str, strlen(str));
+}
+
+char* arena_join(struct arena* a, ...){
+	va_list ap;
+	const char* str;
+	size_t len = 0;
+	char* ret;
+	char* ptr;
+
+	va_start(ap, a);
+	while ((str = va_arg(ap, const char*)) != NULL){
+		len += strlen(str);
+	}
+	va_end(ap);
+
+	ret = arena_alloc(a, len + 1);
+	if (!ret){
+		return NULL;
+	}
+
+	ptr = ret;
+	va_start(ap, a);
+	while ((str = va_arg(ap, const char*)) != NULL){
+		size_t str_len = strlen(str);
+		memcpy(ptr, str, str_len);
+		ptr += str_len;
+	}
+	va_end(ap);
+	*ptr = '\0';
+
+	return ret;
+}
+
+char* arena_concat_path(struct arena* a, const char* dir, const char* path, const char* extension){
+	return_ifnull(dir, NULL);
+	return_ifnull(path, NULL);
+
+	if (path[0] == '/'){
+		path++;
+	}
+	return arena_join(a, dir, dir[0] && dir[strlen(dir) - 1] == '/' ? "" : "/", path, extension ? extension : "", NULL);
+}
+
+void arena_reset(struct arena* a){
+	struct arena_chunk* chunk;
+
+	if (!a){
+		return;
+	}
+	for (chunk = a->head; chunk; chunk = chunk->next){
+		chunk->used = 0;
+	}
+	a->current = a->head;
+}
+
+void arena_free(struct arena* a){
+	struct arena_chunk* chunk;
+
+	if (!a){
+		return;
+	}
+	chunk = a->head;
+	while (chunk){
+		struct arena_chunk* next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	free(a);
+}
@@ -0,0 +1,125 @@
+/** @file strings/arena.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stddef.h>
+
+#ifndef __GNUC__
+#define __attribute__(x)
+#endif
+
+#ifndef ARENA_DEFAULT_CHUNK_SIZE
+#define ARENA_DEFAULT_CHUNK_SIZE (16 * 1024) /**< @brief The default size of each chunk of an arena in bytes. */
+#endif
+
+/**
+ * @brief A bump allocator.<br>
+ * Allocations are carved out of large chunks and are all released at once with arena_reset() or arena_free().<br>
+ * Chunks are kept across arena_reset(), so an arena that is reset after every file stops calling malloc() once it has grown large enough.
+ */
+struct arena;
+
+/**
+ * @brief Creates a new arena.
+ *
+ * @param chunk_size The minimum size of each chunk in bytes.<br>
+ * If this is 0, ARENA_DEFAULT_CHUNK_SIZE is used.
+ *
+ * @return A new arena, or NULL on failure.<br>
+ * This arena must be freed with arena_free() when no longer in use.
+ */
+struct arena* arena_new(size_t chunk_size) __attribute__((malloc));
+
+/**
+ * @brief Allocates memory from an arena.<br>
+ * The returned memory is suitably aligned for any type.
+ *
+ * @param a The arena to allocate from.
+ *
+ * @param size The number of bytes to allocate.
+ *
+ * @return A pointer to the allocated memory, or NULL on failure.<br>
+ * This pointer is valid until the next arena_reset() or arena_free() and must not be passed to free().
+ */
+void* arena_alloc(struct arena* a, size_t size);
+
+/**
+ * @brief Duplicates the first len characters of a string into an arena.
+ *
+ * @param a The arena to allocate from.
+ *
+ * @param str The string to duplicate.
+ *
+ * @param len The number of characters to duplicate.
+ *
+ * @return A null-terminated copy of the string, or NULL on failure.
+ */
+char* arena_dup_n(struct arena* a, const char* str, size_t len);
+
+/**
+ * @brief Duplicates a string into an arena.
+ *
+ * @param a The arena to allocate from.
+ *
+ * @param str The string to duplicate.
+ *
+ * @return A copy of the string, or NULL on failure.
+ */
+char* arena_dup(struct arena* a, const char* str);
+
+/**
+ * @brief Concatenates a NULL-terminated list of strings into an arena.
+ *
+ * @param a The arena to allocate from.
+ *
+ * @param ... The strings to concatenate, followed by NULL.
+ *
+ * @return The concatenated string, or NULL on failure.
+ */
+char* arena_join(struct arena* a, ...);
+
+/**
+ * @brief Joins a directory and a path the same way sh_concat_path() does, placing exactly one '/' between the two.
+ * @see sh_concat_path()
+ *
+ * @param a The arena to allocate from.
+ *
+ * @param dir The directory.
+ *
+ * @param path The path to append to the directory.
+ *
+ * @param extension A string to append after the path.<br>
+ * This can be NULL, in which case nothing is appended.
+ *
+ * @return The joined path, or NULL on failure.
+ */
+char* arena_concat_path(struct arena* a, const char* dir, const char* path, const char* extension);
+
+/**
+ * @brief Releases every allocation made from an arena while keeping its chunks for reuse.
+ *
+ * @param a The arena to reset.<br>
+ * This can be NULL, in which case this function does nothing.
+ *
+ * @return void
+ */
+void arena_reset(struct arena* a);
+
+/**
+ * @brief Frees all memory associated with an arena.
+ *
+ * @param a The arena to free.<br>
+ * This can be NULL, in which case this function does nothing.
+ *
+ * @return void
+ */
+void arena_free(struct arena* a);
+
+#endif
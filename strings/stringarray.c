@@ -14,6 +14,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <limits.h>
 
 int sa_add(struct string_array* array, const char* str){
 	void* tmp;
@@ -259,6 +260,114 @@ size_t sa_sanitize_directories(struct string_array* array){
 	return n_removed;
 }
 
+/* replaces every entry with its canonical path, dropping the ones that do not exist */
+static int canonicalize_paths(struct string_array* array, int dirs_only, size_t* n_removed){
+	char buf[PATH_MAX];
+	size_t i;
+
+	*n_removed = 0;
+	for (i = 0; i < array->len; ++i){
+		struct stat st;
+		char* tmp;
+
+		if (!realpath(array->strings[i], buf) || stat(buf, &st) != 0 || (dirs_only && !S_ISDIR(st.st_mode))){
+			log_info_ex("Ignoring %s because it does not exist", array->strings[i]);
+			if (sa_remove(array, i) != 0){
+				log_error("Failed to remove string from array");
+				return -1;
+			}
+			i--;
+			(*n_removed)++;
+			continue;
+		}
+
+		if (S_ISDIR(st.st_mode) && strcmp(buf, "/") != 0){
+			tmp = sh_concat(sh_dup(buf), "/");
+		}
+		else{
+			tmp = sh_dup(buf);
+		}
+		if (!tmp){
+			log_error("Failed to duplicate canonical path");
+			return -1;
+		}
+		free(array->strings[i]);
+		array->strings[i] = tmp;
+	}
+	return 0;
+}
+
+/* directories end with '/', so a plain prefix check cannot match a sibling such as "/home/user2" */
+static int path_within(const char* path, const char* dir){
+	return strncmp(path, dir, strlen(dir)) == 0;
+}
+
+int sa_normalize_roots(struct string_array* directories, struct string_array* exclude){
+	size_t n_removed;
+	size_t n_tmp;
+	size_t i;
+	size_t j;
+
+	return_ifnull(directories, -1);
+
+	if (canonicalize_paths(directories, 1, &n_removed) != 0 || (exclude && canonicalize_paths(exclude, 0, &n_tmp) != 0)){
+		log_error("Failed to canonicalize paths");
+		return -1;
+	}
+
+	sa_sort(directories);
+	exclude ? sa_sort(exclude) : (void)0;
+
+	/* once sorted, a directory's subdirectories come directly after it */
+	for (i = 1; i < directories->len; ++i){
+		if (path_within(directories->strings[i], directories->strings[i - 1])){
+			if (sa_remove(directories, i) != 0){
+				log_error("Failed to remove nested directory");
+				return -1;
+			}
+			i--;
+			n_removed++;
+		}
+	}
+
+	if (!exclude){
+		return (int)n_removed;
+	}
+
+	for (i = 0; i < directories->len; ++i){
+		for (j = 0; j < exclude->len; ++j){
+			if (strcmp(directories->strings[i], exclude->strings[j]) == 0 || path_within(directories->strings[i], exclude->strings[j])){
+				break;
+			}
+		}
+		if (j < exclude->len){
+			if (sa_remove(directories, i) != 0){
+				log_error("Failed to remove excluded directory");
+				return -1;
+			}
+			i--;
+			n_removed++;
+		}
+	}
+
+	for (j = 0; j < exclude->len; ++j){
+		for (i = 0; i < directories->len; ++i){
+			if (path_within(exclude->strings[j], directories->strings[i])){
+				break;
+			}
+		}
+		if (i == directories->len){
+			if (sa_remove(exclude, j) != 0){
+				log_error("Failed to remove unused exclude path");
+				return -1;
+			}
+			j--;
+		}
+	}
+
+	return (int)n_removed;
+}
+
 struct string_array* sa_get_parent_dirs(const char* directory){
 	char* dir = NULL;
 	char* dir_tok = NULL;
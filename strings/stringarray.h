@@ -35,6 +35,16 @@ struct string_array{
  */
 struct string_array* sa_new(void) __attribute__((malloc));
 
+/**
+ * @brief Duplicates a string array.
+ *
+ * @param src The array to duplicate.
+ *
+ * @return A copy of the array, or NULL on failure.<br>
+ * This array must be freed with sa_free() when no longer in use.
+ */
+struct string_array* sa_dup(const struct string_array* src) __attribute__((malloc));
+
 /**
  * @brief Adds a string to a string array.
  *
@@ -165,6 +175,21 @@ int sa_merge(struct string_array* dst, struct string_array* src);
  */
 size_t sa_sanitize_directories(struct string_array* array);
 
+/**
+ * @brief Turns a list of directories and a list of exclude paths into a plan that walks each file exactly once.<br>
+ * Every entry is resolved with realpath(), so symlinks and ".." components are removed, and entries that do not exist are dropped.<br>
+ * Directories that are nested within another directory or within an exclude path are dropped, and so are exclude paths that are not within any directory.<br>
+ * Both arrays end up sorted, and every directory ends with a trailing slash.
+ *
+ * @param directories The directories to normalize.
+ *
+ * @param exclude The exclude paths to normalize.<br>
+ * This can be NULL, in which case no paths are excluded.
+ *
+ * @return The number of directories removed, or negative on failure.
+ */
+int sa_normalize_roots(struct string_array* directories, struct string_array* exclude);
+
 /**
  * @brief Splits a directory into its parent directories (e.g. `"/dir1/dir2/dir3" -> {"/dir1", "/dir1/dir2", "/dir1/dir2/dir3"}`)
  *
@@ -0,0 +1,160 @@
+/** @file strings/stringset.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "stringset.h"
+#include "arena.h"
+#include "../log.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SS_INITIAL_CAPACITY (64)
+
+struct ss_entry{
+	const char* str;
+	size_t len;
+	unsigned long hash;
+};
+
+struct string_set{
+	struct ss_entry* entries;
+	size_t capacity;
+	size_t len;
+	/* holds the interned strings so their addresses never change */
+	struct arena* strings;
+};
+
+/* FNV-1a */
+static unsigned long ss_hash(const char* str, size_t len){
+	unsigned long hash = 2166136261UL;
+	size_t i;
+
+	for (i = 0; i < len; ++i){
+		hash ^= (unsigned char)str[i];
+		hash = (hash * 16777619UL) & 0xFFFFFFFFUL;
+	}
+	return hash;
+}
+
+static struct ss_entry* ss_lookup(const struct ss_entry* entries, size_t capacity, const char* str, size_t len, unsigned long hash){
+	size_t i;
+
+	/* capacity is a power of 2, and the table is never full */
+	for (i = hash & (capacity - 1); entries[i].str; i = (i + 1) & (capacity - 1)){
+		if (entries[i].hash == hash && entries[i].len == len && memcmp(entries[i].str, str, len) == 0){
+			break;
+		}
+	}
+	return (struct ss_entry*)&entries[i];
+}
+
+static int ss_grow(struct string_set* ss){
+	struct ss_entry* entries;
+	size_t capacity = ss->capacity * 2;
+	size_t i;
+
+	entries = calloc(capacity, sizeof(*entries));
+	if (!entries){
+		log_enomem();
+		return -1;
+	}
+
+	for (i = 0; i < ss->capacity; ++i){
+		if (ss->entries[i].str){
+			*ss_lookup(entries, capacity, ss->entries[i].str, ss->entries[i].len, ss->entries[i].hash) = ss->entries[i];
+		}
+	}
+
+	free(ss->entries);
+	ss->entries = entries;
+	ss->capacity = capacity;
+	return 0;
+}
+
+struct string_set* ss_new(void){
+	struct string_set* ss;
+
+	ss = calloc(1, sizeof(*ss));
+	if (!ss){
+		log_enomem();
+		return NULL;
+	}
+
+	ss->capacity = SS_INITIAL_CAPACITY;
+	ss->entries = calloc(ss->capacity, sizeof(*ss->entries));
+	ss->strings = arena_new(0);
+	if (!ss->entries || !ss->strings){
+		log_enomem();
+		ss_free(ss);
+		return NULL;
+	}
+	return ss;
+}
+
+const char* ss_find_n(const struct string_set* ss, const char* str, size_t len){
+	return_ifnull(ss, NULL);
+	return_ifnull(str, NULL);
+
+	return ss_lookup(ss->entries, ss->capacity, str, len, ss_hash(str, len))->str;
+}
+
+const char* ss_find(const struct string_set* ss, const char* str){
+	return_ifnull(str, NULL);
+	return ss_find_n(ss, str, strlen(str));
+}
+
+const char* ss_intern_n(struct string_set* ss, const char* str, size_t len){
+	struct ss_entry* entry;
+	unsigned long hash;
+
+	return_ifnull(ss, NULL);
+	return_ifnull(str, NULL);
+
+	hash = ss_hash(str, len);
+	entry = ss_lookup(ss->entries, ss->capacity, str, len, hash);
+	if (entry->str){
+		return entry->str;
+	}
+
+	/* keep the load factor at or below 3/4 */
+	if ((ss->len + 1) * 4 > ss->capacity * 3){
+		if (ss_grow(ss) != 0){
+			log_error("Failed to grow string set");
+			return NULL;
+		}
+		entry = ss_lookup(ss->entries, ss->capacity, str, len, hash);
+	}
+
+	entry->str = arena_dup_n(ss->strings, str, len);
+	if (!entry->str){
+		log_error("Failed to intern string");
+		return NULL;
+	}
+	entry->len = len;
+	entry->hash = hash;
+	ss->len++;
+	return entry->str;
+}
+
+const char* ss_intern(struct string_set* ss, const char* str){
+	return_ifnull(str, NULL);
+	return ss_intern_n(ss, str, strlen(str));
+}
+
+size_t ss_len(const struct string_set* ss){
+	return_ifnull(ss, 0);
+	return ss->len;
+}
+
+void ss_free(struct string_set* ss){
+	if (!ss){
+		return;
+	}
+	free(ss->entries);
+	arena_free(ss->strings);
+	free(ss);
+}
@@ -0,0 +1,103 @@
+/** @file strings/stringset.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __STRINGSET_H
+#define __STRINGSET_H
+
+#include <stddef.h>
+
+#ifndef __GNUC__
+#define __attribute__(x)
+#endif
+
+/**
+ * @brief A hash set of strings.<br>
+ * Strings added to the set are interned: each distinct string is stored exactly once, and the stored copy stays at the same address until the set is freed.
+ */
+struct string_set;
+
+/**
+ * @brief Creates a blank string set.
+ *
+ * @return A new string set, or NULL on failure.<br>
+ * This set must be freed with ss_free() when no longer in use.
+ */
+struct string_set* ss_new(void) __attribute__((malloc));
+
+/**
+ * @brief Finds the first len characters of a string within a string set.<br>
+ * The string does not need to be null-terminated.
+ *
+ * @param ss The string set to search.
+ *
+ * @param str The string to find.
+ *
+ * @param len The length of the string.
+ *
+ * @return The interned copy of the string, or NULL if the set does not contain it.
+ */
+const char* ss_find_n(const struct string_set* ss, const char* str, size_t len);
+
+/**
+ * @brief Finds a string within a string set.
+ *
+ * @param ss The string set to search.
+ *
+ * @param str The string to find.
+ *
+ * @return The interned copy of the string, or NULL if the set does not contain it.
+ */
+const char* ss_find(const struct string_set* ss, const char* str);
+
+/**
+ * @brief Adds the first len characters of a string to a string set if it is not already within it.<br>
+ * The string does not need to be null-terminated.
+ *
+ * @param ss The string set to add to.
+ *
+ * @param str The string to add.
+ *
+ * @param len The length of the string.
+ *
+ * @return The interned copy of the string, or NULL on failure.<br>
+ * This pointer is valid until the string set is freed and must not be passed to free().
+ */
+const char* ss_intern_n(struct string_set* ss, const char* str, size_t len);
+
+/**
+ * @brief Adds a string to a string set if it is not already within it.
+ *
+ * @param ss The string set to add to.
+ *
+ * @param str The string to add.
+ *
+ * @return The interned copy of the string, or NULL on failure.<br>
+ * This pointer is valid until the string set is freed and must not be passed to free().
+ */
+const char* ss_intern(struct string_set* ss, const char* str);
+
+/**
+ * @brief Gets the number of strings within a string set.
+ *
+ * @param ss The string set.
+ *
+ * @return The number of strings within the set.
+ */
+size_t ss_len(const struct string_set* ss);
+
+/**
+ * @brief Frees all memory associated with a string set, including its interned strings.
+ *
+ * @param ss The string set to free.<br>
+ * This can be NULL, in which case this function does nothing.
+ *
+ * @return void
+ */
+void ss_free(struct string_set* ss);
+
+#endif
@@ -13,9 +13,21 @@
 #include "../strings/stringhelper.h"
 #include "../log.h"
 #include "../cloud/keys.h"
+#include "../crypt/crypt_easy.h"
+#include "../crypt/crypt_master.h"
+#include "../crypt/base16.h"
+#include "../compression/zip.h"
+#include <dirent.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 const struct unit_test backup_tests[] = {
-	MAKE_TEST_RU(test_backup)
+	MAKE_TEST_RU(test_backup),
+	MAKE_TEST(test_backup_dedup)
 };
 MAKE_PKG(backup_tests, backup_pkg);
 
@@ -59,3 +71,156 @@ cleanup:
 	free(path);
 	free(path_exclude);
 }
+
+#define DEDUP_LEN (200000)
+#define DEDUP_CHANGING_LEN (4 << 20)
+
+static struct options* dedup_options(const char* in, const char* out){
+	struct options* opt = options_new();
+
+	if (!opt){
+		return NULL;
+	}
+	sa_add(opt->directories, in);
+	free(opt->output_directory);
+	opt->output_directory = sh_dup(out);
+	opt->hash_algorithm = EVP_sha256();
+	opt->enc_algorithm = EVP_get_cipherbyname("AES-256-GCM");
+	opt->enc_password = sh_dup("hunter2");
+	opt->c_type = COMPRESSOR_GZIP;
+	opt->flags.bits.flag_convergent = 1;
+	return opt;
+}
+
+static int stat_stored(const char* out, const char* file, struct stat* st){
+	char* path = sh_concat_path(sh_concat_path(sh_dup(out), "files"), file);
+	int ret = path ? stat(path, st) : -1;
+
+	free(path);
+	return ret;
+}
+
+/* checks that every object decrypts and decompresses to the contents its name is the id of */
+static int check_objects(const char* out, const struct crypt_master* cm){
+	char* dir_objects = sh_concat_path(sh_dup(out), "objects");
+	DIR* dp = dir_objects ? opendir(dir_objects) : NULL;
+	struct dirent* dnt;
+	int ret = 0;
+
+	if (!dp){
+		free(dir_objects);
+		return -1;
+	}
+	while (ret == 0 && (dnt = readdir(dp)) != NULL){
+		char* dir_prefix;
+		DIR* dp_prefix;
+		struct dirent* dnt_prefix;
+
+		if (dnt->d_name[0] == '.'){
+			continue;
+		}
+		dir_prefix = sh_concat_path(sh_dup(dir_objects), dnt->d_name);
+		dp_prefix = dir_prefix ? opendir(dir_prefix) : NULL;
+		while (ret == 0 && dp_prefix && (dnt_prefix = readdir(dp_prefix)) != NULL){
+			unsigned char id[CRYPT_CONTENT_ID_LEN];
+			char* id_hex = NULL;
+			char* object;
+
+			if (dnt_prefix->d_name[0] == '.'){
+				continue;
+			}
+			object = sh_concat_path(sh_dup(dir_prefix), dnt_prefix->d_name);
+			if (!object ||
+					easy_decrypt_master(object, "dedup_check.gz", "AES-256-GCM", 0, cm, 0) != 0 ||
+					zip_decompress("dedup_check.gz", "dedup_check", COMPRESSOR_GZIP, 0) != 0 ||
+					crypt_master_content_id(cm, "dedup_check", id) != 0 ||
+					to_base16(id, sizeof(id), &id_hex) != 0 ||
+					strcmp(id_hex, dnt_prefix->d_name) != 0){
+				ret = -1;
+			}
+			free(id_hex);
+			free(object);
+		}
+		dp_prefix ? closedir(dp_prefix) : 0;
+		free(dir_prefix);
+	}
+	closedir(dp);
+	free(dir_objects);
+	remove("dedup_check.gz");
+	remove("dedup_check");
+	return ret;
+}
+
+void test_backup_dedup(enum TEST_STATUS* status){
+	char* in = sh_concat_path(sh_getcwd(), "dedup_in");
+	char* out = sh_concat_path(sh_getcwd(), "dedup_out");
+	char* file_a = sh_concat_path(sh_dup(in), "a.bin");
+	char* file_b = sh_concat_path(sh_dup(in), "b.bin");
+	char* file_c = sh_concat_path(sh_dup(in), "c.bin");
+	char* key_file = sh_concat_path(sh_dup(out), "key");
+	static unsigned char data[DEDUP_CHANGING_LEN];
+	struct options* opt = NULL;
+	struct crypt_master* cm = NULL;
+	struct stat st_a;
+	struct stat st_b;
+	char* cmd;
+	pid_t pid = -1;
+
+	TEST_ASSERT(in && out && file_a && file_b && file_c && key_file);
+	mkdir(in, 0755);
+	fill_sample_data(data, sizeof(data));
+	create_file(file_a, data, DEDUP_LEN);
+	create_file(file_b, data, DEDUP_LEN);
+
+	opt = dedup_options(in, out);
+	TEST_ASSERT(opt);
+	TEST_ASSERT(backup(opt) == 0);
+
+	/* the second copy is a link to the object the first one made */
+	TEST_ASSERT(stat_stored(out, file_a, &st_a) == 0 && stat_stored(out, file_b, &st_b) == 0);
+	TEST_ASSERT(st_a.st_ino == st_b.st_ino);
+	TEST_ASSERT(st_a.st_nlink == 3);
+
+	/* a file that keeps changing while it is read must not be stored under the id of contents it no longer has */
+	create_file(file_c, data, sizeof(data));
+	pid = fork();
+	TEST_ASSERT(pid >= 0);
+	if (pid == 0){
+		FILE* fp = fopen(file_c, "r+b");
+		unsigned i;
+
+		for (i = 0; fp; ++i){
+			rewind(fp);
+			fwrite(data + (i % 2) * 4096, 1, sizeof(data) - 4096, fp);
+			fflush(fp);
+		}
+		_exit(0);
+	}
+	TEST_ASSERT(backup(opt) == 0);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	pid = -1;
+
+	cm = crypt_master_new("hunter2", key_file);
+	TEST_ASSERT(cm);
+	TEST_ASSERT(check_objects(out, cm) == 0);
+
+cleanup:
+	if (pid > 0){
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+	}
+	crypt_master_free(cm);
+	options_free(opt);
+	cmd = sh_sprintf("rm -rf %s %s", in ? in : "dedup_in", out ? out : "dedup_out");
+	if (cmd){
+		system(cmd);
+		free(cmd);
+	}
+	free(in);
+	free(out);
+	free(file_a);
+	free(file_b);
+	free(file_c);
+	free(key_file);
+}
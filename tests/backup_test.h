@@ -12,6 +12,7 @@
 #include "test_framework.h"
 
 void test_backup(enum TEST_STATUS* status);
+void test_backup_dedup(enum TEST_STATUS* status);
 
 EXPORT_PKG(backup_pkg);
 #endif
@@ -0,0 +1,152 @@
+/** @file tests/blockcrc_test.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "blockcrc_test.h"
+#include "../blockcrc.h"
+#include "../scrub.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const struct unit_test blockcrc_tests[] = {
+	MAKE_TEST(test_block_crc),
+	MAKE_TEST(test_scrub_directory)
+};
+MAKE_PKG(blockcrc_tests, blockcrc_pkg);
+
+#define SAMPLE_BLOCK (1 << BLOCK_CRC_SHIFT)
+#define SAMPLE_LEN (3 * SAMPLE_BLOCK + 1000)
+
+static void flip_byte(const char* file, long offset){
+	FILE* fp = fopen(file, "r+b");
+	int c;
+
+	fseek(fp, offset, SEEK_SET);
+	c = fgetc(fp);
+	fseek(fp, offset, SEEK_SET);
+	fputc(c ^ 0xFF, fp);
+	fclose(fp);
+}
+
+void test_block_crc(enum TEST_STATUS* status){
+	const char* file = "blockcrc.bin";
+	const char* file_empty = "blockcrc_empty.bin";
+	const char* sidecar = "blockcrc.crc";
+	const char* sidecar_empty = "blockcrc_empty.crc";
+	static unsigned char data[SAMPLE_LEN + 1];
+	uint64_t* bad = NULL;
+	size_t n_bad;
+
+	fill_sample_data(data, sizeof(data));
+	create_file(file, data, SAMPLE_LEN);
+	create_file(file_empty, "", 0);
+
+	TEST_ASSERT(block_crc_create(file, sidecar) == 0);
+	TEST_ASSERT(block_crc_check(file, sidecar, &bad, &n_bad) == 0);
+	TEST_ASSERT(n_bad == 0);
+	TEST_ASSERT(bad == NULL);
+
+	TEST_ASSERT(block_crc_create(file_empty, sidecar_empty) == 0);
+	TEST_ASSERT(block_crc_check(file_empty, sidecar_empty, NULL, NULL) == 0);
+
+	/* a flipped byte is pinned down to its block */
+	flip_byte(file, 2 * SAMPLE_BLOCK + 17);
+	TEST_ASSERT(block_crc_check(file, sidecar, &bad, &n_bad) > 0);
+	TEST_ASSERT(n_bad == 1);
+	TEST_ASSERT(bad[0] == 2);
+	free(bad);
+	bad = NULL;
+
+	/* a truncated file is missing its last block, and a longer one has an extra block */
+	TEST_ASSERT(truncate(file, SAMPLE_LEN - 10) == 0);
+	TEST_ASSERT(block_crc_check(file, sidecar, &bad, &n_bad) > 0);
+	TEST_ASSERT(n_bad == 2);
+	TEST_ASSERT(bad[0] == 2 && bad[1] == 3);
+	free(bad);
+	bad = NULL;
+
+	create_file(file, data, SAMPLE_LEN + 1);
+	TEST_ASSERT(block_crc_check(file, sidecar, &bad, &n_bad) > 0);
+	TEST_ASSERT(n_bad == 1);
+	TEST_ASSERT(bad[0] == 4);
+	free(bad);
+	bad = NULL;
+
+	/* a damaged sidecar is an error, not a damaged file */
+	create_file(file, data, SAMPLE_LEN);
+	flip_byte(sidecar, 30);
+	TEST_ASSERT(block_crc_check(file, sidecar, &bad, &n_bad) < 0);
+	TEST_ASSERT(bad == NULL);
+
+cleanup:
+	free(bad);
+	remove(file);
+	remove(file_empty);
+	remove(sidecar);
+	remove(sidecar_empty);
+}
+
+void test_scrub_directory(enum TEST_STATUS* status){
+	const char* dirs[] = { "scrub_out", "scrub_out/files", "scrub_out/crc", "scrub_out/crc/files" };
+	const char* objects[] = { "scrub_out/files/good", "scrub_out/files/bad", "scrub_out/files/gone" };
+	const char* sidecars[] = { "scrub_out/crc/files/good", "scrub_out/crc/files/bad", "scrub_out/crc/files/gone" };
+	const char* report_file = "scrub_report.txt";
+	static unsigned char data[SAMPLE_LEN];
+	char line[256];
+	FILE* report = NULL;
+	int n_corrupt = 0;
+	int n_missing = 0;
+	size_t i;
+
+	fill_sample_data(data, sizeof(data));
+	for (i = 0; i < sizeof(dirs) / sizeof(dirs[0]); ++i){
+		mkdir(dirs[i], 0755);
+	}
+	for (i = 0; i < sizeof(objects) / sizeof(objects[0]); ++i){
+		create_file(objects[i], data, sizeof(data));
+		TEST_ASSERT(block_crc_create(objects[i], sidecars[i]) == 0);
+	}
+
+	report = fopen(report_file, "w+");
+	TEST_ASSERT(report);
+	TEST_ASSERT(scrub_directory("scrub_out", report) == 0);
+
+	flip_byte(objects[1], SAMPLE_BLOCK + 5);
+	remove(objects[2]);
+	rewind(report);
+	TEST_ASSERT(scrub_directory("scrub_out/", report) > 0);
+
+	rewind(report);
+	while (fgets(line, sizeof(line), report)){
+		if (!strncmp(line, "CORRUPT\t", 8)){
+			TEST_ASSERT(strstr(line, "scrub_out/files/bad\t1\t") != NULL);
+			n_corrupt++;
+		}
+		else if (!strncmp(line, "MISSING\t", 8)){
+			TEST_ASSERT(strstr(line, "scrub_out/files/gone") != NULL);
+			n_missing++;
+		}
+	}
+	TEST_ASSERT(n_corrupt == 1);
+	TEST_ASSERT(n_missing == 1);
+
+	/* nothing to scrub */
+	TEST_ASSERT(scrub_directory("scrub_nonexistent", report) < 0);
+
+cleanup:
+	report ? fclose(report) : 0;
+	remove(report_file);
+	for (i = 0; i < sizeof(objects) / sizeof(objects[0]); ++i){
+		remove(objects[i]);
+		remove(sidecars[i]);
+	}
+	for (i = sizeof(dirs) / sizeof(dirs[0]); i > 0; --i){
+		rmdir(dirs[i - 1]);
+	}
+}
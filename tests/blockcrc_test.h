@@ -0,0 +1,18 @@
+/** @file tests/blockcrc_test.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __TEST_BLOCKCRC_H
+#define __TEST_BLOCKCRC_H
+
+#include "test_framework.h"
+
+void test_block_crc(enum TEST_STATUS* status);
+void test_scrub_directory(enum TEST_STATUS* status);
+
+EXPORT_PKG(blockcrc_pkg);
+#endif
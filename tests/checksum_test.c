@@ -10,6 +10,7 @@
 #include "../checksum.h"
 #include "../checksumsort.h"
 #include "../log.h"
+#include "../crypt/base16.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -23,7 +24,10 @@ const struct unit_test checksum_tests[] = {
 	MAKE_TEST(test_checksum),
 	MAKE_TEST(test_sort_checksum_file),
 	MAKE_TEST(test_search_for_checksum),
-	MAKE_TEST(test_create_removed_list)
+	MAKE_TEST(test_create_removed_list),
+	MAKE_TEST(test_add_checksum_to_file_ex),
+	MAKE_TEST(test_checksum_batch),
+	MAKE_TEST(test_checksum_stream)
 };
 MAKE_PKG(checksum_tests, checksum_pkg);
 
@@ -83,7 +87,7 @@ void test_sort_checksum_file(enum TEST_STATUS* status){
 	 * this is so we can be sure that sort_checksum_file() actually did something */
 	for (i = 1; i < files_len; i += 2){
 		int res;
-		res = add_checksum_to_file(files[i], EVP_sha1(), fp1, NULL);
+		res = add_checksum_to_file(files[i], EVP_sha1(), fp1, NULL, NULL);
 		TEST_ASSERT(res >= 0);
 		if (res == 1){
 			printf("Old element: %s\n", files[i]);
@@ -91,7 +95,7 @@ void test_sort_checksum_file(enum TEST_STATUS* status){
 	}
 	for (i = 0; i < files_len; i += 2){
 		int res;
-		res = add_checksum_to_file(files[i], EVP_sha1(), fp1, NULL);
+		res = add_checksum_to_file(files[i], EVP_sha1(), fp1, NULL, NULL);
 		TEST_ASSERT(res >= 0);
 		if (res == 1){
 			printf("Old element: %s\n", files[i]);
@@ -138,7 +142,7 @@ void test_sort_checksum_file(enum TEST_STATUS* status){
 	/* check if add_checksum_to_file() skips the unchanged files like it should */
 	for (i = 0; i < files_len; ++i){
 		int res;
-		res = add_checksum_to_file(files[i], EVP_sha1(), fp2, fp1);
+		res = add_checksum_to_file(files[i], EVP_sha1(), fp2, fp1, NULL);
 		/* less than zero means an error occured */
 		TEST_ASSERT(res >= 0);
 		/* if file was unchanged */
@@ -187,7 +191,7 @@ void test_search_for_checksum(enum TEST_STATUS* status){
 	 * this is so we can be sure that sort_checksum_file() actually did something */
 	for (i = 1; i < files_len; i += 2){
 		int res;
-		res = add_checksum_to_file(files[i], EVP_sha1(), fp1, NULL);
+		res = add_checksum_to_file(files[i], EVP_sha1(), fp1, NULL, NULL);
 		TEST_ASSERT(res >= 0);
 		if (res == 1){
 			printf("Old element: %s\n", files[i]);
@@ -195,7 +199,7 @@ void test_search_for_checksum(enum TEST_STATUS* status){
 	}
 	for (i = 0; i < files_len; i += 2){
 		int res;
-		res = add_checksum_to_file(files[i], EVP_sha1(), fp1, NULL);
+		res = add_checksum_to_file(files[i], EVP_sha1(), fp1, NULL, NULL);
 		TEST_ASSERT(res >= 0);
 		if (res == 1){
 			printf("Old element: %s\n", files[i]);
@@ -204,7 +208,7 @@ void test_search_for_checksum(enum TEST_STATUS* status){
 	/* add our file to search for right at the end,
 	 * since binsearch starts at the middle, we don't want to give it an unfair advantage */
 	create_file(sample_file, sample_data, sizeof(sample_data));
-	add_checksum_to_file(sample_file, EVP_sha1(), fp1, NULL);
+	add_checksum_to_file(sample_file, EVP_sha1(), fp1, NULL, NULL);
 
 	TEST_ASSERT_FREE(fp1, fclose);
 
@@ -269,7 +273,7 @@ void test_create_removed_list(enum TEST_STATUS* status){
 	/* do the same shuffle as above */
 	for (i = 1; i < files_len; i += 2){
 		int res;
-		res = add_checksum_to_file(files[i], EVP_sha1(), fp1, NULL);
+		res = add_checksum_to_file(files[i], EVP_sha1(), fp1, NULL, NULL);
 		TEST_ASSERT(res >= 0);
 		if (res == 1){
 			printf("Old element: %s\n", files[i]);
@@ -277,7 +281,7 @@ void test_create_removed_list(enum TEST_STATUS* status){
 	}
 	for (i = 0; i < files_len; i += 2){
 		int res;
-		res = add_checksum_to_file(files[i], EVP_sha1(), fp1, NULL);
+		res = add_checksum_to_file(files[i], EVP_sha1(), fp1, NULL, NULL);
 		TEST_ASSERT(res >= 0);
 		if (res == 1){
 			printf("Old element: %s\n", files[i]);
@@ -311,3 +315,271 @@ cleanup:
 	remove(fp1str);
 	remove(fp2str);
 }
+
+static int append_checksum(const char* file, const char* out, const char* prev, char** out_hash, unsigned long* out_offset){
+	FILE* fp_out;
+	FILE* fp_prev = NULL;
+	int res;
+
+	fp_out = fopen(out, "wb");
+	if (!fp_out){
+		return -1;
+	}
+	if (prev && (fp_prev = fopen(prev, "rb")) == NULL){
+		fclose(fp_out);
+		return -1;
+	}
+
+	res = add_checksum_to_file_ex(file, EVP_sha256(), fp_out, fp_prev, out_hash, out_offset);
+
+	fclose(fp_out);
+	fp_prev ? fclose(fp_prev) : 0;
+	return res;
+}
+
+void test_add_checksum_to_file_ex(enum TEST_STATUS* status){
+	const char* file = "append.log";
+	const char* checksums1 = "checksum1.txt";
+	const char* checksums2 = "checksum2.txt";
+	const char* checksums3 = "checksum3.txt";
+	unsigned char* data = NULL;
+	size_t data_len = CHECKSUM_APPEND_MIN_SIZE + 500000;
+	char* hash_appended = NULL;
+	char* hash_full = NULL;
+	char* hash_plain = NULL;
+	unsigned long offset;
+	FILE* fp = NULL;
+
+	/* +1 so the file can be rewritten one byte longer */
+	data = malloc(data_len + 1);
+	TEST_ASSERT(data);
+	fill_sample_data(data, data_len + 1);
+	create_file(file, data, data_len);
+
+	TEST_ASSERT(append_checksum(file, checksums1, NULL, NULL, &offset) == 0);
+
+	/* unchanged */
+	TEST_ASSERT(append_checksum(file, checksums2, checksums1, NULL, &offset) == 1);
+
+	/* only the appended data needs to be read */
+	fp = fopen(file, "ab");
+	TEST_ASSERT(fp);
+	TEST_ASSERT(fwrite(data, 1, 12345, fp) == 12345);
+	TEST_ASSERT_FREE(fp, fclose);
+
+	TEST_ASSERT(append_checksum(file, checksums2, checksums1, &hash_appended, &offset) == CHECKSUM_APPENDED);
+	TEST_ASSERT(offset == data_len);
+
+	/* the result does not depend on the previous list, and starts with the file's standard digest */
+	TEST_ASSERT(append_checksum(file, checksums3, NULL, &hash_full, &offset) == 0);
+	TEST_ASSERT(strcmp(hash_appended, hash_full) == 0);
+	TEST_ASSERT(checksum_bytestring(file, EVP_sha256(), &hash_plain) == 0);
+	TEST_ASSERT(strncmp(hash_full, hash_plain, strlen(hash_plain)) == 0);
+	TEST_ASSERT(hash_full[strlen(hash_plain)] == ':');
+
+	/* changing the start of the file is not an append */
+	data[0] ^= 0xFF;
+	create_file(file, data, data_len + 1);
+	TEST_ASSERT(append_checksum(file, checksums3, checksums2, NULL, &offset) == 0);
+	TEST_ASSERT(offset == 0);
+
+	/* neither is changing the middle of the file */
+	create_file(file, data, data_len);
+	TEST_ASSERT(append_checksum(file, checksums1, NULL, NULL, &offset) == 0);
+	data[data_len / 2] ^= 0xFF;
+	create_file(file, data, data_len + 1);
+	TEST_ASSERT(append_checksum(file, checksums2, checksums1, NULL, &offset) == 0);
+	TEST_ASSERT(offset == 0);
+
+	/* a previous size that ends exactly on a read */
+	create_file(file, data, CHECKSUM_APPEND_MIN_SIZE);
+	TEST_ASSERT(append_checksum(file, checksums1, NULL, NULL, &offset) == 0);
+	create_file(file, data, CHECKSUM_APPEND_MIN_SIZE + 1);
+	TEST_ASSERT(append_checksum(file, checksums2, checksums1, NULL, &offset) == CHECKSUM_APPENDED);
+	TEST_ASSERT(offset == CHECKSUM_APPEND_MIN_SIZE);
+
+	/* a plain digest from an older list still counts as unchanged */
+	fp = fopen(checksums1, "wb");
+	TEST_ASSERT(fp);
+	TEST_ASSERT(add_checksum_to_file(file, EVP_sha256(), fp, NULL, NULL) == 0);
+	TEST_ASSERT_FREE(fp, fclose);
+	TEST_ASSERT(append_checksum(file, checksums2, checksums1, NULL, &offset) == 1);
+	TEST_ASSERT(append_checksum(file, checksums3, checksums2, NULL, &offset) == 1);
+
+	/* small files keep a plain digest */
+	create_file(file, sample_data, sizeof(sample_data));
+	TEST_ASSERT(append_checksum(file, checksums3, NULL, NULL, &offset) == 0);
+	TEST_ASSERT(offset == 0);
+
+cleanup:
+	fp ? fclose(fp) : 0;
+	free(data);
+	free(hash_appended);
+	free(hash_full);
+	free(hash_plain);
+	remove(file);
+	remove(checksums1);
+	remove(checksums2);
+	remove(checksums3);
+}
+
+void test_checksum_batch(enum TEST_STATUS* status){
+	const char* files[] = { "batch_0.txt", "batch_1.txt", "batch_big.txt", "batch_missing.txt", "batch_empty.txt" };
+	const char* list_batch = "batch_list.txt";
+	const char* list_single = "single_list.txt";
+	const EVP_MD* algorithms[3];
+	struct checksum_batch* cb = NULL;
+	static unsigned char data[CHECKSUM_BATCH_FILE_SIZE + 1];
+	char* hash_batch = NULL;
+	char* hash_single = NULL;
+	FILE* fp_batch = NULL;
+	FILE* fp_single = NULL;
+	size_t i;
+	size_t j;
+
+	algorithms[0] = NULL;
+	algorithms[1] = EVP_sha256();
+	algorithms[2] = EVP_sha512();
+
+	fill_sample_data(data, sizeof(data));
+	create_file(files[0], data, 1);
+	create_file(files[1], data, CHECKSUM_BATCH_FILE_SIZE - 1);
+	create_file(files[2], data, sizeof(data));
+	remove(files[3]);
+	create_file(files[4], data, 0);
+
+	for (i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); ++i){
+		TEST_ASSERT((cb = checksum_batch_new(algorithms[i], i)) != NULL);
+		TEST_ASSERT(checksum_batch_run(cb, files, sizeof(files) / sizeof(files[0])) == 0);
+
+		/* only the small files that exist are hashed */
+		TEST_ASSERT(checksum_batch_hashed(cb, 0));
+		TEST_ASSERT(checksum_batch_hashed(cb, 1));
+		TEST_ASSERT(!checksum_batch_hashed(cb, 2));
+		TEST_ASSERT(!checksum_batch_hashed(cb, 3));
+		TEST_ASSERT(checksum_batch_hashed(cb, 4));
+		TEST_ASSERT(!checksum_batch_hashed(cb, 5));
+
+		/* and produce exactly what hashing them one at a time does */
+		TEST_ASSERT((fp_batch = fopen(list_batch, "wb")) != NULL);
+		TEST_ASSERT((fp_single = fopen(list_single, "wb")) != NULL);
+		for (j = 0; j < sizeof(files) / sizeof(files[0]); ++j){
+			if (!checksum_batch_hashed(cb, j)){
+				continue;
+			}
+			TEST_ASSERT(add_checksum_from_batch(cb, j, fp_batch, NULL, &hash_batch) == 0);
+			TEST_ASSERT(add_checksum_to_file(files[j], algorithms[i], fp_single, NULL, &hash_single) == 0);
+			TEST_ASSERT(strcmp(hash_batch, hash_single) == 0);
+			free(hash_batch);
+			free(hash_single);
+			hash_batch = NULL;
+			hash_single = NULL;
+		}
+		fclose(fp_batch);
+		fclose(fp_single);
+		fp_batch = NULL;
+		fp_single = NULL;
+		TEST_ASSERT(memcmp_file_file(list_batch, list_single) == 0);
+
+		checksum_batch_free(cb);
+		cb = NULL;
+	}
+
+cleanup:
+	checksum_batch_free(cb);
+	fp_batch ? fclose(fp_batch) : 0;
+	fp_single ? fclose(fp_single) : 0;
+	free(hash_batch);
+	free(hash_single);
+	for (i = 0; i < sizeof(files) / sizeof(files[0]); ++i){
+		remove(files[i]);
+	}
+	remove(list_batch);
+	remove(list_single);
+}
+
+static int stream_matches(const char* checksum, const EVP_MD* algorithm, const unsigned char* data, size_t len, size_t piece){
+	struct checksum_stream* cs;
+	size_t pos;
+	int res;
+
+	cs = checksum_stream_new(checksum, algorithm);
+	if (!cs){
+		return -1;
+	}
+	for (pos = 0; pos < len; pos += piece){
+		if (checksum_stream_update(cs, data + pos, len - pos < piece ? len - pos : piece) != 0){
+			checksum_stream_free(cs);
+			return -1;
+		}
+	}
+	res = checksum_stream_check(cs);
+	checksum_stream_free(cs);
+	return res;
+}
+
+void test_checksum_stream(enum TEST_STATUS* status){
+	const char* file = "stream.log";
+	const char* checksums = "checksum_stream.txt";
+	const size_t lens[] = { CHECKSUM_APPEND_MIN_SIZE, CHECKSUM_APPEND_MIN_SIZE + 500000 };
+	unsigned char* data = NULL;
+	unsigned char leaf[EVP_MAX_MD_SIZE];
+	unsigned char prefix = 0x00;
+	char* root_hex = NULL;
+	char* tree = NULL;
+	char* hash = NULL;
+	unsigned long offset;
+	EVP_MD_CTX* ctx = NULL;
+	size_t i;
+
+	/* a plain digest */
+	TEST_ASSERT(stream_matches(sample_sha1_str, NULL, sample_data, sizeof(sample_data), 1) == 0);
+	TEST_ASSERT(stream_matches(sample_sha1_str, NULL, sample_data, sizeof(sample_data) - 1, 1) > 0);
+
+	/* a digest with a size, fed in pieces */
+	data = malloc(lens[1] + 1);
+	TEST_ASSERT(data);
+	fill_sample_data(data, lens[1] + 1);
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); ++i){
+		create_file(file, data, lens[i]);
+		TEST_ASSERT(append_checksum(file, checksums, NULL, &hash, &offset) == 0);
+		TEST_ASSERT(strchr(hash, ':') != NULL);
+
+		TEST_ASSERT(stream_matches(hash, EVP_sha256(), data, lens[i], 100000) == 0);
+		TEST_ASSERT(stream_matches(hash, EVP_sha256(), data, lens[i] - 1, 100000) > 0);
+		TEST_ASSERT(stream_matches(hash, EVP_sha256(), data, lens[i] + 1, 100000) > 0);
+		data[lens[i] / 2] ^= 0xFF;
+		TEST_ASSERT(stream_matches(hash, EVP_sha256(), data, lens[i], 100000) > 0);
+		data[lens[i] / 2] ^= 0xFF;
+
+		free(hash);
+		hash = NULL;
+	}
+
+	/* a tree hash that fits in one leaf is that leaf */
+	ctx = EVP_MD_CTX_create();
+	TEST_ASSERT(ctx);
+	TEST_ASSERT(EVP_DigestInit_ex(ctx, EVP_sha1(), NULL) == 1);
+	TEST_ASSERT(EVP_DigestUpdate(ctx, &prefix, 1) == 1);
+	TEST_ASSERT(EVP_DigestUpdate(ctx, sample_data, sizeof(sample_data)) == 1);
+	TEST_ASSERT(EVP_DigestFinal_ex(ctx, leaf, NULL) == 1);
+	TEST_ASSERT(to_base16(leaf, 20, &root_hex) == 0);
+	tree = malloc(strlen(root_hex) + sizeof("tree:4:"));
+	TEST_ASSERT(tree);
+	sprintf(tree, "tree:4:%s", root_hex);
+	TEST_ASSERT(stream_matches(tree, NULL, sample_data, sizeof(sample_data), 3) == 0);
+	TEST_ASSERT(stream_matches(tree, NULL, sample_data, sizeof(sample_data) - 1, 3) > 0);
+
+	/* checksums that cannot be parsed */
+	TEST_ASSERT(checksum_stream_new("not a checksum", NULL) == NULL);
+	TEST_ASSERT(checksum_stream_new(sample_sha1_str, EVP_sha256()) == NULL);
+
+cleanup:
+	ctx ? EVP_MD_CTX_destroy(ctx) : (void)0;
+	free(data);
+	free(hash);
+	free(root_hex);
+	free(tree);
+	remove(file);
+	remove(checksums);
+}
@@ -16,6 +16,9 @@ void test_checksum(enum TEST_STATUS* status);
 void test_sort_checksum_file(enum TEST_STATUS* status);
 void test_search_for_checksum(enum TEST_STATUS* status);
 void test_create_removed_list(enum TEST_STATUS* status);
+void test_add_checksum_to_file_ex(enum TEST_STATUS* status);
+void test_checksum_batch(enum TEST_STATUS* status);
+void test_checksum_stream(enum TEST_STATUS* status);
 
 EXPORT_PKG(checksum_pkg);
 #endif
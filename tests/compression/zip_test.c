@@ -11,16 +11,33 @@
 #include "../../log.h"
 #include "../../compression/zip.h"
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 const struct unit_test compression_zip_tests[] = {
 	MAKE_TEST(test_compress_gzip),
 	MAKE_TEST(test_compress_bzip2),
 	MAKE_TEST(test_compress_xz),
 	MAKE_TEST(test_compress_lz4),
+	MAKE_TEST(test_compress_zstd),
 	MAKE_TEST(test_decompress_gzip),
 	MAKE_TEST(test_decompress_bzip2),
 	MAKE_TEST(test_decompress_xz),
-	MAKE_TEST(test_decompress_lz4)
+	MAKE_TEST(test_decompress_lz4),
+	MAKE_TEST(test_decompress_zstd),
+	MAKE_TEST(test_zstd_options),
+	MAKE_TEST(test_xz_threads),
+	MAKE_TEST(test_gzip_threads),
+	MAKE_TEST(test_lz4_threads),
+	MAKE_TEST(test_bzip2_threads),
+	MAKE_TEST(test_compress_tail),
+	MAKE_TEST(test_compress_fp),
+	MAKE_TEST(test_zip_reuse),
+	MAKE_TEST(test_zip_stream),
+	MAKE_TEST(test_zip_buffer),
+	MAKE_TEST(test_zstd_dict),
+	MAKE_TEST(test_zip_seekable),
+	MAKE_TEST(test_zip_adapt)
 };
 MAKE_PKG(compression_zip_tests, compression_zip_pkg);
 
@@ -104,6 +121,26 @@ cleanup:
 	remove(arch);
 }
 
+void test_compress_zstd(enum TEST_STATUS* status){
+	const char* file = "file.txt";
+	const char* arch = "file.txt.zst";
+	unsigned char data[1337];
+	const char* system_cmd = "zstd -d --rm file.txt.zst";
+
+	fill_sample_data(data, sizeof(data));
+	create_file(file, data, sizeof(data));
+	TEST_ASSERT(zip_compress(file, arch, COMPRESSOR_ZSTD, 3, ZSTD_NORMAL) == 0);
+
+	remove(file);
+	printf("%s\n", system_cmd);
+	system(system_cmd);
+	TEST_ASSERT(memcmp_file_data(file, data, sizeof(data)) == 0);
+
+cleanup:
+	remove(file);
+	remove(arch);
+}
+
 void test_decompress_gzip(enum TEST_STATUS* status){
 	const char* file = "file.txt";
 	const char* arch = "file.txt.gz";
@@ -183,3 +220,593 @@ cleanup:
 	remove(file);
 	remove(arch);
 }
+
+void test_decompress_zstd(enum TEST_STATUS* status){
+	const char* file = "file.txt";
+	const char* arch = "file.txt.zst";
+	unsigned char data[1337];
+	const char* system_cmd = "zstd -3 --rm file.txt";
+
+	fill_sample_data(data, sizeof(data));
+	create_file(file, data, sizeof(data));
+	printf("%s\n", system_cmd);
+	system(system_cmd);
+
+	remove(file);
+	TEST_ASSERT(zip_decompress(arch, file, COMPRESSOR_ZSTD, ZSTD_NORMAL) == 0);
+	TEST_ASSERT(memcmp_file_data(file, data, sizeof(data)) == 0);
+
+cleanup:
+	remove(file);
+	remove(arch);
+}
+
+void test_zstd_options(enum TEST_STATUS* status){
+	const char* file = "file.txt";
+	const char* arch = "file.txt.zst";
+	const char* out = "file_out.txt";
+	/* larger than BUFFER_LEN so the stream needs several passes */
+	unsigned char data[1 << 17];
+	const int levels[] = { 0, 1, 19, 22, 99 };
+	size_t i;
+
+	fill_sample_data(data, sizeof(data));
+	create_file(file, data, sizeof(data));
+
+	for (i = 0; i < sizeof(levels) / sizeof(levels[0]); ++i){
+		TEST_ASSERT(zip_compress(file, arch, COMPRESSOR_ZSTD, levels[i], ZSTD_NORMAL) == 0);
+		TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_ZSTD, ZSTD_NORMAL) == 0);
+		TEST_ASSERT(memcmp_file_data(out, data, sizeof(data)) == 0);
+	}
+
+	TEST_ASSERT(zip_compress(file, arch, COMPRESSOR_ZSTD, 9, ZSTD_LONG | ZIP_THREADS(2)) == 0);
+	TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_ZSTD, ZSTD_NORMAL) == 0);
+	TEST_ASSERT(memcmp_file_data(out, data, sizeof(data)) == 0);
+
+	/* a truncated frame must not decompress successfully */
+	TEST_ASSERT(truncate(arch, 16) == 0);
+	TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_ZSTD, ZSTD_NORMAL) != 0);
+
+cleanup:
+	remove(file);
+	remove(arch);
+	remove(out);
+}
+
+void test_xz_threads(enum TEST_STATUS* status){
+	const char* file = "file.txt";
+	const char* arch = "file.txt.xz";
+	const char* out = "file_out.txt";
+	unsigned char data[1 << 17];
+	const char* system_cmd = "xz -d file.txt.xz";
+
+	fill_sample_data(data, sizeof(data));
+	create_file(file, data, sizeof(data));
+
+	/* 32KB blocks so each thread gets several of them */
+	TEST_ASSERT(zip_compress(file, arch, COMPRESSOR_XZ, 3, XZ_NORMAL | ZIP_THREADS(2) | ZIP_BLOCK_SHIFT(15)) == 0);
+	TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_XZ, ZIP_THREADS(2)) == 0);
+	TEST_ASSERT(memcmp_file_data(out, data, sizeof(data)) == 0);
+
+	/* the output must still be readable by plain xz */
+	remove(file);
+	printf("%s\n", system_cmd);
+	system(system_cmd);
+	TEST_ASSERT(memcmp_file_data(file, data, sizeof(data)) == 0);
+
+cleanup:
+	remove(file);
+	remove(arch);
+	remove(out);
+}
+
+void test_gzip_threads(enum TEST_STATUS* status){
+	const char* file = "file.txt";
+	const char* arch = "file.txt.gz";
+	const char* out = "file_out.txt";
+	unsigned char data[1 << 17];
+	const char* system_cmd = "gzip -t file.txt.gz";
+	const size_t sizes[] = { 0, 1337, 1 << 12, sizeof(data) };
+	size_t i;
+
+	fill_sample_data(data, sizeof(data));
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i){
+		create_file(file, data, sizes[i]);
+
+		/* 4KB blocks so the 32KB dictionary spans several of them */
+		TEST_ASSERT(zip_compress(file, arch, COMPRESSOR_GZIP, 6, GZIP_NORMAL | ZIP_THREADS(3) | ZIP_BLOCK_SHIFT(12)) == 0);
+		printf("%s\n", system_cmd);
+		TEST_ASSERT(system(system_cmd) == 0);
+		TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_GZIP, GZIP_NORMAL) == 0);
+		TEST_ASSERT(memcmp_file_data(out, data, sizes[i]) == 0);
+	}
+
+cleanup:
+	remove(file);
+	remove(arch);
+	remove(out);
+}
+
+void test_lz4_threads(enum TEST_STATUS* status){
+	const char* file = "file.txt";
+	const char* arch = "file.txt.lz4";
+	const char* out = "file_out.txt";
+	/* several 1MB blocks and a partial one */
+	const size_t len = (5 << 20) + 1337;
+	unsigned char* data = NULL;
+	FILE* fp = NULL;
+	long pos;
+	int c;
+
+	data = malloc(len);
+	TEST_ASSERT(data);
+	fill_sample_data(data, len);
+	create_file(file, data, len);
+
+	TEST_ASSERT(zip_compress(file, arch, COMPRESSOR_LZ4, 3, LZ4_BLOCK_CHECKSUM | ZIP_THREADS(3)) == 0);
+	TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_LZ4, ZIP_THREADS(3)) == 0);
+	TEST_ASSERT(memcmp_file_data(out, data, len) == 0);
+
+	/* independent blocks are still a standard frame */
+	TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_LZ4, LZ4_NORMAL) == 0);
+	TEST_ASSERT(memcmp_file_data(out, data, len) == 0);
+
+	/* a corrupted block has to be caught by its checksum */
+	fp = fopen(arch, "r+b");
+	TEST_ASSERT(fp);
+	TEST_ASSERT(fseek(fp, 0, SEEK_END) == 0);
+	pos = ftell(fp) / 2;
+	TEST_ASSERT(fseek(fp, pos, SEEK_SET) == 0);
+	c = fgetc(fp);
+	TEST_ASSERT(fseek(fp, pos, SEEK_SET) == 0);
+	fputc(c ^ 0xFF, fp);
+	fclose(fp);
+	fp = NULL;
+	TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_LZ4, ZIP_THREADS(3)) != 0);
+
+	/* empty input */
+	create_file(file, data, 0);
+	TEST_ASSERT(zip_compress(file, arch, COMPRESSOR_LZ4, 0, LZ4_BLOCK_4MB | ZIP_THREADS(2)) == 0);
+	TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_LZ4, ZIP_THREADS(2)) == 0);
+	TEST_ASSERT(memcmp_file_data(out, data, 0) == 0);
+
+cleanup:
+	fp ? fclose(fp) : 0;
+	free(data);
+	remove(file);
+	remove(arch);
+	remove(out);
+}
+
+void test_bzip2_threads(enum TEST_STATUS* status){
+	const char* file = "file.txt";
+	const char* arch = "file.txt.bz2";
+	const char* out = "file_out.txt";
+	/* several 100KB streams at level 1 */
+	const size_t len = 456789;
+	unsigned char* data = NULL;
+	const char* system_cmd = "bzip2 -t file.txt.bz2";
+
+	data = malloc(len);
+	TEST_ASSERT(data);
+	fill_sample_data(data, len);
+	create_file(file, data, len);
+
+	TEST_ASSERT(zip_compress(file, arch, COMPRESSOR_BZIP2, 1, BZIP2_NORMAL | ZIP_THREADS(3)) == 0);
+	printf("%s\n", system_cmd);
+	TEST_ASSERT(system(system_cmd) == 0);
+
+	TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_BZIP2, ZIP_THREADS(3)) == 0);
+	TEST_ASSERT(memcmp_file_data(out, data, len) == 0);
+
+	/* the sequential decompressor has to read all of the streams too */
+	TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_BZIP2, BZIP2_NORMAL) == 0);
+	TEST_ASSERT(memcmp_file_data(out, data, len) == 0);
+
+	/* a single stream decompresses in parallel as one unit */
+	TEST_ASSERT(zip_compress(file, arch, COMPRESSOR_BZIP2, 1, BZIP2_NORMAL) == 0);
+	TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_BZIP2, ZIP_THREADS(3)) == 0);
+	TEST_ASSERT(memcmp_file_data(out, data, len) == 0);
+
+	/* empty input */
+	create_file(file, data, 0);
+	TEST_ASSERT(zip_compress(file, arch, COMPRESSOR_BZIP2, 9, BZIP2_NORMAL | ZIP_THREADS(2)) == 0);
+	TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_BZIP2, ZIP_THREADS(2)) == 0);
+	TEST_ASSERT(memcmp_file_data(out, data, 0) == 0);
+
+cleanup:
+	free(data);
+	remove(file);
+	remove(arch);
+	remove(out);
+}
+
+void test_compress_tail(enum TEST_STATUS* status){
+	const char* file = "file.txt";
+	const char* arch = "file.txt.gz";
+	const char* out = "file_out.txt";
+	unsigned char data[1337];
+
+	fill_sample_data(data, sizeof(data));
+	create_file(file, data, sizeof(data));
+
+	TEST_ASSERT(zip_compress_tail(file, arch, 1000, COMPRESSOR_GZIP, 3, GZIP_NORMAL) == 0);
+	TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_GZIP, GZIP_NORMAL) == 0);
+	TEST_ASSERT(memcmp_file_data(out, data + 1000, sizeof(data) - 1000) == 0);
+
+	TEST_ASSERT(zip_compress_tail(file, arch, 1000, COMPRESSOR_NONE, 0, 0) == 0);
+	TEST_ASSERT(memcmp_file_data(arch, data + 1000, sizeof(data) - 1000) == 0);
+
+cleanup:
+	remove(file);
+	remove(arch);
+	remove(out);
+}
+
+void test_compress_fp(enum TEST_STATUS* status){
+	const enum compressor compressors[] = { COMPRESSOR_GZIP, COMPRESSOR_BZIP2, COMPRESSOR_XZ, COMPRESSOR_LZ4, COMPRESSOR_ZSTD, COMPRESSOR_NONE };
+	const char* file = "file.txt";
+	const char* arch = "file.txt.z";
+	const char* out = "file_out.txt";
+	unsigned char data[1337];
+	FILE* fp = NULL;
+	size_t i;
+
+	fill_sample_data(data, sizeof(data));
+	create_file(file, data, sizeof(data));
+
+	for (i = 0; i < sizeof(compressors) / sizeof(compressors[0]); ++i){
+		/* the compressed data lands after whatever was already written to the stream */
+		TEST_ASSERT((fp = fopen(arch, "wb")) != NULL);
+		TEST_ASSERT(zip_compress_fp(file, fp, 100, compressors[i], 0, ZIP_THREADS(i % 2 ? 2 : 0)) == 0);
+		TEST_ASSERT(fclose(fp) == 0);
+		fp = NULL;
+
+		TEST_ASSERT(zip_decompress(arch, out, compressors[i], 0) == 0);
+		TEST_ASSERT(memcmp_file_data(out, data + 100, sizeof(data) - 100) == 0);
+	}
+
+	/* seekable containers are written in order as well */
+	TEST_ASSERT((fp = fopen(arch, "wb")) != NULL);
+	TEST_ASSERT(zip_compress_fp(file, fp, 0, COMPRESSOR_ZSTD, 0, ZIP_SEEKABLE | ZIP_BLOCK_SHIFT(9)) == 0);
+	TEST_ASSERT(fclose(fp) == 0);
+	fp = NULL;
+	TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_ZSTD, ZIP_SEEKABLE) == 0);
+	TEST_ASSERT(memcmp_file_data(out, data, sizeof(data)) == 0);
+
+cleanup:
+	fp ? fclose(fp) : 0;
+	remove(file);
+	remove(arch);
+	remove(out);
+}
+
+void test_zip_reuse(enum TEST_STATUS* status){
+	const char* file = "file.txt";
+	const char* arch = "file.txt.z";
+	const char* out = "file_out.txt";
+	const enum compressor types[] = { COMPRESSOR_GZIP, COMPRESSOR_XZ, COMPRESSOR_ZSTD };
+	unsigned char data[4096];
+	size_t i;
+	int j;
+
+	fill_sample_data(data, sizeof(data));
+
+	/* the second round runs on streams left over from the first, so stale state would show up as a mismatch */
+	for (i = 0; i < sizeof(types) / sizeof(types[0]); ++i){
+		for (j = 0; j < 2; ++j){
+			size_t len = j == 0 ? sizeof(data) : sizeof(data) / 3;
+
+			create_file(file, data + j, len);
+			TEST_ASSERT(zip_compress(file, arch, types[i], 6, 0) == 0);
+			TEST_ASSERT(zip_decompress(arch, out, types[i], 0) == 0);
+			TEST_ASSERT(memcmp_file_data(out, data + j, len) == 0);
+		}
+	}
+
+cleanup:
+	remove(file);
+	remove(arch);
+	remove(out);
+}
+
+static const enum compressor all_compressors[] = { COMPRESSOR_GZIP, COMPRESSOR_BZIP2, COMPRESSOR_XZ, COMPRESSOR_LZ4, COMPRESSOR_ZSTD, COMPRESSOR_NONE };
+
+/* pushes data through a stream in small pieces with a tiny output buffer, so every codec has to hold data back */
+static int run_stream(struct zip_stream* zs, const unsigned char* in, size_t in_len, unsigned char* out, size_t out_size, size_t* out_len){
+	unsigned char tmp[7];
+	size_t pos = 0;
+	size_t len;
+	int res;
+
+	*out_len = 0;
+	while (pos < in_len){
+		size_t chunk = in_len - pos < 333 ? in_len - pos : 333;
+		size_t used;
+
+		if (zip_stream_update(zs, in + pos, chunk, &used, tmp, sizeof(tmp), &len) != 0 || *out_len + len > out_size){
+			return -1;
+		}
+		memcpy(out + *out_len, tmp, len);
+		*out_len += len;
+		pos += used;
+	}
+
+	do{
+		res = zip_stream_finish(zs, tmp, sizeof(tmp), &len);
+		if (res < 0 || *out_len + len > out_size){
+			return -1;
+		}
+		memcpy(out + *out_len, tmp, len);
+		*out_len += len;
+	}while (res > 0);
+	return 0;
+}
+
+void test_zip_stream(enum TEST_STATUS* status){
+	const char* file = "file.txt";
+	const char* arch = "file.txt.z";
+	unsigned char data[20000];
+	unsigned char* comp = NULL;
+	unsigned char* decomp = NULL;
+	struct zip_stream* zs = NULL;
+	size_t comp_len;
+	size_t decomp_len;
+	size_t i;
+
+	fill_sample_data(data, sizeof(data));
+	comp = malloc(sizeof(data) * 2 + 1024);
+	decomp = malloc(sizeof(data));
+	TEST_ASSERT(comp && decomp);
+
+	for (i = 0; i < sizeof(all_compressors) / sizeof(all_compressors[0]); ++i){
+		zs = zip_stream_new(all_compressors[i], 1, 0, 0);
+		TEST_ASSERT(zs);
+		TEST_ASSERT(run_stream(zs, data, sizeof(data), comp, sizeof(data) * 2 + 1024, &comp_len) == 0);
+		zip_stream_free(zs);
+		zs = NULL;
+
+		zs = zip_stream_new(all_compressors[i], 0, 0, 0);
+		TEST_ASSERT(zs);
+		TEST_ASSERT(run_stream(zs, comp, comp_len, decomp, sizeof(data), &decomp_len) == 0);
+		TEST_ASSERT(decomp_len == sizeof(data));
+		TEST_ASSERT(memcmp(decomp, data, sizeof(data)) == 0);
+		zip_stream_free(zs);
+		zs = NULL;
+
+		/* the in-memory format is the same as the file format */
+		if (all_compressors[i] != COMPRESSOR_NONE){
+			create_file(arch, comp, comp_len);
+			TEST_ASSERT(zip_decompress(arch, file, all_compressors[i], 0) == 0);
+			TEST_ASSERT(memcmp_file_data(file, data, sizeof(data)) == 0);
+		}
+
+		/* a stream cut short must not finish successfully */
+		if (all_compressors[i] != COMPRESSOR_NONE){
+			zs = zip_stream_new(all_compressors[i], 0, 0, 0);
+			TEST_ASSERT(zs);
+			TEST_ASSERT(run_stream(zs, comp, comp_len / 2, decomp, sizeof(data), &decomp_len) != 0);
+			zip_stream_free(zs);
+			zs = NULL;
+		}
+	}
+
+cleanup:
+	zip_stream_free(zs);
+	free(comp);
+	free(decomp);
+	remove(file);
+	remove(arch);
+}
+
+void test_zip_buffer(enum TEST_STATUS* status){
+	unsigned char data[2000];
+	unsigned char* comp = NULL;
+	unsigned char decomp[sizeof(data)];
+	size_t comp_len;
+	size_t decomp_len;
+	size_t len;
+	size_t i;
+
+	fill_sample_data(data, sizeof(data));
+
+	for (i = 0; i < sizeof(all_compressors) / sizeof(all_compressors[0]); ++i){
+		size_t bound = zip_compress_bound(all_compressors[i], sizeof(data), 0);
+
+		TEST_ASSERT(bound >= sizeof(data));
+		comp = malloc(bound);
+		TEST_ASSERT(comp);
+
+		TEST_ASSERT(zip_compress_buffer(data, sizeof(data), comp, bound, &comp_len, all_compressors[i], 0, 0) == 0);
+		TEST_ASSERT(comp_len <= bound);
+		TEST_ASSERT(zip_decompress_buffer(comp, comp_len, decomp, sizeof(decomp), &decomp_len, all_compressors[i], 0) == 0);
+		TEST_ASSERT(decomp_len == sizeof(data));
+		TEST_ASSERT(memcmp(decomp, data, sizeof(data)) == 0);
+
+		/* too small buffers are errors instead of overflows */
+		TEST_ASSERT(zip_compress_buffer(data, sizeof(data), comp, comp_len - 1, &len, all_compressors[i], 0, 0) != 0);
+		TEST_ASSERT(zip_decompress_buffer(comp, comp_len, decomp, sizeof(decomp) - 1, &len, all_compressors[i], 0) != 0);
+
+		free(comp);
+		comp = NULL;
+	}
+
+	/* an empty input still produces a valid stream */
+	comp = malloc(zip_compress_bound(COMPRESSOR_ZSTD, 0, 0));
+	TEST_ASSERT(comp);
+	TEST_ASSERT(zip_compress_buffer(data, 0, comp, zip_compress_bound(COMPRESSOR_ZSTD, 0, 0), &comp_len, COMPRESSOR_ZSTD, 0, 0) == 0);
+	TEST_ASSERT(zip_decompress_buffer(comp, comp_len, decomp, sizeof(decomp), &decomp_len, COMPRESSOR_ZSTD, 0) == 0);
+	TEST_ASSERT(decomp_len == 0);
+
+cleanup:
+	free(comp);
+}
+
+void test_zstd_dict(enum TEST_STATUS* status){
+	char* files[100] = { NULL };
+	const char* sample = "sample.txt";
+	const char* arch = "sample.txt.zst";
+	const char* dict_file = "sample.dict";
+	struct zip_dict* dict = NULL;
+	struct zip_dict* loaded = NULL;
+	char buf[512];
+	size_t i;
+
+	/* lots of small files that look alike */
+	for (i = 0; i < sizeof(files) / sizeof(files[0]); ++i){
+		files[i] = malloc(32);
+		TEST_ASSERT(files[i]);
+		sprintf(files[i], "dict_%03lu.json", (unsigned long)i);
+		sprintf(buf, "{\"id\": %lu, \"name\": \"entry number %lu\", \"tags\": [\"alpha\", \"beta\", \"gamma\"], \"size\": %lu, \"owner\": \"nobody\"}\n", (unsigned long)i, (unsigned long)(i * 7919 % 1000), (unsigned long)(i * 31));
+		create_file(files[i], (unsigned char*)buf, strlen(buf));
+	}
+
+	dict = zip_dict_train((const char* const*)files, sizeof(files) / sizeof(files[0]), 1024);
+	TEST_ASSERT(dict);
+	TEST_ASSERT(zip_dict_id(dict) != 0);
+
+	TEST_ASSERT(zip_compress_dict(files[42], arch, 0, 0, dict) == 0);
+	TEST_ASSERT(zip_file_dict_id(arch) == zip_dict_id(dict));
+
+	/* the dictionary survives a trip to disk */
+	TEST_ASSERT(zip_dict_save(dict, dict_file) == 0);
+	loaded = zip_dict_load(dict_file);
+	TEST_ASSERT(loaded);
+	TEST_ASSERT(zip_dict_id(loaded) == zip_dict_id(dict));
+
+	TEST_ASSERT(zip_decompress_dict(arch, sample, 0, loaded) == 0);
+	TEST_ASSERT(memcmp_file_file(files[42], sample) == 0);
+
+	/* the frame cannot be read without its dictionary */
+	TEST_ASSERT(zip_decompress(arch, sample, COMPRESSOR_ZSTD, 0) != 0);
+
+cleanup:
+	for (i = 0; i < sizeof(files) / sizeof(files[0]); ++i){
+		if (files[i]){
+			remove(files[i]);
+			free(files[i]);
+		}
+	}
+	zip_dict_free(dict);
+	zip_dict_free(loaded);
+	remove(sample);
+	remove(arch);
+	remove(dict_file);
+}
+
+void test_zip_seekable(enum TEST_STATUS* status){
+	const char* file = "file.txt";
+	const char* arch = "file.txt.seek";
+	const char* out = "file.txt.out";
+	const unsigned flags = ZIP_SEEKABLE | ZIP_BLOCK_SHIFT(16) | ZIP_THREADS(2);
+	unsigned char* data = NULL;
+	unsigned char* buf = NULL;
+	const size_t data_len = 300000;
+	struct zip_seekable* zsk = NULL;
+	size_t len;
+	size_t i;
+
+	data = malloc(data_len);
+	buf = malloc(data_len);
+	TEST_ASSERT(data && buf);
+	fill_sample_data(data, data_len);
+	create_file(file, data, data_len);
+
+	for (i = 0; i < sizeof(all_compressors) / sizeof(all_compressors[0]); ++i){
+		TEST_ASSERT(zip_compress(file, arch, all_compressors[i], 0, flags) == 0);
+		TEST_ASSERT(zip_decompress(arch, out, all_compressors[i], flags) == 0);
+		TEST_ASSERT(memcmp_file_data(out, data, data_len) == 0);
+
+		zsk = zip_seekable_open(arch);
+		TEST_ASSERT(zsk);
+		TEST_ASSERT(zip_seekable_size(zsk) == data_len);
+
+		/* a read spanning several blocks */
+		TEST_ASSERT(zip_seekable_read(zsk, 70000, buf, 100000, &len) == 0);
+		TEST_ASSERT(len == 100000);
+		TEST_ASSERT(memcmp(buf, data + 70000, len) == 0);
+
+		/* a read running off the end */
+		TEST_ASSERT(zip_seekable_read(zsk, data_len - 10, buf, 100, &len) == 0);
+		TEST_ASSERT(len == 10);
+		TEST_ASSERT(memcmp(buf, data + data_len - 10, len) == 0);
+		TEST_ASSERT(zip_seekable_read(zsk, data_len, buf, 100, &len) == 0);
+		TEST_ASSERT(len == 0);
+
+		zip_seekable_close(zsk);
+		zsk = NULL;
+	}
+
+	/* a single stream is not a seekable container */
+	TEST_ASSERT(zip_compress(file, arch, COMPRESSOR_ZSTD, 0, 0) == 0);
+	TEST_ASSERT(zip_seekable_open(arch) == NULL);
+
+	/* corruption is caught by the block's checksum */
+	TEST_ASSERT(zip_compress(file, arch, COMPRESSOR_NONE, 0, flags) == 0);
+	{
+		FILE* fp = fopen(arch, "r+b");
+		TEST_ASSERT(fp);
+		fseek(fp, 200000, SEEK_SET);
+		fputc(~data[200000] & 0xFF, fp);
+		fclose(fp);
+	}
+	zsk = zip_seekable_open(arch);
+	TEST_ASSERT(zsk);
+	TEST_ASSERT(zip_seekable_read(zsk, 0, buf, 1000, &len) == 0);
+	TEST_ASSERT(zip_seekable_read(zsk, 199000, buf, 1000, &len) != 0);
+	TEST_ASSERT(zip_decompress(arch, out, COMPRESSOR_NONE, flags) != 0);
+
+cleanup:
+	zip_seekable_close(zsk);
+	free(data);
+	free(buf);
+	remove(file);
+	remove(arch);
+	remove(out);
+}
+
+void test_zip_adapt(enum TEST_STATUS* status){
+	struct zip_adapt* za = NULL;
+
+	za = zip_adapt_new(COMPRESSOR_ZSTD, 0, 100.0 * 1048576);
+	TEST_ASSERT(za);
+	TEST_ASSERT(zip_adapt_level(za) == 3);
+
+	/* nothing changes until a full window has been measured */
+	zip_adapt_update(za, ZIP_ADAPT_WINDOW / 2, 1.0, 0);
+	TEST_ASSERT(zip_adapt_level(za) == 3);
+
+	/* 4MB/s can't keep up with 100MB/s */
+	zip_adapt_update(za, ZIP_ADAPT_WINDOW / 2, 1.0, 0);
+	TEST_ASSERT(zip_adapt_level(za) == 2);
+
+	/* 4GB/s is well ahead of it */
+	zip_adapt_update(za, ZIP_ADAPT_WINDOW, 0.001, 0);
+	TEST_ASSERT(zip_adapt_level(za) == 3);
+
+	/* a slow downstream stage is the real target */
+	zip_adapt_update(za, ZIP_ADAPT_WINDOW, 0.1, 10.0);
+	TEST_ASSERT(zip_adapt_level(za) == 4);
+
+	TEST_ASSERT(zip_adapt_level_bytes(za, 3) == (uint64_t)ZIP_ADAPT_WINDOW * 2);
+	TEST_ASSERT(zip_adapt_level_bytes(za, 2) == (uint64_t)ZIP_ADAPT_WINDOW);
+	TEST_ASSERT(zip_adapt_level_bytes(za, 4) == 0);
+	zip_adapt_free(za);
+
+	/* levels stay within the compressor's range */
+	za = zip_adapt_new(COMPRESSOR_GZIP, 1, 1e12);
+	TEST_ASSERT(za);
+	zip_adapt_update(za, ZIP_ADAPT_WINDOW, 1.0, 0);
+	TEST_ASSERT(zip_adapt_level(za) == 1);
+	zip_adapt_free(za);
+
+	za = zip_adapt_new(COMPRESSOR_NONE, 5, 1.0);
+	TEST_ASSERT(za);
+	TEST_ASSERT(zip_adapt_level(za) == 0);
+	zip_adapt_update(za, ZIP_ADAPT_WINDOW, 0.001, 0);
+	TEST_ASSERT(zip_adapt_level(za) == 0);
+
+cleanup:
+	zip_adapt_free(za);
+}
@@ -15,10 +15,25 @@ void test_compress_gzip(enum TEST_STATUS* status);
 void test_compress_bzip2(enum TEST_STATUS* status);
 void test_compress_xz(enum TEST_STATUS* status);
 void test_compress_lz4(enum TEST_STATUS* status);
+void test_compress_zstd(enum TEST_STATUS* status);
 void test_decompress_gzip(enum TEST_STATUS* status);
 void test_decompress_bzip2(enum TEST_STATUS* status);
 void test_decompress_xz(enum TEST_STATUS* status);
 void test_decompress_lz4(enum TEST_STATUS* status);
+void test_decompress_zstd(enum TEST_STATUS* status);
+void test_zstd_options(enum TEST_STATUS* status);
+void test_xz_threads(enum TEST_STATUS* status);
+void test_gzip_threads(enum TEST_STATUS* status);
+void test_lz4_threads(enum TEST_STATUS* status);
+void test_bzip2_threads(enum TEST_STATUS* status);
+void test_compress_tail(enum TEST_STATUS* status);
+void test_compress_fp(enum TEST_STATUS* status);
+void test_zip_reuse(enum TEST_STATUS* status);
+void test_zip_stream(enum TEST_STATUS* status);
+void test_zip_buffer(enum TEST_STATUS* status);
+void test_zstd_dict(enum TEST_STATUS* status);
+void test_zip_seekable(enum TEST_STATUS* status);
+void test_zip_adapt(enum TEST_STATUS* status);
 
 EXPORT_PKG(compression_zip_pkg);
 #endif
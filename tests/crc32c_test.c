@@ -0,0 +1,55 @@
+/** @file tests/crc32c_test.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "crc32c_test.h"
+#include "../crc32c.h"
+
+const struct unit_test crc32c_tests[] = {
+	MAKE_TEST(test_crc32c),
+	MAKE_TEST(test_crc32c_hardware)
+};
+MAKE_PKG(crc32c_tests, crc32c_pkg);
+
+void test_crc32c(enum TEST_STATUS* status){
+	unsigned char data[1337];
+	uint32_t crc;
+	size_t i;
+
+	/* the standard check value */
+	TEST_ASSERT(crc32c(0, "123456789", 9) == 0xE3069283UL);
+	TEST_ASSERT(crc32c(0, "", 0) == 0);
+
+	/* splitting the input anywhere gives the same result */
+	fill_sample_data(data, sizeof(data));
+	crc = crc32c(0, data, sizeof(data));
+	for (i = 0; i < 16; ++i){
+		TEST_ASSERT(crc32c(crc32c(0, data, i), data + i, sizeof(data) - i) == crc);
+	}
+
+cleanup:
+	;
+}
+
+void test_crc32c_hardware(enum TEST_STATUS* status){
+	static unsigned char data[4096 + 7];
+	size_t i;
+
+	/* every alignment and every tail length gives the same crc as the table */
+	fill_sample_data(data, sizeof(data));
+	for (i = 0; i < 8; ++i){
+		size_t len;
+		for (len = 0; len < 24; ++len){
+			TEST_ASSERT(crc32c(0x1234, data + i, len) == crc32c_portable(0x1234, data + i, len));
+		}
+		TEST_ASSERT(crc32c(0, data + i, sizeof(data) - i) == crc32c_portable(0, data + i, sizeof(data) - i));
+	}
+	TEST_ASSERT(crc32c_portable(0, "123456789", 9) == 0xE3069283UL);
+
+cleanup:
+	;
+}
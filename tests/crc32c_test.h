@@ -0,0 +1,18 @@
+/** @file tests/crc32c_test.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __CRC32C_TEST_H
+#define __CRC32C_TEST_H
+
+#include "test_framework.h"
+
+void test_crc32c(enum TEST_STATUS* status);
+void test_crc32c_hardware(enum TEST_STATUS* status);
+
+EXPORT_PKG(crc32c_pkg);
+#endif
@@ -0,0 +1,180 @@
+/** @file tests/crypt/crypt_aead_test.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "crypt_aead_test.h"
+#include "../../crypt/crypt_aead.h"
+#include "../../crypt/crypt_easy.h"
+#include "../../log.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char* const sample_file = "aead.txt";
+static const char* const sample_file_crypt = "aead.txt.enc";
+static const char* const sample_file_decrypt = "aead_decrypt.txt";
+static const unsigned char key[] = "correct horse battery staple";
+
+const struct unit_test crypt_aead_tests[] = {
+	MAKE_TEST(test_crypt_aead),
+	MAKE_TEST(test_crypt_aead_tamper),
+	MAKE_TEST(test_crypt_aead_read_chunk)
+};
+MAKE_PKG(crypt_aead_tests, crypt_aead_pkg);
+
+void test_crypt_aead(enum TEST_STATUS* status){
+	/* empty, a partial chunk, exactly two chunks, and several chunks with a partial one at the end */
+	const size_t sizes[] = {0, 1337, 2 * CRYPT_AEAD_CHUNK_SIZE, 3 * CRYPT_AEAD_CHUNK_SIZE + 12345};
+	const enum crypt_aead_cipher ciphers[] = {CRYPT_AEAD_AES_256_GCM, CRYPT_AEAD_CHACHA20_POLY1305};
+	const unsigned threads[] = {0, 4};
+	unsigned char* data = NULL;
+	size_t i;
+	size_t j;
+	size_t k;
+
+	data = malloc(sizes[3]);
+	TEST_ASSERT(data);
+	fill_sample_data(data, sizes[3]);
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i){
+		create_file(sample_file, data, sizes[i]);
+		for (j = 0; j < sizeof(ciphers) / sizeof(ciphers[0]); ++j){
+			for (k = 0; k < sizeof(threads) / sizeof(threads[0]); ++k){
+				TEST_ASSERT(crypt_aead_encrypt(sample_file, sample_file_crypt, ciphers[j], key, sizeof(key), threads[k]) == 0);
+				TEST_ASSERT(crypt_aead_decrypt(sample_file_crypt, sample_file_decrypt, key, sizeof(key), threads[(k + 1) % 2]) == 0);
+				TEST_ASSERT(memcmp_file_data(sample_file_decrypt, data, sizes[i]) == 0);
+			}
+		}
+	}
+
+	/* the wrong key must not decrypt */
+	TEST_ASSERT(crypt_aead_decrypt(sample_file_crypt, sample_file_decrypt, (const unsigned char*)"hunter2", 7, 0) != 0);
+	TEST_ASSERT(!does_file_exist(sample_file_decrypt));
+
+	/* easy_encrypt uses the chunked format for authenticated ciphers */
+	TEST_ASSERT(easy_encrypt(sample_file, sample_file_crypt, "AES-256-GCM", 0, "hunter2") == 0);
+	TEST_ASSERT(easy_decrypt(sample_file_crypt, sample_file_decrypt, "AES-256-GCM", 0, "hunter2") == 0);
+	TEST_ASSERT(memcmp_file_file(sample_file, sample_file_decrypt) == 0);
+
+cleanup:
+	free(data);
+	remove(sample_file);
+	remove(sample_file_crypt);
+	remove(sample_file_decrypt);
+}
+
+/* rewrites an encrypted file with one byte flipped and/or its end cut off */
+static int damage_file(const char* file, long flip, long truncate_to){
+	FILE* fp = NULL;
+	unsigned char* buf = NULL;
+	long len;
+	int ret = -1;
+
+	fp = fopen(file, "rb");
+	if (!fp || fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0){
+		goto cleanup;
+	}
+	buf = malloc(len);
+	if (!buf || fread(buf, 1, len, fp) != (size_t)len){
+		goto cleanup;
+	}
+	fclose(fp);
+	fp = NULL;
+
+	if (flip >= 0 && flip < len){
+		buf[flip] ^= 0x01;
+	}
+	if (truncate_to >= 0 && truncate_to < len){
+		len = truncate_to;
+	}
+	create_file(file, buf, len);
+	ret = 0;
+
+cleanup:
+	fp ? fclose(fp) : 0;
+	free(buf);
+	return ret;
+}
+
+void test_crypt_aead_tamper(enum TEST_STATUS* status){
+	const long stride = CRYPT_AEAD_CHUNK_SIZE + CRYPT_AEAD_TAG_LEN;
+	const size_t len = 2 * CRYPT_AEAD_CHUNK_SIZE + 100;
+	unsigned char* data = NULL;
+
+	data = malloc(len);
+	TEST_ASSERT(data);
+	fill_sample_data(data, len);
+	create_file(sample_file, data, len);
+
+	/* a flipped bit in the header */
+	TEST_ASSERT(crypt_aead_encrypt(sample_file, sample_file_crypt, CRYPT_AEAD_AES_256_GCM, key, sizeof(key), 2) == 0);
+	TEST_ASSERT(damage_file(sample_file_crypt, 12, -1) == 0);
+	TEST_ASSERT(crypt_aead_decrypt(sample_file_crypt, sample_file_decrypt, key, sizeof(key), 2) != 0);
+	TEST_ASSERT(!does_file_exist(sample_file_decrypt));
+
+	/* a flipped bit in a chunk */
+	TEST_ASSERT(crypt_aead_encrypt(sample_file, sample_file_crypt, CRYPT_AEAD_AES_256_GCM, key, sizeof(key), 2) == 0);
+	TEST_ASSERT(damage_file(sample_file_crypt, CRYPT_AEAD_HEADER_LEN + stride + 5, -1) == 0);
+	TEST_ASSERT(crypt_aead_decrypt(sample_file_crypt, sample_file_decrypt, key, sizeof(key), 2) != 0);
+	TEST_ASSERT(!does_file_exist(sample_file_decrypt));
+
+	/* the file cut off at a chunk boundary */
+	TEST_ASSERT(crypt_aead_encrypt(sample_file, sample_file_crypt, CRYPT_AEAD_CHACHA20_POLY1305, key, sizeof(key), 2) == 0);
+	TEST_ASSERT(damage_file(sample_file_crypt, -1, CRYPT_AEAD_HEADER_LEN + 2 * stride) == 0);
+	TEST_ASSERT(crypt_aead_decrypt(sample_file_crypt, sample_file_decrypt, key, sizeof(key), 2) != 0);
+	TEST_ASSERT(!does_file_exist(sample_file_decrypt));
+
+	/* the file cut off in the middle of a chunk */
+	TEST_ASSERT(crypt_aead_encrypt(sample_file, sample_file_crypt, CRYPT_AEAD_CHACHA20_POLY1305, key, sizeof(key), 2) == 0);
+	TEST_ASSERT(damage_file(sample_file_crypt, -1, CRYPT_AEAD_HEADER_LEN + stride + 1000) == 0);
+	TEST_ASSERT(crypt_aead_decrypt(sample_file_crypt, sample_file_decrypt, key, sizeof(key), 2) != 0);
+	TEST_ASSERT(!does_file_exist(sample_file_decrypt));
+
+cleanup:
+	free(data);
+	remove(sample_file);
+	remove(sample_file_crypt);
+	remove(sample_file_decrypt);
+}
+
+void test_crypt_aead_read_chunk(enum TEST_STATUS* status){
+	const size_t len = 3 * CRYPT_AEAD_CHUNK_SIZE + 4321;
+	struct crypt_aead_file* caf = NULL;
+	unsigned char* data = NULL;
+	unsigned char* chunk = NULL;
+	size_t chunk_len;
+
+	data = malloc(len);
+	chunk = malloc(CRYPT_AEAD_CHUNK_SIZE);
+	TEST_ASSERT(data && chunk);
+	fill_sample_data(data, len);
+	create_file(sample_file, data, len);
+
+	TEST_ASSERT(crypt_aead_encrypt(sample_file, sample_file_crypt, CRYPT_AEAD_AES_256_GCM, key, sizeof(key), 4) == 0);
+	TEST_ASSERT((caf = crypt_aead_open(sample_file_crypt, key, sizeof(key))) != NULL);
+	TEST_ASSERT(crypt_aead_chunks(caf) == 4);
+
+	/* out of order, so nothing can depend on the previous chunk */
+	TEST_ASSERT(crypt_aead_read_chunk(caf, 3, chunk, &chunk_len) == 0);
+	TEST_ASSERT(chunk_len == 4321);
+	TEST_ASSERT(memcmp(chunk, data + 3 * CRYPT_AEAD_CHUNK_SIZE, chunk_len) == 0);
+
+	TEST_ASSERT(crypt_aead_read_chunk(caf, 1, chunk, &chunk_len) == 0);
+	TEST_ASSERT(chunk_len == CRYPT_AEAD_CHUNK_SIZE);
+	TEST_ASSERT(memcmp(chunk, data + CRYPT_AEAD_CHUNK_SIZE, chunk_len) == 0);
+
+	TEST_ASSERT(crypt_aead_read_chunk(caf, 0, chunk, &chunk_len) == 0);
+	TEST_ASSERT(memcmp(chunk, data, chunk_len) == 0);
+
+	TEST_ASSERT(crypt_aead_read_chunk(caf, 4, chunk, &chunk_len) != 0);
+
+cleanup:
+	crypt_aead_close(caf);
+	free(data);
+	free(chunk);
+	remove(sample_file);
+	remove(sample_file_crypt);
+}
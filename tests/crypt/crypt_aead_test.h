@@ -0,0 +1,19 @@
+/** @file tests/crypt/crypt_aead_test.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __CRYPT_AEAD_TEST_H
+#define __CRYPT_AEAD_TEST_H
+
+#include "../test_framework.h"
+
+void test_crypt_aead(enum TEST_STATUS* status);
+void test_crypt_aead_tamper(enum TEST_STATUS* status);
+void test_crypt_aead_read_chunk(enum TEST_STATUS* status);
+
+EXPORT_PKG(crypt_aead_pkg);
+#endif
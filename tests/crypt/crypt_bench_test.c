@@ -0,0 +1,47 @@
+/** @file tests/crypt/crypt_bench_test.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "crypt_bench_test.h"
+#include "../../crypt/crypt_bench.h"
+#include "../../crypt/crypt_aead.h"
+#include "../../log.h"
+#include <stdlib.h>
+#include <string.h>
+
+const struct unit_test crypt_bench_tests[] = {
+	MAKE_TEST(test_crypt_bench),
+	MAKE_TEST(test_crypt_auto)
+};
+MAKE_PKG(crypt_bench_tests, crypt_bench_pkg);
+
+void test_crypt_bench(enum TEST_STATUS* status){
+	TEST_ASSERT(crypt_bench_cipher(EVP_aes_256_gcm()) > 0);
+	TEST_ASSERT(crypt_bench_md(EVP_sha256()) > 0);
+	TEST_ASSERT(crypt_benchmark(stdout) == 0);
+
+cleanup:
+	;
+}
+
+void test_crypt_auto(enum TEST_STATUS* status){
+	const EVP_CIPHER* cipher;
+	const EVP_MD* md;
+
+	/* whatever is picked has to meet the floor */
+	TEST_ASSERT((cipher = crypt_auto_cipher()) != NULL);
+	TEST_ASSERT(crypt_aead_from_evp(cipher) != CRYPT_AEAD_NONE);
+	TEST_ASSERT((md = crypt_auto_md()) != NULL);
+	TEST_ASSERT(EVP_MD_size(md) >= 32);
+
+	/* and it is only picked once */
+	TEST_ASSERT(crypt_auto_cipher() == cipher);
+	TEST_ASSERT(crypt_auto_md() == md);
+
+cleanup:
+	;
+}
@@ -8,6 +8,7 @@
 
 #include "crypt_easy_test.h"
 #include "../../crypt/crypt_easy.h"
+#include "../../crypt/crypt_aead.h"
 #include "../../log.h"
 #include <stdlib.h>
 #include <string.h>
@@ -15,6 +16,7 @@
 const struct unit_test crypt_easy_tests[] = {
 	MAKE_TEST(test_easy_encrypt),
 	MAKE_TEST(test_easy_encrypt_inplace),
+	MAKE_TEST(test_easy_reader),
 };
 MAKE_PKG(crypt_easy_tests, crypt_easy_pkg);
 
@@ -50,3 +52,67 @@ void test_easy_encrypt_inplace(enum TEST_STATUS* status){
 cleanup:
 	remove(file);
 }
+
+static void flip_byte(const char* file, long offset){
+	FILE* fp = fopen(file, "r+b");
+	int c;
+
+	fseek(fp, offset, SEEK_SET);
+	c = fgetc(fp);
+	fseek(fp, offset, SEEK_SET);
+	fputc(c ^ 0xFF, fp);
+	fclose(fp);
+}
+
+void test_easy_reader(enum TEST_STATUS* status){
+	const char* file = "file.txt";
+	const char* file_crypt = "file_crypt.txt";
+	const char* key_file = "file_key";
+	const char* ciphers[] = { "AES-256-CBC", "AES-256-GCM" };
+	/* several authenticated chunks, with a partial one at the end */
+	static unsigned char data[2 * CRYPT_AEAD_CHUNK_SIZE + 1337];
+	static unsigned char out[sizeof(data) + 1];
+	struct crypt_master* cm = NULL;
+	struct easy_reader* er = NULL;
+	size_t total;
+	size_t len;
+	size_t i;
+
+	fill_sample_data(data, sizeof(data));
+	create_file(file, data, sizeof(data));
+	remove(key_file);
+	TEST_ASSERT((cm = crypt_master_new("hunter2", key_file)) != NULL);
+
+	for (i = 0; i < sizeof(ciphers) / sizeof(ciphers[0]); ++i){
+		TEST_ASSERT(easy_encrypt_master(file, file_crypt, ciphers[i], 0, cm, 0) == 0);
+
+		/* reads smaller than a chunk come out in order */
+		TEST_ASSERT((er = easy_decrypt_master_open(file_crypt, ciphers[i], cm)) != NULL);
+		total = 0;
+		do{
+			TEST_ASSERT(easy_reader_read(er, out + total, total + 1000 < sizeof(out) ? 1000 : sizeof(out) - total, &len) == 0);
+			total += len;
+		}while (len > 0 && total < sizeof(out));
+		TEST_ASSERT(total == sizeof(data));
+		TEST_ASSERT(memcmp(out, data, sizeof(data)) == 0);
+		easy_reader_close(er);
+		er = NULL;
+	}
+
+	/* a damaged chunk is caught before any of it is returned */
+	TEST_ASSERT(easy_encrypt_master(file, file_crypt, "AES-256-GCM", 0, cm, 0) == 0);
+	flip_byte(file_crypt, CRYPT_AEAD_CHUNK_SIZE + 100);
+	TEST_ASSERT((er = easy_decrypt_master_open(file_crypt, "AES-256-GCM", cm)) != NULL);
+	total = 0;
+	while (easy_reader_read(er, out, sizeof(out), &len) == 0 && len > 0){
+		total += len;
+	}
+	TEST_ASSERT(total < sizeof(data));
+
+cleanup:
+	easy_reader_close(er);
+	crypt_master_free(cm);
+	remove(file);
+	remove(file_crypt);
+	remove(key_file);
+}
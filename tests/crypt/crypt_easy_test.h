@@ -13,6 +13,7 @@
 
 void test_easy_encrypt(enum TEST_STATUS* status);
 void test_easy_encrypt_inplace(enum TEST_STATUS* status);
+void test_easy_reader(enum TEST_STATUS* status);
 
 EXPORT_PKG(crypt_easy_pkg);
 #endif
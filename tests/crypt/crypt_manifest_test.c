@@ -0,0 +1,196 @@
+/** @file tests/crypt/crypt_manifest_test.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "crypt_manifest_test.h"
+#include "../../crypt/crypt_manifest.h"
+#include "../../checksumsort.h"
+#include "../../log.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char* const sample_list = "manifest.txt";
+static const char* const sample_manifest = "manifest.enc";
+static const unsigned char key[] = "correct horse battery staple";
+
+/* enough entries for several blocks */
+#define N_ENTRIES (5000)
+
+const struct unit_test crypt_manifest_tests[] = {
+	MAKE_TEST(test_crypt_manifest),
+	MAKE_TEST(test_crypt_manifest_tamper)
+};
+MAKE_PKG(crypt_manifest_tests, crypt_manifest_pkg);
+
+/* writes a sorted checksum list of n entries */
+static void make_list(const char* file, int n){
+	FILE* fp = fopen(file, "wb");
+	int i;
+
+	for (i = 0; i < n; ++i){
+		fprintf(fp, "/home/equifax/passwords/%05d.txt%c%08X%08X\n", i, '\0', (unsigned)i * 2654435761U, (unsigned)i);
+	}
+	fclose(fp);
+}
+
+static int seal_list(const char* list, const char* manifest){
+	FILE* fp = fopen(list, "rb");
+	int ret;
+
+	if (!fp){
+		return -1;
+	}
+	ret = crypt_manifest_seal(fp, manifest, CRYPT_AEAD_AES_256_GCM, key, sizeof(key));
+	fclose(fp);
+	return ret;
+}
+
+void test_crypt_manifest(enum TEST_STATUS* status){
+	const int sizes[] = {0, 1, N_ENTRIES};
+	FILE* fp_list = NULL;
+	FILE* fp_manifest = NULL;
+	struct crypt_manifest* cm = NULL;
+	struct element* e1 = NULL;
+	struct element* e2 = NULL;
+	char* checksum = NULL;
+	char* checksum_plain = NULL;
+	char path[64];
+	size_t i;
+	int j;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i){
+		make_list(sample_list, sizes[i]);
+		TEST_ASSERT(seal_list(sample_list, sample_manifest) == 0);
+
+		TEST_ASSERT((fp_list = fopen(sample_list, "rb")) != NULL);
+		TEST_ASSERT((fp_manifest = fopen(sample_manifest, "rb")) != NULL);
+		TEST_ASSERT(crypt_manifest_detect(fp_manifest) == 1);
+		TEST_ASSERT(crypt_manifest_detect(fp_list) == 0);
+
+		TEST_ASSERT((cm = crypt_manifest_open(fp_manifest, key, sizeof(key))) != NULL);
+
+		/* every entry is found, in any order */
+		for (j = sizes[i] - 1; j >= 0; j -= 7){
+			sprintf(path, "/home/equifax/passwords/%05d.txt", j);
+			TEST_ASSERT(crypt_manifest_search(cm, path, &checksum) == 0);
+			TEST_ASSERT(search_file(fp_list, path, &checksum_plain) == 0);
+			TEST_ASSERT(strcmp(checksum, checksum_plain) == 0);
+			free(checksum);
+			free(checksum_plain);
+			checksum = NULL;
+			checksum_plain = NULL;
+		}
+		TEST_ASSERT(crypt_manifest_search(cm, "/home/equifax/passwords/00003.txx", &checksum) > 0);
+		TEST_ASSERT(crypt_manifest_search(cm, "/aaa", &checksum) > 0);
+		TEST_ASSERT(crypt_manifest_search(cm, "/zzz", &checksum) > 0);
+
+		/* reading in order gives back the list */
+		TEST_ASSERT(fseek(fp_list, 0, SEEK_SET) == 0);
+		TEST_ASSERT(crypt_manifest_rewind(cm) == 0);
+		for (j = 0; j < sizes[i]; ++j){
+			TEST_ASSERT((e1 = get_next_checksum_element(fp_list)) != NULL);
+			TEST_ASSERT((e2 = crypt_manifest_next(cm)) != NULL);
+			TEST_ASSERT(strcmp(e1->file, e2->file) == 0 && strcmp(e1->checksum, e2->checksum) == 0);
+			free_element(e1);
+			free_element(e2);
+			e1 = NULL;
+			e2 = NULL;
+
+			/* searches in between do not disturb it */
+			if (j % 1000 == 0){
+				TEST_ASSERT(crypt_manifest_search(cm, "/home/equifax/passwords/00000.txt", &checksum) == 0);
+				free(checksum);
+				checksum = NULL;
+			}
+		}
+		TEST_ASSERT(crypt_manifest_next(cm) == NULL);
+
+		crypt_manifest_close(cm);
+		cm = NULL;
+		fclose(fp_list);
+		fp_list = NULL;
+
+		/* the wrong key does not open it */
+		TEST_ASSERT(crypt_manifest_open(fp_manifest, (const unsigned char*)"hunter2", 7) == NULL);
+		fclose(fp_manifest);
+		fp_manifest = NULL;
+	}
+
+cleanup:
+	free(checksum);
+	free(checksum_plain);
+	free_element(e1);
+	free_element(e2);
+	crypt_manifest_close(cm);
+	fp_list ? fclose(fp_list) : 0;
+	fp_manifest ? fclose(fp_manifest) : 0;
+	remove(sample_list);
+	remove(sample_manifest);
+}
+
+/* flips a byte of a file */
+static int flip_byte(const char* file, long offset){
+	FILE* fp = fopen(file, "r+b");
+	int c;
+
+	if (!fp){
+		return -1;
+	}
+	fseek(fp, offset, SEEK_SET);
+	c = fgetc(fp);
+	fseek(fp, offset, SEEK_SET);
+	fputc(c ^ 0x01, fp);
+	fclose(fp);
+	return 0;
+}
+
+void test_crypt_manifest_tamper(enum TEST_STATUS* status){
+	FILE* fp_manifest = NULL;
+	struct crypt_manifest* cm = NULL;
+	struct element* e = NULL;
+	char* checksum = NULL;
+	int n = 0;
+
+	make_list(sample_list, N_ENTRIES);
+	TEST_ASSERT(seal_list(sample_list, sample_manifest) == 0);
+	/* somewhere in the first block */
+	TEST_ASSERT(flip_byte(sample_manifest, CRYPT_MANIFEST_HEADER_LEN + 100) == 0);
+
+	TEST_ASSERT((fp_manifest = fopen(sample_manifest, "rb")) != NULL);
+	TEST_ASSERT((cm = crypt_manifest_open(fp_manifest, key, sizeof(key))) != NULL);
+
+	/* only lookups that need the damaged block fail */
+	TEST_ASSERT(crypt_manifest_search(cm, "/home/equifax/passwords/00000.txt", &checksum) < 0);
+	TEST_ASSERT(crypt_manifest_search(cm, "/home/equifax/passwords/04999.txt", &checksum) == 0);
+	free(checksum);
+	checksum = NULL;
+
+	/* and reading in order stops at it */
+	while ((e = crypt_manifest_next(cm)) != NULL){
+		free_element(e);
+		n++;
+	}
+	TEST_ASSERT(n == 0);
+
+	crypt_manifest_close(cm);
+	cm = NULL;
+	fclose(fp_manifest);
+	fp_manifest = NULL;
+
+	/* a damaged header fails the index */
+	TEST_ASSERT(seal_list(sample_list, sample_manifest) == 0);
+	TEST_ASSERT(flip_byte(sample_manifest, 20) == 0);
+	TEST_ASSERT((fp_manifest = fopen(sample_manifest, "rb")) != NULL);
+	TEST_ASSERT((cm = crypt_manifest_open(fp_manifest, key, sizeof(key))) == NULL);
+
+cleanup:
+	free(checksum);
+	crypt_manifest_close(cm);
+	fp_manifest ? fclose(fp_manifest) : 0;
+	remove(sample_list);
+	remove(sample_manifest);
+}
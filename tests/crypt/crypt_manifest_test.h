@@ -0,0 +1,18 @@
+/** @file tests/crypt/crypt_manifest_test.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __CRYPT_MANIFEST_TEST_H
+#define __CRYPT_MANIFEST_TEST_H
+
+#include "../test_framework.h"
+
+void test_crypt_manifest(enum TEST_STATUS* status);
+void test_crypt_manifest_tamper(enum TEST_STATUS* status);
+
+EXPORT_PKG(crypt_manifest_pkg);
+#endif
@@ -0,0 +1,185 @@
+/** @file tests/crypt/crypt_master_test.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "crypt_master_test.h"
+#include "../../crypt/crypt_master.h"
+#include "../../crypt/crypt_easy.h"
+#include "../../log.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char* const key_file = "master.key";
+
+const struct unit_test crypt_master_tests[] = {
+	MAKE_TEST(test_crypt_master),
+	MAKE_TEST(test_easy_encrypt_master),
+	MAKE_TEST(test_easy_encrypt_convergent),
+	MAKE_TEST(test_easy_writer)
+};
+MAKE_PKG(crypt_master_tests, crypt_master_pkg);
+
+void test_crypt_master(enum TEST_STATUS* status){
+	struct crypt_master* cm1 = NULL;
+	struct crypt_master* cm2 = NULL;
+	struct crypt_master* cm3 = NULL;
+
+	remove(key_file);
+
+	/* the first use makes the key file */
+	TEST_ASSERT((cm1 = crypt_master_new("hunter2", key_file)) != NULL);
+	TEST_ASSERT(does_file_exist(key_file));
+
+	/* later uses derive the same key from it */
+	TEST_ASSERT((cm2 = crypt_master_new("hunter2", key_file)) != NULL);
+	TEST_ASSERT(memcmp(crypt_master_key(cm1), crypt_master_key(cm2), CRYPT_MASTER_KEY_LEN) == 0);
+
+	TEST_ASSERT((cm3 = crypt_master_new("hunter3", key_file)) == NULL);
+
+cleanup:
+	crypt_master_free(cm1);
+	crypt_master_free(cm2);
+	crypt_master_free(cm3);
+	remove(key_file);
+}
+
+void test_easy_encrypt_master(enum TEST_STATUS* status){
+	const char* const ciphers[] = {"AES-256-CBC", "AES-256-GCM", "ChaCha20-Poly1305"};
+	const char* file = "file.txt";
+	const char* file_crypt = "file_crypt.txt";
+	const char* file_crypt2 = "file_crypt2.txt";
+	const char* file_decrypt = "file_decrypt.txt";
+	struct crypt_master* cm = NULL;
+	unsigned char data[1337];
+	size_t i;
+
+	remove(key_file);
+	fill_sample_data(data, sizeof(data));
+	create_file(file, data, sizeof(data));
+
+	TEST_ASSERT((cm = crypt_master_new("hunter2", key_file)) != NULL);
+
+	for (i = 0; i < sizeof(ciphers) / sizeof(ciphers[0]); ++i){
+		TEST_ASSERT(easy_encrypt_master(file, file_crypt, ciphers[i], 0, cm, 2) == 0);
+		TEST_ASSERT(easy_decrypt_master(file_crypt, file_decrypt, ciphers[i], 0, cm, 2) == 0);
+		TEST_ASSERT(memcmp_file_file(file, file_decrypt) == 0);
+
+		/* every file gets its own key */
+		TEST_ASSERT(easy_encrypt_master(file, file_crypt2, ciphers[i], 0, cm, 0) == 0);
+		TEST_ASSERT(memcmp_file_file(file_crypt, file_crypt2) != 0);
+	}
+
+	TEST_ASSERT(easy_encrypt_master_inplace(file_decrypt, "AES-256-GCM", 0, cm, 0) == 0);
+	TEST_ASSERT(memcmp_file_file(file, file_decrypt) != 0);
+	TEST_ASSERT(easy_decrypt_master_inplace(file_decrypt, "AES-256-GCM", 0, cm, 0) == 0);
+	TEST_ASSERT(memcmp_file_file(file, file_decrypt) == 0);
+
+cleanup:
+	crypt_master_free(cm);
+	remove(key_file);
+	remove(file);
+	remove(file_crypt);
+	remove(file_crypt2);
+	remove(file_decrypt);
+}
+
+void test_easy_encrypt_convergent(enum TEST_STATUS* status){
+	const char* const ciphers[] = {"AES-256-CBC", "AES-256-GCM", "ChaCha20-Poly1305"};
+	const char* file = "file.txt";
+	const char* file_copy = "file_copy.txt";
+	const char* file_other = "file_other.txt";
+	const char* file_crypt = "file_crypt.txt";
+	const char* file_crypt2 = "file_crypt2.txt";
+	const char* file_decrypt = "file_decrypt.txt";
+	struct crypt_master* cm = NULL;
+	unsigned char data[1337];
+	unsigned char id[CRYPT_CONTENT_ID_LEN];
+	unsigned char id_copy[CRYPT_CONTENT_ID_LEN];
+	unsigned char id_other[CRYPT_CONTENT_ID_LEN];
+	size_t i;
+
+	remove(key_file);
+	fill_sample_data(data, sizeof(data));
+	create_file(file, data, sizeof(data));
+	create_file(file_copy, data, sizeof(data));
+	data[0] ^= 1;
+	create_file(file_other, data, sizeof(data));
+
+	TEST_ASSERT((cm = crypt_master_new("hunter2", key_file)) != NULL);
+
+	/* identical contents have identical ids */
+	TEST_ASSERT(crypt_master_content_id(cm, file, id) == 0);
+	TEST_ASSERT(crypt_master_content_id(cm, file_copy, id_copy) == 0);
+	TEST_ASSERT(crypt_master_content_id(cm, file_other, id_other) == 0);
+	TEST_ASSERT(memcmp(id, id_copy, sizeof(id)) == 0);
+	TEST_ASSERT(memcmp(id, id_other, sizeof(id)) != 0);
+
+	for (i = 0; i < sizeof(ciphers) / sizeof(ciphers[0]); ++i){
+		/* and encrypt to identical files */
+		TEST_ASSERT(easy_encrypt_convergent(file, file_crypt, ciphers[i], 0, cm, id, 2) == 0);
+		TEST_ASSERT(easy_encrypt_convergent(file_copy, file_crypt2, ciphers[i], 0, cm, id_copy, 0) == 0);
+		TEST_ASSERT(memcmp_file_file(file_crypt, file_crypt2) == 0);
+
+		/* which still decrypt normally */
+		TEST_ASSERT(easy_decrypt_master(file_crypt, file_decrypt, ciphers[i], 0, cm, 0) == 0);
+		TEST_ASSERT(memcmp_file_file(file, file_decrypt) == 0);
+
+		TEST_ASSERT(easy_encrypt_convergent(file_other, file_crypt2, ciphers[i], 0, cm, id_other, 0) == 0);
+		TEST_ASSERT(memcmp_file_file(file_crypt, file_crypt2) != 0);
+	}
+
+cleanup:
+	crypt_master_free(cm);
+	remove(key_file);
+	remove(file);
+	remove(file_copy);
+	remove(file_other);
+	remove(file_crypt);
+	remove(file_crypt2);
+	remove(file_decrypt);
+}
+
+void test_easy_writer(enum TEST_STATUS* status){
+	const char* const ciphers[] = {"AES-256-CBC", "AES-256-GCM", "ChaCha20-Poly1305"};
+	const char* file_crypt = "file_crypt.txt";
+	const char* file_decrypt = "file_decrypt.txt";
+	struct crypt_master* cm = NULL;
+	struct easy_writer* ew = NULL;
+	/* more than a chunk, so the authenticated ciphers have to stream it */
+	static unsigned char data[(1 << 20) + 1337];
+	size_t i;
+
+	remove(key_file);
+	fill_sample_data(data, sizeof(data));
+
+	TEST_ASSERT((cm = crypt_master_new("hunter2", key_file)) != NULL);
+
+	for (i = 0; i < sizeof(ciphers) / sizeof(ciphers[0]); ++i){
+		/* whatever is written comes out encrypted like easy_encrypt_master() would */
+		TEST_ASSERT((ew = easy_encrypt_master_fopen(file_crypt, ciphers[i], cm, 2)) != NULL);
+		TEST_ASSERT(fwrite(data, 1, sizeof(data), easy_writer_fp(ew)) == sizeof(data));
+		TEST_ASSERT(easy_writer_close(ew, 0) == 0);
+		ew = NULL;
+
+		TEST_ASSERT(easy_decrypt_master(file_crypt, file_decrypt, ciphers[i], 0, cm, 0) == 0);
+		TEST_ASSERT(memcmp_file_data(file_decrypt, data, sizeof(data)) == 0);
+	}
+
+	/* discarding the output removes it */
+	TEST_ASSERT((ew = easy_encrypt_master_fopen(file_crypt, "AES-256-GCM", cm, 0)) != NULL);
+	TEST_ASSERT(fwrite(data, 1, 1000, easy_writer_fp(ew)) == 1000);
+	TEST_ASSERT(easy_writer_close(ew, 1) != 0);
+	ew = NULL;
+	TEST_ASSERT(!does_file_exist(file_crypt));
+
+cleanup:
+	ew ? easy_writer_close(ew, 1) : 0;
+	crypt_master_free(cm);
+	remove(key_file);
+	remove(file_crypt);
+	remove(file_decrypt);
+}
@@ -0,0 +1,20 @@
+/** @file tests/crypt/crypt_master_test.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __CRYPT_MASTER_TEST_H
+#define __CRYPT_MASTER_TEST_H
+
+#include "../test_framework.h"
+
+void test_crypt_master(enum TEST_STATUS* status);
+void test_easy_encrypt_master(enum TEST_STATUS* status);
+void test_easy_encrypt_convergent(enum TEST_STATUS* status);
+void test_easy_writer(enum TEST_STATUS* status);
+
+EXPORT_PKG(crypt_master_pkg);
+#endif
@@ -22,7 +22,8 @@ static const unsigned char salt[8] = {0, 0, 0, 0, 0, 0, 0, 0};
 
 const struct unit_test crypt_tests[] = {
 	MAKE_TEST(test_crypt_encrypt),
-	MAKE_TEST(test_crypt_decrypt)
+	MAKE_TEST(test_crypt_decrypt),
+	MAKE_TEST(test_crypt_stream)
 };
 MAKE_PKG(crypt_tests, crypt_pkg);
 
@@ -86,3 +87,85 @@ cleanup:
 	remove(sample_file_decrypt);
 	remove(sample_file_decrypt2);
 }
+
+void test_crypt_stream(enum TEST_STATUS* status){
+	struct crypt_keys* fk = NULL;
+	struct crypt_stream* cs = NULL;
+	unsigned char sample_data[999];
+	unsigned char* crypt_data = NULL;
+	unsigned char* decrypt_data = NULL;
+	FILE* fp = NULL;
+	FILE* fp_out = NULL;
+	size_t crypt_len = 0;
+	size_t decrypt_len = 0;
+	size_t pos;
+	int len;
+
+	fill_sample_data(sample_data, sizeof(sample_data));
+	create_file(sample_file, sample_data, sizeof(sample_data));
+
+	TEST_ASSERT((fk = crypt_new()) != NULL);
+	TEST_ASSERT(crypt_set_encryption(EVP_aes_256_cbc(), fk) == 0);
+	TEST_ASSERT(crypt_set_salt(salt, fk) == 0);
+	TEST_ASSERT(crypt_gen_keys((const unsigned char*)password, strlen(password), NULL, 1, fk) == 0);
+	TEST_ASSERT(crypt_encrypt(sample_file, fk, sample_file_crypt) == 0);
+
+	TEST_ASSERT((crypt_data = malloc(sizeof(sample_data) + CRYPT_STREAM_OVERHEAD)) != NULL);
+	TEST_ASSERT((decrypt_data = malloc(sizeof(sample_data) + 2 * CRYPT_STREAM_OVERHEAD)) != NULL);
+
+	/* encrypting in uneven pieces gives the same output as encrypting the file */
+	TEST_ASSERT((cs = crypt_stream_new(fk, 1)) != NULL);
+	for (pos = 0; pos < sizeof(sample_data); pos += 100){
+		size_t n = sizeof(sample_data) - pos < 100 ? sizeof(sample_data) - pos : 100;
+		TEST_ASSERT(crypt_stream_update(cs, sample_data + pos, (int)n, crypt_data + crypt_len, &len) == 0);
+		crypt_len += len;
+	}
+	TEST_ASSERT(crypt_stream_final(cs, crypt_data + crypt_len, &len) == 0);
+	crypt_len += len;
+	crypt_stream_free(cs);
+	cs = NULL;
+	TEST_ASSERT(memcmp_file_data(sample_file_crypt, crypt_data, crypt_len) == 0);
+
+	/* decrypting a byte at a time handles the header being split up */
+	crypt_reset(fk);
+	TEST_ASSERT(crypt_set_encryption(EVP_aes_256_cbc(), fk) == 0);
+	TEST_ASSERT(crypt_extract_salt(sample_file_crypt, fk) == 0);
+	TEST_ASSERT(crypt_gen_keys((const unsigned char*)password, strlen(password), NULL, 1, fk) == 0);
+	TEST_ASSERT((cs = crypt_stream_new(fk, 0)) != NULL);
+	for (pos = 0; pos < crypt_len; ++pos){
+		TEST_ASSERT(crypt_stream_update(cs, crypt_data + pos, 1, decrypt_data + decrypt_len, &len) == 0);
+		decrypt_len += len;
+	}
+	TEST_ASSERT(crypt_stream_final(cs, decrypt_data + decrypt_len, &len) == 0);
+	decrypt_len += len;
+	TEST_ASSERT(decrypt_len == sizeof(sample_data));
+	TEST_ASSERT(memcmp(decrypt_data, sample_data, sizeof(sample_data)) == 0);
+	crypt_stream_free(cs);
+	cs = NULL;
+
+	/* a header with a different salt is rejected */
+	crypt_data[8] ^= 1;
+	TEST_ASSERT((cs = crypt_stream_new(fk, 0)) != NULL);
+	TEST_ASSERT(crypt_stream_update(cs, crypt_data, (int)crypt_len, decrypt_data, &len) != 0);
+	crypt_stream_free(cs);
+	cs = NULL;
+
+	/* and the FILE* version reads the same format */
+	TEST_ASSERT((fp = fopen(sample_file_crypt, "rb")) != NULL);
+	TEST_ASSERT((fp_out = fopen(sample_file_decrypt, "wb")) != NULL);
+	TEST_ASSERT(crypt_decrypt_fp(fp, fk, fp_out) == 0);
+	fclose(fp_out);
+	fp_out = NULL;
+	TEST_ASSERT(memcmp_file_data(sample_file_decrypt, sample_data, sizeof(sample_data)) == 0);
+
+cleanup:
+	fp ? fclose(fp) : 0;
+	fp_out ? fclose(fp_out) : 0;
+	crypt_stream_free(cs);
+	fk ? crypt_free(fk) : (void)0;
+	free(crypt_data);
+	free(decrypt_data);
+	remove(sample_file);
+	remove(sample_file_crypt);
+	remove(sample_file_decrypt);
+}
@@ -13,6 +13,7 @@
 
 void test_crypt_encrypt(enum TEST_STATUS* status);
 void test_crypt_decrypt(enum TEST_STATUS* status);
+void test_crypt_stream(enum TEST_STATUS* status);
 
 EXPORT_PKG(crypt_pkg);
 #endif
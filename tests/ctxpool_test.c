@@ -0,0 +1,112 @@
+/** @file tests/ctxpool_test.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "ctxpool_test.h"
+#include "../ctxpool.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+const struct unit_test ctxpool_tests[] = {
+	MAKE_TEST(test_ctxpool_reuse),
+	MAKE_TEST(test_ctxpool_evict),
+	MAKE_TEST(test_ctxpool_thread)
+};
+MAKE_PKG(ctxpool_tests, ctxpool_pkg);
+
+static int n_freed = 0;
+
+static void count_free(void* ctx){
+	n_freed++;
+	free(ctx);
+}
+
+void test_ctxpool_reuse(enum TEST_STATUS* status){
+	void* ctx = NULL;
+	void* ctx2 = NULL;
+
+	ctxpool_clear();
+	n_freed = 0;
+
+	ctx = malloc(16);
+	TEST_ASSERT(ctx);
+
+	ctxpool_give(CTXPOOL_ZIP_COMPRESS, 1, 6, 0, ctx, count_free);
+
+	/* every part of the key has to match */
+	TEST_ASSERT(ctxpool_take(CTXPOOL_ZIP_DECOMPRESS, 1, 6, 0) == NULL);
+	TEST_ASSERT(ctxpool_take(CTXPOOL_ZIP_COMPRESS, 2, 6, 0) == NULL);
+	TEST_ASSERT(ctxpool_take(CTXPOOL_ZIP_COMPRESS, 1, 9, 0) == NULL);
+	TEST_ASSERT(ctxpool_take(CTXPOOL_ZIP_COMPRESS, 1, 6, 1) == NULL);
+
+	ctx2 = ctxpool_take(CTXPOOL_ZIP_COMPRESS, 1, 6, 0);
+	TEST_ASSERT(ctx2 == ctx);
+	ctx = NULL;
+
+	/* a context can only be taken once */
+	TEST_ASSERT(ctxpool_take(CTXPOOL_ZIP_COMPRESS, 1, 6, 0) == NULL);
+
+	ctxpool_give(CTXPOOL_ZIP_COMPRESS, 1, 6, 0, ctx2, count_free);
+	ctx2 = NULL;
+	ctxpool_clear();
+	TEST_ASSERT(n_freed == 1);
+
+cleanup:
+	free(ctx);
+	free(ctx2);
+}
+
+void test_ctxpool_evict(enum TEST_STATUS* status){
+	void* newest = NULL;
+	int i;
+
+	ctxpool_clear();
+	n_freed = 0;
+
+	for (i = 0; i <= CTXPOOL_MAX; ++i){
+		void* ctx = malloc(16);
+		TEST_ASSERT(ctx);
+		ctxpool_give(CTXPOOL_DIGEST, i, 0, 0, ctx, count_free);
+	}
+
+	/* the oldest one makes room for the last */
+	TEST_ASSERT(n_freed == 1);
+	TEST_ASSERT(ctxpool_take(CTXPOOL_DIGEST, 0, 0, 0) == NULL);
+	newest = ctxpool_take(CTXPOOL_DIGEST, CTXPOOL_MAX, 0, 0);
+	TEST_ASSERT(newest);
+	free(newest);
+	newest = NULL;
+
+	ctxpool_clear();
+	TEST_ASSERT(n_freed == CTXPOOL_MAX);
+
+cleanup:
+	ctxpool_clear();
+}
+
+static void* give_thread(void* arg){
+	(void)arg;
+	ctxpool_give(CTXPOOL_CIPHER, 0, 0, 0, malloc(16), count_free);
+	return NULL;
+}
+
+void test_ctxpool_thread(enum TEST_STATUS* status){
+	pthread_t thread;
+
+	ctxpool_clear();
+	n_freed = 0;
+
+	TEST_ASSERT(pthread_create(&thread, NULL, give_thread, NULL) == 0);
+	pthread_join(thread, NULL);
+
+	/* the context belonged to the other thread, and was freed when it exited */
+	TEST_ASSERT(n_freed == 1);
+	TEST_ASSERT(ctxpool_take(CTXPOOL_CIPHER, 0, 0, 0) == NULL);
+
+cleanup:
+	;
+}
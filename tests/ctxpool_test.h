@@ -0,0 +1,19 @@
+/** @file tests/ctxpool_test.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __CTXPOOL_TEST_H
+#define __CTXPOOL_TEST_H
+
+#include "test_framework.h"
+
+void test_ctxpool_reuse(enum TEST_STATUS* status);
+void test_ctxpool_evict(enum TEST_STATUS* status);
+void test_ctxpool_thread(enum TEST_STATUS* status);
+
+EXPORT_PKG(ctxpool_pkg);
+#endif
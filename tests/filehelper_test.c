@@ -9,6 +9,7 @@
 #include "filehelper_test.h"
 #include "../filehelper.h"
 #include "../log.h"
+#include "../strings/stringhelper.h"
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -21,7 +22,8 @@ const struct unit_test filehelper_tests[] = {
 	MAKE_TEST(test_file_opened_for_writing),
 	MAKE_TEST(test_copy_file),
 	MAKE_TEST(test_rename_file),
-	MAKE_TEST(test_exists)
+	MAKE_TEST(test_exists),
+	MAKE_TEST(test_mkdir_recursive_cached)
 };
 MAKE_PKG(filehelper_tests, filehelper_pkg);
 
@@ -258,3 +260,42 @@ cleanup:
 	rmdir(dir);
 	remove(file);
 }
+
+void test_mkdir_recursive_cached(enum TEST_STATUS* status){
+	struct string_set* known = NULL;
+	char* cwd = NULL;
+	char* dir = NULL;
+
+	known = ss_new();
+	TEST_ASSERT(known);
+
+	cwd = sh_getcwd();
+	TEST_ASSERT(cwd);
+	dir = sh_concat_path(sh_dup(cwd), "mkdir_test/a/b/");
+	TEST_ASSERT(dir);
+
+	TEST_ASSERT(mkdir_recursive_cached(dir, known) == 0);
+	TEST_ASSERT(directory_exists("mkdir_test/a/b"));
+	/* mkdir_test, mkdir_test/a, and mkdir_test/a/b */
+	TEST_ASSERT(ss_len(known) == 3);
+
+	/* found in the cache without touching the disk */
+	rmdir("mkdir_test/a/b");
+	TEST_ASSERT(mkdir_recursive_cached(dir, known) > 0);
+	TEST_ASSERT(!directory_exists("mkdir_test/a/b"));
+
+	/* a fresh cache finds directories that already exist */
+	ss_free(known);
+	known = ss_new();
+	TEST_ASSERT(known);
+	TEST_ASSERT(mkdir_recursive_cached("mkdir_test/a", known) > 0);
+	TEST_ASSERT(ss_find(known, "mkdir_test/a"));
+
+cleanup:
+	rmdir("mkdir_test/a/b");
+	rmdir("mkdir_test/a");
+	rmdir("mkdir_test");
+	ss_free(known);
+	free(cwd);
+	free(dir);
+}
@@ -18,6 +18,7 @@ void test_file_opened_for_writing(enum TEST_STATUS* status);
 void test_copy_file(enum TEST_STATUS* status);
 void test_rename_file(enum TEST_STATUS* status);
 void test_exists(enum TEST_STATUS* status);
+void test_mkdir_recursive_cached(enum TEST_STATUS* status);
 
 extern const struct test_pkg filehelper_pkg;
 #endif
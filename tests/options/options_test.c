@@ -9,13 +9,17 @@
 #include "options_test.h"
 #include "../../log.h"
 #include "../../options/options.h"
+#include "../../options/options_file.h"
 #include "../../strings/stringhelper.h"
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 const struct unit_test options_tests[] = {
 	MAKE_TEST(test_parse_options_cmdline),
 	MAKE_TEST(test_parse_options_fromfile),
+	MAKE_TEST(test_options_resolve_auto),
 };
 MAKE_PKG(options_tests, options_pkg);
 
@@ -125,3 +129,79 @@ cleanup:
 	opt_read ? options_free(opt_read) : (void)0;
 	remove(file);
 }
+
+void test_options_resolve_auto(enum TEST_STATUS* status){
+	struct options* opt = NULL;
+	enum operation op;
+	char* argv_auto[] = {
+		"PROG_NAME",
+		"-C",
+		"auto",
+		"-e",
+		"auto",
+		"-o",
+		"options_auto"
+	};
+	const char* file = "options_auto/" OPTIONS_ALGORITHMS_FILE;
+	FILE* fp = NULL;
+
+	mkdir("options_auto", 0755);
+
+	/* the parser only notes that "auto" was asked for */
+	TEST_ASSERT(parse_options_cmdline(sizeof(argv_auto) / sizeof(argv_auto[0]), argv_auto, &opt, &op) == 0);
+	TEST_ASSERT(opt->flags.bits.flag_auto_hash && opt->flags.bits.flag_auto_cipher);
+	TEST_ASSERT(!does_file_exist(file));
+
+	/* nothing is recorded yet, so the algorithms are benchmarked */
+	TEST_ASSERT(options_resolve_auto(opt, 1) == 0);
+	TEST_ASSERT(!opt->flags.bits.flag_auto_hash && !opt->flags.bits.flag_auto_cipher);
+	TEST_ASSERT(opt->hash_algorithm && opt->enc_algorithm);
+
+	/* once a backup records its algorithms, "auto" reuses them */
+	opt->hash_algorithm = EVP_sha512();
+	opt->enc_algorithm = EVP_aes_256_cbc();
+	TEST_ASSERT(options_record_algorithms(opt) == 0);
+	opt->hash_algorithm = EVP_sha1();
+	opt->enc_algorithm = NULL;
+	opt->flags.bits.flag_auto_hash = 1;
+	opt->flags.bits.flag_auto_cipher = 1;
+	TEST_ASSERT(options_resolve_auto(opt, 1) == 0);
+	TEST_ASSERT(EVP_MD_type(opt->hash_algorithm) == EVP_MD_type(EVP_sha512()));
+	TEST_ASSERT(EVP_CIPHER_nid(opt->enc_algorithm) == EVP_CIPHER_nid(EVP_aes_256_cbc()));
+
+	/* an algorithm that was given explicitly is left alone */
+	opt->hash_algorithm = EVP_sha1();
+	opt->flags.bits.flag_auto_cipher = 1;
+	TEST_ASSERT(options_resolve_auto(opt, 1) == 0);
+	TEST_ASSERT(EVP_MD_type(opt->hash_algorithm) == EVP_MD_type(EVP_sha1()));
+
+	/* a backup made without encryption stays unencrypted */
+	opt->enc_algorithm = NULL;
+	TEST_ASSERT(options_record_algorithms(opt) == 0);
+	opt->enc_algorithm = EVP_aes_256_cbc();
+	opt->flags.bits.flag_auto_cipher = 1;
+	TEST_ASSERT(options_resolve_auto(opt, 1) == 0);
+	TEST_ASSERT(opt->enc_algorithm == NULL);
+
+	/* a recorded name that cannot be looked up is an error, not "none" */
+	fp = create_option_file(file);
+	TEST_ASSERT(fp);
+	TEST_ASSERT(add_option_tofile(fp, "HASH_ALGORITHM", "SHA512", sizeof("SHA512")) == 0);
+	TEST_ASSERT(add_option_tofile(fp, "ENC_ALGORITHM", "NOT-A-CIPHER", sizeof("NOT-A-CIPHER")) == 0);
+	fclose(fp);
+	fp = NULL;
+	opt->flags.bits.flag_auto_cipher = 1;
+	TEST_ASSERT(options_resolve_auto(opt, 1) != 0);
+
+	/* without a record, only a backup may benchmark */
+	remove(file);
+	opt->flags.bits.flag_auto_hash = 1;
+	opt->flags.bits.flag_auto_cipher = 0;
+	TEST_ASSERT(options_resolve_auto(opt, 0) != 0);
+
+cleanup:
+	fp ? fclose(fp) : 0;
+	opt ? options_free(opt) : (void)0;
+	remove(file);
+	rmdir("options_auto");
+}
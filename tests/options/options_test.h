@@ -13,6 +13,7 @@
 
 void test_parse_options_cmdline(enum TEST_STATUS* status);
 void test_parse_options_fromfile(enum TEST_STATUS* status);
+void test_options_resolve_auto(enum TEST_STATUS* status);
 
 EXPORT_PKG(options_pkg);
 #endif
@@ -0,0 +1,117 @@
+/** @file tests/strings/arena_test.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "arena_test.h"
+#include "../../strings/arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+const struct unit_test arena_tests[] = {
+	MAKE_TEST(test_arena_alloc),
+	MAKE_TEST(test_arena_join),
+	MAKE_TEST(test_arena_concat_path),
+	MAKE_TEST(test_arena_reset)
+};
+MAKE_PKG(arena_tests, arena_pkg);
+
+void test_arena_alloc(enum TEST_STATUS* status){
+	struct arena* a = NULL;
+	unsigned char* ptrs[64];
+	unsigned char* big = NULL;
+	size_t i;
+
+	a = arena_new(128);
+	TEST_ASSERT(a);
+
+	for (i = 0; i < sizeof(ptrs) / sizeof(ptrs[0]); ++i){
+		ptrs[i] = arena_alloc(a, i + 1);
+		TEST_ASSERT(ptrs[i]);
+		TEST_ASSERT((size_t)ptrs[i] % sizeof(void*) == 0);
+		memset(ptrs[i], (int)i, i + 1);
+	}
+
+	/* larger than a chunk */
+	big = arena_alloc(a, 1000);
+	TEST_ASSERT(big);
+	memset(big, 0xFF, 1000);
+
+	for (i = 0; i < sizeof(ptrs) / sizeof(ptrs[0]); ++i){
+		TEST_ASSERT(ptrs[i][0] == (unsigned char)i && ptrs[i][i] == (unsigned char)i);
+	}
+
+cleanup:
+	arena_free(a);
+}
+
+void test_arena_join(enum TEST_STATUS* status){
+	struct arena* a = NULL;
+	char* str;
+
+	a = arena_new(0);
+	TEST_ASSERT(a);
+
+	str = arena_join(a, "/home", "/user", "/file.txt", NULL);
+	TEST_ASSERT(str);
+	TEST_ASSERT(strcmp(str, "/home/user/file.txt") == 0);
+
+	str = arena_join(a, NULL);
+	TEST_ASSERT(str);
+	TEST_ASSERT(strcmp(str, "") == 0);
+
+	str = arena_dup_n(a, "hunter2", 6);
+	TEST_ASSERT(str);
+	TEST_ASSERT(strcmp(str, "hunter") == 0);
+
+cleanup:
+	arena_free(a);
+}
+
+void test_arena_concat_path(enum TEST_STATUS* status){
+	struct arena* a = NULL;
+	char* str;
+
+	a = arena_new(0);
+	TEST_ASSERT(a);
+
+	str = arena_concat_path(a, "/out/files", "/home/user/file.txt", NULL);
+	TEST_ASSERT(str);
+	TEST_ASSERT(strcmp(str, "/out/files/home/user/file.txt") == 0);
+
+	str = arena_concat_path(a, "/out/files/", "home/user/file.txt", ".123");
+	TEST_ASSERT(str);
+	TEST_ASSERT(strcmp(str, "/out/files/home/user/file.txt.123") == 0);
+
+cleanup:
+	arena_free(a);
+}
+
+void test_arena_reset(enum TEST_STATUS* status){
+	struct arena* a = NULL;
+	void* first;
+	void* tmp;
+	size_t i;
+
+	a = arena_new(256);
+	TEST_ASSERT(a);
+
+	first = arena_alloc(a, 16);
+	TEST_ASSERT(first);
+	for (i = 0; i < 100; ++i){
+		TEST_ASSERT(arena_alloc(a, 100));
+	}
+
+	/* the first chunk is reused after a reset */
+	arena_reset(a);
+	tmp = arena_alloc(a, 16);
+	TEST_ASSERT(tmp == first);
+
+	arena_reset(NULL);
+
+cleanup:
+	arena_free(a);
+}
@@ -0,0 +1,20 @@
+/** @file tests/strings/arena_test.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __ARENA_TEST_H
+#define __ARENA_TEST_H
+
+#include "../test_framework.h"
+
+void test_arena_alloc(enum TEST_STATUS* status);
+void test_arena_join(enum TEST_STATUS* status);
+void test_arena_concat_path(enum TEST_STATUS* status);
+void test_arena_reset(enum TEST_STATUS* status);
+
+EXPORT_PKG(arena_pkg);
+#endif
@@ -21,6 +21,7 @@ const struct unit_test stringarray_tests[] = {
 	MAKE_TEST(test_sa_insert),
 	MAKE_TEST(test_sa_contains),
 	MAKE_TEST(test_sa_sanitize_directories),
+	MAKE_TEST(test_sa_normalize_roots),
 	MAKE_TEST(test_sa_sort),
 	MAKE_TEST(test_sa_cmp),
 	MAKE_TEST(test_sa_get_parent_dirs),
@@ -122,6 +123,65 @@ cleanup:
 	sa ? sa_free(sa) : (void)0;
 }
 
+void test_sa_normalize_roots(enum TEST_STATUS* status){
+	struct string_array* dirs = NULL;
+	struct string_array* exclude = NULL;
+	char* cwd = NULL;
+	char* expected = NULL;
+
+	cwd = sh_getcwd();
+	TEST_ASSERT(cwd);
+
+	TEST_ASSERT(mkdir("roots", 0755) == 0 || errno == EEXIST);
+	TEST_ASSERT(mkdir("roots/a", 0755) == 0 || errno == EEXIST);
+	TEST_ASSERT(mkdir("roots/a/b", 0755) == 0 || errno == EEXIST);
+	TEST_ASSERT(mkdir("roots/a2", 0755) == 0 || errno == EEXIST);
+	TEST_ASSERT(mkdir("roots/c", 0755) == 0 || errno == EEXIST);
+	TEST_ASSERT(symlink("a/b", "roots/link") == 0 || errno == EEXIST);
+
+	dirs = sa_new();
+	exclude = sa_new();
+	TEST_ASSERT(dirs && exclude);
+
+	TEST_ASSERT(sa_add(dirs, "roots/a") == 0);
+	TEST_ASSERT(sa_add(dirs, "roots/a2/../a/b") == 0);
+	TEST_ASSERT(sa_add(dirs, "roots/link") == 0);
+	TEST_ASSERT(sa_add(dirs, "roots/a2") == 0);
+	TEST_ASSERT(sa_add(dirs, "roots/c") == 0);
+	TEST_ASSERT(sa_add(dirs, "roots/noexist") == 0);
+
+	TEST_ASSERT(sa_add(exclude, "roots/a/b") == 0);
+	TEST_ASSERT(sa_add(exclude, "roots/c") == 0);
+	TEST_ASSERT(sa_add(exclude, "/dev") == 0);
+
+	/* "a/b" and "link" are nested in "a", "c" is excluded, and "noexist" does not exist */
+	TEST_ASSERT(sa_normalize_roots(dirs, exclude) == 4);
+	TEST_ASSERT(dirs->len == 2);
+	expected = sh_sprintf("%s/roots/a/", cwd);
+	TEST_ASSERT(strcmp(dirs->strings[0], expected) == 0);
+	free(expected);
+	expected = sh_sprintf("%s/roots/a2/", cwd);
+	TEST_ASSERT(strcmp(dirs->strings[1], expected) == 0);
+	free(expected);
+
+	/* "/dev" and "c" are not within any directory */
+	TEST_ASSERT(exclude->len == 1);
+	expected = sh_sprintf("%s/roots/a/b/", cwd);
+	TEST_ASSERT(strcmp(exclude->strings[0], expected) == 0);
+
+cleanup:
+	remove("roots/link");
+	rmdir("roots/a/b");
+	rmdir("roots/a");
+	rmdir("roots/a2");
+	rmdir("roots/c");
+	rmdir("roots");
+	sa_free(dirs);
+	sa_free(exclude);
+	free(cwd);
+	free(expected);
+}
+
 void test_sa_sort(enum TEST_STATUS* status){
 	struct string_array* sa = NULL;
 
@@ -15,6 +15,7 @@ void test_sa_add(enum TEST_STATUS* status);
 void test_sa_insert(enum TEST_STATUS* status);
 void test_sa_contains(enum TEST_STATUS* status);
 void test_sa_sanitize_directories(enum TEST_STATUS* status);
+void test_sa_normalize_roots(enum TEST_STATUS* status);
 void test_sa_sort(enum TEST_STATUS* status);
 void test_sa_cmp(enum TEST_STATUS* status);
 void test_sa_get_parent_dirs(enum TEST_STATUS* status);
@@ -0,0 +1,93 @@
+/** @file tests/strings/stringset_test.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "stringset_test.h"
+#include "../../strings/stringset.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const struct unit_test stringset_tests[] = {
+	MAKE_TEST(test_ss_intern),
+	MAKE_TEST(test_ss_find),
+	MAKE_TEST(test_ss_grow)
+};
+MAKE_PKG(stringset_tests, stringset_pkg);
+
+void test_ss_intern(enum TEST_STATUS* status){
+	struct string_set* ss = NULL;
+	char buf[32];
+	const char* s1;
+	const char* s2;
+
+	ss = ss_new();
+	TEST_ASSERT(ss);
+
+	strcpy(buf, "/home/user");
+	s1 = ss_intern(ss, buf);
+	TEST_ASSERT(s1);
+	TEST_ASSERT(s1 != buf);
+	TEST_ASSERT(strcmp(s1, "/home/user") == 0);
+
+	/* the same string interns to the same address */
+	s2 = ss_intern(ss, "/home/user");
+	TEST_ASSERT(s1 == s2);
+
+	/* the string does not need to be null-terminated */
+	s2 = ss_intern_n(ss, "/home/user/file.txt", strlen("/home/user"));
+	TEST_ASSERT(s1 == s2);
+
+	TEST_ASSERT(ss_len(ss) == 1);
+
+cleanup:
+	ss_free(ss);
+}
+
+void test_ss_find(enum TEST_STATUS* status){
+	struct string_set* ss = NULL;
+
+	ss = ss_new();
+	TEST_ASSERT(ss);
+
+	TEST_ASSERT(ss_find(ss, "/home") == NULL);
+	TEST_ASSERT(ss_intern(ss, "/home"));
+	TEST_ASSERT(ss_intern(ss, ""));
+	TEST_ASSERT(ss_find(ss, "/home"));
+	TEST_ASSERT(ss_find(ss, ""));
+	TEST_ASSERT(ss_find(ss, "/hom") == NULL);
+	TEST_ASSERT(ss_find_n(ss, "/home/user", 5));
+
+cleanup:
+	ss_free(ss);
+}
+
+void test_ss_grow(enum TEST_STATUS* status){
+	struct string_set* ss = NULL;
+	const char* ptrs[1000];
+	char buf[32];
+	size_t i;
+
+	ss = ss_new();
+	TEST_ASSERT(ss);
+
+	for (i = 0; i < sizeof(ptrs) / sizeof(ptrs[0]); ++i){
+		sprintf(buf, "/dir/%lu", (unsigned long)i);
+		ptrs[i] = ss_intern(ss, buf);
+		TEST_ASSERT(ptrs[i]);
+	}
+	TEST_ASSERT(ss_len(ss) == sizeof(ptrs) / sizeof(ptrs[0]));
+
+	/* addresses are stable across growth */
+	for (i = 0; i < sizeof(ptrs) / sizeof(ptrs[0]); ++i){
+		sprintf(buf, "/dir/%lu", (unsigned long)i);
+		TEST_ASSERT(ss_find(ss, buf) == ptrs[i]);
+	}
+
+cleanup:
+	ss_free(ss);
+}
@@ -0,0 +1,19 @@
+/** @file tests/strings/stringset_test.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __STRINGSET_TEST_H
+#define __STRINGSET_TEST_H
+
+#include "../test_framework.h"
+
+void test_ss_intern(enum TEST_STATUS* status);
+void test_ss_find(enum TEST_STATUS* status);
+void test_ss_grow(enum TEST_STATUS* status);
+
+EXPORT_PKG(stringset_pkg);
+#endif
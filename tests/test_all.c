@@ -8,24 +8,37 @@
 
 #include "test_framework.h"
 #include "backup_test.h"
+#include "blockcrc_test.h"
 #include "checksum_test.h"
 #include "cli_test.h"
 #include "coredumps_test.h"
+#include "ctxpool_test.h"
+#include "crc32c_test.h"
 #include "filehelper_test.h"
 #include "fileiterator_test.h"
 #include "log_test.h"
 #include "progressbar_test.h"
+#include "threadpool_test.h"
+#include "treehash_test.h"
+#include "verify_test.h"
+#include "watch_test.h"
 #include "cloud/base_test.h"
 #include "cloud/cloud_options_test.h"
 #include "compression/zip_test.h"
 #include "crypt/crypt_test.h"
+#include "crypt/crypt_aead_test.h"
+#include "crypt/crypt_bench_test.h"
 #include "crypt/crypt_easy_test.h"
 #include "crypt/crypt_getpassword_test.h"
+#include "crypt/crypt_manifest_test.h"
+#include "crypt/crypt_master_test.h"
 #include "options/options_test.h"
 #include "options/options_file_test.h"
 #include "options/options_menu_test.h"
+#include "strings/arena_test.h"
 #include "strings/stringarray_test.h"
 #include "strings/stringhelper_test.h"
+#include "strings/stringset_test.h"
 #include <stdlib.h>
 #include <string.h>
 #include "../cli.h"
@@ -45,24 +58,37 @@ void register_package(const struct test_pkg* pkg_toreg, const struct test_pkg***
 
 void register_all_packages(const struct test_pkg*** pkg_arr, size_t* pkgs_len){
 	register_package(&backup_pkg, pkg_arr, pkgs_len);
+	register_package(&blockcrc_pkg, pkg_arr, pkgs_len);
 	register_package(&checksum_pkg, pkg_arr, pkgs_len);
 	register_package(&cli_pkg, pkg_arr, pkgs_len);
 	register_package(&coredumps_pkg, pkg_arr, pkgs_len);
+	register_package(&ctxpool_pkg, pkg_arr, pkgs_len);
+	register_package(&crc32c_pkg, pkg_arr, pkgs_len);
 	register_package(&filehelper_pkg, pkg_arr, pkgs_len);
 	register_package(&fileiterator_pkg, pkg_arr, pkgs_len);
 	register_package(&log_pkg, pkg_arr, pkgs_len);
 	register_package(&progressbar_pkg, pkg_arr, pkgs_len);
+	register_package(&threadpool_pkg, pkg_arr, pkgs_len);
+	register_package(&treehash_pkg, pkg_arr, pkgs_len);
+	register_package(&verify_pkg, pkg_arr, pkgs_len);
+	register_package(&watch_pkg, pkg_arr, pkgs_len);
 	register_package(&cloud_base_pkg, pkg_arr, pkgs_len);
 	register_package(&cloud_options_pkg, pkg_arr, pkgs_len);
 	register_package(&compression_zip_pkg, pkg_arr, pkgs_len);
 	register_package(&crypt_pkg, pkg_arr, pkgs_len);
+	register_package(&crypt_aead_pkg, pkg_arr, pkgs_len);
+	register_package(&crypt_bench_pkg, pkg_arr, pkgs_len);
 	register_package(&crypt_easy_pkg, pkg_arr, pkgs_len);
 	register_package(&crypt_getpassword_pkg, pkg_arr, pkgs_len);
+	register_package(&crypt_manifest_pkg, pkg_arr, pkgs_len);
+	register_package(&crypt_master_pkg, pkg_arr, pkgs_len);
 	register_package(&options_pkg, pkg_arr, pkgs_len);
 	register_package(&options_file_pkg, pkg_arr, pkgs_len);
 	register_package(&options_menu_pkg, pkg_arr, pkgs_len);
+	register_package(&arena_pkg, pkg_arr, pkgs_len);
 	register_package(&stringarray_pkg, pkg_arr, pkgs_len);
 	register_package(&stringhelper_pkg, pkg_arr, pkgs_len);
+	register_package(&stringset_pkg, pkg_arr, pkgs_len);
 }
 
 void add_string_toarr(const char* str, const char*** str_arr, size_t* arr_len){
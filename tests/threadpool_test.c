@@ -0,0 +1,88 @@
+/** @file tests/threadpool_test.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "threadpool_test.h"
+#include "../threadpool.h"
+#include <stdlib.h>
+#include <string.h>
+
+const struct unit_test threadpool_tests[] = {
+	MAKE_TEST(test_tp_submit),
+	MAKE_TEST(test_tp_inline)
+};
+MAKE_PKG(threadpool_tests, threadpool_pkg);
+
+struct counter{
+	unsigned long per_thread[4];
+	int bad_index;
+};
+
+static void count_job(void* arg, unsigned thread_index){
+	struct counter* c = arg;
+	if (thread_index >= 4){
+		c->bad_index = 1;
+		return;
+	}
+	/* no two jobs with the same index run at once, so this does not need a lock */
+	c->per_thread[thread_index]++;
+}
+
+void test_tp_submit(enum TEST_STATUS* status){
+	struct threadpool* tp = NULL;
+	struct counter c;
+	unsigned long total = 0;
+	size_t i;
+
+	memset(&c, 0, sizeof(c));
+
+	tp = tp_new(4);
+	TEST_ASSERT(tp);
+	TEST_ASSERT(tp_threads(tp) == 4);
+
+	for (i = 0; i < 1000; ++i){
+		TEST_ASSERT(tp_submit(tp, count_job, &c) == 0);
+	}
+	tp_wait(tp);
+
+	TEST_ASSERT(!c.bad_index);
+	for (i = 0; i < 4; ++i){
+		total += c.per_thread[i];
+	}
+	TEST_ASSERT(total == 1000);
+
+	/* the pool can be reused after waiting */
+	TEST_ASSERT(tp_submit(tp, count_job, &c) == 0);
+	tp_wait(tp);
+	total = 0;
+	for (i = 0; i < 4; ++i){
+		total += c.per_thread[i];
+	}
+	TEST_ASSERT(total == 1001);
+
+cleanup:
+	tp_free(tp);
+}
+
+void test_tp_inline(enum TEST_STATUS* status){
+	struct threadpool* tp = NULL;
+	struct counter c;
+
+	memset(&c, 0, sizeof(c));
+
+	tp = tp_new(0);
+	TEST_ASSERT(tp);
+	TEST_ASSERT(tp_threads(tp) == 1);
+
+	/* runs before tp_submit() returns */
+	TEST_ASSERT(tp_submit(tp, count_job, &c) == 0);
+	TEST_ASSERT(c.per_thread[0] == 1);
+	tp_wait(tp);
+
+cleanup:
+	tp_free(tp);
+}
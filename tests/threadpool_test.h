@@ -0,0 +1,18 @@
+/** @file tests/threadpool_test.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __THREADPOOL_TEST_H
+#define __THREADPOOL_TEST_H
+
+#include "test_framework.h"
+
+void test_tp_submit(enum TEST_STATUS* status);
+void test_tp_inline(enum TEST_STATUS* status);
+
+EXPORT_PKG(threadpool_pkg);
+#endif
@@ -0,0 +1,246 @@
+/** @file tests/treehash_test.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "treehash_test.h"
+#include "../treehash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+const struct unit_test treehash_tests[] = {
+	MAKE_TEST(test_tree_hash_file),
+	MAKE_TEST(test_tree_hash_stream),
+	MAKE_TEST(test_tree_hash_save_load),
+	MAKE_TEST(test_tree_hash_diff)
+};
+MAKE_PKG(treehash_tests, treehash_pkg);
+
+#define SAMPLE_SHIFT (10)
+#define SAMPLE_LEAF (1 << SAMPLE_SHIFT)
+/* an odd amount of leaves with a partial one at the end, so a node gets carried up */
+#define SAMPLE_LEN (5 * SAMPLE_LEAF + 300)
+
+static void digest_prefixed(unsigned char prefix, const unsigned char* a, size_t a_len, const unsigned char* b, size_t b_len, unsigned char* out){
+	EVP_MD_CTX* ctx = EVP_MD_CTX_create();
+
+	EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+	EVP_DigestUpdate(ctx, &prefix, 1);
+	EVP_DigestUpdate(ctx, a, a_len);
+	EVP_DigestUpdate(ctx, b, b_len);
+	EVP_DigestFinal_ex(ctx, out, NULL);
+	EVP_MD_CTX_destroy(ctx);
+}
+
+void test_tree_hash_file(enum TEST_STATUS* status){
+	const char* file = "tree.txt";
+	const char* file_empty = "tree_empty.txt";
+	static unsigned char data[SAMPLE_LEN];
+	unsigned char leaves[6][32];
+	unsigned char nodes[3][32];
+	unsigned char root[32];
+	struct tree_hash* th_single = NULL;
+	struct tree_hash* th_parallel = NULL;
+	struct tree_hash* th_empty = NULL;
+	const unsigned char* out;
+	unsigned len;
+	size_t i;
+
+	fill_sample_data(data, sizeof(data));
+	create_file(file, data, sizeof(data));
+	create_file(file_empty, "", 0);
+
+	/* the tree by hand. leaf 5 has no partner on the first level, and nodes[2] has none on the second */
+	for (i = 0; i < 6; ++i){
+		size_t leaf_len = i < 5 ? SAMPLE_LEAF : SAMPLE_LEN - 5 * SAMPLE_LEAF;
+		digest_prefixed(0x00, data + i * SAMPLE_LEAF, leaf_len, NULL, 0, leaves[i]);
+	}
+	for (i = 0; i < 3; ++i){
+		digest_prefixed(0x01, leaves[2 * i], 32, leaves[2 * i + 1], 32, nodes[i]);
+	}
+	digest_prefixed(0x01, nodes[0], 32, nodes[1], 32, nodes[0]);
+	digest_prefixed(0x01, nodes[0], 32, nodes[2], 32, root);
+
+	th_single = tree_hash_file(file, EVP_sha256(), SAMPLE_SHIFT, 0);
+	TEST_ASSERT(th_single);
+	TEST_ASSERT(tree_hash_size(th_single) == SAMPLE_LEN);
+	TEST_ASSERT(tree_hash_leaf_count(th_single) == 6);
+	for (i = 0; i < 6; ++i){
+		TEST_ASSERT(memcmp(tree_hash_leaf(th_single, i), leaves[i], 32) == 0);
+	}
+	TEST_ASSERT(tree_hash_leaf(th_single, 6) == NULL);
+	out = tree_hash_root(th_single, &len);
+	TEST_ASSERT(len == 32);
+	TEST_ASSERT(memcmp(out, root, 32) == 0);
+
+	/* the number of threads does not change the result */
+	th_parallel = tree_hash_file(file, EVP_sha256(), SAMPLE_SHIFT, 4);
+	TEST_ASSERT(th_parallel);
+	TEST_ASSERT(memcmp(tree_hash_root(th_parallel, NULL), root, 32) == 0);
+
+	/* an empty file is one empty leaf */
+	th_empty = tree_hash_file(file_empty, EVP_sha256(), SAMPLE_SHIFT, 4);
+	TEST_ASSERT(th_empty);
+	TEST_ASSERT(tree_hash_leaf_count(th_empty) == 1);
+	digest_prefixed(0x00, NULL, 0, NULL, 0, root);
+	TEST_ASSERT(memcmp(tree_hash_root(th_empty, NULL), root, 32) == 0);
+
+	/* leaf sizes out of range */
+	TEST_ASSERT(tree_hash_file(file, EVP_sha256(), TREE_HASH_MIN_SHIFT - 1, 0) == NULL);
+	TEST_ASSERT(tree_hash_file(file, EVP_sha256(), TREE_HASH_MAX_SHIFT + 1, 0) == NULL);
+
+cleanup:
+	tree_hash_free(th_single);
+	tree_hash_free(th_parallel);
+	tree_hash_free(th_empty);
+	remove(file);
+	remove(file_empty);
+}
+
+void test_tree_hash_stream(enum TEST_STATUS* status){
+	const char* file = "tree.txt";
+	static unsigned char data[SAMPLE_LEN];
+	struct tree_hash* th_file = NULL;
+	struct tree_hash* th_stream = NULL;
+	struct tree_hash* th_short = NULL;
+	struct tree_hash* th_empty = NULL;
+	unsigned char root[32];
+	size_t pos;
+	size_t i;
+
+	fill_sample_data(data, sizeof(data));
+	create_file(file, data, sizeof(data));
+
+	th_file = tree_hash_file(file, EVP_sha256(), SAMPLE_SHIFT, 0);
+	TEST_ASSERT(th_file);
+
+	/* pieces that straddle leaf boundaries give the same tree as reading the file */
+	th_stream = tree_hash_begin(SAMPLE_LEN, EVP_sha256(), SAMPLE_SHIFT);
+	TEST_ASSERT(th_stream);
+	for (pos = 0; pos < SAMPLE_LEN; pos += 700){
+		TEST_ASSERT(tree_hash_update(th_stream, data + pos, SAMPLE_LEN - pos < 700 ? SAMPLE_LEN - pos : 700) == 0);
+	}
+	TEST_ASSERT(tree_hash_update(th_stream, data, 1) < 0);
+	TEST_ASSERT(tree_hash_end(th_stream) == 0);
+	TEST_ASSERT(tree_hash_leaf_count(th_stream) == tree_hash_leaf_count(th_file));
+	for (i = 0; i < tree_hash_leaf_count(th_file); ++i){
+		TEST_ASSERT(memcmp(tree_hash_leaf(th_stream, i), tree_hash_leaf(th_file, i), 32) == 0);
+	}
+	TEST_ASSERT(memcmp(tree_hash_root(th_stream, NULL), tree_hash_root(th_file, NULL), 32) == 0);
+	TEST_ASSERT(tree_hash_end(th_stream) < 0);
+
+	/* too little data */
+	th_short = tree_hash_begin(SAMPLE_LEN, EVP_sha256(), SAMPLE_SHIFT);
+	TEST_ASSERT(th_short);
+	TEST_ASSERT(tree_hash_update(th_short, data, SAMPLE_LEN - 1) == 0);
+	TEST_ASSERT(tree_hash_end(th_short) < 0);
+
+	th_empty = tree_hash_begin(0, EVP_sha256(), SAMPLE_SHIFT);
+	TEST_ASSERT(th_empty);
+	TEST_ASSERT(tree_hash_end(th_empty) == 0);
+	digest_prefixed(0x00, NULL, 0, NULL, 0, root);
+	TEST_ASSERT(memcmp(tree_hash_root(th_empty, NULL), root, 32) == 0);
+
+cleanup:
+	tree_hash_free(th_file);
+	tree_hash_free(th_stream);
+	tree_hash_free(th_short);
+	tree_hash_free(th_empty);
+	remove(file);
+}
+
+void test_tree_hash_save_load(enum TEST_STATUS* status){
+	const char* file = "tree.txt";
+	const char* file_saved = "tree.ezt";
+	static unsigned char data[SAMPLE_LEN];
+	struct tree_hash* th = NULL;
+	struct tree_hash* th_loaded = NULL;
+	FILE* fp = NULL;
+	size_t i;
+
+	fill_sample_data(data, sizeof(data));
+	create_file(file, data, sizeof(data));
+
+	th = tree_hash_file(file, EVP_sha1(), SAMPLE_SHIFT, 2);
+	TEST_ASSERT(th);
+	TEST_ASSERT(tree_hash_save(th, file_saved) == 0);
+
+	th_loaded = tree_hash_load(file_saved);
+	TEST_ASSERT(th_loaded);
+	TEST_ASSERT(tree_hash_size(th_loaded) == tree_hash_size(th));
+	TEST_ASSERT(tree_hash_leaf_count(th_loaded) == tree_hash_leaf_count(th));
+	TEST_ASSERT(memcmp(tree_hash_root(th_loaded, NULL), tree_hash_root(th, NULL), 20) == 0);
+	for (i = 0; i < tree_hash_leaf_count(th); ++i){
+		TEST_ASSERT(memcmp(tree_hash_leaf(th_loaded, i), tree_hash_leaf(th, i), 20) == 0);
+	}
+	tree_hash_free(th_loaded);
+	th_loaded = NULL;
+
+	/* a damaged leaf no longer matches the saved root */
+	fp = fopen(file_saved, "r+b");
+	TEST_ASSERT(fp);
+	TEST_ASSERT(fseek(fp, -1, SEEK_END) == 0);
+	TEST_ASSERT(fputc(0xAA ^ tree_hash_leaf(th, tree_hash_leaf_count(th) - 1)[19], fp) != EOF);
+	TEST_ASSERT(fclose(fp) == 0);
+	fp = NULL;
+	TEST_ASSERT(tree_hash_load(file_saved) == NULL);
+
+	/* nor is a truncated one accepted */
+	TEST_ASSERT(tree_hash_save(th, file_saved) == 0);
+	TEST_ASSERT(truncate(file_saved, 40) == 0);
+	TEST_ASSERT(tree_hash_load(file_saved) == NULL);
+
+cleanup:
+	fp ? fclose(fp) : 0;
+	tree_hash_free(th);
+	tree_hash_free(th_loaded);
+	remove(file);
+	remove(file_saved);
+}
+
+void test_tree_hash_diff(enum TEST_STATUS* status){
+	const char* file = "tree.txt";
+	static unsigned char data[SAMPLE_LEN + 1000];
+	struct tree_hash* th_prev = NULL;
+	struct tree_hash* th_cur = NULL;
+	size_t* changed = NULL;
+	size_t n_changed;
+
+	fill_sample_data(data, sizeof(data));
+	create_file(file, data, SAMPLE_LEN);
+	th_prev = tree_hash_file(file, EVP_sha256(), SAMPLE_SHIFT, 2);
+	TEST_ASSERT(th_prev);
+
+	/* nothing changed */
+	TEST_ASSERT(tree_hash_diff(th_prev, th_prev, &changed, &n_changed) == 0);
+	TEST_ASSERT(n_changed == 0);
+	TEST_ASSERT(changed == NULL);
+
+	/* one byte in leaf 3 changes, and data is appended, which changes the partial leaf 5 and adds leaf 6 */
+	data[3 * SAMPLE_LEAF + 5] ^= 0xFF;
+	create_file(file, data, sizeof(data));
+	th_cur = tree_hash_file(file, EVP_sha256(), SAMPLE_SHIFT, 2);
+	TEST_ASSERT(th_cur);
+
+	TEST_ASSERT(tree_hash_diff(th_prev, th_cur, &changed, &n_changed) == 0);
+	TEST_ASSERT(n_changed == 3);
+	TEST_ASSERT(changed[0] == 3);
+	TEST_ASSERT(changed[1] == 5);
+	TEST_ASSERT(changed[2] == 6);
+
+	/* checking single regions against the previous version */
+	TEST_ASSERT(tree_hash_verify_leaf(th_prev, file, 0) == 0);
+	TEST_ASSERT(tree_hash_verify_leaf(th_prev, file, 3) > 0);
+	TEST_ASSERT(tree_hash_verify_leaf(th_cur, file, 3) == 0);
+	TEST_ASSERT(tree_hash_verify_leaf(th_cur, file, 7) < 0);
+
+cleanup:
+	free(changed);
+	tree_hash_free(th_prev);
+	tree_hash_free(th_cur);
+	remove(file);
+}
@@ -0,0 +1,274 @@
+/** @file tests/verify_test.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "verify_test.h"
+#include "../verify.h"
+#include "../checksum.h"
+#include "../filehelper.h"
+#include "../strings/stringhelper.h"
+#include "../crypt/crypt_easy.h"
+#include "../crypt/crypt_master.h"
+#include "../compression/zip.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const struct unit_test verify_tests[] = {
+	MAKE_TEST(test_verify_directory),
+	MAKE_TEST(test_verify_encrypted)
+};
+MAKE_PKG(verify_tests, verify_pkg);
+
+#define SMALL_LEN (100000)
+#define BIG_LEN (CHECKSUM_APPEND_MIN_SIZE + 500000)
+#define BIG_APPEND_LEN ((1 << 20) + 777)
+
+static void flip_byte(const char* file, long offset){
+	FILE* fp = fopen(file, "r+b");
+	int c;
+
+	fseek(fp, offset, SEEK_SET);
+	c = fgetc(fp);
+	fseek(fp, offset, SEEK_SET);
+	fputc(c ^ 0xFF, fp);
+	fclose(fp);
+}
+
+static int count_lines(FILE* report, const char* prefix){
+	char line[512];
+	int ret = 0;
+
+	rewind(report);
+	while (fgets(line, sizeof(line), report)){
+		ret += !strncmp(line, prefix, strlen(prefix));
+	}
+	return ret;
+}
+
+static struct options* verify_options(const char* output_directory, enum compressor c_type){
+	struct options* opt = options_new();
+
+	if (!opt){
+		return NULL;
+	}
+	opt->output_directory = sh_dup(output_directory);
+	opt->hash_algorithm = EVP_sha256();
+	opt->enc_algorithm = NULL;
+	opt->c_type = c_type;
+	opt->c_flags = ZIP_THREADS(2);
+	return opt;
+}
+
+/* makes a backup of a small file and a large file that had data appended to it after it was stored, the way backup() lays it out */
+static int make_backup(const char* dir, enum compressor c_type, unsigned c_flags, const char* enc_algorithm, const struct crypt_master* cm, char*** out_objects){
+	const char* files[] = { "verify_in/a.bin", "verify_in/b.bin" };
+	static unsigned char data[BIG_LEN + BIG_APPEND_LEN];
+	char* objects[3] = { NULL, NULL, NULL };
+	char* checksum_file = NULL;
+	char* checksum_prev = NULL;
+	char* tmp = NULL;
+	char offset_str[32];
+	unsigned long offset;
+	FILE* fp = NULL;
+	FILE* fp_prev = NULL;
+	size_t i;
+	int ret = -1;
+
+	fill_sample_data(data, sizeof(data));
+	mkdir("verify_in", 0755);
+	create_file(files[0], data, SMALL_LEN);
+	create_file(files[1], data, BIG_LEN);
+
+	checksum_file = sh_concat_path(sh_dup(dir), "checksums.txt");
+	checksum_prev = sh_concat_path(sh_dup(dir), "checksums.prev");
+	objects[0] = sh_concat_path(sh_concat_path(sh_dup(dir), "files"), files[0]);
+	objects[1] = sh_concat_path(sh_concat_path(sh_dup(dir), "files"), files[1]);
+	tmp = sh_concat_path(sh_concat_path(sh_dup(dir), "appends"), files[1]);
+	if (!checksum_file || !checksum_prev || !objects[0] || !objects[1] || !tmp ||
+			mkdir_recursive(tmp) != 0){
+		goto cleanup;
+	}
+	free(tmp);
+	tmp = sh_concat_path(sh_concat_path(sh_dup(dir), "files"), "verify_in");
+	if (!tmp || mkdir_recursive(tmp) != 0){
+		goto cleanup;
+	}
+
+	/* the large file is stored, and then grows */
+	fp_prev = fopen(checksum_prev, "w+b");
+	if (!fp_prev || add_checksum_to_file_ex(files[1], EVP_sha256(), fp_prev, NULL, NULL, &offset) != 0 ||
+			zip_compress(files[1], objects[1], c_type, 0, c_flags) != 0){
+		goto cleanup;
+	}
+	create_file(files[1], data, sizeof(data));
+	rewind(fp_prev);
+
+	fp = fopen(checksum_file, "wb");
+	if (!fp || add_checksum_to_file(files[0], EVP_sha256(), fp, NULL, NULL) != 0 ||
+			add_checksum_to_file_ex(files[1], EVP_sha256(), fp, fp_prev, NULL, &offset) != CHECKSUM_APPENDED ||
+			offset != BIG_LEN){
+		goto cleanup;
+	}
+	fclose(fp);
+	fp = NULL;
+	if (sort_checksum_file(checksum_file) != 0 || zip_compress(files[0], objects[0], c_type, 0, c_flags) != 0){
+		goto cleanup;
+	}
+
+	sprintf(offset_str, "%lu", offset);
+	objects[2] = sh_concat_path(sh_concat_path(sh_concat_path(sh_dup(dir), "appends"), files[1]), offset_str);
+	if (!objects[2] || zip_compress_tail(files[1], objects[2], offset, c_type, 0, c_flags) != 0){
+		goto cleanup;
+	}
+
+	if (enc_algorithm){
+		for (i = 0; i < 3; ++i){
+			if (easy_encrypt_master_inplace(objects[i], enc_algorithm, 0, cm, 0) != 0){
+				goto cleanup;
+			}
+		}
+	}
+
+	*out_objects = malloc(3 * sizeof(**out_objects));
+	if (!*out_objects){
+		goto cleanup;
+	}
+	memcpy(*out_objects, objects, sizeof(objects));
+	memset(objects, 0, sizeof(objects));
+	ret = 0;
+
+cleanup:
+	fp ? fclose(fp) : 0;
+	fp_prev ? fclose(fp_prev) : 0;
+	checksum_prev ? remove(checksum_prev) : 0;
+	for (i = 0; i < 3; ++i){
+		free(objects[i]);
+	}
+	free(checksum_file);
+	free(checksum_prev);
+	free(tmp);
+	remove(files[0]);
+	remove(files[1]);
+	rmdir("verify_in");
+	return ret;
+}
+
+static void remove_backup(const char* dir, char** objects){
+	char* cmd = sh_sprintf("rm -rf %s", dir);
+	size_t i;
+
+	if (objects){
+		for (i = 0; i < 3; ++i){
+			free(objects[i]);
+		}
+		free(objects);
+	}
+	if (cmd){
+		system(cmd);
+		free(cmd);
+	}
+}
+
+void test_verify_directory(enum TEST_STATUS* status){
+	const char* dir = "verify_out";
+	const char* report_file = "verify_report.txt";
+	char** objects = NULL;
+	struct options* opt = NULL;
+	FILE* report = NULL;
+
+	TEST_ASSERT(make_backup(dir, COMPRESSOR_GZIP, 0, NULL, NULL, &objects) == 0);
+	opt = verify_options(dir, COMPRESSOR_GZIP);
+	TEST_ASSERT(opt);
+	report = fopen(report_file, "w+");
+	TEST_ASSERT(report);
+
+	TEST_ASSERT(verify_directory(opt, NULL, report) == 0);
+	TEST_ASSERT(count_lines(report, "Verified 2 files") == 1);
+	/* a finished pass does not leave a cursor behind */
+	TEST_ASSERT(!does_file_exist("verify_out/" VERIFY_CURSOR_FILE));
+
+	/* an interrupted pass picks up after the last file it finished */
+	create_file("verify_out/" VERIFY_CURSOR_FILE, "verify_in/a.bin\n", 16);
+	TEST_ASSERT(freopen(report_file, "w+", report));
+	TEST_ASSERT(verify_directory(opt, NULL, report) == 0);
+	TEST_ASSERT(count_lines(report, "Verified 1 files") == 1);
+
+	/* damage in the appended segment is caught too */
+	flip_byte(objects[2], 100);
+	TEST_ASSERT(freopen(report_file, "w+", report));
+	TEST_ASSERT(verify_directory(opt, NULL, report) > 0);
+	TEST_ASSERT(count_lines(report, "MISMATCH\tverify_in/b.bin") + count_lines(report, "UNREADABLE\tverify_in/b.bin") == 1);
+
+	remove(objects[0]);
+	TEST_ASSERT(freopen(report_file, "w+", report));
+	TEST_ASSERT(verify_directory(opt, NULL, report) > 0);
+	TEST_ASSERT(count_lines(report, "MISSING\tverify_in/a.bin") == 1);
+	TEST_ASSERT(count_lines(report, "Verified 2 files") == 1);
+
+	/* nothing to verify */
+	free(opt->output_directory);
+	opt->output_directory = sh_dup("verify_nonexistent");
+	TEST_ASSERT(verify_directory(opt, NULL, report) < 0);
+
+cleanup:
+	report ? fclose(report) : 0;
+	remove(report_file);
+	options_free(opt);
+	remove_backup(dir, objects);
+}
+
+void test_verify_encrypted(enum TEST_STATUS* status){
+	const char* dir = "verify_enc";
+	const char* report_file = "verify_report.txt";
+	const char* ciphers[] = { "AES-256-GCM", "AES-256-CBC", "AES-256-GCM" };
+	/* the last backup is made of seekable containers with small enough blocks that their indexes do not fit in the first BUFFER_LEN bytes kept */
+	const unsigned flags[] = { 0, 0, ZIP_SEEKABLE | ZIP_BLOCK_SHIFT(10) };
+	char** objects = NULL;
+	struct crypt_master* cm = NULL;
+	struct options* opt = NULL;
+	FILE* report = NULL;
+	size_t i;
+
+	report = fopen(report_file, "w+");
+	TEST_ASSERT(report);
+
+	for (i = 0; i < sizeof(ciphers) / sizeof(ciphers[0]); ++i){
+		mkdir(dir, 0755);
+		cm = crypt_master_new("hunter2", "verify_enc/key");
+		TEST_ASSERT(cm);
+		TEST_ASSERT(make_backup(dir, COMPRESSOR_ZSTD, flags[i], ciphers[i], cm, &objects) == 0);
+		opt = verify_options(dir, COMPRESSOR_ZSTD);
+		TEST_ASSERT(opt);
+		opt->enc_algorithm = EVP_get_cipherbyname(ciphers[i]);
+		opt->c_flags |= flags[i];
+
+		TEST_ASSERT(freopen(report_file, "w+", report));
+		TEST_ASSERT(verify_directory(opt, cm, report) == 0);
+		TEST_ASSERT(count_lines(report, "Verified 2 files") == 1);
+
+		flip_byte(objects[0], 200);
+		TEST_ASSERT(freopen(report_file, "w+", report));
+		TEST_ASSERT(verify_directory(opt, cm, report) > 0);
+		TEST_ASSERT(count_lines(report, "MISMATCH\tverify_in/a.bin") + count_lines(report, "UNREADABLE\tverify_in/a.bin") == 1);
+
+		options_free(opt);
+		opt = NULL;
+		crypt_master_free(cm);
+		cm = NULL;
+		remove_backup(dir, objects);
+		objects = NULL;
+	}
+
+cleanup:
+	report ? fclose(report) : 0;
+	remove(report_file);
+	options_free(opt);
+	crypt_master_free(cm);
+	remove_backup(dir, objects);
+}
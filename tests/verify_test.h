@@ -0,0 +1,18 @@
+/** @file tests/verify_test.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __TEST_VERIFY_H
+#define __TEST_VERIFY_H
+
+#include "test_framework.h"
+
+void test_verify_directory(enum TEST_STATUS* status);
+void test_verify_encrypted(enum TEST_STATUS* status);
+
+EXPORT_PKG(verify_pkg);
+#endif
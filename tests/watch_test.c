@@ -0,0 +1,307 @@
+/** @file tests/watch_test.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "watch_test.h"
+#include "../watch.h"
+#include "../filehelper.h"
+#include "../options/options.h"
+#include "../strings/stringhelper.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+const struct unit_test watch_tests[] = {
+	MAKE_TEST(test_watch_take_journal),
+	MAKE_TEST(test_watch_take_journal_lost),
+	MAKE_TEST(test_watch_take_journal_locked),
+	MAKE_TEST(test_watch_is_dirty),
+	MAKE_TEST(test_watch_modify)
+};
+MAKE_PKG(watch_tests, watch_pkg);
+
+static void setup_output_dir(const char* dir, const char* const* entries, size_t entries_len){
+	FILE* fp;
+	char path[256];
+	size_t i;
+
+	mkdir(dir, 0755);
+
+	/* pretend this process is the watcher */
+	sprintf(path, "%s/watch.pid", dir);
+	fp = fopen(path, "wb");
+	fprintf(fp, "%ld\n", (long)getpid());
+	fclose(fp);
+
+	sprintf(path, "%s/%s", dir, WATCH_JOURNAL_NAME);
+	fp = fopen(path, "wb");
+	for (i = 0; i < entries_len; ++i){
+		fprintf(fp, "%s%c\n", entries[i], '\0');
+	}
+	fclose(fp);
+}
+
+static void cleanup_output_dir(const char* dir){
+	char path[256];
+
+	sprintf(path, "%s/watch.pid", dir);
+	remove(path);
+	sprintf(path, "%s/%s", dir, WATCH_JOURNAL_NAME);
+	remove(path);
+	sprintf(path, "%s/%s", dir, WATCH_FULL_SCAN_NAME);
+	remove(path);
+	rmdir(dir);
+}
+
+void test_watch_take_journal(enum TEST_STATUS* status){
+	const char* dir = "watch_out";
+	const char* entries[] = {
+		"/home/user/b.txt",
+		"/home/user/dir/a.txt",
+		"/home/user/b.txt",
+		"/home/user/dir",
+		"/home/user/dir-2/c.txt"
+	};
+	struct string_array* dirty = NULL;
+	char path[256];
+
+	setup_output_dir(dir, entries, sizeof(entries) / sizeof(entries[0]));
+
+	/* no full scan has happened yet */
+	TEST_ASSERT(watch_take_journal(dir, &dirty) > 0);
+	TEST_ASSERT(dirty == NULL);
+
+	setup_output_dir(dir, entries, sizeof(entries) / sizeof(entries[0]));
+	TEST_ASSERT(watch_mark_full_scan(dir) == 0);
+
+	TEST_ASSERT(watch_take_journal(dir, &dirty) == 0);
+	TEST_ASSERT(dirty != NULL);
+	TEST_ASSERT(dirty->len == 3);
+	TEST_ASSERT(strcmp(dirty->strings[0], "/home/user/b.txt") == 0);
+	TEST_ASSERT(strcmp(dirty->strings[1], "/home/user/dir") == 0);
+	TEST_ASSERT(strcmp(dirty->strings[2], "/home/user/dir-2/c.txt") == 0);
+
+	/* the journal is consumed */
+	sprintf(path, "%s/%s", dir, WATCH_JOURNAL_NAME);
+	TEST_ASSERT(!file_exists(path));
+	sa_free(dirty);
+
+	/* nothing changed */
+	TEST_ASSERT(watch_take_journal(dir, &dirty) == 0);
+	TEST_ASSERT(dirty != NULL);
+	TEST_ASSERT(dirty->len == 0);
+	sa_free(dirty);
+	dirty = NULL;
+
+	/* a failed backup forces a full scan */
+	setup_output_dir(dir, entries, sizeof(entries) / sizeof(entries[0]));
+	watch_invalidate_full_scan(dir);
+	TEST_ASSERT(watch_take_journal(dir, &dirty) > 0);
+	TEST_ASSERT(dirty == NULL);
+
+cleanup:
+	sa_free(dirty);
+	cleanup_output_dir(dir);
+}
+
+void test_watch_take_journal_lost(enum TEST_STATUS* status){
+	const char* dir = "watch_out";
+	const char* entries[] = {
+		"/home/user/a.txt",
+		"",
+		"/home/user/b.txt"
+	};
+	struct string_array* dirty = NULL;
+
+	setup_output_dir(dir, entries, sizeof(entries) / sizeof(entries[0]));
+	TEST_ASSERT(watch_mark_full_scan(dir) == 0);
+
+	TEST_ASSERT(watch_take_journal(dir, &dirty) > 0);
+	TEST_ASSERT(dirty == NULL);
+
+cleanup:
+	sa_free(dirty);
+	cleanup_output_dir(dir);
+}
+
+void test_watch_take_journal_locked(enum TEST_STATUS* status){
+	const char* dir = "watch_out";
+	const char* entries[] = {
+		"/home/user/a.txt"
+	};
+	struct string_array* dirty = NULL;
+	struct flock fl;
+	char path[256];
+	int fds[2] = { -1, -1 };
+	char c;
+	pid_t pid = -1;
+
+	setup_output_dir(dir, entries, sizeof(entries) / sizeof(entries[0]));
+	TEST_ASSERT(watch_mark_full_scan(dir) == 0);
+	sprintf(path, "%s/%s", dir, WATCH_JOURNAL_NAME);
+	TEST_ASSERT(pipe(fds) == 0);
+
+	/* a watcher that is in the middle of writing a batch when the backup starts */
+	pid = fork();
+	TEST_ASSERT(pid >= 0);
+	if (pid == 0){
+		FILE* fp = fopen(path, "ab");
+
+		memset(&fl, 0, sizeof(fl));
+		fl.l_type = F_WRLCK;
+		fl.l_whence = SEEK_SET;
+		if (!fp || fcntl(fileno(fp), F_SETLKW, &fl) != 0 || write(fds[1], "x", 1) != 1){
+			_exit(1);
+		}
+		usleep(300000);
+		fprintf(fp, "%s%c\n", "/home/user/b.txt", '\0');
+		_exit(fclose(fp) == 0 ? 0 : 1);
+	}
+	TEST_ASSERT(read(fds[0], &c, 1) == 1);
+
+	/* the backup waits for the batch instead of taking the journal out from under it */
+	TEST_ASSERT(watch_take_journal(dir, &dirty) == 0);
+	TEST_ASSERT(dirty != NULL);
+	TEST_ASSERT(dirty->len == 2);
+	TEST_ASSERT(strcmp(dirty->strings[0], "/home/user/a.txt") == 0);
+	TEST_ASSERT(strcmp(dirty->strings[1], "/home/user/b.txt") == 0);
+
+cleanup:
+	if (pid > 0){
+		waitpid(pid, NULL, 0);
+	}
+	fds[0] >= 0 ? close(fds[0]) : 0;
+	fds[1] >= 0 ? close(fds[1]) : 0;
+	sa_free(dirty);
+	cleanup_output_dir(dir);
+}
+
+void test_watch_is_dirty(enum TEST_STATUS* status){
+	struct string_array* dirty;
+
+	dirty = sa_new();
+	TEST_ASSERT(dirty);
+	TEST_ASSERT(sa_add(dirty, "/home/user/dir") == 0);
+	TEST_ASSERT(sa_add(dirty, "/home/user/file.txt") == 0);
+	sa_sort(dirty);
+
+	TEST_ASSERT(watch_is_dirty(dirty, "/home/user/dir"));
+	TEST_ASSERT(watch_is_dirty(dirty, "/home/user/dir/a/b.txt"));
+	TEST_ASSERT(watch_is_dirty(dirty, "/home/user/file.txt"));
+	TEST_ASSERT(!watch_is_dirty(dirty, "/home/user/dir2/a.txt"));
+	TEST_ASSERT(!watch_is_dirty(dirty, "/home/user/file.txt.bak"));
+	TEST_ASSERT(!watch_is_dirty(dirty, "/home/user"));
+
+cleanup:
+	sa_free(dirty);
+}
+
+/* counts the journal entries for a path */
+static int count_journal(const char* journal, const char* path){
+	char* data = NULL;
+	uint64_t len;
+	uint64_t i;
+	size_t path_len = strlen(path);
+	FILE* fp;
+	int ret = 0;
+
+	fp = fopen(journal, "rb");
+	if (!fp){
+		return 0;
+	}
+	len = get_file_size_fp(fp);
+	data = malloc(len + 1);
+	if (data && fread(data, 1, len, fp) == len){
+		/* each entry is "path\0\n" */
+		for (i = 0; i + path_len + 2 <= len; ++i){
+			if ((i == 0 || data[i - 1] == '\n') && !memcmp(data + i, path, path_len) && data[i + path_len] == '\0'){
+				ret++;
+			}
+		}
+	}
+	free(data);
+	fclose(fp);
+	return ret;
+}
+
+void test_watch_modify(enum TEST_STATUS* status){
+	const char* dir_src = "watch_src";
+	const char* dir_out = "watch_out";
+	const char* file = "watch_src/app.log";
+	char file_abs[PATH_MAX];
+	char* journal = NULL;
+	char* pid_file = NULL;
+	struct options* opt = NULL;
+	FILE* fp = NULL;
+	pid_t pid = -1;
+	int i;
+
+	mkdir(dir_src, 0755);
+	create_file(file, "start\n", 6);
+	TEST_ASSERT(realpath(file, file_abs) != NULL);
+
+	opt = options_new();
+	TEST_ASSERT(opt);
+	TEST_ASSERT(sa_add(opt->directories, dir_src) == 0);
+	opt->output_directory = sh_dup(dir_out);
+	journal = sh_concat_path(sh_dup(dir_out), WATCH_JOURNAL_NAME);
+	pid_file = sh_concat_path(sh_dup(dir_out), "watch.pid");
+	TEST_ASSERT(opt->output_directory && journal && pid_file);
+
+	pid = fork();
+	TEST_ASSERT(pid >= 0);
+	if (pid == 0){
+		_exit(watch_run(opt) == 0 ? 0 : 1);
+	}
+	for (i = 0; i < 500 && !file_exists(pid_file); ++i){
+		usleep(10000);
+	}
+	TEST_ASSERT(file_exists(pid_file));
+
+	/* a file that is written to but never closed, like a log */
+	fp = fopen(file, "ab");
+	TEST_ASSERT(fp);
+	for (i = 0; i < 20; ++i){
+		fprintf(fp, "line %d\n", i);
+		fflush(fp);
+		usleep(10000);
+	}
+	for (i = 0; i < 500 && count_journal(journal, file_abs) == 0; ++i){
+		usleep(10000);
+	}
+
+	/* every write generates an event, but the path is only journaled once */
+	TEST_ASSERT(count_journal(journal, file_abs) == 1);
+
+	/* once a backup takes the journal, the path is recorded again */
+	remove(journal);
+	fprintf(fp, "after backup\n");
+	fflush(fp);
+	for (i = 0; i < 500 && count_journal(journal, file_abs) == 0; ++i){
+		usleep(10000);
+	}
+	TEST_ASSERT(count_journal(journal, file_abs) == 1);
+
+cleanup:
+	if (pid > 0){
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+	fp ? fclose(fp) : 0;
+	options_free(opt);
+	free(journal);
+	free(pid_file);
+	remove(file);
+	rmdir(dir_src);
+	cleanup_output_dir(dir_out);
+}
@@ -0,0 +1,21 @@
+/** @file tests/watch_test.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __WATCH_TEST_H
+#define __WATCH_TEST_H
+
+#include "test_framework.h"
+
+void test_watch_take_journal(enum TEST_STATUS* status);
+void test_watch_take_journal_lost(enum TEST_STATUS* status);
+void test_watch_take_journal_locked(enum TEST_STATUS* status);
+void test_watch_is_dirty(enum TEST_STATUS* status);
+void test_watch_modify(enum TEST_STATUS* status);
+
+extern const struct test_pkg watch_pkg;
+#endif
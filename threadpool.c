@@ -0,0 +1,199 @@
+/** @file threadpool.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "threadpool.h"
+#include "log.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+struct tp_job{
+	tp_job_fn fn;
+	void* arg;
+	struct tp_job* next;
+};
+
+struct tp_worker{
+	struct threadpool* tp;
+	unsigned index;
+};
+
+struct threadpool{
+	pthread_t* threads;
+	struct tp_worker* workers;
+	unsigned n_threads;
+	unsigned n_started;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond_job;
+	pthread_cond_t cond_done;
+
+	struct tp_job* head;
+	struct tp_job* tail;
+	/* queued + running */
+	unsigned long pending;
+	int stop;
+};
+
+static void* tp_worker_main(void* arg){
+	struct tp_worker* w = arg;
+	struct threadpool* tp = w->tp;
+
+	pthread_mutex_lock(&tp->lock);
+	for (;;){
+		struct tp_job* job;
+
+		while (!tp->head && !tp->stop){
+			pthread_cond_wait(&tp->cond_job, &tp->lock);
+		}
+		if (tp->stop){
+			break;
+		}
+
+		job = tp->head;
+		tp->head = job->next;
+		if (!tp->head){
+			tp->tail = NULL;
+		}
+		pthread_mutex_unlock(&tp->lock);
+
+		job->fn(job->arg, w->index);
+		free(job);
+
+		pthread_mutex_lock(&tp->lock);
+		tp->pending--;
+		if (tp->pending == 0){
+			pthread_cond_broadcast(&tp->cond_done);
+		}
+	}
+	pthread_mutex_unlock(&tp->lock);
+	return NULL;
+}
+
+struct threadpool* tp_new(unsigned threads){
+	struct threadpool* tp;
+	unsigned i;
+
+	tp = calloc(1, sizeof(*tp));
+	if (!tp){
+		log_enomem();
+		return NULL;
+	}
+
+	tp->n_threads = threads;
+	if (threads == 0){
+		return tp;
+	}
+
+	tp->threads = malloc(threads * sizeof(*tp->threads));
+	tp->workers = malloc(threads * sizeof(*tp->workers));
+	if (!tp->threads || !tp->workers){
+		log_enomem();
+		free(tp->threads);
+		free(tp->workers);
+		free(tp);
+		return NULL;
+	}
+
+	pthread_mutex_init(&tp->lock, NULL);
+	pthread_cond_init(&tp->cond_job, NULL);
+	pthread_cond_init(&tp->cond_done, NULL);
+
+	for (i = 0; i < threads; ++i){
+		tp->workers[i].tp = tp;
+		tp->workers[i].index = i;
+		if (pthread_create(&tp->threads[i], NULL, tp_worker_main, &tp->workers[i]) != 0){
+			log_error("Failed to start worker thread");
+			tp_free(tp);
+			return NULL;
+		}
+		tp->n_started++;
+	}
+
+	return tp;
+}
+
+unsigned tp_threads(const struct threadpool* tp){
+	return tp->n_threads > 0 ? tp->n_threads : 1;
+}
+
+int tp_submit(struct threadpool* tp, tp_job_fn fn, void* arg){
+	struct tp_job* job;
+
+	if (tp->n_threads == 0){
+		fn(arg, 0);
+		return 0;
+	}
+
+	job = malloc(sizeof(*job));
+	if (!job){
+		log_enomem();
+		return -1;
+	}
+	job->fn = fn;
+	job->arg = arg;
+	job->next = NULL;
+
+	pthread_mutex_lock(&tp->lock);
+	if (tp->tail){
+		tp->tail->next = job;
+	}
+	else{
+		tp->head = job;
+	}
+	tp->tail = job;
+	tp->pending++;
+	pthread_cond_signal(&tp->cond_job);
+	pthread_mutex_unlock(&tp->lock);
+
+	return 0;
+}
+
+void tp_wait(struct threadpool* tp){
+	if (tp->n_threads == 0){
+		return;
+	}
+
+	pthread_mutex_lock(&tp->lock);
+	while (tp->pending > 0){
+		pthread_cond_wait(&tp->cond_done, &tp->lock);
+	}
+	pthread_mutex_unlock(&tp->lock);
+}
+
+void tp_free(struct threadpool* tp){
+	unsigned i;
+
+	if (!tp){
+		return;
+	}
+
+	if (tp->n_threads > 0){
+		pthread_mutex_lock(&tp->lock);
+		tp->stop = 1;
+		pthread_cond_broadcast(&tp->cond_job);
+		pthread_mutex_unlock(&tp->lock);
+
+		for (i = 0; i < tp->n_started; ++i){
+			pthread_join(tp->threads[i], NULL);
+		}
+
+		while (tp->head){
+			struct tp_job* next = tp->head->next;
+			free(tp->head);
+			tp->head = next;
+		}
+
+		pthread_mutex_destroy(&tp->lock);
+		pthread_cond_destroy(&tp->cond_job);
+		pthread_cond_destroy(&tp->cond_done);
+	}
+
+	free(tp->threads);
+	free(tp->workers);
+	free(tp);
+}
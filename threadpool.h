@@ -0,0 +1,85 @@
+/** @file threadpool.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __THREADPOOL_H
+#define __THREADPOOL_H
+
+#ifndef __GNUC__
+#define __attribute__(x)
+#endif
+
+/**
+ * @brief A fixed set of worker threads that run jobs from a shared queue.
+ */
+struct threadpool;
+
+/**
+ * @brief A job to run on a threadpool.
+ *
+ * @param arg The argument given to tp_submit().
+ *
+ * @param thread_index The index of the worker running the job, from 0 to tp_threads() - 1.<br>
+ * No two jobs with the same index run at the same time, so this can be used to index per-thread state.
+ */
+typedef void (*tp_job_fn)(void* arg, unsigned thread_index);
+
+/**
+ * @brief Creates a threadpool.
+ *
+ * @param threads The amount of worker threads to start.<br>
+ * If this is 0, no threads are started and jobs run on the calling thread within tp_submit().
+ *
+ * @return A new threadpool, or NULL on failure.<br>
+ * This threadpool must be freed with tp_free() when no longer in use.
+ */
+struct threadpool* tp_new(unsigned threads) __attribute__((malloc));
+
+/**
+ * @brief Gets the amount of distinct thread indexes a threadpool's jobs can receive.
+ *
+ * @param tp The threadpool.
+ *
+ * @return The amount of worker threads, or 1 if the threadpool runs jobs on the calling thread.
+ */
+unsigned tp_threads(const struct threadpool* tp);
+
+/**
+ * @brief Queues a job on a threadpool.
+ *
+ * @param tp The threadpool.
+ *
+ * @param fn The job to run.
+ *
+ * @param arg The argument to pass to the job.<br>
+ * This must remain valid until the job has completed.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int tp_submit(struct threadpool* tp, tp_job_fn fn, void* arg);
+
+/**
+ * @brief Waits until every job submitted to a threadpool has completed.
+ *
+ * @param tp The threadpool.
+ *
+ * @return void
+ */
+void tp_wait(struct threadpool* tp);
+
+/**
+ * @brief Stops a threadpool's workers and frees it.<br>
+ * Jobs that are still queued are discarded, so call tp_wait() first if they need to run.
+ *
+ * @param tp The threadpool to free.<br>
+ * If this is NULL, this function does nothing.
+ *
+ * @return void
+ */
+void tp_free(struct threadpool* tp);
+
+#endif
@@ -0,0 +1,633 @@
+/** @file treehash.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "treehash.h"
+#include "log.h"
+#include "filehelper.h"
+#include "threadpool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* a saved tree hash is laid out as follows
+ *
+ * 8 byte magic
+ * u8  version
+ * u8  log2 of the leaf size
+ * u8  digest length
+ * u8  reserved
+ * u16 nid of the digest algorithm (little endian)
+ * 3 bytes reserved
+ * u64 file size (little endian)
+ * u64 leaf count (little endian)
+ * root
+ * leaf hashes, in order */
+#define TREE_MAGIC "EZBTREE1"
+#define TREE_VERSION (1)
+#define TREE_HEADER_LEN (32)
+
+/* the prefixes that keep a leaf from ever hashing the same as a node */
+#define LEAF_PREFIX (0x00)
+#define NODE_PREFIX (0x01)
+
+struct tree_hash{
+	const EVP_MD* algorithm;
+	unsigned leaf_shift;
+	unsigned md_len;
+	uint64_t size;
+	size_t n_leaves;
+	unsigned char* leaves;
+	unsigned char root[EVP_MAX_MD_SIZE];
+	/* the leaf being hashed and how much data has arrived so far, while a tree is built by tree_hash_update() */
+	EVP_MD_CTX* ctx;
+	uint64_t fed;
+};
+
+/* each job hashes every n_jobs'th leaf starting at first, so the jobs read from all over the file at once instead of one of them getting the whole tail */
+struct leaf_job{
+	struct tree_hash* th;
+	int fd;
+	size_t first;
+	size_t step;
+	int ret;
+};
+
+static void write_u64(unsigned char* out, uint64_t val){
+	int i;
+	for (i = 0; i < 8; ++i){
+		out[i] = (unsigned char)(val >> (8 * i));
+	}
+}
+
+static uint64_t read_u64(const unsigned char* in){
+	uint64_t val = 0;
+	int i;
+	for (i = 7; i >= 0; --i){
+		val = (val << 8) | in[i];
+	}
+	return val;
+}
+
+static size_t leaf_count(uint64_t size, unsigned leaf_shift){
+	return size ? (size_t)(((size - 1) >> leaf_shift) + 1) : 1;
+}
+
+static size_t leaf_len(const struct tree_hash* th, size_t index){
+	uint64_t offset = (uint64_t)index << th->leaf_shift;
+	uint64_t len = th->size - offset;
+	uint64_t max = (uint64_t)1 << th->leaf_shift;
+
+	return offset >= th->size ? 0 : (size_t)(len < max ? len : max);
+}
+
+/* reads exactly len bytes at offset, unless the file ends first */
+static ssize_t pread_full(int fd, unsigned char* buf, size_t len, uint64_t offset){
+	size_t total = 0;
+
+	while (total < len){
+		ssize_t res = pread(fd, buf + total, len - total, (off_t)(offset + total));
+		if (res < 0 && errno == EINTR){
+			continue;
+		}
+		if (res < 0){
+			return -1;
+		}
+		if (res == 0){
+			break;
+		}
+		total += res;
+	}
+	return total;
+}
+
+static int hash_leaf(EVP_MD_CTX* ctx, const EVP_MD* algorithm, const unsigned char* data, size_t len, unsigned char* out){
+	unsigned char prefix = LEAF_PREFIX;
+
+	return EVP_DigestInit_ex(ctx, algorithm, NULL) == 1 &&
+		EVP_DigestUpdate(ctx, &prefix, 1) == 1 &&
+		EVP_DigestUpdate(ctx, data, len) == 1 &&
+		EVP_DigestFinal_ex(ctx, out, NULL) == 1 ? 0 : -1;
+}
+
+static int hash_node(EVP_MD_CTX* ctx, const EVP_MD* algorithm, const unsigned char* left, const unsigned char* right, unsigned md_len, unsigned char* out){
+	unsigned char prefix = NODE_PREFIX;
+
+	return EVP_DigestInit_ex(ctx, algorithm, NULL) == 1 &&
+		EVP_DigestUpdate(ctx, &prefix, 1) == 1 &&
+		EVP_DigestUpdate(ctx, left, md_len) == 1 &&
+		EVP_DigestUpdate(ctx, right, md_len) == 1 &&
+		EVP_DigestFinal_ex(ctx, out, NULL) == 1 ? 0 : -1;
+}
+
+/* reads and hashes one leaf of the file */
+static int read_hash_leaf(const struct tree_hash* th, EVP_MD_CTX* ctx, int fd, size_t index, unsigned char* buf, unsigned char* out){
+	size_t len = leaf_len(th, index);
+
+	if (pread_full(fd, buf, len, (uint64_t)index << th->leaf_shift) != (ssize_t)len){
+		return -1;
+	}
+	return hash_leaf(ctx, th->algorithm, buf, len, out);
+}
+
+static void leaf_job_run(void* arg, unsigned thread_index){
+	struct leaf_job* job = arg;
+	struct tree_hash* th = job->th;
+	unsigned char* buf = NULL;
+	EVP_MD_CTX* ctx = NULL;
+	size_t i;
+
+	(void)thread_index;
+
+	buf = malloc((size_t)1 << th->leaf_shift);
+	ctx = EVP_MD_CTX_create();
+	if (!buf || !ctx){
+		job->ret = -1;
+		goto cleanup;
+	}
+
+	for (i = job->first; i < th->n_leaves; i += job->step){
+		if (read_hash_leaf(th, ctx, job->fd, i, buf, th->leaves + i * th->md_len) != 0){
+			job->ret = -1;
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	EVP_MD_CTX_destroy(ctx);
+	free(buf);
+}
+
+/* combines the leaves pairwise until one node is left */
+static int compute_root(const struct tree_hash* th, unsigned char* out){
+	unsigned char* level = NULL;
+	EVP_MD_CTX* ctx = NULL;
+	size_t n = th->n_leaves;
+	int ret = 0;
+
+	level = malloc(n * th->md_len);
+	ctx = EVP_MD_CTX_create();
+	if (!level || !ctx){
+		log_enomem();
+		ret = -1;
+		goto cleanup;
+	}
+	memcpy(level, th->leaves, n * th->md_len);
+
+	while (n > 1){
+		size_t i;
+		for (i = 0; i < n / 2; ++i){
+			if (hash_node(ctx, th->algorithm, level + 2 * i * th->md_len, level + (2 * i + 1) * th->md_len, th->md_len, level + i * th->md_len) != 0){
+				log_error("Failed to hash tree node");
+				ERR_print_errors_fp(stderr);
+				ret = -1;
+				goto cleanup;
+			}
+		}
+		if (n % 2){
+			memmove(level + i * th->md_len, level + (n - 1) * th->md_len, th->md_len);
+		}
+		n = (n + 1) / 2;
+	}
+	memcpy(out, level, th->md_len);
+
+cleanup:
+	EVP_MD_CTX_destroy(ctx);
+	free(level);
+	return ret;
+}
+
+static struct tree_hash* tree_hash_new(uint64_t size, unsigned leaf_shift, const EVP_MD* algorithm){
+	struct tree_hash* th;
+
+	th = calloc(1, sizeof(*th));
+	if (!th){
+		log_enomem();
+		return NULL;
+	}
+	th->algorithm = algorithm;
+	th->leaf_shift = leaf_shift;
+	th->md_len = EVP_MD_size(algorithm);
+	th->size = size;
+	th->n_leaves = leaf_count(size, leaf_shift);
+	th->leaves = malloc(th->n_leaves * th->md_len);
+	if (!th->leaves){
+		log_enomem();
+		free(th);
+		return NULL;
+	}
+	return th;
+}
+
+struct tree_hash* tree_hash_file(const char* file, const EVP_MD* algorithm, unsigned leaf_shift, unsigned threads){
+	struct tree_hash* th = NULL;
+	struct threadpool* tp = NULL;
+	struct leaf_job* jobs = NULL;
+	size_t n_jobs;
+	struct stat st;
+	int fd = -1;
+	size_t i;
+
+	return_ifnull(file, NULL);
+
+	if (leaf_shift < TREE_HASH_MIN_SHIFT || leaf_shift > TREE_HASH_MAX_SHIFT){
+		log_error_ex("Invalid tree hash leaf size (2^%u)", leaf_shift);
+		return NULL;
+	}
+	if (!algorithm){
+		algorithm = EVP_sha1();
+	}
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0){
+		log_error_ex2("Failed to open %s (%s)", file, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)){
+		log_error_ex("%s is not a regular file", file);
+		goto cleanup_fail;
+	}
+
+	th = tree_hash_new(st.st_size, leaf_shift, algorithm);
+	if (!th){
+		goto cleanup_fail;
+	}
+
+	n_jobs = threads > 0 ? threads : 1;
+	if (n_jobs > th->n_leaves){
+		n_jobs = th->n_leaves;
+	}
+	jobs = malloc(n_jobs * sizeof(*jobs));
+	tp = tp_new(threads);
+	if (!jobs || !tp){
+		log_error("Failed to create tree hash workers");
+		goto cleanup_fail;
+	}
+
+	for (i = 0; i < n_jobs; ++i){
+		jobs[i].th = th;
+		jobs[i].fd = fd;
+		jobs[i].first = i;
+		jobs[i].step = n_jobs;
+		jobs[i].ret = 0;
+	}
+	for (i = 0; i < n_jobs; ++i){
+		/* leaves that a job was never run for are not hashed, so the whole tree fails */
+		if (tp_submit(tp, leaf_job_run, &jobs[i]) != 0){
+			for (; i < n_jobs; ++i){
+				jobs[i].ret = -1;
+			}
+		}
+	}
+	tp_wait(tp);
+
+	for (i = 0; i < n_jobs; ++i){
+		if (jobs[i].ret != 0){
+			log_error_ex("Failed to hash %s (did it shrink while being read?)", file);
+			goto cleanup_fail;
+		}
+	}
+
+	if (compute_root(th, th->root) != 0){
+		goto cleanup_fail;
+	}
+
+	tp_free(tp);
+	free(jobs);
+	close(fd);
+	return th;
+
+cleanup_fail:
+	tp_free(tp);
+	free(jobs);
+	close(fd);
+	tree_hash_free(th);
+	return NULL;
+}
+
+static int start_leaf(struct tree_hash* th){
+	unsigned char prefix = LEAF_PREFIX;
+
+	return EVP_DigestInit_ex(th->ctx, th->algorithm, NULL) == 1 &&
+		EVP_DigestUpdate(th->ctx, &prefix, 1) == 1 ? 0 : -1;
+}
+
+struct tree_hash* tree_hash_begin(uint64_t size, const EVP_MD* algorithm, unsigned leaf_shift){
+	struct tree_hash* th;
+
+	if (leaf_shift < TREE_HASH_MIN_SHIFT || leaf_shift > TREE_HASH_MAX_SHIFT){
+		log_error_ex("Invalid tree hash leaf size (2^%u)", leaf_shift);
+		return NULL;
+	}
+	if (!algorithm){
+		algorithm = EVP_sha1();
+	}
+
+	th = tree_hash_new(size, leaf_shift, algorithm);
+	if (!th){
+		return NULL;
+	}
+	th->ctx = EVP_MD_CTX_create();
+	if (!th->ctx || start_leaf(th) != 0){
+		log_error("Failed to start tree hash");
+		ERR_print_errors_fp(stderr);
+		tree_hash_free(th);
+		return NULL;
+	}
+	return th;
+}
+
+int tree_hash_update(struct tree_hash* th, const void* data, size_t len){
+	const unsigned char* ptr = data;
+
+	return_ifnull(th, -1);
+	if (!th->ctx){
+		log_error("The tree hash is already finished");
+		return -1;
+	}
+
+	while (len > 0){
+		size_t index = (size_t)(th->fed >> th->leaf_shift);
+		uint64_t leaf_end;
+		size_t n;
+
+		if (th->fed >= th->size){
+			log_error("More data was given to the tree hash than its size");
+			return -1;
+		}
+
+		leaf_end = ((uint64_t)index << th->leaf_shift) + leaf_len(th, index);
+		n = leaf_end - th->fed < len ? (size_t)(leaf_end - th->fed) : len;
+		if (EVP_DigestUpdate(th->ctx, ptr, n) != 1){
+			log_error("Failed to hash tree leaf");
+			ERR_print_errors_fp(stderr);
+			return -1;
+		}
+		th->fed += n;
+		ptr += n;
+		len -= n;
+
+		/* the next leaf only starts if there is more data to come */
+		if (th->fed == leaf_end && (EVP_DigestFinal_ex(th->ctx, th->leaves + index * th->md_len, NULL) != 1 ||
+					(th->fed < th->size && start_leaf(th) != 0))){
+			log_error("Failed to hash tree leaf");
+			ERR_print_errors_fp(stderr);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int tree_hash_end(struct tree_hash* th){
+	int ret = 0;
+
+	return_ifnull(th, -1);
+	if (!th->ctx){
+		log_error("The tree hash is already finished");
+		return -1;
+	}
+
+	if (th->fed != th->size){
+		log_error_ex2("The tree hash was given %lu bytes instead of %lu", (unsigned long)th->fed, (unsigned long)th->size);
+		ret = -1;
+	}
+	/* an empty file's only leaf was started, but never given anything to finish it */
+	else if (th->size == 0 && EVP_DigestFinal_ex(th->ctx, th->leaves, NULL) != 1){
+		log_error("Failed to hash tree leaf");
+		ERR_print_errors_fp(stderr);
+		ret = -1;
+	}
+	else if (compute_root(th, th->root) != 0){
+		ret = -1;
+	}
+
+	EVP_MD_CTX_destroy(th->ctx);
+	th->ctx = NULL;
+	return ret;
+}
+
+const unsigned char* tree_hash_root(const struct tree_hash* th, unsigned* len){
+	if (!th){
+		return NULL;
+	}
+	if (len){
+		*len = th->md_len;
+	}
+	return th->root;
+}
+
+uint64_t tree_hash_size(const struct tree_hash* th){
+	return th ? th->size : 0;
+}
+
+size_t tree_hash_leaf_count(const struct tree_hash* th){
+	return th ? th->n_leaves : 0;
+}
+
+const unsigned char* tree_hash_leaf(const struct tree_hash* th, size_t index){
+	return th && index < th->n_leaves ? th->leaves + index * th->md_len : NULL;
+}
+
+int tree_hash_save(const struct tree_hash* th, const char* file){
+	unsigned char header[TREE_HEADER_LEN];
+	FILE* fp;
+	int ret = 0;
+
+	return_ifnull(th, -1);
+	return_ifnull(file, -1);
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, TREE_MAGIC, 8);
+	header[8] = TREE_VERSION;
+	header[9] = th->leaf_shift;
+	header[10] = th->md_len;
+	header[12] = EVP_MD_type(th->algorithm) & 0xFF;
+	header[13] = (EVP_MD_type(th->algorithm) >> 8) & 0xFF;
+	write_u64(header + 16, th->size);
+	write_u64(header + 24, th->n_leaves);
+
+	fp = fopen(file, "wb");
+	if (!fp){
+		log_efopen(file);
+		return -1;
+	}
+	if (fwrite(header, 1, sizeof(header), fp) != sizeof(header) ||
+			fwrite(th->root, 1, th->md_len, fp) != th->md_len ||
+			fwrite(th->leaves, th->md_len, th->n_leaves, fp) != th->n_leaves){
+		log_efwrite(file);
+		ret = -1;
+	}
+	if (fclose(fp) != 0){
+		log_efclose(file);
+		ret = -1;
+	}
+	if (ret != 0){
+		remove(file);
+	}
+	return ret;
+}
+
+struct tree_hash* tree_hash_load(const char* file){
+	unsigned char header[TREE_HEADER_LEN];
+	unsigned char saved_root[EVP_MAX_MD_SIZE];
+	struct tree_hash* th = NULL;
+	const EVP_MD* algorithm;
+	unsigned leaf_shift;
+	unsigned md_len;
+	uint64_t size;
+	uint64_t n_leaves;
+	FILE* fp;
+
+	return_ifnull(file, NULL);
+
+	fp = fopen(file, "rb");
+	if (!fp){
+		log_efopen(file);
+		return NULL;
+	}
+
+	if (read_file(fp, header, sizeof(header)) != sizeof(header) || memcmp(header, TREE_MAGIC, 8) != 0){
+		log_error_ex("%s is not a tree hash", file);
+		goto cleanup_fail;
+	}
+	if (header[8] != TREE_VERSION){
+		log_error_ex("Unsupported tree hash version %d", header[8]);
+		goto cleanup_fail;
+	}
+
+	leaf_shift = header[9];
+	md_len = header[10];
+	algorithm = EVP_get_digestbynid(header[12] | (header[13] << 8));
+	size = read_u64(header + 16);
+	n_leaves = read_u64(header + 24);
+	/* the leaf count is checked against the file's size before anything is allocated, so a damaged header cannot ask for an absurd amount of memory */
+	if (!algorithm || (unsigned)EVP_MD_size(algorithm) != md_len || leaf_shift < TREE_HASH_MIN_SHIFT || leaf_shift > TREE_HASH_MAX_SHIFT ||
+			n_leaves != leaf_count(size, leaf_shift) || get_file_size(file) != TREE_HEADER_LEN + (n_leaves + 1) * md_len){
+		log_error_ex("%s is damaged", file);
+		goto cleanup_fail;
+	}
+
+	th = tree_hash_new(size, leaf_shift, algorithm);
+	if (!th){
+		goto cleanup_fail;
+	}
+	if (read_file(fp, saved_root, md_len) != (int)md_len ||
+			fread(th->leaves, md_len, th->n_leaves, fp) != th->n_leaves){
+		log_efread(file);
+		goto cleanup_fail;
+	}
+
+	if (compute_root(th, th->root) != 0 || memcmp(th->root, saved_root, md_len) != 0){
+		log_error_ex("%s is damaged (the root does not match its leaves)", file);
+		goto cleanup_fail;
+	}
+
+	if (fclose(fp) != 0){
+		log_efclose(file);
+	}
+	return th;
+
+cleanup_fail:
+	fclose(fp);
+	tree_hash_free(th);
+	return NULL;
+}
+
+int tree_hash_diff(const struct tree_hash* prev, const struct tree_hash* cur, size_t** out, size_t* out_len){
+	size_t i;
+
+	return_ifnull(prev, -1);
+	return_ifnull(cur, -1);
+	return_ifnull(out, -1);
+	return_ifnull(out_len, -1);
+
+	*out = NULL;
+	*out_len = 0;
+
+	if (prev->leaf_shift != cur->leaf_shift || EVP_MD_type(prev->algorithm) != EVP_MD_type(cur->algorithm)){
+		log_error("The tree hashes were made with different leaf sizes or digests");
+		return -1;
+	}
+
+	for (i = 0; i < cur->n_leaves; ++i){
+		size_t* tmp;
+
+		/* the last leaf of prev is compared too. if it was partial, its hash only matches if it is still the same length */
+		if (i < prev->n_leaves && leaf_len(prev, i) == leaf_len(cur, i) &&
+				memcmp(prev->leaves + i * prev->md_len, cur->leaves + i * cur->md_len, cur->md_len) == 0){
+			continue;
+		}
+
+		tmp = realloc(*out, (*out_len + 1) * sizeof(**out));
+		if (!tmp){
+			log_enomem();
+			free(*out);
+			*out = NULL;
+			*out_len = 0;
+			return -1;
+		}
+		*out = tmp;
+		(*out)[(*out_len)++] = i;
+	}
+	return 0;
+}
+
+int tree_hash_verify_leaf(const struct tree_hash* th, const char* file, size_t index){
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned char* buf = NULL;
+	EVP_MD_CTX* ctx = NULL;
+	int fd;
+	int ret = 0;
+
+	return_ifnull(th, -1);
+	return_ifnull(file, -1);
+
+	if (index >= th->n_leaves){
+		log_error_ex("Leaf %lu is out of range", (unsigned long)index);
+		return -1;
+	}
+	fd = open(file, O_RDONLY);
+	if (fd < 0){
+		log_error_ex2("Failed to open %s (%s)", file, strerror(errno));
+		return -1;
+	}
+
+	buf = malloc((size_t)1 << th->leaf_shift);
+	ctx = EVP_MD_CTX_create();
+	if (!buf || !ctx){
+		log_enomem();
+		ret = -1;
+		goto cleanup;
+	}
+
+	/* a region that cannot be read in full no longer matches */
+	if (read_hash_leaf(th, ctx, fd, index, buf, md) != 0){
+		ret = 1;
+		goto cleanup;
+	}
+	ret = memcmp(md, th->leaves + index * th->md_len, th->md_len) != 0;
+
+cleanup:
+	EVP_MD_CTX_destroy(ctx);
+	free(buf);
+	close(fd);
+	return ret;
+}
+
+void tree_hash_free(struct tree_hash* th){
+	if (!th){
+		return;
+	}
+	th->ctx ? EVP_MD_CTX_destroy(th->ctx) : (void)0;
+	free(th->leaves);
+	free(th);
+}
@@ -0,0 +1,209 @@
+/** @file treehash.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __TREEHASH_H
+#define __TREEHASH_H
+
+#include <openssl/evp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __GNUC__
+#define __attribute__(x)
+#endif
+
+#ifndef TREE_HASH_LEAF_SHIFT
+#define TREE_HASH_LEAF_SHIFT (22) /**< @brief log2 of the default leaf size (4MB). */
+#endif
+
+#define TREE_HASH_MIN_SHIFT (10) /**< @brief log2 of the smallest leaf size (1KB). */
+#define TREE_HASH_MAX_SHIFT (30) /**< @brief log2 of the largest leaf size (1GB). */
+
+/**
+ * @brief A Merkle tree digest of a file.<br>
+ * The file is split into fixed-size leaves that are hashed independently, so a large file can be hashed on many cores at once.<br>
+ * Each leaf is hashed as H(0x00 || data), and each pair of nodes as H(0x01 || left || right). A node without a partner is carried up unchanged.<br>
+ * The leaf hashes are kept, so a single region can be verified, or the regions that changed between two versions found, without reading the whole file.
+ */
+struct tree_hash;
+
+/**
+ * @brief Computes the tree hash of a file.
+ *
+ * @param file Path to the file.
+ *
+ * @param algorithm The digest algorithm to use.<br>
+ * If this is NULL, sha1 is used.
+ *
+ * @param leaf_shift log2 of the leaf size.<br>
+ * This must be between TREE_HASH_MIN_SHIFT and TREE_HASH_MAX_SHIFT.
+ *
+ * @param threads The amount of worker threads to hash leaves on.<br>
+ * 0 hashes on the calling thread.
+ *
+ * @return The tree hash, or NULL on failure.<br>
+ * This must be freed with tree_hash_free() when no longer in use.
+ */
+struct tree_hash* tree_hash_file(const char* file, const EVP_MD* algorithm, unsigned leaf_shift, unsigned threads) __attribute__((malloc));
+
+/**
+ * @brief Starts computing the tree hash of data that arrives a piece at a time, e.g. as it is decompressed.<br>
+ * The result is the same as tree_hash_file() on a file with the same contents.
+ * @see tree_hash_update()
+ * @see tree_hash_end()
+ *
+ * @param size The total size of the data.<br>
+ * This must be known ahead of time, as it decides the shape of the tree.
+ *
+ * @param algorithm The digest algorithm to use.<br>
+ * If this is NULL, sha1 is used.
+ *
+ * @param leaf_shift log2 of the leaf size.<br>
+ * This must be between TREE_HASH_MIN_SHIFT and TREE_HASH_MAX_SHIFT.
+ *
+ * @return The unfinished tree hash, or NULL on failure.<br>
+ * This must be freed with tree_hash_free() when no longer in use.
+ */
+struct tree_hash* tree_hash_begin(uint64_t size, const EVP_MD* algorithm, unsigned leaf_shift) __attribute__((malloc));
+
+/**
+ * @brief Hashes the next piece of data of a tree hash started with tree_hash_begin().<br>
+ * Each leaf is hashed as soon as all of its data has arrived.
+ *
+ * @param th The tree hash.
+ *
+ * @param data The data.
+ *
+ * @param len The length of the data.
+ *
+ * @return 0 on success, or negative on failure (including if this is more data than the size given to tree_hash_begin()).
+ */
+int tree_hash_update(struct tree_hash* th, const void* data, size_t len);
+
+/**
+ * @brief Finishes a tree hash started with tree_hash_begin() by computing its root.<br>
+ * Afterwards, the tree hash can be used like one returned by tree_hash_file().
+ *
+ * @param th The tree hash.
+ *
+ * @return 0 on success, or negative on failure (including if less data arrived than the size given to tree_hash_begin()).
+ */
+int tree_hash_end(struct tree_hash* th);
+
+/**
+ * @brief Gets the root of a tree hash.<br>
+ * This is what identifies the file's contents, like the output of checksum() does.
+ *
+ * @param th The tree hash.
+ *
+ * @param len A pointer to the length of the root in bytes.
+ *
+ * @return A pointer to the root.<br>
+ * This pointer is invalidated when the tree hash is freed.
+ */
+const unsigned char* tree_hash_root(const struct tree_hash* th, unsigned* len);
+
+/**
+ * @brief Gets the size of the file a tree hash was computed over.
+ *
+ * @param th The tree hash.
+ *
+ * @return The size of the file in bytes.
+ */
+uint64_t tree_hash_size(const struct tree_hash* th);
+
+/**
+ * @brief Gets the amount of leaves in a tree hash.<br>
+ * An empty file has a single empty leaf.
+ *
+ * @param th The tree hash.
+ *
+ * @return The amount of leaves.
+ */
+size_t tree_hash_leaf_count(const struct tree_hash* th);
+
+/**
+ * @brief Gets the hash of a leaf.
+ *
+ * @param th The tree hash.
+ *
+ * @param index The index of the leaf. Leaf i covers bytes [i << leaf_shift, (i + 1) << leaf_shift) of the file.
+ *
+ * @return A pointer to the leaf's hash, which is as long as the root, or NULL if index is out of range.<br>
+ * This pointer is invalidated when the tree hash is freed.
+ */
+const unsigned char* tree_hash_leaf(const struct tree_hash* th, size_t index);
+
+/**
+ * @brief Saves the leaf hashes and root of a tree hash to a file.<br>
+ * This is the sidecar kept next to a backed up file, so its regions can be checked later.
+ *
+ * @param th The tree hash.
+ *
+ * @param file Path to write to.<br>
+ * This file is overwritten if it exists, and removed on failure.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int tree_hash_save(const struct tree_hash* th, const char* file);
+
+/**
+ * @brief Loads a tree hash saved with tree_hash_save().<br>
+ * The root is recomputed from the leaves and checked against the saved one, so a damaged file is not accepted.
+ *
+ * @param file Path to the saved tree hash.
+ *
+ * @return The tree hash, or NULL on failure.<br>
+ * This must be freed with tree_hash_free() when no longer in use.
+ */
+struct tree_hash* tree_hash_load(const char* file) __attribute__((malloc));
+
+/**
+ * @brief Finds the leaves that differ between two versions of a file.<br>
+ * Only the leaf hashes are compared, so neither file is read.
+ *
+ * @param prev The tree hash of the previous version.
+ *
+ * @param cur The tree hash of the current version.<br>
+ * This must use the same leaf size and digest algorithm as prev.
+ *
+ * @param out A pointer to an array that will contain the indices of the leaves in cur that are not the same as in prev, in ascending order.<br>
+ * Leaves past the end of prev always count as changed.<br>
+ * This will be set to NULL if nothing changed or on failure. Otherwise it must be free()'d when no longer in use.
+ *
+ * @param out_len A pointer to the amount of changed leaves.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int tree_hash_diff(const struct tree_hash* prev, const struct tree_hash* cur, size_t** out, size_t* out_len);
+
+/**
+ * @brief Checks a single region of a file against a tree hash.<br>
+ * Only the leaf's own bytes are read.
+ *
+ * @param th The tree hash.
+ *
+ * @param file Path to the file.
+ *
+ * @param index The index of the leaf to check.
+ *
+ * @return 0 if the region matches, positive if it does not, or negative on failure.
+ */
+int tree_hash_verify_leaf(const struct tree_hash* th, const char* file, size_t index);
+
+/**
+ * @brief Frees a tree hash.
+ *
+ * @param th The tree hash to free.<br>
+ * If this is NULL, this function does nothing.
+ *
+ * @return void
+ */
+void tree_hash_free(struct tree_hash* th);
+
+#endif
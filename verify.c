@@ -0,0 +1,859 @@
+/** @file verify.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "verify.h"
+#include "checksum.h"
+#include "checksumsort.h"
+#include "filehelper.h"
+#include "log.h"
+#include "threadpool.h"
+#include "crypt/crypt.h"
+#include "crypt/crypt_easy.h"
+#include "crypt/crypt_getpassword.h"
+#include "crypt/crypt_manifest.h"
+#include "compression/zip.h"
+#include "strings/stringhelper.h"
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+enum verify_result{
+	VERIFY_OK = 0,
+	VERIFY_MISMATCH,
+	VERIFY_MISSING,
+	VERIFY_UNREADABLE,
+	VERIFY_UNSUPPORTED
+};
+
+/* the state shared by every job of a run */
+struct verify_run{
+	char* files;
+	char* appends;
+	char* dicts;
+	const EVP_MD* algorithm;
+	const char* enc_algorithm;
+	const struct crypt_master* master;
+	enum compressor c_type;
+	unsigned c_flags;
+
+	/* reads are paced so every worker together reads at most bytes_per_sec.
+	 * next is when the next read may start; each read pushes it back by as long as that read should take */
+	pthread_mutex_t rate_lock;
+	double bytes_per_sec;
+	double next;
+
+	/* dictionaries are loaded the first time a file needs them */
+	pthread_mutex_t dict_lock;
+	struct zip_dict** dict_list;
+	size_t dict_len;
+};
+
+struct verify_job{
+	struct verify_run* vr;
+	struct element* e;
+	enum verify_result result;
+	char* object;
+	unsigned long bytes;
+};
+
+static double now_secs(void){
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void sleep_secs(double secs){
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)secs;
+	ts.tv_nsec = (long)((secs - ts.tv_sec) * 1000000000.0);
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+static void rate_limit(struct verify_run* vr, size_t bytes){
+	double now;
+	double wait;
+
+	if (vr->bytes_per_sec <= 0){
+		return;
+	}
+
+	pthread_mutex_lock(&vr->rate_lock);
+	now = now_secs();
+	if (vr->next < now){
+		vr->next = now;
+	}
+	wait = vr->next - now;
+	vr->next += bytes / vr->bytes_per_sec;
+	pthread_mutex_unlock(&vr->rate_lock);
+
+	if (wait > 0){
+		sleep_secs(wait);
+	}
+}
+
+#ifndef NO_ZSTD_SUPPORT
+/* dictionaries are encrypted like everything else, so an encrypted one is decrypted into memory instead of onto the disk */
+static struct zip_dict* load_dict(const struct verify_run* vr, const char* path){
+	struct easy_reader* er = NULL;
+	unsigned char* data = NULL;
+	struct zip_dict* ret = NULL;
+	size_t len = 0;
+	size_t size = 0;
+	size_t n;
+
+	if (!vr->master){
+		return zip_dict_load(path);
+	}
+
+	er = easy_decrypt_master_open(path, vr->enc_algorithm, vr->master);
+	if (!er){
+		goto cleanup;
+	}
+	do{
+		if (size - len < BUFFER_LEN){
+			unsigned char* tmp = realloc(data, size + BUFFER_LEN);
+			if (!tmp){
+				log_enomem();
+				goto cleanup;
+			}
+			data = tmp;
+			size += BUFFER_LEN;
+		}
+		if (easy_reader_read(er, data + len, size - len, &n) != 0){
+			goto cleanup;
+		}
+		len += n;
+	}while (n > 0);
+
+	ret = zip_dict_from_buffer(data, len);
+
+cleanup:
+	easy_reader_close(er);
+	free(data);
+	return ret;
+}
+
+static struct zip_dict* get_dict(struct verify_run* vr, unsigned id){
+	struct zip_dict* ret = NULL;
+	char id_str[32];
+	char* path;
+	size_t i;
+
+	pthread_mutex_lock(&vr->dict_lock);
+	for (i = 0; i < vr->dict_len; ++i){
+		if (zip_dict_id(vr->dict_list[i]) == id){
+			ret = vr->dict_list[i];
+			goto cleanup;
+		}
+	}
+
+	sprintf(id_str, "%u", id);
+	path = sh_concat_path(sh_dup(vr->dicts), id_str);
+	if (!path){
+		goto cleanup;
+	}
+	ret = load_dict(vr, path);
+	free(path);
+	if (ret){
+		struct zip_dict** tmp = realloc(vr->dict_list, (vr->dict_len + 1) * sizeof(*tmp));
+		if (!tmp){
+			log_enomem();
+			zip_dict_free(ret);
+			ret = NULL;
+			goto cleanup;
+		}
+		vr->dict_list = tmp;
+		vr->dict_list[vr->dict_len++] = ret;
+	}
+
+cleanup:
+	pthread_mutex_unlock(&vr->dict_lock);
+	return ret;
+}
+#endif
+
+static int read_object(struct easy_reader* er, FILE* fp, unsigned char* buf, size_t size, size_t* len){
+	int res;
+
+	if (er){
+		return easy_reader_read(er, buf, size, len);
+	}
+	res = read_file(fp, buf, size);
+	*len = res > 0 ? (size_t)res : 0;
+	return res < 0 ? -1 : 0;
+}
+
+/* decrypts a whole object, keeping only the last keep bytes of it */
+static int decrypt_tail(struct verify_job* job, const char* object, unsigned char* in, size_t keep, unsigned char** out, size_t* out_len, uint64_t* total){
+	struct verify_run* vr = job->vr;
+	struct easy_reader* er = NULL;
+	unsigned char* ring = NULL;
+	uint64_t len = 0;
+	size_t start;
+	size_t first;
+	size_t n;
+	int ret = 0;
+
+	*out = NULL;
+	*out_len = 0;
+
+	ring = malloc(keep);
+	if (!ring){
+		log_enomem();
+		ret = -1;
+		goto cleanup;
+	}
+	er = easy_decrypt_master_open(object, vr->enc_algorithm, vr->master);
+	if (!er){
+		ret = -1;
+		goto cleanup;
+	}
+
+	while ((ret = easy_reader_read(er, in, BUFFER_LEN, &n)) == 0 && n > 0){
+		size_t m = n < keep ? n : keep;
+
+		rate_limit(vr, n);
+		job->bytes += n;
+
+		start = (size_t)((len + n - m) % keep);
+		first = m < keep - start ? m : keep - start;
+		memcpy(ring + start, in + n - m, first);
+		memcpy(ring, in + n - m + first, m - first);
+		len += n;
+	}
+	if (ret != 0){
+		goto cleanup;
+	}
+
+	*out_len = len < keep ? (size_t)len : keep;
+	*out = malloc(*out_len + 1);
+	if (!*out){
+		log_enomem();
+		ret = -1;
+		goto cleanup;
+	}
+	start = (size_t)((len - *out_len) % keep);
+	first = *out_len < keep - start ? *out_len : keep - start;
+	memcpy(*out, ring + start, first);
+	memcpy(*out + first, ring, *out_len - first);
+	*total = len;
+
+cleanup:
+	ring ? crypt_scrub(ring, keep) : 0;
+	free(ring);
+	easy_reader_close(er);
+	return ret;
+}
+
+/* an encrypted seekable container cannot be read randomly, and its index is at the end.
+ * so it is decrypted once to get the index, which usually fits in the first BUFFER_LEN bytes kept, and again to decode its blocks in order */
+static enum verify_result verify_seekable_encrypted(struct verify_job* job, const char* object, struct checksum_stream* cs, unsigned char* in){
+	struct verify_run* vr = job->vr;
+	struct zip_seekable* zsk = NULL;
+	struct easy_reader* er = NULL;
+	unsigned char* tail = NULL;
+	size_t tail_len;
+	size_t keep = BUFFER_LEN;
+	uint64_t total;
+	size_t in_len;
+	int res;
+	enum verify_result ret = VERIFY_OK;
+
+	do{
+		if (decrypt_tail(job, object, in, keep, &tail, &tail_len, &total) != 0){
+			ret = VERIFY_UNREADABLE;
+			goto cleanup;
+		}
+		zsk = zip_seekable_from_tail(tail, tail_len, total, &keep);
+		crypt_scrub(tail, tail_len);
+		free(tail);
+		tail = NULL;
+	}while (!zsk && keep > 0);
+	if (!zsk){
+		ret = VERIFY_UNREADABLE;
+		goto cleanup;
+	}
+
+	er = easy_decrypt_master_open(object, vr->enc_algorithm, vr->master);
+	if (!er){
+		ret = VERIFY_UNREADABLE;
+		goto cleanup;
+	}
+	while ((res = easy_reader_read(er, in, BUFFER_LEN, &in_len)) == 0 && in_len > 0){
+		size_t pos = 0;
+
+		rate_limit(vr, in_len);
+		job->bytes += in_len;
+
+		while (pos < in_len){
+			const void* block;
+			size_t block_len;
+			size_t in_used;
+
+			if (zip_seekable_decode(zsk, in + pos, in_len - pos, &in_used, &block, &block_len) != 0 ||
+					checksum_stream_update(cs, block, block_len) != 0){
+				ret = VERIFY_UNREADABLE;
+				goto cleanup;
+			}
+			pos += in_used;
+		}
+	}
+	if (res != 0 || zip_seekable_decode_end(zsk, total) != 0){
+		ret = VERIFY_UNREADABLE;
+	}
+
+cleanup:
+	easy_reader_close(er);
+	zip_seekable_close(zsk);
+	return ret;
+}
+
+static enum verify_result verify_seekable(struct verify_job* job, const char* object, struct checksum_stream* cs, unsigned char* in, unsigned char* out){
+	struct zip_seekable* zsk;
+	unsigned long offset = 0;
+	size_t len;
+	enum verify_result ret = VERIFY_OK;
+
+	if (job->vr->master){
+		return verify_seekable_encrypted(job, object, cs, in);
+	}
+
+	zsk = zip_seekable_open(object);
+	if (!zsk){
+		return VERIFY_UNREADABLE;
+	}
+	do{
+		if (zip_seekable_read(zsk, offset, out, BUFFER_LEN, &len) != 0 || checksum_stream_update(cs, out, len) != 0){
+			ret = VERIFY_UNREADABLE;
+			break;
+		}
+		rate_limit(job->vr, len);
+		offset += len;
+	}while (len > 0);
+
+	job->bytes += get_file_size(object);
+	zip_seekable_close(zsk);
+	return ret;
+}
+
+/* decrypts and decompresses an object into the checksum stream */
+static enum verify_result verify_object(struct verify_job* job, const char* object, struct checksum_stream* cs, unsigned char* in, unsigned char* out){
+	struct verify_run* vr = job->vr;
+	struct easy_reader* er = NULL;
+	FILE* fp = NULL;
+	struct zip_stream* zs = NULL;
+	size_t in_len;
+	size_t out_len;
+#ifndef NO_ZSTD_SUPPORT
+	int first = 1;
+#endif
+	int res;
+	enum verify_result ret = VERIFY_OK;
+
+	if (!file_exists(object)){
+		return VERIFY_MISSING;
+	}
+	if (vr->c_flags & ZIP_SEEKABLE){
+		return verify_seekable(job, object, cs, in, out);
+	}
+
+	if (vr->master){
+		er = easy_decrypt_master_open(object, vr->enc_algorithm, vr->master);
+	}
+	else if (!(fp = fopen(object, "rb"))){
+		log_efopen(object);
+	}
+	zs = er || fp ? zip_stream_new(vr->c_type, 0, 0, vr->c_flags) : NULL;
+	if (!zs){
+		ret = VERIFY_UNREADABLE;
+		goto cleanup;
+	}
+
+	while ((res = read_object(er, fp, in, BUFFER_LEN, &in_len)) == 0 && in_len > 0){
+		size_t pos = 0;
+
+		rate_limit(vr, in_len);
+		job->bytes += in_len;
+
+#ifndef NO_ZSTD_SUPPORT
+		/* the frame header says which dictionary, if any, the file was compressed with */
+		if (first && vr->c_type == COMPRESSOR_ZSTD){
+			unsigned id = zip_buffer_dict_id(in, in_len);
+			struct zip_dict* dict;
+
+			if (id != 0 && ((dict = get_dict(vr, id)) == NULL || zip_stream_set_dict(zs, dict) != 0)){
+				log_error_ex2("Failed to load dictionary %u for %s", id, object);
+				ret = VERIFY_UNREADABLE;
+				goto cleanup;
+			}
+		}
+		first = 0;
+#endif
+
+		while (pos < in_len){
+			size_t in_used;
+
+			if (zip_stream_update(zs, in + pos, in_len - pos, &in_used, out, BUFFER_LEN, &out_len) != 0 ||
+					checksum_stream_update(cs, out, out_len) != 0){
+				ret = VERIFY_UNREADABLE;
+				goto cleanup;
+			}
+			pos += in_used;
+		}
+	}
+	if (res != 0){
+		ret = VERIFY_UNREADABLE;
+		goto cleanup;
+	}
+
+	do{
+		res = zip_stream_finish(zs, out, BUFFER_LEN, &out_len);
+		if (res < 0 || checksum_stream_update(cs, out, out_len) != 0){
+			ret = VERIFY_UNREADABLE;
+			goto cleanup;
+		}
+	}while (res > 0);
+
+cleanup:
+	zip_stream_free(zs);
+	easy_reader_close(er);
+	fp ? fclose(fp) : 0;
+	return ret;
+}
+
+static int compare_offsets(const void* a, const void* b){
+	unsigned long l = *(const unsigned long*)a;
+	unsigned long r = *(const unsigned long*)b;
+
+	return (l > r) - (l < r);
+}
+
+/* gets the offsets of the segments in appends/<file>, in the order they were appended.
+ * a file that has had nothing appended to it has none */
+static int list_segments(const char* dir, unsigned long** out, size_t* out_len){
+	DIR* dp;
+	struct dirent* dnt;
+	int ret = 0;
+
+	*out = NULL;
+	*out_len = 0;
+
+	dp = opendir(dir);
+	if (!dp){
+		if (errno == ENOENT || errno == ENOTDIR){
+			return 0;
+		}
+		log_error_ex2("Failed to open directory %s (%s)", dir, strerror(errno));
+		return -1;
+	}
+
+	while ((dnt = readdir(dp)) != NULL){
+		unsigned long* tmp;
+		char* endptr;
+		unsigned long offset = strtoul(dnt->d_name, &endptr, 10);
+
+		/* the block checksums and anything else that is not a segment */
+		if (endptr == dnt->d_name || *endptr != '\0'){
+			continue;
+		}
+		tmp = realloc(*out, (*out_len + 1) * sizeof(**out));
+		if (!tmp){
+			log_enomem();
+			ret = -1;
+			break;
+		}
+		*out = tmp;
+		(*out)[(*out_len)++] = offset;
+	}
+	closedir(dp);
+
+	if (ret != 0){
+		free(*out);
+		*out = NULL;
+		*out_len = 0;
+		return ret;
+	}
+	qsort(*out, *out_len, sizeof(**out), compare_offsets);
+	return 0;
+}
+
+static void verify_job_run(void* arg, unsigned thread_index){
+	struct verify_job* job = arg;
+	struct verify_run* vr = job->vr;
+	struct checksum_stream* cs = NULL;
+	unsigned char* in = NULL;
+	unsigned char* out = NULL;
+	unsigned long* offsets = NULL;
+	size_t n_offsets = 0;
+	char* dir_appends = NULL;
+	size_t i;
+	int res;
+
+	(void)thread_index;
+
+	in = malloc(BUFFER_LEN);
+	out = malloc(BUFFER_LEN);
+	if (!in || !out){
+		log_enomem();
+		job->result = VERIFY_UNREADABLE;
+		goto cleanup;
+	}
+
+	job->object = sh_concat_path(sh_dup(vr->files), job->e->file);
+	dir_appends = sh_concat_path(sh_dup(vr->appends), job->e->file);
+	if (!job->object || !dir_appends){
+		log_error("Failed to determine object path");
+		job->result = VERIFY_UNREADABLE;
+		goto cleanup;
+	}
+
+	cs = checksum_stream_new(job->e->checksum, vr->algorithm);
+	if (!cs){
+		job->result = VERIFY_UNSUPPORTED;
+		goto cleanup;
+	}
+
+	job->result = verify_object(job, job->object, cs, in, out);
+	if (job->result != VERIFY_OK){
+		goto cleanup;
+	}
+
+	/* data appended since the stored copy was made is stored separately, and the checksum covers all of it */
+	if (list_segments(dir_appends, &offsets, &n_offsets) != 0){
+		job->result = VERIFY_UNREADABLE;
+		goto cleanup;
+	}
+	for (i = 0; i < n_offsets; ++i){
+		char offset_str[32];
+		char* segment;
+
+		sprintf(offset_str, "%lu", offsets[i]);
+		segment = sh_concat_path(sh_dup(dir_appends), offset_str);
+		if (!segment){
+			job->result = VERIFY_UNREADABLE;
+			goto cleanup;
+		}
+		job->result = verify_object(job, segment, cs, in, out);
+		if (job->result != VERIFY_OK){
+			free(job->object);
+			job->object = segment;
+			goto cleanup;
+		}
+		free(segment);
+	}
+
+	res = checksum_stream_check(cs);
+	job->result = res == 0 ? VERIFY_OK : res > 0 ? VERIFY_MISMATCH : VERIFY_UNREADABLE;
+
+cleanup:
+	/* these held plaintext */
+	in ? crypt_scrub(in, BUFFER_LEN) : 0;
+	out ? crypt_scrub(out, BUFFER_LEN) : 0;
+	free(in);
+	free(out);
+	free(offsets);
+	free(dir_appends);
+	checksum_stream_free(cs);
+}
+
+static void report_job(const struct verify_job* job, FILE* report){
+	const char* object = job->object ? job->object : "";
+
+	switch (job->result){
+	case VERIFY_OK:
+		break;
+	case VERIFY_MISMATCH:
+		fprintf(report, "MISMATCH\t%s\n", job->e->file);
+		break;
+	case VERIFY_MISSING:
+		fprintf(report, "MISSING\t%s\t%s\n", job->e->file, object);
+		break;
+	case VERIFY_UNREADABLE:
+		fprintf(report, "UNREADABLE\t%s\t%s\n", job->e->file, object);
+		break;
+	case VERIFY_UNSUPPORTED:
+		fprintf(report, "UNSUPPORTED\t%s\t%s\n", job->e->file, object);
+		break;
+	}
+}
+
+/* reads the last path the previous pass finished, or returns NULL if it finished completely */
+static char* read_cursor(const char* cursor_file){
+	FILE* fp;
+	char* ret;
+	uint64_t len;
+
+	fp = fopen(cursor_file, "rb");
+	if (!fp){
+		return NULL;
+	}
+	len = get_file_size_fp(fp);
+	ret = len > 0 && len < BUFFER_LEN ? malloc(len + 1) : NULL;
+	if (!ret || fread(ret, 1, len, fp) != len){
+		log_warning_ex("%s is damaged. Starting over.", cursor_file);
+		free(ret);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+
+	/* the newline is only there for anyone reading the file */
+	ret[len] = '\0';
+	if (ret[len - 1] == '\n'){
+		ret[len - 1] = '\0';
+	}
+	return ret;
+}
+
+/* the cursor is replaced all at once, so it is never left half-written if the pass is interrupted */
+static int write_cursor(const char* cursor_file, const char* path){
+	char* tmp_file;
+	FILE* fp;
+	int ret = 0;
+
+	tmp_file = sh_sprintf("%s.part", cursor_file);
+	if (!tmp_file){
+		return -1;
+	}
+	fp = fopen(tmp_file, "wb");
+	if (!fp){
+		log_efopen(tmp_file);
+		free(tmp_file);
+		return -1;
+	}
+	if (fprintf(fp, "%s\n", path) < 0){
+		log_efwrite(tmp_file);
+		ret = -1;
+	}
+	if (fclose(fp) != 0){
+		log_efclose(tmp_file);
+		ret = -1;
+	}
+	if (ret == 0 && rename(tmp_file, cursor_file) != 0){
+		log_error_ex2("Failed to save %s (%s)", cursor_file, strerror(errno));
+		ret = -1;
+	}
+	if (ret != 0){
+		remove(tmp_file);
+	}
+	free(tmp_file);
+	return ret;
+}
+
+int verify_directory(const struct options* opt, const struct crypt_master* master, FILE* report){
+	struct verify_run vr;
+	struct verify_job jobs[VERIFY_BATCH_LEN];
+	struct checksum_source src;
+	struct crypt_manifest* manifest = NULL;
+	struct threadpool* tp = NULL;
+	char* checksum_file = NULL;
+	char* cursor_file = NULL;
+	char* cursor = NULL;
+	FILE* fp_checksums = NULL;
+	unsigned long n_files = 0;
+	unsigned long n_bad = 0;
+	double bytes = 0;
+	double t_start;
+	double elapsed;
+	int res;
+	int ret = 0;
+
+	return_ifnull(opt, -1);
+	return_ifnull(report, -1);
+
+	memset(&vr, 0, sizeof(vr));
+	pthread_mutex_init(&vr.rate_lock, NULL);
+	pthread_mutex_init(&vr.dict_lock, NULL);
+	vr.algorithm = opt->hash_algorithm;
+	vr.enc_algorithm = opt->enc_algorithm && master ? EVP_CIPHER_name(opt->enc_algorithm) : NULL;
+	vr.master = vr.enc_algorithm ? master : NULL;
+	vr.c_type = opt->c_type;
+	vr.c_flags = opt->c_flags;
+	vr.bytes_per_sec = opt->verify_rate * 1048576.0;
+
+	vr.files = sh_concat_path(sh_dup(opt->output_directory), "/files");
+	vr.appends = sh_concat_path(sh_dup(opt->output_directory), "/appends");
+	vr.dicts = sh_concat_path(sh_dup(opt->output_directory), "/dicts");
+	checksum_file = sh_concat_path(sh_dup(opt->output_directory), "checksums.txt");
+	cursor_file = sh_concat_path(sh_dup(opt->output_directory), VERIFY_CURSOR_FILE);
+	if (!vr.files || !vr.appends || !vr.dicts || !checksum_file || !cursor_file){
+		log_error("Failed to determine internal directory paths.");
+		ret = -1;
+		goto cleanup;
+	}
+
+	fp_checksums = fopen(checksum_file, "rb");
+	if (!fp_checksums){
+		log_efopen(checksum_file);
+		ret = -1;
+		goto cleanup;
+	}
+	if ((res = crypt_manifest_detect(fp_checksums)) < 0){
+		ret = -1;
+		goto cleanup;
+	}
+	if (res == 0){
+		checksum_source_file(fp_checksums, &src);
+	}
+	else if (!master){
+		log_error_ex("%s is encrypted, but no key was given", checksum_file);
+		ret = -1;
+		goto cleanup;
+	}
+	else if ((manifest = crypt_manifest_open(fp_checksums, crypt_master_key(master), CRYPT_MASTER_KEY_LEN)) == NULL){
+		ret = -1;
+		goto cleanup;
+	}
+	else{
+		crypt_manifest_source(manifest, &src);
+	}
+
+	tp = tp_new(ZIP_GET_THREADS(opt->c_flags));
+	if (!tp){
+		log_error("Failed to create verify workers");
+		ret = -1;
+		goto cleanup;
+	}
+
+	cursor = read_cursor(cursor_file);
+	if (cursor){
+		log_info_ex("Resuming verification after %s", cursor);
+	}
+
+	t_start = now_secs();
+	for (;;){
+		struct element* e;
+		size_t n_jobs = 0;
+		size_t i;
+
+		while (n_jobs < VERIFY_BATCH_LEN && (e = src.next(src.data)) != NULL){
+			/* the list is sorted, so everything up to the cursor was verified by the previous pass */
+			if (cursor && strcmp(e->file, cursor) <= 0){
+				free_element(e);
+				continue;
+			}
+			jobs[n_jobs].vr = &vr;
+			jobs[n_jobs].e = e;
+			jobs[n_jobs].result = VERIFY_OK;
+			jobs[n_jobs].object = NULL;
+			jobs[n_jobs].bytes = 0;
+			n_jobs++;
+		}
+		if (n_jobs == 0){
+			break;
+		}
+
+		for (i = 0; i < n_jobs; ++i){
+			if (tp_submit(tp, verify_job_run, &jobs[i]) != 0){
+				verify_job_run(&jobs[i], 0);
+			}
+		}
+		tp_wait(tp);
+
+		for (i = 0; i < n_jobs; ++i){
+			report_job(&jobs[i], report);
+			n_bad += jobs[i].result != VERIFY_OK;
+			bytes += jobs[i].bytes;
+		}
+		n_files += n_jobs;
+		fflush(report);
+
+		if (write_cursor(cursor_file, jobs[n_jobs - 1].e->file) != 0){
+			log_warning("Failed to save verify cursor");
+		}
+		for (i = 0; i < n_jobs; ++i){
+			free_element(jobs[i].e);
+			free(jobs[i].object);
+		}
+	}
+	elapsed = now_secs() - t_start;
+
+	/* the pass is finished, so the next one starts from the beginning */
+	remove(cursor_file);
+
+	fprintf(report, "Verified %lu files (%.1f MB read) in %.1fs at %.1f MB/s. %lu failed.\n",
+			n_files, bytes / 1048576.0, elapsed, elapsed > 0 ? bytes / 1048576.0 / elapsed : 0.0, n_bad);
+	ret = n_bad > 0;
+
+cleanup:
+	tp_free(tp);
+	crypt_manifest_close(manifest);
+	fp_checksums ? fclose(fp_checksums) : 0;
+	free(cursor);
+	free(cursor_file);
+	free(checksum_file);
+	free(vr.files);
+	free(vr.appends);
+	free(vr.dicts);
+#ifndef NO_ZSTD_SUPPORT
+	{
+		size_t i;
+		for (i = 0; i < vr.dict_len; ++i){
+			zip_dict_free(vr.dict_list[i]);
+		}
+	}
+#endif
+	free(vr.dict_list);
+	pthread_mutex_destroy(&vr.rate_lock);
+	pthread_mutex_destroy(&vr.dict_lock);
+	return ret;
+}
+
+/* the key file already exists if the backup is encrypted, and it checks the password, so there is no need to ask for it twice */
+static struct crypt_master* verify_master_key(const struct options* opt){
+	struct crypt_master* ret = NULL;
+	char* password = NULL;
+	char* key_file;
+
+	key_file = sh_concat_path(sh_dup(opt->output_directory), "/key");
+	if (!key_file){
+		log_error("Failed to determine location of key file.");
+		return NULL;
+	}
+	if (!file_exists(key_file)){
+		log_error_ex("%s does not exist. Was the backup encrypted?", key_file);
+		goto cleanup;
+	}
+
+	if (!opt->enc_password && crypt_getpassword("Enter encryption password:", NULL, &password) != 0){
+		log_error("Failed to read encryption password from terminal");
+		goto cleanup;
+	}
+
+	ret = crypt_master_new(password ? password : opt->enc_password, key_file);
+	if (!ret){
+		log_error("Failed to derive the encryption key");
+	}
+
+cleanup:
+	if (password){
+		crypt_freepassword(password);
+	}
+	free(key_file);
+	return ret;
+}
+
+int verify(const struct options* opt){
+	struct crypt_master* master = NULL;
+	int ret;
+
+	return_ifnull(opt, -1);
+
+	if (opt->enc_algorithm && (master = verify_master_key(opt)) == NULL){
+		return -1;
+	}
+	ret = verify_directory(opt, master, stdout);
+	crypt_master_free(master);
+	return ret;
+}
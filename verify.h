@@ -0,0 +1,56 @@
+/** @file verify.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __VERIFY_H
+#define __VERIFY_H
+
+#include "options/options.h"
+#include "crypt/crypt_master.h"
+#include <stdio.h>
+
+#define VERIFY_CURSOR_FILE "verify.cursor" /**< @brief The file within the output directory that holds the last path verify_directory() finished, so an interrupted pass can pick up where it left off. */
+
+#ifndef VERIFY_BATCH_LEN
+#define VERIFY_BATCH_LEN (64) /**< @brief The amount of files verified at once. The cursor is saved after each batch. */
+#endif
+
+/**
+ * @brief Checks that every file in an output directory's checksum list can be restored.<br>
+ * Each file's stored copy (and any data appended to it since) is decrypted and decompressed in memory on worker threads, hashed, and compared with its checksum. No plaintext is written to disk.<br>
+ * <br>
+ * Files are checked in the order of the checksum list, and the last one finished is saved to VERIFY_CURSOR_FILE, so a pass that is interrupted continues where it left off next time. Once a pass is finished, the cursor is removed so the next one starts over.<br>
+ * <br>
+ * Each problem is written to the report as one tab-separated line:<br>
+ * `MISMATCH\tFILE` if the stored copy does not match the checksum,<br>
+ * `MISSING\tFILE\tOBJECT` if a stored object no longer exists,<br>
+ * `UNREADABLE\tFILE\tOBJECT` if a stored object cannot be decrypted or decompressed,<br>
+ * `UNSUPPORTED\tFILE\tOBJECT` if its checksum cannot be parsed.
+ *
+ * @param opt The options the backup was made with.<br>
+ * opt->c_flags decides the amount of worker threads (ZIP_THREADS()), and opt->verify_rate caps how fast the stored objects are read.
+ *
+ * @param master The backup's master key.<br>
+ * This can be NULL if the backup is not encrypted.
+ *
+ * @param report The file to write problems and a summary to.
+ *
+ * @return 0 if every file checked out, positive if any problems were found, or negative on failure.
+ */
+int verify_directory(const struct options* opt, const struct crypt_master* master, FILE* report);
+
+/**
+ * @brief Verifies the output directory in an options structure, asking for the password if needed and writing the report to stdout.
+ * @see verify_directory()
+ *
+ * @param opt The options structure to use.
+ *
+ * @return 0 if every file checked out, positive if any problems were found, or negative on failure.
+ */
+int verify(const struct options* opt);
+
+#endif
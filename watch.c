@@ -0,0 +1,695 @@
+/** @file watch.c
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "watch.h"
+#include "checksum.h"
+#include "filehelper.h"
+#include "log.h"
+#include "strings/stringhelper.h"
+#include "strings/stringset.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#define WATCH_PID_NAME "watch.pid"
+
+/* the events that can change the contents of a backup.
+ * IN_MODIFY is needed for files that are written to but never closed (logs, databases) */
+#define WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+struct watch_data{
+	int fd;                              /* inotify file descriptor */
+	char** paths;                        /* directory path for each watch descriptor */
+	size_t paths_len;                    /* length of the paths array */
+	const struct string_array* exclude;  /* paths to ignore */
+	struct string_array* pending;        /* paths gathered from the current batch of events */
+	struct string_set* journaled;        /* paths already in the journal, which are not written again until a backup takes it */
+};
+
+static volatile sig_atomic_t watch_stop = 0;
+
+static void watch_signal_handler(int signum){
+	(void)signum;
+	watch_stop = 1;
+}
+
+static char* output_path(const char* output_directory, const char* name){
+	return sh_concat_path(sh_dup(output_directory), name);
+}
+
+static int is_excluded(const struct watch_data* wd, const char* path){
+	size_t i;
+	for (i = 0; i < wd->exclude->len; ++i){
+		if (sh_starts_with(path, wd->exclude->strings[i])){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int add_pending(struct watch_data* wd, const char* path){
+	/* the same file usually generates several events in a row */
+	if (wd->pending->len > 0 && strcmp(wd->pending->strings[wd->pending->len - 1], path) == 0){
+		return 0;
+	}
+	return sa_add(wd->pending, path);
+}
+
+static int set_watch_path(struct watch_data* wd, int desc, const char* path){
+	if ((size_t)desc >= wd->paths_len){
+		size_t len_new = (size_t)desc + 1;
+		void* tmp = realloc(wd->paths, len_new * sizeof(*wd->paths));
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		wd->paths = tmp;
+		memset(wd->paths + wd->paths_len, 0, (len_new - wd->paths_len) * sizeof(*wd->paths));
+		wd->paths_len = len_new;
+	}
+
+	free(wd->paths[desc]);
+	wd->paths[desc] = sh_dup(path);
+	if (!wd->paths[desc]){
+		log_error("Failed to store watch path");
+		return -1;
+	}
+	return 0;
+}
+
+static int add_watch_recursive(struct watch_data* wd, const char* dir){
+	struct string_array* stack = NULL;
+	int ret = 0;
+
+	stack = sa_new();
+	if (!stack || sa_add(stack, dir) != 0){
+		log_error("Failed to create directory stack");
+		ret = -1;
+		goto cleanup;
+	}
+
+	while (stack->len > 0){
+		char* cur = stack->strings[stack->len - 1];
+		DIR* dp;
+		struct dirent* dnt;
+		int desc;
+
+		/* take ownership of the top string before popping it */
+		stack->strings[stack->len - 1] = NULL;
+		sa_remove(stack, stack->len - 1);
+
+		desc = inotify_add_watch(wd->fd, cur, WATCH_MASK);
+		if (desc < 0){
+			if (errno == ENOSPC){
+				log_error("Out of inotify watches (raise fs.inotify.max_user_watches)");
+				free(cur);
+				ret = -1;
+				goto cleanup;
+			}
+			log_warning_ex2("Failed to watch %s (%s)", cur, strerror(errno));
+			free(cur);
+			continue;
+		}
+		if (set_watch_path(wd, desc, cur) != 0){
+			free(cur);
+			ret = -1;
+			goto cleanup;
+		}
+
+		dp = opendir(cur);
+		if (!dp){
+			log_warning_ex2("Failed to open %s (%s)", cur, strerror(errno));
+			free(cur);
+			continue;
+		}
+		while ((dnt = readdir(dp)) != NULL){
+			struct stat st;
+			char* child;
+
+			if (!strcmp(dnt->d_name, ".") || !strcmp(dnt->d_name, "..")){
+				continue;
+			}
+
+			child = sh_concat_path(sh_dup(cur), dnt->d_name);
+			if (!child){
+				log_warning("Failed to create child path");
+				continue;
+			}
+			if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode) && !is_excluded(wd, child)){
+				sa_add(stack, child);
+			}
+			free(child);
+		}
+		closedir(dp);
+		free(cur);
+	}
+
+cleanup:
+	sa_free(stack);
+	return ret;
+}
+
+/* a moved directory keeps its watch descriptors, but their paths are stale */
+static void remove_watches_under(struct watch_data* wd, const char* dir){
+	size_t dir_len = strlen(dir);
+	size_t i;
+
+	for (i = 0; i < wd->paths_len; ++i){
+		if (wd->paths[i] && strncmp(wd->paths[i], dir, dir_len) == 0 &&
+				(wd->paths[i][dir_len] == '\0' || wd->paths[i][dir_len] == '/')){
+			inotify_rm_watch(wd->fd, (int)i);
+		}
+	}
+}
+
+static int handle_event(struct watch_data* wd, const struct inotify_event* ev){
+	char* path = NULL;
+	int ret = 0;
+
+	if (ev->mask & IN_Q_OVERFLOW){
+		log_warning("inotify queue overflowed. The next backup will perform a full scan.");
+		return add_pending(wd, "");
+	}
+
+	if (ev->wd < 0 || (size_t)ev->wd >= wd->paths_len || !wd->paths[ev->wd]){
+		return 0;
+	}
+
+	if (ev->mask & IN_IGNORED){
+		free(wd->paths[ev->wd]);
+		wd->paths[ev->wd] = NULL;
+		return 0;
+	}
+
+	if (ev->len == 0){
+		return add_pending(wd, wd->paths[ev->wd]);
+	}
+
+	path = sh_concat_path(sh_dup(wd->paths[ev->wd]), ev->name);
+	if (!path){
+		log_error("Failed to create event path");
+		return -1;
+	}
+
+	if (is_excluded(wd, path)){
+		goto cleanup;
+	}
+
+	if (ev->mask & IN_ISDIR){
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO)){
+			if (add_watch_recursive(wd, path) != 0){
+				ret = -1;
+				goto cleanup;
+			}
+		}
+		else if (ev->mask & IN_MOVED_FROM){
+			remove_watches_under(wd, path);
+		}
+	}
+
+	ret = add_pending(wd, path);
+
+cleanup:
+	free(path);
+	return ret;
+}
+
+/* locks the whole journal, waiting for the other side to let go of it.
+ * the watcher holds a write lock while it writes a batch and a backup holds a read lock while it takes the journal, so a batch never straddles a backup.
+ * fcntl() locks are used since flock() is not part of POSIX */
+static int lock_journal(FILE* fp, short type){
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = 0;
+	fl.l_len = 0;
+
+	while (fcntl(fileno(fp), F_SETLKW, &fl) != 0){
+		if (errno != EINTR){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* opens the journal for appending and locks it */
+static FILE* open_journal_locked(const char* journal){
+	struct stat st_path;
+	struct stat st_fp;
+	FILE* fp;
+
+	for (;;){
+		fp = fopen(journal, "ab");
+		if (!fp){
+			log_efopen(journal);
+			return NULL;
+		}
+		if (lock_journal(fp, F_WRLCK) != 0 || fstat(fileno(fp), &st_fp) != 0){
+			log_error_ex2("Failed to lock %s (%s)", journal, strerror(errno));
+			fclose(fp);
+			return NULL;
+		}
+		/* a backup may have taken the journal between fopen() and the lock, in which case the batch goes into a new one */
+		if (stat(journal, &st_path) == 0 && st_path.st_dev == st_fp.st_dev && st_path.st_ino == st_fp.st_ino){
+			return fp;
+		}
+		fclose(fp);
+	}
+}
+
+static int flush_pending(struct watch_data* wd, const char* journal){
+	FILE* fp;
+	size_t i;
+	int ret = 0;
+
+	if (wd->pending->len == 0){
+		return 0;
+	}
+
+	/* reopened for every batch so the journal can be renamed away by a backup.
+	 * the lock is released by fclose() after the batch is flushed */
+	fp = open_journal_locked(journal);
+	if (!fp){
+		return -1;
+	}
+
+	/* an empty journal means a backup took the previous one, so everything has to be recorded again */
+	if (fseek(fp, 0, SEEK_END) != 0 || ftell(fp) == 0){
+		ss_free(wd->journaled);
+		wd->journaled = ss_new();
+		if (!wd->journaled){
+			log_error("Failed to reset the journaled path set");
+			fclose(fp);
+			return -1;
+		}
+	}
+
+	/* a file that is being written to generates an event for every write, but it only needs to be in the journal once */
+	for (i = 0; i < wd->pending->len; ++i){
+		if (ss_find(wd->journaled, wd->pending->strings[i])){
+			continue;
+		}
+		if (fprintf(fp, "%s%c\n", wd->pending->strings[i], '\0') < 0 ||
+				ss_intern(wd->journaled, wd->pending->strings[i]) == NULL){
+			ret = -1;
+			break;
+		}
+	}
+	if (ret != 0 || ferror(fp)){
+		log_efwrite(journal);
+		ret = -1;
+	}
+	if (fclose(fp) != 0){
+		log_efclose(journal);
+		ret = -1;
+	}
+	sa_reset(wd->pending);
+	return ret;
+}
+
+static int write_pid_file(const char* pid_file){
+	FILE* fp = fopen(pid_file, "wb");
+	if (!fp){
+		log_efopen(pid_file);
+		return -1;
+	}
+	fprintf(fp, "%ld\n", (long)getpid());
+	if (fclose(fp) != 0){
+		log_efclose(pid_file);
+		return -1;
+	}
+	return 0;
+}
+
+static int watcher_alive(const char* output_directory){
+	char* pid_file = NULL;
+	FILE* fp = NULL;
+	long pid = 0;
+	int ret = 0;
+
+	pid_file = output_path(output_directory, WATCH_PID_NAME);
+	if (!pid_file){
+		log_error("Failed to determine pid file location");
+		return 0;
+	}
+
+	fp = fopen(pid_file, "rb");
+	if (!fp){
+		goto cleanup;
+	}
+	if (fscanf(fp, "%ld", &pid) != 1 || pid <= 0){
+		goto cleanup;
+	}
+	ret = kill((pid_t)pid, 0) == 0 || errno == EPERM;
+
+cleanup:
+	fp ? fclose(fp) : 0;
+	free(pid_file);
+	return ret;
+}
+
+int watch_run(const struct options* opt){
+	struct watch_data wd;
+	struct sigaction sa;
+	struct string_array* roots = NULL;
+	struct string_array* exclude = NULL;
+	char* journal = NULL;
+	char* pid_file = NULL;
+	union{
+		struct inotify_event ev;
+		char buf[1 << 16];
+	}events;
+	size_t i;
+	int ret = 0;
+
+	return_ifnull(opt, -1);
+
+	memset(&wd, 0, sizeof(wd));
+	wd.fd = -1;
+
+	journal = output_path(opt->output_directory, WATCH_JOURNAL_NAME);
+	pid_file = output_path(opt->output_directory, WATCH_PID_NAME);
+	wd.pending = sa_new();
+	wd.journaled = ss_new();
+	roots = sa_dup(opt->directories);
+	exclude = sa_dup(opt->exclude);
+	if (!journal || !pid_file || !wd.pending || !wd.journaled || !roots || !exclude){
+		log_error("Failed to initialize watch data");
+		ret = -1;
+		goto cleanup;
+	}
+
+	/* watch the same paths that the backup walks */
+	if (sa_normalize_roots(roots, exclude) < 0){
+		log_error("Failed to normalize the directories to watch");
+		ret = -1;
+		goto cleanup;
+	}
+	wd.exclude = exclude;
+
+	if (mkdir_recursive(opt->output_directory) < 0){
+		log_error("Failed to create output directory");
+		ret = -1;
+		goto cleanup;
+	}
+
+	wd.fd = inotify_init();
+	if (wd.fd < 0){
+		log_error_ex("Failed to initialize inotify (%s)", strerror(errno));
+		ret = -1;
+		goto cleanup;
+	}
+
+	for (i = 0; i < roots->len; ++i){
+		if (add_watch_recursive(&wd, roots->strings[i]) != 0){
+			log_error_ex("Failed to watch %s", roots->strings[i]);
+			ret = -1;
+			goto cleanup;
+		}
+	}
+
+	/* anything could have changed while nobody was watching */
+	if (add_pending(&wd, "") != 0 || flush_pending(&wd, journal) != 0 || write_pid_file(pid_file) != 0){
+		log_error("Failed to initialize journal");
+		ret = -1;
+		goto cleanup;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = watch_signal_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	while (!watch_stop){
+		ssize_t len;
+		char* ptr;
+
+		len = read(wd.fd, events.buf, sizeof(events.buf));
+		if (len < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			log_error_ex("Failed to read inotify events (%s)", strerror(errno));
+			ret = -1;
+			goto cleanup;
+		}
+
+		for (ptr = events.buf; ptr < events.buf + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event*)ptr)->len){
+			if (handle_event(&wd, (struct inotify_event*)ptr) != 0){
+				log_warning("Failed to handle inotify event. The next backup will perform a full scan.");
+				add_pending(&wd, "");
+			}
+		}
+
+		if (flush_pending(&wd, journal) != 0){
+			log_error("Failed to write to dirty-path journal");
+			ret = -1;
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	pid_file ? remove(pid_file) : 0;
+	wd.fd >= 0 ? close(wd.fd) : 0;
+	for (i = 0; i < wd.paths_len; ++i){
+		free(wd.paths[i]);
+	}
+	free(wd.paths);
+	sa_free(wd.pending);
+	ss_free(wd.journaled);
+	sa_free(roots);
+	sa_free(exclude);
+	free(journal);
+	free(pid_file);
+	return ret;
+}
+
+static int full_scan_due(const char* output_directory){
+	char* marker = NULL;
+	struct stat st;
+	int ret = 1;
+
+	marker = output_path(output_directory, WATCH_FULL_SCAN_NAME);
+	if (!marker){
+		log_error("Failed to determine full scan marker location");
+		return 1;
+	}
+
+	if (stat(marker, &st) == 0 && time(NULL) - st.st_mtime < WATCH_FULL_SCAN_INTERVAL){
+		ret = 0;
+	}
+
+	free(marker);
+	return ret;
+}
+
+int watch_take_journal(const char* output_directory, struct string_array** out){
+	char* journal = NULL;
+	char* journal_taken = NULL;
+	struct string_array* dirty = NULL;
+	FILE* fp = NULL;
+	char* tmp;
+	size_t i;
+	int ret = 0;
+
+	return_ifnull(output_directory, -1);
+	return_ifnull(out, -1);
+
+	*out = NULL;
+
+	journal = output_path(output_directory, WATCH_JOURNAL_NAME);
+	journal_taken = sh_concat(output_path(output_directory, WATCH_JOURNAL_NAME), ".taken");
+	if (!journal || !journal_taken){
+		log_error("Failed to determine journal location");
+		ret = -1;
+		goto cleanup;
+	}
+
+	/* held until the journal is read, so the watcher cannot add to it after it is taken */
+	fp = fopen(journal, "rb");
+	if (!fp && errno != ENOENT){
+		log_efopen(journal);
+		ret = -1;
+		goto cleanup;
+	}
+	if (fp && lock_journal(fp, F_RDLCK) != 0){
+		log_error_ex2("Failed to lock %s (%s)", journal, strerror(errno));
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (!watcher_alive(output_directory) || full_scan_due(output_directory)){
+		log_info("Performing a full scan");
+		remove(journal);
+		ret = 1;
+		goto cleanup;
+	}
+
+	dirty = sa_new();
+	if (!dirty){
+		log_error("Failed to create dirty-path list");
+		ret = -1;
+		goto cleanup;
+	}
+
+	/* nothing has changed since the last backup */
+	if (!fp){
+		*out = dirty;
+		dirty = NULL;
+		goto cleanup;
+	}
+
+	/* rename() is atomic, so the watcher starts a fresh journal with its next batch.
+	 * the already open descriptor still reads the taken one */
+	if (rename(journal, journal_taken) != 0){
+		log_error_ex2("Failed to take %s (%s)", journal, strerror(errno));
+		ret = -1;
+		goto cleanup;
+	}
+
+	while ((tmp = get_next_removed(fp)) != NULL){
+		if (tmp[0] == '\0'){
+			log_info("Events were lost since the last backup. Performing a full scan");
+			free(tmp);
+			ret = 1;
+			goto cleanup;
+		}
+		if (sa_add(dirty, tmp) != 0){
+			log_error("Failed to add path to dirty-path list");
+			free(tmp);
+			ret = -1;
+			goto cleanup;
+		}
+		free(tmp);
+	}
+
+	sa_sort(dirty);
+
+	*out = sa_new();
+	if (!(*out)){
+		log_error("Failed to create dirty-path list");
+		ret = -1;
+		goto cleanup;
+	}
+	/* drop duplicates and paths whose parent directory is already dirty */
+	for (i = 0; i < dirty->len; ++i){
+		if (!watch_is_dirty(*out, dirty->strings[i]) && sa_add(*out, dirty->strings[i]) != 0){
+			log_error("Failed to add path to dirty-path list");
+			ret = -1;
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	if (ret != 0){
+		sa_free(*out);
+		*out = NULL;
+	}
+	fp ? fclose(fp) : 0;
+	journal_taken ? remove(journal_taken) : 0;
+	sa_free(dirty);
+	free(journal);
+	free(journal_taken);
+	return ret;
+}
+
+int watch_mark_full_scan(const char* output_directory){
+	char* marker = NULL;
+	FILE* fp = NULL;
+	int ret = 0;
+
+	return_ifnull(output_directory, -1);
+
+	marker = output_path(output_directory, WATCH_FULL_SCAN_NAME);
+	if (!marker){
+		log_error("Failed to determine full scan marker location");
+		return -1;
+	}
+
+	fp = fopen(marker, "wb");
+	if (!fp){
+		log_efopen(marker);
+		ret = -1;
+		goto cleanup;
+	}
+	fprintf(fp, "%lu\n", (unsigned long)time(NULL));
+	if (fclose(fp) != 0){
+		log_efclose(marker);
+		ret = -1;
+	}
+
+cleanup:
+	free(marker);
+	return ret;
+}
+
+void watch_invalidate_full_scan(const char* output_directory){
+	char* marker;
+
+	return_ifnull(output_directory, ;);
+
+	marker = output_path(output_directory, WATCH_FULL_SCAN_NAME);
+	if (!marker){
+		log_error("Failed to determine full scan marker location");
+		return;
+	}
+	remove(marker);
+	free(marker);
+}
+
+static int cmp_str(const void* key, const void* elem){
+	return strcmp((const char*)key, *(char* const*)elem);
+}
+
+int watch_is_dirty(const struct string_array* dirty, const char* path){
+	char* buf = NULL;
+	size_t i;
+	int ret = 0;
+
+	return_ifnull(dirty, 0);
+	return_ifnull(path, 0);
+
+	if (dirty->len == 0){
+		return 0;
+	}
+
+	buf = sh_dup(path);
+	if (!buf){
+		log_error("Failed to duplicate path");
+		return 0;
+	}
+
+	/* check the path itself, then every parent directory */
+	for (i = strlen(buf); i > 0; --i){
+		if (i != strlen(path) && buf[i] != '/'){
+			continue;
+		}
+		buf[i] = '\0';
+		if (bsearch(buf, dirty->strings, dirty->len, sizeof(*dirty->strings), cmp_str)){
+			ret = 1;
+			break;
+		}
+	}
+	if (!ret && path[0] == '/' && bsearch("/", dirty->strings, dirty->len, sizeof(*dirty->strings), cmp_str)){
+		ret = 1;
+	}
+
+	free(buf);
+	return ret;
+}
@@ -0,0 +1,84 @@
+/** @file watch.h
+ *
+ * Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __WATCH_H
+#define __WATCH_H
+
+#include "options/options.h"
+#include "strings/stringarray.h"
+
+#ifndef WATCH_FULL_SCAN_INTERVAL
+#define WATCH_FULL_SCAN_INTERVAL (60 * 60 * 24) /**< @brief The maximum amount of seconds between two full scans of the backup directories (24 hours). */
+#endif
+
+#define WATCH_JOURNAL_NAME "dirty.txt"      /**< @brief The name of the dirty-path journal within the output directory. */
+#define WATCH_FULL_SCAN_NAME "fullscan.txt" /**< @brief The name of the file within the output directory whose modification time marks the last full scan. */
+
+/**
+ * @brief Watches the directories in an options structure for changes and records them in a dirty-path journal.<br>
+ * This function does not return until it receives SIGINT/SIGTERM or encounters a fatal error.<br>
+ * <br>
+ * The journal is placed at opt->output_directory/WATCH_JOURNAL_NAME.<br>
+ * Each entry has the following format:<br>
+ * `/path/to/file\0\n`<br>
+ * An empty entry means that events were lost, and the next backup must perform a full scan.
+ *
+ * @param opt The options structure to use.<br>
+ * opt->directories are watched recursively, and paths starting with any string in opt->exclude are ignored.
+ *
+ * @return 0 if the watch was stopped by a signal, or negative on failure.
+ */
+int watch_run(const struct options* opt);
+
+/**
+ * @brief Takes the dirty-path journal out of the output directory so the next backup can process only the paths within it.<br>
+ * The journal is locked while it is taken, so a batch the watcher is writing at the same time either ends up in the returned list or in the next journal.
+ *
+ * @param output_directory The output directory containing the journal.
+ *
+ * @param out A pointer to a string array that will contain the sorted, de-duplicated dirty paths.<br>
+ * This will be set to NULL if a full scan is required.<br>
+ * This string array must be freed with sa_free() when no longer in use.
+ *
+ * @return 0 if only the dirty paths need to be processed, positive if a full scan is required, or negative on failure.<br>
+ * A full scan is required if there is no journal, if events were lost, or if the last full scan is older than WATCH_FULL_SCAN_INTERVAL.
+ */
+int watch_take_journal(const char* output_directory, struct string_array** out);
+
+/**
+ * @brief Records that a full scan of the backup directories just completed.
+ *
+ * @param output_directory The output directory to place the marker in.
+ *
+ * @return 0 on success, or negative on failure.
+ */
+int watch_mark_full_scan(const char* output_directory);
+
+/**
+ * @brief Forces the next backup to perform a full scan.<br>
+ * This should be called when a backup that only processed dirty paths fails, since the journal it consumed is gone.
+ *
+ * @param output_directory The output directory containing the marker.
+ *
+ * @return void
+ */
+void watch_invalidate_full_scan(const char* output_directory);
+
+/**
+ * @brief Checks if a path or any of its parent directories is within a dirty-path list.
+ *
+ * @param dirty A sorted dirty-path list returned by watch_take_journal().
+ * @see watch_take_journal()
+ *
+ * @param path The path to check.
+ *
+ * @return 1 if the path is dirty, 0 if not.
+ */
+int watch_is_dirty(const struct string_array* dirty, const char* path);
+
+#endif